@@ -0,0 +1,95 @@
+// NV12 -> letterboxed model input, per frame.
+//
+//   opencv  the path before AXNV12Letterbox: full resolution cvtColor to BGR,
+//           cv::resize to the letterbox size, cv::copyMakeBorder for the padding
+//   ref     AXNV12Letterbox::RunRef, scalar
+//   simd    AXNV12Letterbox::Run, NEON / AVX2 when available
+//
+// The source planes get a linesize wider than the width, as the decoder gives
+// them. simd is also checked to be bit identical to ref.
+#include <opencv2/opencv.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "utils/cmdline.hpp"
+#include "utils/timer.hpp"
+#include "utils/nv12_letterbox.hpp"
+
+static double time_us(int iters, const std::function<void()> &fn)
+{
+    fn(); // warm up caches and lazy allocations
+    std::vector<int64_t> t(iters);
+    for (int i = 0; i < iters; i++)
+    {
+        int64_t t0 = ax_now_us();
+        fn();
+        t[i] = ax_now_us() - t0;
+    }
+    std::sort(t.begin(), t.end());
+    return (double)t[iters / 2];
+}
+
+int main(int argc, char *argv[])
+{
+    cmdline::parser a;
+    a.add<int>("src_w", 0, "source width", false, 1920);
+    a.add<int>("src_h", 0, "source height", false, 1080);
+    a.add<int>("dst_w", 0, "model input width", false, 640);
+    a.add<int>("dst_h", 0, "model input height", false, 640);
+    a.add<int>("iters", 0, "timed runs per path, the median is reported", false, 200);
+    a.parse_check(argc, argv);
+
+    int src_w = a.get<int>("src_w"), src_h = a.get<int>("src_h");
+    int dst_w = a.get<int>("dst_w"), dst_h = a.get<int>("dst_h");
+    int iters = std::max(1, a.get<int>("iters"));
+
+    // 解码器给出的 linesize 通常按 64 / 256 对齐
+    int stride = (src_w + 255) & ~255;
+    std::vector<uint8_t> y(stride * src_h), uv(stride * src_h / 2);
+    srand(1);
+    for (auto &v : y)
+        v = rand() & 0xff;
+    for (auto &v : uv)
+        v = rand() & 0xff;
+
+    AXNV12Letterbox lb;
+    if (lb.Init(src_w, src_h, dst_w, dst_h, false) != 0)
+    {
+        fprintf(stderr, "bad sizes\n");
+        return -1;
+    }
+    AXLetterboxMap map = lb.GetMap();
+
+    cv::Mat ref(dst_h, dst_w, CV_8UC3), simd(dst_h, dst_w, CV_8UC3);
+    double t_ref = time_us(iters, [&]
+                           { lb.RunRef(y.data(), stride, uv.data(), stride, ref.data, (int)ref.step); });
+    double t_simd = time_us(iters, [&]
+                            { lb.Run(y.data(), stride, uv.data(), stride, simd.data, (int)simd.step); });
+
+    // 旧路径：cvtColor 要连续的 NV12，先按行拷出来，和原来 GetFrame 做的一样
+    cv::Mat nv12(src_h * 3 / 2, src_w, CV_8UC1), bgr, resized, boxed;
+    int new_w = src_w * map.scale + 0.5f, new_h = src_h * map.scale + 0.5f;
+    double t_cv = time_us(iters, [&]
+                          {
+        for (int i = 0; i < src_h; i++)
+            memcpy(nv12.data + i * src_w, y.data() + i * stride, src_w);
+        for (int i = 0; i < src_h / 2; i++)
+            memcpy(nv12.data + (src_h + i) * src_w, uv.data() + i * stride, src_w);
+        cv::cvtColor(nv12, bgr, cv::COLOR_YUV2BGR_NV12);
+        cv::resize(bgr, resized, cv::Size(new_w, new_h), 0, 0, cv::INTER_LINEAR);
+        int right = dst_w - new_w - map.pad_x, bottom = dst_h - new_h - map.pad_y;
+        cv::copyMakeBorder(resized, boxed, map.pad_y, bottom, map.pad_x, right,
+                           cv::BORDER_CONSTANT, cv::Scalar(114, 114, 114)); });
+
+    bool same = memcmp(ref.data, simd.data, (size_t)dst_h * ref.step) == 0;
+    printf("%dx%d (linesize %d) -> %dx%d, median of %d runs\n", src_w, src_h, stride, dst_w, dst_h, iters);
+    printf("opencv %8.1f us\n", t_cv);
+    printf("ref    %8.1f us  %.2fx opencv\n", t_ref, t_cv / t_ref);
+    printf("simd   %8.1f us  %.2fx opencv, %.2fx ref, %s\n", t_simd, t_cv / t_simd, t_ref / t_simd,
+           same ? "bit identical to ref" : "MISMATCH with ref");
+    return same ? 0 : 1;
+}
@@ -0,0 +1,138 @@
+// Detection overlay cost per frame, n boxes with a label tag and 17 keypoints each.
+//
+//   opencv_gray  the path before AXNV12Osd: cv::rectangle / cv::putText / cv::circle
+//                on a gray view of the Y plane
+//   opencv_bgr   the same calls on a BGR frame, drawing only (no colour conversion),
+//                the usual way of getting a coloured overlay with OpenCV
+//   nv12_osd     AXNV12Osd::Draw into both NV12 planes
+//
+// Boxes are spread over the frame with a fixed seed so every path draws the
+// same thing.
+#include <opencv2/opencv.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "utils/cmdline.hpp"
+#include "utils/timer.hpp"
+#include "utils/nv12_osd.hpp"
+
+static double time_us(int iters, const std::function<void()> &fn)
+{
+    fn(); // warm up caches and lazy allocations
+    std::vector<int64_t> t(iters);
+    for (int i = 0; i < iters; i++)
+    {
+        int64_t t0 = ax_now_us();
+        fn();
+        t[i] = ax_now_us() - t0;
+    }
+    std::sort(t.begin(), t.end());
+    return (double)t[iters / 2];
+}
+
+static void label_text(char *buf, size_t size, const ax_det_obj_t &obj, int id)
+{
+    snprintf(buf, size, "#%d %d %4.2f", id, obj.label, obj.score);
+}
+
+int main(int argc, char *argv[])
+{
+    cmdline::parser a;
+    a.add<int>("width", 0, "frame width", false, 1920);
+    a.add<int>("height", 0, "frame height", false, 1080);
+    a.add<int>("boxes", 0, "boxes per frame", false, 128);
+    a.add<int>("kpts", 0, "keypoints per box, 0 - 17", false, 17);
+    a.add<int>("iters", 0, "timed runs per path, the median is reported", false, 200);
+    a.parse_check(argc, argv);
+
+    int width = a.get<int>("width"), height = a.get<int>("height");
+    int boxes = std::max(1, a.get<int>("boxes"));
+    int kpts = std::min(17, std::max(0, a.get<int>("kpts")));
+    int iters = std::max(1, a.get<int>("iters"));
+
+    // 一个 ax_det_result_t 装不下时拆成几批，和多路结果叠加画是一样的
+    const int per_result = (int)(sizeof(ax_det_result_t::objects) / sizeof(ax_det_obj_t));
+    std::vector<ax_det_result_t> results((boxes + per_result - 1) / per_result);
+    std::vector<std::vector<int>> ids(results.size());
+    srand(1);
+    for (int i = 0; i < boxes; i++)
+    {
+        ax_det_result_t &r = results[i / per_result];
+        ax_det_obj_t &obj = r.objects[r.num_objs++];
+        obj.box.w = 40 + rand() % 200;
+        obj.box.h = 40 + rand() % 200;
+        obj.box.x = rand() % std::max(1, width - (int)obj.box.w);
+        obj.box.y = rand() % std::max(1, height - (int)obj.box.h);
+        obj.label = rand() % 80;
+        obj.score = 0.25f + (rand() % 75) / 100.0f;
+        obj.num_kpt = kpts;
+        for (int j = 0; j < kpts; j++)
+        {
+            obj.kpts[j].x = obj.box.x + rand() % (int)obj.box.w;
+            obj.kpts[j].y = obj.box.y + rand() % (int)obj.box.h;
+        }
+        ids[i / per_result].push_back(i);
+    }
+
+    int stride = (width + 255) & ~255;
+    std::vector<uint8_t> y(stride * height, 0x80), uv(stride * height / 2, 0x80);
+    cv::Mat gray(height, width, CV_8UC1, y.data(), stride);
+    cv::Mat bgr(height, width, CV_8UC3, cv::Scalar(128, 128, 128));
+
+    char label_info[64];
+    double t_gray = time_us(iters, [&]
+                            {
+        for (size_t k = 0; k < results.size(); k++)
+            for (int i = 0; i < results[k].num_objs; i++)
+            {
+                const ax_det_obj_t &obj = results[k].objects[i];
+                cv::rectangle(gray, cv::Rect(obj.box.x, obj.box.y, obj.box.w, obj.box.h), cv::Scalar(255), 2);
+                label_text(label_info, sizeof(label_info), obj, ids[k][i]);
+                cv::putText(gray, label_info, cv::Point(obj.box.x, obj.box.y - 10),
+                            cv::FONT_HERSHEY_SIMPLEX, 1.0, cv::Scalar(255), 2);
+                for (int j = 0; j < obj.num_kpt; j++)
+                    cv::circle(gray, cv::Point(obj.kpts[j].x, obj.kpts[j].y), 5, cv::Scalar(255), -1);
+            } });
+
+    double t_bgr = time_us(iters, [&]
+                           {
+        for (size_t k = 0; k < results.size(); k++)
+            for (int i = 0; i < results[k].num_objs; i++)
+            {
+                const ax_det_obj_t &obj = results[k].objects[i];
+                cv::Scalar c((obj.label * 37) & 0xff, (obj.label * 91) & 0xff, (obj.label * 53) & 0xff);
+                cv::rectangle(bgr, cv::Rect(obj.box.x, obj.box.y, obj.box.w, obj.box.h), c, 2);
+                label_text(label_info, sizeof(label_info), obj, ids[k][i]);
+                int baseline = 0;
+                cv::Size ts = cv::getTextSize(label_info, cv::FONT_HERSHEY_SIMPLEX, 0.6, 1, &baseline);
+                cv::Point org(obj.box.x, obj.box.y - baseline);
+                cv::rectangle(bgr, cv::Rect(org.x, org.y - ts.height, ts.width + 4, ts.height + baseline), c, -1);
+                cv::putText(bgr, label_info, cv::Point(org.x + 2, org.y), cv::FONT_HERSHEY_SIMPLEX, 0.6,
+                            cv::Scalar(255, 255, 255), 1);
+                for (int j = 0; j < obj.num_kpt; j++)
+                    cv::circle(bgr, cv::Point(obj.kpts[j].x, obj.kpts[j].y), 3, c, -1);
+            } });
+
+    AXNV12Osd osd;
+    osd.Init();
+    AXNV12Surface surf;
+    surf.y = y.data();
+    surf.y_stride = stride;
+    surf.uv = uv.data();
+    surf.uv_stride = stride;
+    surf.width = width;
+    surf.height = height;
+    double t_osd = time_us(iters, [&]
+                           {
+        for (size_t k = 0; k < results.size(); k++)
+            osd.Draw(surf, results[k], ids[k].data()); });
+
+    printf("%dx%d, %d boxes with %d keypoints, median of %d runs\n", width, height, boxes, kpts, iters);
+    printf("opencv_gray %8.1f us\n", t_gray);
+    printf("opencv_bgr  %8.1f us\n", t_bgr);
+    printf("nv12_osd    %8.1f us  %.2fx opencv_gray, %.2fx opencv_bgr\n", t_osd, t_gray / t_osd, t_bgr / t_osd);
+    return 0;
+}
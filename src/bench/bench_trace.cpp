@@ -0,0 +1,153 @@
+// Cost of AXTrace spans.
+//
+// span      CPU ns per AX_TRACE_SCOPE in a tight loop, tracing off and on, from
+//           every thread at once so the rings are written concurrently
+// pipeline  a frame costs frame_us of CPU work, split evenly into spans slices
+//           with one span per slice; the pipe records about 12 spans per frame
+//           (demux to mux) with encoding on. Tracing is switched on for every
+//           other frame, so drift of the machine hits both alike, and the
+//           median CPU time per frame with tracing on against off is the
+//           overhead.
+// Times are CPU time of the measuring threads, so other threads on the same
+// core do not count. Span runs alternate off / on and keep the best of each.
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+#include "utils/cmdline.hpp"
+#include "utils/timer.hpp"
+#include "utils/trace.hpp"
+
+static const char *STAGE_NAMES[] = {"stage0", "stage1", "stage2", "stage3", "stage4", "stage5", "stage6", "stage7"};
+
+static int64_t thread_cpu_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// fixed amount of work, independent of the clock
+static uint32_t spin(int64_t rounds, uint32_t x)
+{
+    for (int64_t i = 0; i < rounds; i++)
+        x = x * 1664525u + 1013904223u;
+    return x;
+}
+
+// spin rounds per microsecond on this machine
+static double calibrate()
+{
+    int64_t rounds = 10000000;
+    int64_t t0 = thread_cpu_ns();
+    volatile uint32_t sink = spin(rounds, 1);
+    (void)sink;
+    return rounds / ((thread_cpu_ns() - t0) / 1000.0);
+}
+
+// runs body on threads threads at once, returns their summed CPU ns
+template <typename F>
+static int64_t on_threads(int threads, F body)
+{
+    std::vector<std::thread> th;
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+    std::atomic<int64_t> cpu_ns{0};
+    for (int t = 0; t < threads; t++)
+    {
+        th.emplace_back([&, t]
+                        {
+                            ready++;
+                            while (!go)
+                                std::this_thread::yield();
+                            int64_t t0 = thread_cpu_ns();
+                            body(t);
+                            cpu_ns += thread_cpu_ns() - t0; });
+    }
+    while (ready < threads)
+        std::this_thread::yield();
+    go = true;
+    for (auto &t : th)
+        t.join();
+    return cpu_ns;
+}
+
+// CPU ns per span
+static double run_span(int threads, int iters)
+{
+    int64_t ns = on_threads(threads, [&](int)
+                            {
+                                for (int i = 0; i < iters; i++)
+                                {
+                                    AX_TRACE_SCOPE("span", i);
+                                    // 防止空循环被优化掉
+                                    asm volatile("" ::: "memory");
+                                } });
+    return (double)ns / threads / iters;
+}
+
+static double median(std::vector<int64_t> &v)
+{
+    std::sort(v.begin(), v.end());
+    return v.empty() ? 0 : (double)v[v.size() / 2];
+}
+
+// median CPU us per frame with tracing off and on
+static void run_pipeline(int spans, int frames, int64_t rounds_per_span, double &off_us, double &on_us)
+{
+    std::vector<int64_t> off, on;
+    uint32_t x = 1;
+    for (int f = 0; f < frames * 2; f++)
+    {
+        AXTrace::Enable(f & 1);
+        int64_t t0 = thread_cpu_ns();
+        for (int s = 0; s < spans; s++)
+        {
+            AX_TRACE_SCOPE(STAGE_NAMES[s % 8], f);
+            x = spin(rounds_per_span, x);
+        }
+        (f & 1 ? on : off).push_back(thread_cpu_ns() - t0);
+    }
+    AXTrace::Enable(false);
+    volatile uint32_t sink = x;
+    (void)sink;
+    off_us = median(off) / 1000;
+    on_us = median(on) / 1000;
+}
+
+int main(int argc, char *argv[])
+{
+    cmdline::parser a;
+    a.add<int>("threads", 't', "threads recording at once in the span run, like the pipe's stage threads", false, 4);
+    a.add<int>("spans", 's', "spans per frame over all threads", false, 12);
+    a.add<int>("frame_us", 'f', "CPU time of one frame over all stages", false, 2000);
+    a.add<int>("frames", 'n', "frames with tracing off, and as many on, in the pipeline run", false, 2000);
+    a.add<int>("iters", 'i', "spans per thread in the span run", false, 1000000);
+    a.add<int>("runs", 'r', "span runs, the best is kept", false, 5);
+    a.parse_check(argc, argv);
+
+    int threads = a.get<int>("threads");
+    int spans = a.get<int>("spans");
+    int runs = a.get<int>("runs");
+    int64_t rounds_per_span = (int64_t)(calibrate() * a.get<int>("frame_us") / spans);
+
+    double span_off = 1e18, span_on = 1e18, frame_off = 0, frame_on = 0;
+    for (int r = 0; r < runs; r++)
+    {
+        AXTrace::Enable(false);
+        span_off = std::min(span_off, run_span(threads, a.get<int>("iters")));
+        AXTrace::Enable(true);
+        span_on = std::min(span_on, run_span(threads, a.get<int>("iters")));
+    }
+    run_pipeline(spans, a.get<int>("frames"), rounds_per_span, frame_off, frame_on);
+
+    printf("span, %d threads: off %.1f ns, on %.1f ns\n", threads, span_off, span_on);
+    printf("pipeline, %d spans per frame: off %.1f us, on %.1f us per frame, overhead %.3f%% (%.3f%% from the span cost)\n",
+           spans, frame_off, frame_on, (frame_on - frame_off) / frame_off * 100,
+           spans * (span_on - span_off) / 1000 / frame_off * 100);
+    printf("rings allocated: %d for %d recording threads started one run after another\n",
+           (int)AXTrace::RingCount(), threads * runs + 1);
+    return 0;
+}
@@ -0,0 +1,201 @@
+// Publish-to-consume latency of the GetFrame hand-off.
+//
+// A producer thread stands in for the decode callback: every interval it fills
+// a frame-sized buffer and hands it over. A consumer thread stands in for the
+// inference loop: it asks for a frame, "infers" for infer_us, and asks again.
+// Two hand-offs are compared:
+//   handshake     the old request_copy / cv_done scheme, the producer takes the
+//                 mutex on every frame and copies only when asked
+//   triple_buffer TripleBuffer as used by AXFFmpegPipe, GetFrame polls every 500 us
+// Reported per fetched frame: age of the frame when the consumer gets it
+// (publish to consume), time the consumer waited, and the producer's own cost.
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "utils/cmdline.hpp"
+#include "utils/timer.hpp"
+#include "utils/triple_buffer.hpp"
+
+struct Slot
+{
+    std::vector<uint8_t> data;
+    int64_t t_publish = 0;
+};
+
+struct Result
+{
+    std::vector<int64_t> age_us;
+    std::vector<int64_t> wait_us;
+    std::vector<int64_t> produce_us;
+};
+
+static void busy_wait_until(int64_t t)
+{
+    while (ax_now_us() < t)
+        ;
+}
+
+static void fill(std::vector<uint8_t> &dst, const std::vector<uint8_t> &src)
+{
+    memcpy(dst.data(), src.data(), src.size());
+}
+
+static Result run_handshake(size_t frame_bytes, int interval_us, int infer_us, int frames)
+{
+    std::mutex mtx;
+    std::condition_variable cv_done;
+    bool request_copy = false;
+    bool copy_done = false;
+    std::atomic<bool> stop{false};
+    Slot shared;
+    shared.data.resize(frame_bytes);
+    std::vector<uint8_t> decoded(frame_bytes, 0x80);
+    Result r;
+
+    std::thread producer([&]
+                         {
+        int64_t next = ax_now_us();
+        while (!stop)
+        {
+            busy_wait_until(next);
+            next += interval_us;
+            int64_t t0 = ax_now_us();
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                if (request_copy)
+                {
+                    fill(shared.data, decoded);
+                    shared.t_publish = ax_now_us();
+                    copy_done = true;
+                    request_copy = false;
+                    cv_done.notify_one();
+                }
+            }
+            r.produce_us.push_back(ax_now_us() - t0);
+        } });
+
+    std::vector<uint8_t> local(frame_bytes);
+    for (int i = 0; i < frames; i++)
+    {
+        int64_t t0 = ax_now_us();
+        std::unique_lock<std::mutex> lock(mtx);
+        request_copy = true;
+        copy_done = false;
+        if (!cv_done.wait_for(lock, std::chrono::milliseconds(100), [&]
+                              { return copy_done; }))
+            continue;
+        int64_t t1 = ax_now_us();
+        fill(local, shared.data);
+        r.age_us.push_back(t1 - shared.t_publish);
+        r.wait_us.push_back(t1 - t0);
+        lock.unlock();
+        busy_wait_until(ax_now_us() + infer_us);
+    }
+    stop = true;
+    producer.join();
+    return r;
+}
+
+static Result run_triple_buffer(size_t frame_bytes, int interval_us, int infer_us, int frames)
+{
+    TripleBuffer<Slot> tb;
+    tb.Back().data.resize(frame_bytes);
+    std::atomic<bool> stop{false};
+    std::vector<uint8_t> decoded(frame_bytes, 0x80);
+    Result r;
+
+    std::thread producer([&]
+                         {
+        int64_t next = ax_now_us();
+        while (!stop)
+        {
+            busy_wait_until(next);
+            next += interval_us;
+            int64_t t0 = ax_now_us();
+            Slot &slot = tb.Back();
+            slot.data.resize(frame_bytes);
+            fill(slot.data, decoded);
+            slot.t_publish = ax_now_us();
+            tb.Publish();
+            r.produce_us.push_back(ax_now_us() - t0);
+        } });
+
+    for (int i = 0; i < frames; i++)
+    {
+        int64_t t0 = ax_now_us();
+        int64_t deadline = t0 + 100000;
+        bool got = true;
+        while (!tb.Fetch())
+        {
+            if (ax_now_us() >= deadline)
+            {
+                got = false;
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+        }
+        if (!got)
+            continue;
+        int64_t t1 = ax_now_us();
+        r.age_us.push_back(t1 - tb.Front().t_publish);
+        r.wait_us.push_back(t1 - t0);
+        busy_wait_until(ax_now_us() + infer_us);
+    }
+    stop = true;
+    producer.join();
+    return r;
+}
+
+static int64_t pct(std::vector<int64_t> v, double q)
+{
+    if (v.empty())
+        return 0;
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, (size_t)(q * v.size()))];
+}
+
+static double avg(const std::vector<int64_t> &v)
+{
+    if (v.empty())
+        return 0;
+    double s = 0;
+    for (auto x : v)
+        s += x;
+    return s / v.size();
+}
+
+static void report(const char *name, const Result &r)
+{
+    printf("%-14s frames %5zu | age avg %7.1f p50 %6lld p99 %6lld us | wait avg %7.1f p99 %6lld us | producer avg %6.1f p99 %6lld us\n",
+           name, r.age_us.size(),
+           avg(r.age_us), (long long)pct(r.age_us, 0.5), (long long)pct(r.age_us, 0.99),
+           avg(r.wait_us), (long long)pct(r.wait_us, 0.99),
+           avg(r.produce_us), (long long)pct(r.produce_us, 0.99));
+}
+
+int main(int argc, char *argv[])
+{
+    cmdline::parser a;
+    a.add<int>("width", 0, "frame width, the buffer is NV12", false, 1920);
+    a.add<int>("height", 0, "frame height", false, 1080);
+    a.add<int>("fps", 0, "producer frame rate", false, 30);
+    a.add<int>("infer_us", 0, "consumer work per frame in us", false, 20000);
+    a.add<int>("frames", 0, "frames fetched per run", false, 300);
+    a.parse_check(argc, argv);
+
+    size_t frame_bytes = (size_t)a.get<int>("width") * a.get<int>("height") * 3 / 2;
+    int interval_us = 1000000 / std::max(1, a.get<int>("fps"));
+    int infer_us = a.get<int>("infer_us");
+    int frames = a.get<int>("frames");
+    printf("%dx%d NV12 at %d fps, consumer works %d us per frame\n",
+           a.get<int>("width"), a.get<int>("height"), a.get<int>("fps"), infer_us);
+
+    report("handshake", run_handshake(frame_bytes, interval_us, infer_us, frames));
+    report("triple_buffer", run_triple_buffer(frame_bytes, interval_us, infer_us, frames));
+    return 0;
+}
@@ -0,0 +1,420 @@
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C"
+{
+#include "libavcodec/avcodec.h"
+}
+
+#include "utils/logger.h"
+#include "utils/timer.hpp"
+#include "utils/trace.hpp"
+#include "AXFFmpegQueue.hpp"
+#include "AXFFmpegMuxer.hpp"
+#include "../libdet/include/libdet.h"
+
+// which detections start a clip
+struct AXRecordRule
+{
+    std::vector<int> labels; // empty: any label
+    float min_score = 0.5f;
+    int min_objs = 1; // objects passing labels / min_score needed in one result
+
+    // comma separated class ids, e.g. "0,2"; empty for any label
+    void SetLabels(const std::string &list)
+    {
+        labels.clear();
+        size_t pos = 0;
+        while (pos < list.size())
+        {
+            size_t end = list.find(',', pos);
+            if (end == std::string::npos)
+                end = list.size();
+            if (end > pos)
+                labels.push_back(atoi(list.substr(pos, end - pos).c_str()));
+            pos = end + 1;
+        }
+    }
+
+    bool Match(const ax_det_result_t &result) const
+    {
+        int n = 0;
+        for (int i = 0; i < result.num_objs; i++)
+        {
+            const ax_det_obj_t &obj = result.objects[i];
+            if (obj.score < min_score)
+                continue;
+            if (!labels.empty() && std::find(labels.begin(), labels.end(), obj.label) == labels.end())
+                continue;
+            n++;
+        }
+        return n >= min_objs;
+    }
+};
+
+struct AXRecorderConfig
+{
+    double pre_roll_s = 5;   // kept before the trigger, rounded out to the keyframe before it
+    double post_roll_s = 5;  // kept after the last matching detection
+    double max_clip_s = 120; // triggers stop extending a clip after this long
+    int64_t max_bytes = 32 << 20; // cap of the pre-roll ring, and separately of the writer backlog
+    AXRecordRule rule;
+};
+
+struct AXRecorderStats
+{
+    uint64_t triggers = 0; // matching detection results
+    uint64_t clips = 0;    // clips started
+    uint64_t packets = 0;  // packets sent to clips
+    uint64_t overflows = 0; // a single GOP did not fit max_bytes, pre-roll lost
+    uint64_t dropped = 0;   // clip packets dropped because the writer fell behind, whole GOPs at a time
+    int64_t ring_bytes = 0;
+    double ring_s = 0;
+    bool recording = false;
+};
+
+// Event recording without re-encoding.
+//
+// Push feeds the encoded packets of one stream (input demuxer or encoder output)
+// into a ring that always starts on a keyframe and holds at least pre_roll_s,
+// trimmed a whole GOP at a time. When OnDetections sees a result matching the
+// rule, the ring is handed to the writer thread followed by every new packet
+// until post_roll_s after the last match, and the writer remuxes them into
+// <prefix>_<YYYYmmdd_HHMMSS>.mp4 with AXFFmpegMuxer, shifted so that the clip
+// starts at dts 0.
+//
+// Packets are held by reference, nothing is copied. Push never waits for the
+// writer: when its backlog reaches max_bytes or QUEUE_ITEMS packets, the rest
+// of the GOP is dropped and the clip goes on from the next keyframe that fits,
+// and a clip that can not even be started is skipped. Push and OnDetections
+// may be called from different threads; times are wall clock, so timestamp
+// jumps after a reconnect do not confuse retention.
+class AXEventRecorder
+{
+private:
+    struct Entry
+    {
+        AVPacket *pkt;
+        int64_t t_us; // arrival
+    };
+
+    // writer 线程队列里的标记包
+    static const int CLIP_START = -2;
+    static const int CLIP_END = -3;
+    // writer backlog in packets and markers, q_clip is this long so Push never blocks
+    static const int QUEUE_ITEMS = 4096;
+
+    std::string prefix;
+    AXRecorderConfig cfg;
+    AVCodecParameters *par = nullptr;
+    AVRational time_base = {1, 90000};
+    AVRational frame_rate = {0, 1};
+
+    std::mutex mtx;
+    std::deque<Entry> ring;
+    std::vector<AVPacket *> shells;
+    int64_t ring_bytes = 0;
+    bool start_pending = false; // set by OnDetections, the next Push opens the clip
+    bool recording = false;
+    int64_t clip_start_us = 0;
+    int64_t record_until_us = 0;
+    std::vector<const AVPacket *> to_send; // Push only, reused
+    AVPacket *start_marker = nullptr;
+    AVPacket *end_marker = nullptr;
+
+    std::thread th_write;
+    AXFFmpegQueue<AVPacket> q_clip;
+    std::atomic<int64_t> queued_bytes{0};
+    std::atomic<int> queued_items{0}; // in q_clip or reserved for the end marker of the open clip
+    bool skip_to_key = false;          // backlog was full, drop until a keyframe fits
+    AXRecorderStats stats;
+
+    AVPacket *get_shell()
+    {
+        if (shells.empty())
+            return av_packet_alloc();
+        AVPacket *p = shells.back();
+        shells.pop_back();
+        return p;
+    }
+
+    void drop_front(size_t n)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            ring_bytes -= ring.front().pkt->size;
+            av_packet_unref(ring.front().pkt);
+            shells.push_back(ring.front().pkt);
+            ring.pop_front();
+        }
+    }
+
+    // index of the first keyframe after the front one, 0 if there is none
+    size_t next_gop() const
+    {
+        for (size_t i = 1; i < ring.size(); i++)
+        {
+            if (ring[i].pkt->flags & AV_PKT_FLAG_KEY)
+                return i;
+        }
+        return 0;
+    }
+
+    // whole GOPs only, so the ring always starts on a keyframe; lock held
+    void trim(int64_t now)
+    {
+        int64_t pre_roll_us = (int64_t)(cfg.pre_roll_s * 1e6);
+        size_t k;
+        while ((k = next_gop()) > 0 && (now - ring[k].t_us >= pre_roll_us || ring_bytes > cfg.max_bytes))
+            drop_front(k);
+        if (ring_bytes > cfg.max_bytes)
+        {
+            // 单个 GOP 就超出预算，丢掉等下一个关键帧
+            drop_front(ring.size());
+            stats.overflows++;
+        }
+    }
+
+    // clip packet for the writer, lock held
+    void send(const AVPacket *p)
+    {
+        // 积压超出预算后整段丢到下一个关键帧，片段里不会出现缺参考帧的包
+        if (skip_to_key && !(p->flags & AV_PKT_FLAG_KEY))
+        {
+            stats.dropped++;
+            return;
+        }
+        if (queued_bytes + p->size > cfg.max_bytes || queued_items >= QUEUE_ITEMS)
+        {
+            skip_to_key = true;
+            stats.dropped++;
+            return;
+        }
+        skip_to_key = false;
+        queued_bytes += p->size;
+        queued_items++;
+        stats.packets++;
+        to_send.push_back(p);
+    }
+
+    void func_th_write()
+    {
+        AXTrace::SetThreadName("record");
+        AVPacket *pkt = av_packet_alloc();
+        std::unique_ptr<AXFFmpegMuxer> muxer;
+        std::string path;
+        int64_t ts_base = AV_NOPTS_VALUE; // dts of the first packet of the clip
+        while (pkt && q_clip.Pop(pkt) != AVERROR_EOF)
+        {
+            queued_items--;
+            if (pkt->stream_index == CLIP_START)
+            {
+                char stamp[32];
+                time_t now = time(NULL);
+                struct tm tm_now;
+                localtime_r(&now, &tm_now);
+                strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", &tm_now);
+                path = prefix + "_" + stamp + ".mp4";
+                ts_base = AV_NOPTS_VALUE;
+                muxer.reset(new AXFFmpegMuxer());
+                if (muxer->Init(path, par, time_base, frame_rate) < 0)
+                {
+                    SAMPLE_LOG_E("can not create clip %s", path.c_str());
+                    muxer.reset();
+                }
+            }
+            else if (pkt->stream_index == CLIP_END)
+            {
+                if (muxer)
+                {
+                    AXMuxerStats ms = muxer->GetStats();
+                    muxer->Deinit();
+                    SAMPLE_LOG_I("clip %s: %llu packets, %.2f MB", path.c_str(),
+                                 (unsigned long long)ms.packets, ms.bytes / 1048576.0);
+                }
+                muxer.reset();
+            }
+            else
+            {
+                queued_bytes -= pkt->size;
+                // 每段从 0 开始，否则 mp4 的 edit list 会从流的开头算起，前面是几个小时的空白
+                if (ts_base == AV_NOPTS_VALUE)
+                    ts_base = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+                if (ts_base != AV_NOPTS_VALUE)
+                {
+                    if (pkt->dts != AV_NOPTS_VALUE)
+                        pkt->dts -= ts_base;
+                    if (pkt->pts != AV_NOPTS_VALUE)
+                        pkt->pts -= ts_base;
+                }
+                if (muxer)
+                    muxer->Push(pkt);
+            }
+            av_packet_unref(pkt);
+        }
+        if (muxer)
+            muxer->Deinit();
+        av_packet_free(&pkt);
+    }
+
+public:
+    AXEventRecorder() = default;
+    ~AXEventRecorder()
+    {
+        Deinit();
+    }
+
+    // _par/_time_base describe the packets that will be pushed; clips are named <prefix>_<time>.mp4
+    int Init(const std::string &_prefix, const AVCodecParameters *_par, AVRational _time_base,
+             AVRational _frame_rate, const AXRecorderConfig &_cfg)
+    {
+        prefix = _prefix;
+        cfg = _cfg;
+        time_base = _time_base;
+        frame_rate = _frame_rate;
+        par = avcodec_parameters_alloc();
+        start_marker = av_packet_alloc();
+        end_marker = av_packet_alloc();
+        if (!par || !start_marker || !end_marker)
+            return AVERROR(ENOMEM);
+        start_marker->stream_index = CLIP_START;
+        end_marker->stream_index = CLIP_END;
+        int ret = avcodec_parameters_copy(par, _par);
+        if (ret < 0)
+            return ret;
+        SAMPLE_LOG_I("event recording to %s_*.mp4, pre-roll %.1fs, post-roll %.1fs, budget %.1f MB",
+                     prefix.c_str(), cfg.pre_roll_s, cfg.post_roll_s, cfg.max_bytes / 1048576.0);
+        return 0;
+    }
+
+    void Start()
+    {
+        // send 按条数和字节数限住积压，队列不会满，Push 不会阻塞
+        q_clip.Reset();
+        q_clip.Config(QUEUE_ITEMS, ax_overflow_block);
+        queued_bytes = 0;
+        queued_items = 0;
+        th_write = std::thread(&AXEventRecorder::func_th_write, this);
+    }
+
+    // one packet of the stream, in order; all calls from the same thread
+    void Push(const AVPacket *pkt)
+    {
+        if (!th_write.joinable())
+            return;
+        int64_t now = ax_now_us();
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            // 环形缓冲总是从关键帧开始
+            if (!ring.empty() || (pkt->flags & AV_PKT_FLAG_KEY))
+            {
+                AVPacket *p = get_shell();
+                if (p && av_packet_ref(p, pkt) == 0)
+                {
+                    ring.push_back({p, now});
+                    ring_bytes += p->size;
+                    if (recording)
+                        send(p);
+                }
+                else if (p)
+                    shells.push_back(p);
+            }
+
+            // 触发时把预录的整段（含当前包）先送给写线程
+            if (start_pending && !recording && !ring.empty())
+            {
+                start_pending = false;
+                if (queued_items + 2 > QUEUE_ITEMS)
+                {
+                    // 写线程积压太多，连开始标记都放不下，这一段不录
+                    stats.dropped += ring.size();
+                }
+                else
+                {
+                    recording = true;
+                    clip_start_us = now;
+                    stats.clips++;
+                    // 开始标记，以及给结束标记预留的一格
+                    queued_items += 2;
+                    to_send.push_back(start_marker);
+                    skip_to_key = false;
+                    for (auto &e : ring)
+                        send(e.pkt);
+                }
+            }
+            if (recording && now > record_until_us)
+            {
+                recording = false;
+                to_send.push_back(end_marker);
+            }
+
+            // 队列里放的是新引用，必须在 trim 释放环形缓冲之前推；条数有预算，不会阻塞
+            for (const AVPacket *p : to_send)
+                q_clip.Push(p);
+            to_send.clear();
+            trim(now);
+        }
+    }
+
+    // start or extend a clip when result matches the rule; any thread
+    void OnDetections(const ax_det_result_t &result)
+    {
+        if (!th_write.joinable() || !cfg.rule.Match(result))
+            return;
+        int64_t now = ax_now_us();
+        std::lock_guard<std::mutex> lock(mtx);
+        stats.triggers++;
+        int64_t until = now + (int64_t)(cfg.post_roll_s * 1e6);
+        if (recording)
+            until = std::min(until, clip_start_us + (int64_t)(cfg.max_clip_s * 1e6));
+        else
+            start_pending = true;
+        record_until_us = std::max(record_until_us, until);
+    }
+
+    // finish the open clip and stop the writer
+    void Deinit()
+    {
+        if (th_write.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (recording)
+                    q_clip.Push(end_marker);
+                recording = false;
+                start_pending = false;
+            }
+            q_clip.Abort();
+            th_write.join();
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!ring.empty())
+            drop_front(ring.size());
+        for (auto p : shells)
+            av_packet_free(&p);
+        shells.clear();
+        av_packet_free(&start_marker);
+        av_packet_free(&end_marker);
+        avcodec_parameters_free(&par);
+    }
+
+    AXRecorderStats GetStats()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        AXRecorderStats s = stats;
+        s.ring_bytes = ring_bytes;
+        s.ring_s = ring.empty() ? 0 : (ax_now_us() - ring.front().t_us) / 1e6;
+        s.recording = recording;
+        return s;
+    }
+};
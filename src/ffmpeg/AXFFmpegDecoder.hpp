@@ -11,12 +11,19 @@ extern "C"
 #include "libavformat/avformat.h"
 #include "libavutil/opt.h"
 #include "libavutil/pixdesc.h"
+#include "libavutil/imgutils.h"
 #include "libswscale/swscale.h"
 }
 
 #include "utils/logger.h"
 #include "utils/def.h"
+#include "utils/timer.hpp"
+#include "utils/trace.hpp"
+#include "utils/metrics.hpp"
+#include "AXFFmpegQueue.hpp"
+#include "AXStreamInfoCache.hpp"
 
+#include <atomic>
 #include <string>
 #include <thread>
 #include <mutex>
@@ -29,21 +36,70 @@ extern "C"
 // typedef void (*AXFrameCallback)(AVFrame *frame, void *user_data);
 using AXFrameCallback = std::function<void(AVFrame *frame, void *user_data)>;
 
+struct AXDemuxStats
+{
+    uint64_t reconnects = 0;  // successful reconnects
+    uint64_t failures = 0;    // failed reconnect attempts
+    int64_t downtime_us = 0;  // total time without input, including the current outage
+    bool connected = false;
+};
+
+// backpressure from the decoder: send_eagain counts every EAGAIN from avcodec_send_packet,
+// stalled_packets the packets that saw at least one, stall_us the time they waited
+struct AXDecodeStats
+{
+    uint64_t send_eagain = 0;
+    uint64_t stalled_packets = 0;
+    uint64_t send_errors = 0; // packets the decoder rejected as invalid
+    int64_t stall_us = 0;
+    int64_t max_stall_us = 0;
+};
+
+struct AXStartupStats
+{
+    bool cached = false;         // opened from AXStreamInfoCache without probing
+    int64_t open_us = 0;         // avformat_open_input
+    int64_t probe_us = 0;        // avformat_find_stream_info, 0 when cached
+    int64_t first_frame_us = -1; // Init to first delivered frame, -1 until then
+};
+
 class AXFFmpegDecoder
 {
 private:
+    std::thread th_demux;
     std::thread th_decode;
+    // demux -> decode，吸收网络抖动
+    AXFFmpegQueue<AVPacket> q_packets;
+    int packet_queue_size = 64;
     AVBufferRef *hw_device_ctx = nullptr;
     AVFormatContext *pstAvFmtCtx = nullptr;
 
     const AVCodec *codec = NULL;
+    // video stream as first opened; pstAvFmtCtx is replaced on a reconnect, so the
+    // parameters are copied and later connections are rescaled to in_time_base
     AVCodecParameters *origin_par = NULL;
+    AVRational in_time_base = {0, 1};
+    AVRational in_frame_rate = {0, 1};
     AVCodecContext *avctx = NULL;
 
     AVDictionary *codec_opts = NULL; // used for avcodec_open2
     AVDictionary *input_opts = NULL; // used for avformat_open_input
 
     enum AVCodecID eCodecID = AV_CODEC_ID_H264;
+    AXCodecBackend backend = ax_codec_backend_axcl;
+    // ax_hwframe_axmm: 解码输出留在卡上的 AXMM 帧
+    AXHwFrameMode hw_mode = ax_hwframe_off;
+    int hw_pool_size = 20;
+
+    // 只分析不出流时只解推理要用的帧，省下子卡的解码能力
+    AXDecodeMode decode_mode = ax_decode_all;
+    double sample_interval = 0; // seconds between delivered frames, 0 delivers all
+    double next_sample_t = -1;
+    // decode 线程写，GetDecodeStats 在别的线程读，整体拷贝要加锁
+    std::mutex mtx_decode_stats;
+    AXDecodeStats decode_stats;
+    std::atomic<unsigned long long> packets_skipped{0};
+    std::atomic<unsigned long long> frames_sampled_out{0};
     char device_index[16] = "0";
     char codec_names[128] = {0};
 
@@ -51,11 +107,336 @@ private:
     unsigned long long frame_num = 0;
     volatile int loop_exit = 0;
 
+    // 网络输入断流后在 demux 线程里重连，解码器上下文保留，只 flush
+    std::string input_url;
+    bool is_network = false;
+    bool reconnect = true;
+    int io_timeout_ms = 5000;      // any single blocking open/read call
+    int max_backoff_ms = 5000;
+    std::atomic<int64_t> io_deadline_us{0};
+    std::atomic<bool> demux_done{false};
+    std::atomic<bool> decode_done{false};
+    std::mutex mtx_demux_stats;
+    AXDemuxStats demux_stats;
+    int64_t outage_start_us = 0;
+
+    static const int DISCONTINUITY = -1; // stream_index of the marker packet sent after a reconnect
+
+    // 快速启动：有缓存的参数就跳过 avformat_find_stream_info，第一帧出来后再核对
+    AXStreamInfoCache *info_cache = nullptr;
+    bool opened_from_cache = false;
+    AXStreamInfo cached_info;
+    std::atomic<bool> verify_pending{false};
+    std::atomic<bool> failed{false};
+    int verify_packets = 0;
+    int64_t last_open_us = 0, last_probe_us = 0;
+    int64_t init_start_us = 0;
+    std::atomic<int64_t> first_frame_us{-1};
+    AXStartupStats startup;
+
+    // nullptr until SetMetricsLabels
+    AXCounter *m_packets = nullptr;
+    AXCounter *m_frames = nullptr;
+    AXCounter *m_skipped = nullptr;
+    AXCounter *m_eagain = nullptr;
+    AXCounter *m_reconnects = nullptr;
+    AXGauge *m_connected = nullptr;
+    AXGauge *m_queue_depth = nullptr;
+    AXHistogram *m_send = nullptr;
+
+    static const int VERIFY_MAX_PACKETS = 100; // packets without a frame before the cached parameters are blamed
+
+    // fills the video stream of pstAvFmtCtx from the cache, false if the demuxer disagrees with it
+    bool apply_cached_info(int index, const AXStreamInfo &info)
+    {
+        AVCodecParameters *par = pstAvFmtCtx->streams[index]->codecpar;
+        if (par->codec_id != AV_CODEC_ID_NONE && par->codec_id != (AVCodecID)info.codec_id)
+            return false;
+        if ((par->width && par->width != info.width) || (par->height && par->height != info.height))
+            return false;
+
+        par->codec_id = (AVCodecID)info.codec_id;
+        par->width = info.width;
+        par->height = info.height;
+        if (info.fps_num > 0 && info.fps_den > 0)
+        {
+            par->framerate = av_make_q(info.fps_num, info.fps_den);
+            if (pstAvFmtCtx->streams[index]->avg_frame_rate.num <= 0)
+                pstAvFmtCtx->streams[index]->avg_frame_rate = par->framerate;
+        }
+        if (par->extradata_size == 0 && !info.extradata.empty())
+        {
+            par->extradata = (uint8_t *)av_mallocz(info.extradata.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+            if (!par->extradata)
+                return false;
+            memcpy(par->extradata, info.extradata.data(), info.extradata.size());
+            par->extradata_size = (int)info.extradata.size();
+        }
+        return true;
+    }
+
+    void store_info(int index)
+    {
+        AVStream *st = pstAvFmtCtx->streams[index];
+        AXStreamInfo info;
+        info.codec_id = st->codecpar->codec_id;
+        info.width = st->codecpar->width;
+        info.height = st->codecpar->height;
+        AVRational fps = st->avg_frame_rate.num > 0 ? st->avg_frame_rate : st->r_frame_rate;
+        if (fps.num > 0 && fps.den > 0)
+        {
+            info.fps_num = fps.num;
+            info.fps_den = fps.den;
+        }
+        if (st->codecpar->extradata_size > 0)
+            info.extradata.assign(st->codecpar->extradata, st->codecpar->extradata + st->codecpar->extradata_size);
+        if (info.width > 0 && info.height > 0)
+            info_cache->Put(input_url, info);
+    }
+
+    int find_video_stream() const
+    {
+        for (int i = 0; i < (int)pstAvFmtCtx->nb_streams; i++)
+        {
+            if (AVMEDIA_TYPE_VIDEO == pstAvFmtCtx->streams[i]->codecpar->codec_type)
+                return i;
+        }
+        return -1;
+    }
+
+    // first frames after a cached open: the stream must decode to the cached size.
+    // The encoder and fan-out are already sized from the cache, so a wrong entry
+    // stops the stream with an error; it is dropped, the next Init probes
+    bool verify_cached_info(const AVFrame *frame)
+    {
+        verify_pending = false;
+        if (frame && frame->width == cached_info.width && frame->height == cached_info.height)
+            return true;
+        if (frame)
+            SAMPLE_LOG_E("%s decodes to %dx%d, cached %dx%d; cache entry dropped, stream stopped",
+                         input_url.c_str(), frame->width, frame->height, cached_info.width, cached_info.height);
+        else
+            SAMPLE_LOG_E("%s: no frame from %d packets with cached parameters; cache entry dropped, stream stopped",
+                         input_url.c_str(), verify_packets);
+        info_cache->Invalidate(input_url);
+        failed = true;
+        loop_exit = 1;
+        q_packets.Abort();
+        return false;
+    }
+
+    // aborts blocking avformat calls on Deinit or when the current call overruns its deadline
+    static int interrupt_cb(void *opaque)
+    {
+        AXFFmpegDecoder *self = (AXFFmpegDecoder *)opaque;
+        if (self->loop_exit)
+            return 1;
+        int64_t deadline = self->io_deadline_us.load(std::memory_order_relaxed);
+        return deadline > 0 && ax_now_us() > deadline;
+    }
+
+    void arm_deadline()
+    {
+        io_deadline_us = ax_now_us() + (int64_t)io_timeout_ms * 1000;
+    }
+
+    // open input_url into pstAvFmtCtx and select its first video stream
+    int open_input()
+    {
+        pstAvFmtCtx = avformat_alloc_context();
+        if (!pstAvFmtCtx)
+        {
+            SAMPLE_LOG_E("avformat_alloc_context() failed!");
+            return AVERROR(ENOMEM);
+        }
+        pstAvFmtCtx->interrupt_callback.callback = interrupt_cb;
+        pstAvFmtCtx->interrupt_callback.opaque = this;
+
+        // If url looks like rtsp, set some helpful input options (use tcp, set timeout)
+        if (input_url.rfind("rtsp://", 0) == 0)
+        {
+            av_dict_set(&input_opts, "rtsp_transport", "tcp", 0);
+            av_dict_set(&input_opts, "stimeout", "5000000", 0); // microseconds
+            av_dict_set(&input_opts, "max_delay", "500000", 0);
+        }
+
+        AXStreamInfo info;
+        bool use_cache = info_cache && info_cache->Get(input_url, info);
+
+        int64_t t0 = ax_now_us();
+        arm_deadline();
+        int ret = avformat_open_input(&pstAvFmtCtx, input_url.c_str(), NULL, &input_opts);
+        av_dict_free(&input_opts);
+        last_open_us = ax_now_us() - t0;
+        last_probe_us = 0;
+        if (ret < 0)
+        {
+            AX_CHAR szError[128] = {0};
+            av_strerror(ret, szError, sizeof(szError));
+            SAMPLE_LOG_E("open %s fail, error: %d, %s", input_url.c_str(), ret, szError);
+            return -1;
+        }
+
+        opened_from_cache = false;
+        int index = -1;
+        if (use_cache)
+        {
+            index = find_video_stream();
+            if (index >= 0 && apply_cached_info(index, info))
+            {
+                opened_from_cache = true;
+                cached_info = info;
+            }
+            else
+                SAMPLE_LOG_W("%s does not match its cached parameters, probing", input_url.c_str());
+        }
+
+        if (!opened_from_cache)
+        {
+            t0 = ax_now_us();
+            arm_deadline();
+            ret = avformat_find_stream_info(pstAvFmtCtx, NULL);
+            last_probe_us = ax_now_us() - t0;
+            if (ret < 0)
+            {
+                SAMPLE_LOG_E("avformat_find_stream_info fail, error = %d", ret);
+                avformat_close_input(&pstAvFmtCtx);
+                return -1;
+            }
+            index = find_video_stream();
+            if (index >= 0 && info_cache)
+                store_info(index);
+        }
+        io_deadline_us = 0;
+
+        if (index < 0)
+        {
+            SAMPLE_LOG_E("No video stream found");
+            avformat_close_input(&pstAvFmtCtx);
+            return -1;
+        }
+        s32VideoIndex = index;
+        verify_pending = opened_from_cache;
+        verify_packets = 0;
+        return 0;
+    }
+
+    // sleep in short slices so Deinit is not held up by the backoff
+    void backoff_sleep(int ms)
+    {
+        int64_t until = ax_now_us() + (int64_t)ms * 1000;
+        while (!loop_exit && ax_now_us() < until)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    // reopen the input with exponential backoff; the decoder keeps its context
+    bool reopen_input()
+    {
+        AVCodecID codec_id = pstAvFmtCtx->streams[s32VideoIndex]->codecpar->codec_id;
+        int width = pstAvFmtCtx->streams[s32VideoIndex]->codecpar->width;
+        int height = pstAvFmtCtx->streams[s32VideoIndex]->codecpar->height;
+        avformat_close_input(&pstAvFmtCtx);
+
+        {
+            std::lock_guard<std::mutex> lock(mtx_demux_stats);
+            demux_stats.connected = false;
+            outage_start_us = ax_now_us();
+        }
+        if (m_connected)
+            m_connected->Set(0);
+
+        int backoff_ms = 100;
+        while (!loop_exit)
+        {
+            SAMPLE_LOG_W("reconnecting %s in %d ms", input_url.c_str(), backoff_ms);
+            backoff_sleep(backoff_ms);
+            if (loop_exit)
+                break;
+
+            if (open_input() == 0)
+            {
+                AVCodecParameters *par = pstAvFmtCtx->streams[s32VideoIndex]->codecpar;
+                if (par->codec_id != codec_id || par->width != width || par->height != height)
+                    SAMPLE_LOG_W("stream changed on reconnect: codec %d %dx%d -> %d %dx%d",
+                                 codec_id, width, height, par->codec_id, par->width, par->height);
+
+                std::lock_guard<std::mutex> lock(mtx_demux_stats);
+                int64_t down = ax_now_us() - outage_start_us;
+                demux_stats.reconnects++;
+                demux_stats.downtime_us += down;
+                demux_stats.connected = true;
+                outage_start_us = 0;
+                if (m_reconnects)
+                    m_reconnects->Inc();
+                if (m_connected)
+                    m_connected->Set(1);
+                SAMPLE_LOG_I("reconnected %s after %.1f s", input_url.c_str(), down / 1e6);
+                return true;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mtx_demux_stats);
+                demux_stats.failures++;
+            }
+            backoff_ms = std::min(backoff_ms * 2, max_backoff_ms);
+        }
+
+        std::lock_guard<std::mutex> lock(mtx_demux_stats);
+        demux_stats.downtime_us += ax_now_us() - outage_start_us;
+        outage_start_us = 0;
+        return false;
+    }
+
     // std::vector<unsigned char> nv12_frame_data;
     // std::mutex mtx_nv12_frame_data;
 
     AXFrameCallback frame_cb = nullptr;
     void *user_data = nullptr;
+    AXPacketCallback packet_tap = nullptr;
+
+    // 软解输出一般是 YUV420P，转成 NV12 后再回调；缓冲来自池子，回调方可以持有引用
+    SwsContext *sws_ctx = nullptr;
+    AVBufferPool *nv12_pool = nullptr;
+    int nv12_pool_size = 0;
+    AVFrame *nv12_frame = nullptr;
+
+    // frame -> nv12_frame, returns nv12_frame or NULL on failure
+    AVFrame *convert_to_nv12(const AVFrame *frame)
+    {
+        int size = av_image_get_buffer_size(AV_PIX_FMT_NV12, frame->width, frame->height, 32);
+        if (size <= 0)
+            return NULL;
+        if (!nv12_pool || nv12_pool_size != size)
+        {
+            av_buffer_pool_uninit(&nv12_pool);
+            nv12_pool = av_buffer_pool_init(size, NULL);
+            nv12_pool_size = size;
+            if (!nv12_pool)
+                return NULL;
+        }
+
+        sws_ctx = sws_getCachedContext(sws_ctx, frame->width, frame->height, (AVPixelFormat)frame->format,
+                                       frame->width, frame->height, AV_PIX_FMT_NV12, SWS_POINT, NULL, NULL, NULL);
+        if (!sws_ctx)
+        {
+            SAMPLE_LOG_E("sws_getCachedContext failed for format %d", frame->format);
+            return NULL;
+        }
+
+        av_frame_unref(nv12_frame);
+        nv12_frame->buf[0] = av_buffer_pool_get(nv12_pool);
+        if (!nv12_frame->buf[0])
+            return NULL;
+        av_image_fill_arrays(nv12_frame->data, nv12_frame->linesize, nv12_frame->buf[0]->data,
+                             AV_PIX_FMT_NV12, frame->width, frame->height, 32);
+        nv12_frame->format = AV_PIX_FMT_NV12;
+        nv12_frame->width = frame->width;
+        nv12_frame->height = frame->height;
+        av_frame_copy_props(nv12_frame, frame);
+
+        sws_scale(sws_ctx, frame->data, frame->linesize, 0, frame->height, nv12_frame->data, nv12_frame->linesize);
+        return nv12_frame;
+    }
 
     static enum AVPixelFormat get_format(AVCodecContext *s, const enum AVPixelFormat *pix_fmts)
     {
@@ -72,6 +453,17 @@ private:
         return *p;
     }
 
+    // keep frames on the card when the decoder offers AXMM
+    static enum AVPixelFormat get_hw_format(AVCodecContext *s, const enum AVPixelFormat *pix_fmts)
+    {
+        for (const enum AVPixelFormat *p = pix_fmts; *p != AV_PIX_FMT_NONE; p++)
+        {
+            if (*p == AV_PIX_FMT_AXMM)
+                return *p;
+        }
+        return get_format(s, pix_fmts);
+    }
+
     int set_hwframe_ctx(AVCodecContext *ctx, AVBufferRef *hw_device_ctx, int width, int height)
     {
         AVBufferRef *hw_frames_ref = av_hwframe_ctx_alloc(hw_device_ctx);
@@ -86,7 +478,7 @@ private:
         frames_ctx->sw_format = AV_PIX_FMT_NV12;
         frames_ctx->width = width;
         frames_ctx->height = height;
-        frames_ctx->initial_pool_size = 20;
+        frames_ctx->initial_pool_size = hw_pool_size;
 
         int err = av_hwframe_ctx_init(hw_frames_ref);
         if (err < 0)
@@ -101,11 +493,223 @@ private:
         return 0;
     }
 
+    void func_th_demux()
+    {
+        AVPacket *pstAvPkt = av_packet_alloc();
+        if (!pstAvPkt)
+        {
+            SAMPLE_LOG_E("av_packet_alloc failed \n");
+            q_packets.Abort();
+            return;
+        }
+
+        AXTrace::SetThreadName("demux");
+        while (!loop_exit)
+        {
+            int ret;
+            arm_deadline();
+            {
+                AX_TRACE_SCOPE("demux");
+                ret = av_read_frame(pstAvFmtCtx, pstAvPkt);
+            }
+            io_deadline_us = 0;
+            if (ret < 0)
+            {
+                if (loop_exit)
+                    break;
+                bool eof = ret == AVERROR_EOF || (pstAvFmtCtx->pb && avio_feof(pstAvFmtCtx->pb));
+                if (eof)
+                    SAMPLE_LOG_I("demux reached EOF\n");
+                else
+                    SAMPLE_LOG_E("av_read_frame fail, error: %d", ret);
+
+                // 网络流的 EOF 也是断流
+                if (!is_network || !reconnect || !reopen_input())
+                    break;
+
+                // 新连接从关键帧开始，让解码线程丢掉旧的参考帧
+                av_packet_unref(pstAvPkt);
+                pstAvPkt->stream_index = DISCONTINUITY;
+                q_packets.Push(pstAvPkt);
+                continue;
+            }
+
+            // only queue packets for video stream
+            if (pstAvPkt->stream_index == s32VideoIndex)
+            {
+                // 重连后的时间基可能变了，统一换回第一次连接的
+                AVRational tb = pstAvFmtCtx->streams[s32VideoIndex]->time_base;
+                if (av_cmp_q(tb, in_time_base) != 0)
+                    av_packet_rescale_ts(pstAvPkt, tb, in_time_base);
+                if (m_packets)
+                    m_packets->Inc();
+                q_packets.Push(pstAvPkt);
+            }
+
+            av_packet_unref(pstAvPkt);
+        }
+
+        // decode thread drains what is left, then flushes the decoder
+        demux_done = true;
+        {
+            std::lock_guard<std::mutex> lock(mtx_demux_stats);
+            demux_stats.connected = false;
+        }
+        if (m_connected)
+            m_connected->Set(0);
+        q_packets.Abort();
+        av_packet_free(&pstAvPkt);
+        SAMPLE_LOG_I("demux thread exit\n");
+    }
+
+    // packets the decoder never needs to see in the current mode
+    bool skip_packet(const AVPacket *pkt) const
+    {
+        if (decode_mode == ax_decode_key)
+            return !(pkt->flags & AV_PKT_FLAG_KEY);
+        if (decode_mode == ax_decode_nonref)
+            return (pkt->flags & AV_PKT_FLAG_DISPOSABLE) != 0;
+        return false;
+    }
+
+    // pts based sampling of decoded frames, frames without a timestamp always pass
+    bool sample_due(const AVFrame *frame)
+    {
+        if (sample_interval <= 0 || frame->best_effort_timestamp == AV_NOPTS_VALUE)
+            return true;
+
+        double t = frame->best_effort_timestamp * av_q2d(in_time_base);
+        // 时间戳回退（文件循环、重连）时重新开始采样
+        if (next_sample_t < 0 || t < next_sample_t - 2 * sample_interval)
+        {
+            next_sample_t = t + sample_interval;
+            return true;
+        }
+        if (t + 1e-3 < next_sample_t)
+            return false;
+        // 落后太多时从当前帧重新对齐，不连续补帧
+        next_sample_t = t - next_sample_t > sample_interval ? t + sample_interval : next_sample_t + sample_interval;
+        return true;
+    }
+
+    // verify, sample, convert and hand one decoded frame to the callback
+    void deliver_frame(AVFrame *frame)
+    {
+        // 缓存参数不对时一帧都不送，下游是按缓存的尺寸建的
+        if (failed || (verify_pending && !verify_cached_info(frame)))
+        {
+            av_frame_unref(frame);
+            return;
+        }
+
+        if (!sample_due(frame))
+        {
+            frames_sampled_out++;
+            av_frame_unref(frame);
+            frame_num++;
+            return;
+        }
+
+        // 回调统一给 NV12，hw_mode 为 ax_hwframe_axmm 时是 AXMM 帧
+        AVFrame *out = frame;
+        if (frame->format != AV_PIX_FMT_NV12 && frame->format != AV_PIX_FMT_AXMM)
+        {
+            AX_TRACE_SCOPE("to_nv12", frame->pts);
+            out = NULL;
+            if (sws_isSupportedInput((AVPixelFormat)frame->format))
+                out = convert_to_nv12(frame);
+            if (!out)
+                SAMPLE_LOG_W("Frame format is %d, conversion to NV12 failed, frame skipped", frame->format);
+        }
+
+        if (out && frame_cb)
+        {
+            AX_TRACE_SCOPE("frame_cb", frame->pts);
+            frame_cb(out, user_data);
+        }
+        if (out && m_frames)
+            m_frames->Inc();
+        if (out && first_frame_us < 0)
+            first_frame_us = ax_now_us() - init_start_us;
+
+        av_frame_unref(frame);
+        if (out == nv12_frame)
+            av_frame_unref(nv12_frame);
+
+        frame_num++;
+    }
+
+    // receive until the decoder wants input (EAGAIN) or is done (EOF); returns that code,
+    // *received counts the frames taken out
+    int receive_frames(AVFrame *frame, int *received)
+    {
+        *received = 0;
+        while (true)
+        {
+            int64_t t0 = AXTrace::Enabled() ? ax_now_us() : 0;
+            int ret = avcodec_receive_frame(avctx, frame);
+            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+                return ret;
+            if (ret < 0)
+            {
+                SAMPLE_LOG_E("avcodec_receive_frame error: %d", ret);
+                return ret;
+            }
+            if (t0)
+                AXTrace::Record("receive_frame", t0, ax_now_us() - t0, frame->pts);
+            (*received)++;
+            deliver_frame(frame);
+        }
+    }
+
+    // send pkt without ever dropping it: while the decoder is full, drain its frames
+    // and resend the same packet. The time until it is accepted is the stall time
+    int send_packet(AVPacket *pkt, AVFrame *frame)
+    {
+        AX_TRACE_SCOPE("send_packet", pkt ? pkt->pts : -1);
+        int64_t t0 = ax_now_us();
+        int ret = avcodec_send_packet(avctx, pkt);
+        if (ret != AVERROR(EAGAIN))
+        {
+            if (m_send)
+                m_send->Observe(ax_now_us() - t0);
+            return ret;
+        }
+
+        uint64_t eagain = 0;
+        while (ret == AVERROR(EAGAIN) && !loop_exit)
+        {
+            eagain++;
+            if (m_eagain)
+                m_eagain->Inc();
+            int received = 0;
+            int rret = receive_frames(frame, &received);
+            if (rret < 0 && rret != AVERROR(EAGAIN))
+            {
+                ret = rret;
+                break;
+            }
+            // 异步硬解：输入满了但还没有帧可取，稍等硬件
+            if (received == 0)
+                std::this_thread::sleep_for(std::chrono::microseconds(500));
+            ret = avcodec_send_packet(avctx, pkt);
+        }
+
+        int64_t stall = ax_now_us() - t0;
+        if (m_send)
+            m_send->Observe(stall);
+        std::lock_guard<std::mutex> lock(mtx_decode_stats);
+        decode_stats.stalled_packets++;
+        decode_stats.send_eagain += eagain;
+        decode_stats.stall_us += stall;
+        decode_stats.max_stall_us = std::max(decode_stats.max_stall_us, stall);
+        return ret;
+    }
+
     void func_th_decode()
     {
         int ret;
         AVFrame *frame = NULL;
-        AVFrame *nv12_frame = NULL;
         AVPacket *pstAvPkt = NULL;
         frame = av_frame_alloc();
         if (!frame)
@@ -114,20 +718,6 @@ private:
             return;
         }
 
-        // frame->format = AV_PIX_FMT_NV12;
-        // frame->width = avctx->width;
-        // frame->height = avctx->height;
-
-        // // 注意这里对齐参数选得足够大（例如 256 或 512）
-        // ret = av_frame_get_buffer(frame, 1);
-
-        // if (!nv12_frame)
-        // {
-        //     SAMPLE_LOG_E("Can't allocate nv12 frame\n");
-        //     av_frame_free(&frame);
-        //     return;
-        // }
-
         pstAvPkt = av_packet_alloc();
         if (!pstAvPkt)
         {
@@ -136,30 +726,38 @@ private:
             return;
         }
 
-        while (!loop_exit)
+        AXTrace::SetThreadName("decode");
+        bool flushing = false;
+        while (!loop_exit && !flushing)
         {
-            ret = av_read_frame(pstAvFmtCtx, pstAvPkt);
-            if (ret < 0)
+            ret = q_packets.Pop(pstAvPkt);
+            if (ret == AVERROR_EOF)
             {
-                if (ret == AVERROR_EOF || avio_feof(pstAvFmtCtx->pb))
-                {
-                    // flush the decoder
-                    ret = avcodec_send_packet(avctx, NULL);
-                    if (ret < 0)
-                        SAMPLE_LOG_E("avcodec_send_packet(NULL) failed: %d", ret);
-                    break;
-                }
-                else
-                {
-                    SAMPLE_LOG_E("av_read_frame fail, error: %d", ret);
-                    break;
-                }
+                // flush the decoder
+                flushing = true;
+                ret = send_packet(NULL, frame);
+                if (ret < 0)
+                    SAMPLE_LOG_E("avcodec_send_packet(NULL) failed: %d", ret);
+            }
+            else if (pstAvPkt->stream_index == DISCONTINUITY)
+            {
+                // 重连：保留解码器，只清掉内部缓存的帧
+                avcodec_flush_buffers(avctx);
+                next_sample_t = -1;
+                av_packet_unref(pstAvPkt);
+                continue;
             }
             else
             {
-                // only send packets for video stream
-                if (pstAvPkt->stream_index != s32VideoIndex)
+                // 转发原始码流的输出在这里拿包，跳帧模式也不影响它
+                if (packet_tap)
+                    packet_tap(pstAvPkt);
+
+                if (skip_packet(pstAvPkt))
                 {
+                    packets_skipped++;
+                    if (m_skipped)
+                        m_skipped->Inc();
                     av_packet_unref(pstAvPkt);
                     continue;
                 }
@@ -167,90 +765,52 @@ private:
                 avctx->codec_type = AVMEDIA_TYPE_VIDEO;
                 avctx->codec_id = eCodecID;
 
-                ret = avcodec_send_packet(avctx, pstAvPkt);
-                if (ret == AVERROR(EAGAIN))
+                if (verify_pending && ++verify_packets > VERIFY_MAX_PACKETS && !verify_cached_info(NULL))
                 {
-                    SAMPLE_LOG_E("avcodec_send_packet EAGAIN\n");
                     av_packet_unref(pstAvPkt);
-                    continue;
+                    break;
                 }
-                else if (ret == AVERROR_EOF)
-                {
+
+                ret = send_packet(pstAvPkt, frame);
+                if (ret == AVERROR_EOF)
                     SAMPLE_LOG_I("decoder returned EOF on send_packet\n");
+                else if (ret < 0 && ret != AVERROR(EAGAIN))
+                {
+                    // 坏包：解码器不收就丢掉，不影响后面的包
+                    std::lock_guard<std::mutex> lock(mtx_decode_stats);
+                    decode_stats.send_errors++;
+                    ret = 0;
                 }
 
                 av_packet_unref(pstAvPkt);
             }
 
-            while (ret >= 0)
+            if (flushing)
             {
-                ret = avcodec_receive_frame(avctx, frame);
-                if (ret == AVERROR(EAGAIN))
-                {
-                    // SAMPLE_LOG_E("avcodec_receive_frame EAGAIN\n");
-                    break; // need more input
-                }
-                else if (ret == AVERROR_EOF)
-                {
-                    // SAMPLE_LOG_I("decoder returned EOF on receive_frame\n");
-                    break;
-                }
-                else if (ret < 0)
-                {
-                    SAMPLE_LOG_E("avcodec_receive_frame error: %d", ret);
-                    break;
-                }
-
-                // printf("avcodec_receive_frame success, frame_num: %d, width: %d, height: %d, format: %d\n", frame_num, frame->width, frame->height, frame->format);
-
-                // Copy Y and UV (assume NV12 layout)
-                if (frame->format == AV_PIX_FMT_NV12 || frame->format == AV_PIX_FMT_NV21 || frame->format == AV_PIX_FMT_YUV420P)
+                // after flushing keep receiving until the decoder reports EOF; an async
+                // hardware decoder answers EAGAIN while its last frames are still in flight
+                while (!loop_exit)
                 {
-                    if (frame_cb)
-                    {
-                        frame_cb(frame, user_data);
-                        // sws_freeContext(sws_ctx);
-                    }
-
-                    // std::lock_guard<std::mutex> lock(mtx_nv12_frame_data);
-
-                    // // Ensure buffer is large enough
-                    // size_t expected = static_cast<size_t>(avctx->width) * avctx->height * 3 / 2;
-                    // if (nv12_frame_data.size() < expected)
-                    //     nv12_frame_data.resize(expected);
-
-                    // unsigned char *p_lu = frame->data[0];
-                    // for (int i = 0; i < frame->height; i++)
-                    // {
-                    //     memcpy(nv12_frame_data.data() + i * frame->width, p_lu, frame->width);
-                    //     p_lu += frame->linesize[0];
-                    // }
-
-                    // unsigned char *p_ch = frame->data[1];
-                    // for (int i = 0; i < frame->height / 2; i++)
-                    // {
-                    //     memcpy(nv12_frame_data.data() + frame->width * frame->height + i * frame->width, p_ch, frame->width);
-                    //     p_ch += frame->linesize[1];
-                    // }
+                    int received = 0;
+                    int rret = receive_frames(frame, &received);
+                    if (rret != AVERROR(EAGAIN))
+                        break;
+                    if (received == 0)
+                        std::this_thread::sleep_for(std::chrono::microseconds(500));
                 }
-                else
-                {
-                    // If HW frame or other format, you may want to convert to NV12 here (not implemented)
-                    SAMPLE_LOG_W("Frame format is %d, copying skipped (conversion not implemented)", frame->format);
-                }
-
-                av_frame_unref(frame);
-
-                frame_num++;
+            }
+            else if (ret >= 0)
+            {
+                int received = 0;
+                receive_frames(frame, &received);
             }
         }
 
         av_frame_free(&frame);
         frame = NULL;
-        av_frame_free(&nv12_frame);
-        nv12_frame = NULL;
         av_packet_free(&pstAvPkt);
         pstAvPkt = NULL;
+        decode_done = true;
         SAMPLE_LOG_I("thread exit\n");
     }
 
@@ -263,8 +823,12 @@ public:
 
     // url can be an RTSP url (rtsp://...) or a local file path
     // device_id is optional and used when using a hardware child card decoder ("d" option)
-    int Init(const std::string input, AXFFmpegCodecID codec_type, int device_id = 0)
+    // backend ax_codec_backend_sw decodes with the stock libavcodec decoder on the host, device_id is ignored
+    int Init(const std::string input, AXFFmpegCodecID codec_type, int device_id = 0,
+             AXCodecBackend _backend = ax_codec_backend_axcl)
     {
+        backend = _backend;
+
         // choose decoder mode
         if (codec_type == AXFFmpegCodecID::h264_ax)
         {
@@ -285,56 +849,33 @@ public:
         snprintf(device_index, sizeof(device_index), "%d", device_id);
         SAMPLE_LOG_I("Init decoder %s, device_id %s, input=%s\n", codec_names[0] ? codec_names : "auto", device_index, input.c_str());
 
-        pstAvFmtCtx = avformat_alloc_context();
-        if (!pstAvFmtCtx)
-        {
-            SAMPLE_LOG_E("avformat_alloc_context() failed!");
-            return AVERROR(ENOMEM);
-        }
-
-        // If url looks like rtsp, set some helpful input options (use tcp, set timeout)
-        if (input.rfind("rtsp://", 0) == 0)
-        {
-            av_dict_set(&input_opts, "rtsp_transport", "tcp", 0);
-            av_dict_set(&input_opts, "stimeout", "5000000", 0); // microseconds
-            av_dict_set(&input_opts, "max_delay", "500000", 0);
-        }
-
-        int ret = avformat_open_input(&pstAvFmtCtx, input.c_str(), NULL, &input_opts);
-        if (ret < 0)
-        {
-            AX_CHAR szError[128] = {0};
-            av_strerror(ret, szError, sizeof(szError));
-            SAMPLE_LOG_E("open %s fail, error: %d, %s", input.c_str(), ret, szError);
-            av_dict_free(&input_opts);
-            return -1;
-        }
-        av_dict_free(&input_opts);
+        input_url = input;
+        // 本地文件以外的都按网络流处理，断了会重连
+        is_network = input.find("://") != std::string::npos && input.rfind("file:", 0) != 0;
+        loop_exit = 0;
+        failed = false;
+        init_start_us = ax_now_us();
+        first_frame_us = -1;
 
-        ret = avformat_find_stream_info(pstAvFmtCtx, NULL);
+        int ret = open_input();
         if (ret < 0)
+            return ret;
+        demux_stats.connected = true;
+        if (m_connected)
+            m_connected->Set(1);
+        startup.cached = opened_from_cache;
+        startup.open_us = last_open_us;
+        startup.probe_us = last_probe_us;
+
+        AVStream *st = pstAvFmtCtx->streams[s32VideoIndex];
+        origin_par = avcodec_parameters_alloc();
+        if (!origin_par || avcodec_parameters_copy(origin_par, st->codecpar) < 0)
         {
-            SAMPLE_LOG_E("avformat_find_stream_info fail, error = %d", ret);
-            return -1;
-        }
-
-        s32VideoIndex = -1;
-        for (int i = 0; i < (int)pstAvFmtCtx->nb_streams; i++)
-        {
-            if (AVMEDIA_TYPE_VIDEO == pstAvFmtCtx->streams[i]->codecpar->codec_type)
-            {
-                s32VideoIndex = i;
-                break;
-            }
-        }
-
-        if (s32VideoIndex < 0)
-        {
-            SAMPLE_LOG_E("No video stream found");
-            return -1;
+            SAMPLE_LOG_E("copying the codec parameters failed");
+            return AVERROR(ENOMEM);
         }
-
-        origin_par = pstAvFmtCtx->streams[s32VideoIndex]->codecpar;
+        in_time_base = st->time_base;
+        in_frame_rate = st->avg_frame_rate.num > 0 ? st->avg_frame_rate : st->r_frame_rate;
 
         // If user requested auto_decoder, let FFmpeg pick based on codec id
         if (codec_type == AXFFmpegCodecID::auto_ax)
@@ -356,14 +897,32 @@ public:
             }
         }
 
-        // try to find special hw child card decoder by name first
-        codec = avcodec_find_decoder_by_name(codec_names);
-        if (!codec)
+        if (backend == ax_codec_backend_sw)
         {
-            SAMPLE_LOG_E("avcodec_find_decoder_by_name failed\n");
-            return -1;
+            // 软解：用 ffmpeg 自带的 h264 / hevc 解码器
+            codec = avcodec_find_decoder(eCodecID);
+            if (!codec)
+            {
+                SAMPLE_LOG_E("avcodec_find_decoder(%d) failed\n", eCodecID);
+                return -1;
+            }
+            snprintf(codec_names, sizeof(codec_names), "%s", codec->name);
+        }
+        else
+        {
+            // try to find special hw child card decoder by name first
+            codec = avcodec_find_decoder_by_name(codec_names);
+            if (!codec)
+            {
+                SAMPLE_LOG_E("avcodec_find_decoder_by_name failed\n");
+                return -1;
+            }
         }
 
+        nv12_frame = av_frame_alloc();
+        if (!nv12_frame)
+            return AVERROR(ENOMEM);
+
         avctx = avcodec_alloc_context3(codec);
         if (!avctx)
         {
@@ -380,19 +939,28 @@ public:
         }
 
         // Configure threads and limits
-        avctx->thread_count = 2;
-        avctx->thread_type = FF_THREAD_FRAME;
         avctx->debug = 0;
-        avctx->max_pixels = avctx->width * avctx->height * 3 / 2;
-        avctx->get_format = get_format;
-        avctx->pix_fmt = AV_PIX_FMT_AXMM;
+        if (backend == ax_codec_backend_sw)
+        {
+            // 0: libavcodec picks the thread count from the cpu count
+            avctx->thread_count = 0;
+            avctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+        }
+        else
+        {
+            avctx->thread_count = 2;
+            avctx->thread_type = FF_THREAD_FRAME;
+            avctx->max_pixels = avctx->width * avctx->height * 3 / 2;
+            avctx->get_format = hw_mode == ax_hwframe_axmm ? get_hw_format : get_format;
+            avctx->pix_fmt = AV_PIX_FMT_AXMM;
 
-        // Setup codec options. If using hardware child card, set device index
-        // codec_opts = (AVDictionary *)malloc(sizeof(AVDictionary *));
+            // Setup codec options. If using hardware child card, set device index
+            // codec_opts = (AVDictionary *)malloc(sizeof(AVDictionary *));
 
-        av_dict_set(&codec_opts, "d", device_index, 0);
+            av_dict_set(&codec_opts, "d", device_index, 0);
+        }
 
-        if (0)
+        if (backend == ax_codec_backend_axcl && hw_mode == ax_hwframe_axmm)
         { // 硬件上下文
             AVDictionary *dict = nullptr;
             char value[8];
@@ -426,6 +994,12 @@ public:
             }
         }
 
+        // 不支持 skip_frame 的解码器也没关系，skip_packet 已经在送解码前丢掉了
+        if (decode_mode == ax_decode_key)
+            avctx->skip_frame = AVDISCARD_NONKEY;
+        else if (decode_mode == ax_decode_nonref)
+            avctx->skip_frame = AVDISCARD_NONREF;
+
         // open codec
         ret = avcodec_open2(avctx, codec, &codec_opts);
         if (ret < 0)
@@ -446,20 +1020,139 @@ public:
         return 0;
     }
 
+    // where decoded frames are delivered, must be called before Init. With ax_hwframe_axmm
+    // the callback gets AXMM surfaces from a pool of pool_size frames; every frame the
+    // caller still references (encoder queue, delay line) holds one of them
+    void SetHwFrames(AXHwFrameMode mode, int pool_size = 20)
+    {
+        hw_mode = mode;
+        hw_pool_size = pool_size;
+    }
+
+    // frames context of the AXMM surfaces, NULL unless hw frames are on
+    AVBufferRef *GetHwFramesCtx() const
+    {
+        return avctx ? avctx->hw_frames_ctx : NULL;
+    }
+
+    // decode only what inference consumes, must be called before Init.
+    // sample_fps > 0 additionally delivers at most that many frames per second of stream time
+    void SetDecodeMode(AXDecodeMode mode, double sample_fps = 0)
+    {
+        decode_mode = mode;
+        sample_interval = sample_fps > 0 ? 1.0 / sample_fps : 0;
+        next_sample_t = -1;
+    }
+
+    // a consistent snapshot, safe to call from any thread while decoding
+    AXDecodeStats GetDecodeStats()
+    {
+        std::lock_guard<std::mutex> lock(mtx_decode_stats);
+        return decode_stats;
+    }
+
+    // packets dropped before the decoder, decoded frames dropped by sampling
+    unsigned long long GetSkippedPackets() const { return packets_skipped; }
+    unsigned long long GetSampledOutFrames() const { return frames_sampled_out; }
+
+    // packet queue between demux and decode, must be called before Start
+    void SetPacketQueueSize(int size)
+    {
+        packet_queue_size = size;
+    }
+
+    // open inputs with the codec parameters cached for their url and skip probing;
+    // inputs without an entry are probed as usual and added. Shared by all decoders
+    // of a process, must outlive them; call before Init, nullptr turns it off
+    void SetStreamInfoCache(AXStreamInfoCache *cache)
+    {
+        info_cache = cache;
+    }
+
+    // time spent opening and probing the input, and Init to first delivered frame
+    AXStartupStats GetStartupStats() const
+    {
+        AXStartupStats s = startup;
+        s.first_frame_us = first_frame_us;
+        return s;
+    }
+
+    // reconnect network inputs when they drop, io_timeout_ms bounds every blocking
+    // open/read so a dead peer is noticed and Deinit never waits on the network;
+    // must be called before Init
+    void SetReconnect(bool enable, int _io_timeout_ms = 5000, int _max_backoff_ms = 5000)
+    {
+        reconnect = enable;
+        io_timeout_ms = _io_timeout_ms > 0 ? _io_timeout_ms : 5000;
+        max_backoff_ms = _max_backoff_ms > 100 ? _max_backoff_ms : 100;
+    }
+
+    AXDemuxStats GetDemuxStats()
+    {
+        std::lock_guard<std::mutex> lock(mtx_demux_stats);
+        AXDemuxStats s = demux_stats;
+        if (outage_start_us > 0)
+            s.downtime_us += ax_now_us() - outage_start_us;
+        return s;
+    }
+
+    // publish this decoder in AXMetrics under labels (e.g. stream="3"); decoders given
+    // the same labels share their series. Must be called before Init
+    void SetMetricsLabels(const std::string &labels)
+    {
+        AXMetrics &m = AXMetrics::Get();
+        m_packets = m.Counter("axcl_demux_packets_total", "Video packets read from the input", labels);
+        m_frames = m.Counter("axcl_decode_frames_total", "Decoded frames delivered to the pipeline", labels);
+        m_skipped = m.Counter("axcl_decode_skipped_packets_total", "Packets not decoded because of the decode mode", labels);
+        m_eagain = m.Counter("axcl_decode_eagain_total", "EAGAIN returned by avcodec_send_packet", labels);
+        m_reconnects = m.Counter("axcl_input_reconnects_total", "Successful reconnects of the input", labels);
+        m_connected = m.Gauge("axcl_input_connected", "1 while the input is connected", labels);
+        m_queue_depth = m.Gauge("axcl_packet_queue_depth", "Packets waiting between demux and decode", labels);
+        m_send = m.Histogram("axcl_decode_send_seconds", "avcodec_send_packet latency including backpressure", labels);
+    }
+
+    // every video packet, before skipping and decoding; must be called before Start
+    void SetPacketTap(AXPacketCallback tap)
+    {
+        packet_tap = tap;
+    }
+
+    // video stream as opened by Init, for muxing its packets unchanged; stays valid
+    // across reconnects, packets of every connection are in GetTimeBase units
+    const AVCodecParameters *GetCodecParameters() const { return origin_par; }
+    AVRational GetTimeBase() const { return in_time_base; }
+    AVRational GetFrameRate() const { return in_frame_rate; }
+
+    // input ended for good (file EOF, reconnect off or given up) and every frame was delivered,
+    // or the stream stopped on an error
+    bool IsFinished() const { return demux_done && decode_done; }
+
+    // stopped because the input does not decode as the cached parameters promised
+    bool IsFailed() const { return failed; }
+
     void Start(AXFrameCallback _frame_cb, void *_user_data = nullptr)
     {
         frame_cb = _frame_cb;
         user_data = _user_data;
 
         loop_exit = 0;
-
-        // start decode thread
+        demux_done = false;
+        decode_done = false;
+        q_packets.Reset();
+        q_packets.Config(packet_queue_size, ax_overflow_block);
+        q_packets.SetMetrics(m_queue_depth, nullptr);
+
+        // start demux and decode thread
+        th_demux = std::thread(&AXFFmpegDecoder::func_th_demux, this);
         th_decode = std::thread(&AXFFmpegDecoder::func_th_decode, this);
     }
 
     void Deinit()
     {
         loop_exit = 1;
+        q_packets.Abort();
+        if (th_demux.joinable())
+            th_demux.join();
         if (th_decode.joinable())
             th_decode.join();
 
@@ -474,9 +1167,21 @@ public:
             avformat_close_input(&pstAvFmtCtx);
             pstAvFmtCtx = NULL;
         }
+        avcodec_parameters_free(&origin_par);
 
         if (hw_device_ctx)
             av_buffer_unref(&hw_device_ctx);
+
+        if (nv12_frame)
+            av_frame_free(&nv12_frame);
+        // 已送出的 NV12 缓冲还挂着引用时，池子会等最后一个归还后才真正释放
+        av_buffer_pool_uninit(&nv12_pool);
+        nv12_pool_size = 0;
+        if (sws_ctx)
+        {
+            sws_freeContext(sws_ctx);
+            sws_ctx = nullptr;
+        }
     }
 
     // Pull latest NV12 frame into user buffer (must be large enough)
@@ -489,8 +1194,15 @@ public:
 
     unsigned long long GetFrameCount() const { return frame_num; }
 
+    // depth and wait time of the demux -> decode packet queue
+    // push_wait_us: demux blocked by a slow decoder, pop_wait_us: decoder starved by the network
+    AXQueueStats GetPacketQueueStats() { return q_packets.GetStats(); }
+
+    AXCodecBackend GetBackend() const { return backend; }
+
     int GetWidth() const { return avctx->width; }
     int GetHeight() const { return avctx->height; }
 
-    float GetFps() const { return avctx->framerate.num / avctx->framerate.den; }
+    // 29.97 stays 29.97, 0 when the stream does not say
+    float GetFps() const { return avctx->framerate.num > 0 && avctx->framerate.den > 0 ? av_q2d(avctx->framerate) : 0; }
 };
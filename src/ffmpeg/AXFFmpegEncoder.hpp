@@ -2,7 +2,10 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <atomic>
 #include <string>
+#include <thread>
+#include <vector>
 #include <unistd.h>
 
 extern "C"
@@ -13,19 +16,79 @@ extern "C"
 #include "libavutil/opt.h"
 #include "libavutil/pixdesc.h"
 #include "libavutil/imgutils.h"
+#include "libswscale/swscale.h"
 }
 
 #include "utils/def.h"
+#include "utils/timer.hpp"
+#include "utils/trace.hpp"
+#include "utils/metrics.hpp"
+#include "AXFFmpegQueue.hpp"
+
+struct AXEncoderStats
+{
+    uint64_t frames = 0;
+    uint64_t packets = 0;
+    int64_t upload_us = 0; // host to device copy (mapped or transferred)
+    int64_t encode_us = 0; // avcodec_send_frame + avcodec_receive_packet
+    int64_t mux_us = 0;    // av_interleaved_write_frame
+    uint64_t bytes_copied = 0;   // host side bytes copied for uploads, 1x frame size when mapped
+    uint64_t mapped_uploads = 0; // uploads written straight into a mapped surface
+    uint64_t surface_frames = 0; // frames sent as they are, no upload or conversion
+    uint64_t allocs = 0;         // pool frames, their buffers and the packet; must stay flat once warmed up
+    int pool_frames = 0;         // frames in the upload / conversion pool
+    AXQueueStats queue;    // only filled in when the worker is running
+};
+
+// the counters behind AXEncoderStats; written on the encode thread, GetStats reads them from any thread
+struct AXEncoderCounters
+{
+    std::atomic<uint64_t> frames{0};
+    std::atomic<uint64_t> packets{0};
+    std::atomic<int64_t> upload_us{0};
+    std::atomic<int64_t> encode_us{0};
+    std::atomic<int64_t> mux_us{0};
+    std::atomic<uint64_t> bytes_copied{0};
+    std::atomic<uint64_t> mapped_uploads{0};
+    std::atomic<uint64_t> surface_frames{0};
+    std::atomic<uint64_t> allocs{0};
+    std::atomic<int> pool_frames{0};
+};
 
 class AXFFmpegEncoder
 {
 private:
-    AVFrame *hw_frame = nullptr, *sw_frame = nullptr;
+    AVFrame *sw_frame = nullptr; // linesize 对齐用的中转帧，只在映射不可用时使用
+    AVFrame *map_frame = nullptr; // 映射出来的 surface 主机视图
+    bool map_unsupported = false;
     AVCodecContext *avctx = nullptr;
     const AVCodec *codec = nullptr;
     char *enc_name = (char *)"h264_axenc";
     AVDictionary *dict = nullptr;
     AVBufferRef *hw_device_ctx = nullptr;
+    AXCodecBackend backend = ax_codec_backend_axcl;
+    // 解码器的 AXMM 帧池，设置后编码器直接吃解码出来的帧
+    AVBufferRef *ext_frames_ctx = nullptr;
+    // ax_hwframe_emulated：软编能直接收的主机帧当作 surface，走同一个分支
+    bool emulated_surfaces = false;
+
+    // 软编：NV12 直接送编码器，编码器不支持 NV12 时转换到池子里的帧
+    AVFrame *enc_frame = nullptr;
+    SwsContext *sws_ctx = nullptr;
+
+    // 主机帧尺寸和编码尺寸不同时（缩小的预览输出）先缩放，在编码线程上做
+    AVFrame *scaled = nullptr;
+    SwsContext *scale_ctx = nullptr;
+    AVPixelFormat sw_convert_fmt = AV_PIX_FMT_NONE;
+
+    // 送给 avcodec_send_frame 的帧池：卡上编码是 AXMM surface，软编是转换后的帧。
+    // 编码器还持有引用的帧不可写，挑一个可写的用，编码器就能提前收下一帧
+    std::vector<AVFrame *> frame_pool;
+    int frame_pool_size = DEFAULT_FRAME_POOL;
+    int enc_width = 0, enc_height = 0;
+    bool pool_grow_logged = false;
+
+    AVPacket *pkt = nullptr; // 所有输出包复用
 
     // 输出
     AVFormatContext *ofmt_ctx = nullptr;
@@ -35,6 +98,22 @@ private:
 
     int64_t encode_pts = 0;
 
+    // 编码线程，把编码和推流从解码线程剥离
+    std::thread th_encode;
+    AXFFmpegQueue<AVFrame> q_frames;
+
+    AXEncoderCounters stats;
+    AXPacketCallback packet_tap = nullptr;
+
+    // nullptr until SetMetricsLabels
+    AXCounter *m_frames = nullptr;
+    AXCounter *m_packets = nullptr;
+    AXCounter *m_dropped = nullptr;
+    AXGauge *m_queue_depth = nullptr;
+    AXHistogram *m_upload = nullptr;
+    AXHistogram *m_encode = nullptr;
+    AXHistogram *m_mux = nullptr;
+
     int set_hwframe_ctx(AVCodecContext *ctx, AVBufferRef *hw_device_ctx, int width, int height)
     {
         AVBufferRef *hw_frames_ref = av_hwframe_ctx_alloc(hw_device_ctx);
@@ -93,11 +172,340 @@ private:
         return sw_frame;
     }
 
+    static uint64_t nv12_bytes(const AVFrame *frame)
+    {
+        int size = av_image_get_buffer_size(AV_PIX_FMT_NV12, frame->width, frame->height, 1);
+        return size > 0 ? (uint64_t)size : 0;
+    }
+
+    AVFrame *alloc_pool_frame()
+    {
+        AVFrame *f = av_frame_alloc();
+        if (!f)
+            return nullptr;
+        int err;
+        if (backend == ax_codec_backend_axcl)
+        {
+            err = av_hwframe_get_buffer(avctx->hw_frames_ctx, f, 0);
+        }
+        else
+        {
+            f->format = sw_convert_fmt;
+            f->width = enc_width;
+            f->height = enc_height;
+            err = av_frame_get_buffer(f, 0);
+        }
+        if (err < 0)
+        {
+            fprintf(stderr, "Failed to allocate pool frame: %d\n", err);
+            av_frame_free(&f);
+            return nullptr;
+        }
+        stats.allocs += 2;
+        frame_pool.push_back(f);
+        stats.pool_frames = (int)frame_pool.size();
+        return f;
+    }
+
+    // a pool frame the encoder no longer references, the pool grows when all are in flight
+    AVFrame *acquire_frame()
+    {
+        for (AVFrame *f : frame_pool)
+        {
+            if (av_buffer_is_writable(f->buf[0]))
+                return f;
+        }
+        if (!pool_grow_logged)
+        {
+            fprintf(stderr, "encoder frame pool of %d exhausted, growing\n", (int)frame_pool.size());
+            pool_grow_logged = true;
+        }
+        return alloc_pool_frame();
+    }
+
+    // frames sent to the encoder as they are: AXMM surfaces, and with emulated hw frames
+    // host NV12 frames of the encoded size that the software encoder takes without conversion
+    bool is_surface(const AVFrame *frame) const
+    {
+        if (frame->format == AV_PIX_FMT_AXMM)
+            return true;
+        return emulated_surfaces && backend == ax_codec_backend_sw && sw_convert_fmt == AV_PIX_FMT_NONE &&
+               frame->format == AV_PIX_FMT_NV12 && frame->width == enc_width && frame->height == enc_height;
+    }
+
+    // host NV12 -> surface with one copy: map the surface for writing and copy the
+    // planes from their own strides. Drivers that can not map take the old path,
+    // which needs a second copy when the strides differ.
+    int upload(AVFrame *frame, AVFrame *hw_frame)
+    {
+        if (!map_unsupported)
+        {
+            map_frame->format = AV_PIX_FMT_NV12;
+            int err = av_hwframe_map(map_frame, hw_frame, AV_HWFRAME_MAP_WRITE | AV_HWFRAME_MAP_OVERWRITE);
+            if (err == 0)
+            {
+                av_image_copy(map_frame->data, map_frame->linesize,
+                              (const uint8_t **)frame->data, frame->linesize,
+                              AV_PIX_FMT_NV12, frame->width, frame->height);
+                av_frame_unref(map_frame);
+                stats.bytes_copied += nv12_bytes(frame);
+                stats.mapped_uploads++;
+                return 0;
+            }
+            av_frame_unref(map_frame);
+            map_unsupported = true;
+            fprintf(stderr, "av_hwframe_map not supported (%d), uploading with av_hwframe_transfer_data\n", err);
+        }
+
+        auto fixed = match_linesize_and_copy(frame, hw_frame);
+        int err = av_hwframe_transfer_data(hw_frame, fixed, 0);
+        if (err < 0)
+        {
+            fprintf(stderr, "Error transferring frame data: %d\n", err);
+            return -1;
+        }
+        stats.bytes_copied += nv12_bytes(frame) * (fixed == frame ? 1 : 2);
+        return 0;
+    }
+
+    // 输出上下文和视频流，codecpar 在 write_header 里从打开的编码器拿
+    int open_output(const std::string &url)
+    {
+        // ---------------- 输出初始化 ----------------
+        if (is_rtsp)
+        {
+            avformat_alloc_output_context2(&ofmt_ctx, NULL, "rtsp", url.c_str());
+        }
+        else
+        {
+            avformat_alloc_output_context2(&ofmt_ctx, NULL, NULL, url.c_str());
+        }
+        if (!ofmt_ctx)
+        {
+            fprintf(stderr, "Could not allocate output context\n");
+            return -1;
+        }
+
+        out_stream = avformat_new_stream(ofmt_ctx, NULL);
+        if (!out_stream)
+        {
+            fprintf(stderr, "Failed to create output stream\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    int write_header(const std::string &url)
+    {
+        int err;
+        avcodec_parameters_from_context(out_stream->codecpar, avctx);
+        out_stream->time_base = avctx->time_base;
+
+        if (is_rtsp)
+        {
+            av_dict_set(&dict, "rtsp_transport", "tcp", 0);
+            av_dict_set(&dict, "muxdelay", "0.1", 0);
+        }
+
+        // 打开输出
+        if (!(ofmt_ctx->oformat->flags & AVFMT_NOFILE))
+        {
+            if ((err = avio_open(&ofmt_ctx->pb, url.c_str(), AVIO_FLAG_WRITE)) < 0)
+            {
+                fprintf(stderr, "Failed to open output file: %d\n", err);
+                return -1;
+            }
+        }
+
+        if ((err = avformat_write_header(ofmt_ctx, &dict)) < 0)
+        {
+            fprintf(stderr, "Error occurred when writing header: %d\n", err);
+            return -1;
+        }
+        return 0;
+    }
+
+    int init_sw(const std::string &url, AXFFmpegCodecID codec_id, int width, int height, int fps)
+    {
+        const char *names[2] = {codec_id == hevc_ax ? "libx265" : "libx264", "mpeg4"};
+        for (const char *name : names)
+        {
+            codec = avcodec_find_encoder_by_name(name);
+            if (codec)
+            {
+                enc_name = (char *)name;
+                break;
+            }
+            fprintf(stderr, "Could not find encoder: %s\n", name);
+        }
+        if (!codec)
+            return -1;
+
+        avctx = avcodec_alloc_context3(codec);
+        if (!avctx)
+        {
+            fprintf(stderr, "Failed to alloc codec context\n");
+            return -1;
+        }
+
+        // 编码器支持 NV12 就直接送解码出来的帧，否则转 YUV420P
+        AVPixelFormat pix_fmt = AV_PIX_FMT_YUV420P;
+        const void *cfg = nullptr;
+        avcodec_get_supported_config(avctx, codec, AV_CODEC_CONFIG_PIX_FORMAT, 0, &cfg, nullptr);
+        for (const AVPixelFormat *p = (const AVPixelFormat *)cfg; p && *p != AV_PIX_FMT_NONE; p++)
+        {
+            if (*p == AV_PIX_FMT_NV12)
+            {
+                pix_fmt = AV_PIX_FMT_NV12;
+                break;
+            }
+        }
+
+        avctx->width = width;
+        avctx->height = height;
+        avctx->time_base = {1, fps};
+        avctx->framerate = {fps, 1};
+        avctx->sample_aspect_ratio = {1, 1};
+        avctx->pix_fmt = pix_fmt;
+        avctx->bit_rate = width * height;
+        avctx->gop_size = fps;
+        avctx->max_b_frames = 0; // 与硬编一致，不引入 B 帧延迟
+        avctx->thread_count = 0;
+        if (codec->id == AV_CODEC_ID_H264 || codec->id == AV_CODEC_ID_HEVC)
+        {
+            av_opt_set(avctx->priv_data, "preset", "veryfast", 0);
+            av_opt_set(avctx->priv_data, "tune", "zerolatency", 0);
+        }
+
+        int err;
+        if (!url.empty() && (err = open_output(url)) < 0)
+            return err;
+        // mp4 等容器要求 extradata 里的参数集；没有自己的输出时包给别的 muxer，一律放 extradata
+        if (!ofmt_ctx || (ofmt_ctx->oformat->flags & AVFMT_GLOBALHEADER))
+            avctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+        if ((err = avcodec_open2(avctx, codec, nullptr)) < 0)
+        {
+            fprintf(stderr, "Cannot open encoder %s: %d\n", enc_name, err);
+            return -1;
+        }
+
+        if (ofmt_ctx && (err = write_header(url)) < 0)
+            return err;
+
+        enc_frame = av_frame_alloc();
+        if (!enc_frame)
+            return AVERROR(ENOMEM);
+
+        pkt = av_packet_alloc();
+        if (!pkt)
+            return AVERROR(ENOMEM);
+        stats.allocs++;
+
+        enc_width = width;
+        enc_height = height;
+        if (pix_fmt != AV_PIX_FMT_NV12)
+        {
+            sw_convert_fmt = pix_fmt;
+            for (int i = 0; i < frame_pool_size; i++)
+            {
+                if (!alloc_pool_frame())
+                    return AVERROR(ENOMEM);
+            }
+        }
+
+        printf("Encoder %s (software, %s) initialized for %s output.\n", enc_name,
+               av_get_pix_fmt_name(pix_fmt), url.empty() ? "shared" : is_rtsp ? "RTSP" : "File");
+        return 0;
+    }
+
+    // host NV12 frame -> NV12 of the encoder size, frame itself when the size matches
+    AVFrame *scale_host(AVFrame *frame)
+    {
+        if (frame->width == enc_width && frame->height == enc_height)
+            return frame;
+        // 编码器可能还引用着上一帧的缓冲
+        if (scaled->buf[0] && !av_buffer_is_writable(scaled->buf[0]))
+            av_frame_unref(scaled);
+        if (!scaled->buf[0])
+        {
+            scaled->format = AV_PIX_FMT_NV12;
+            scaled->width = enc_width;
+            scaled->height = enc_height;
+            if (av_frame_get_buffer(scaled, 0) < 0)
+                return nullptr;
+            stats.allocs++;
+        }
+        scale_ctx = sws_getCachedContext(scale_ctx, frame->width, frame->height, (AVPixelFormat)frame->format,
+                                         enc_width, enc_height, AV_PIX_FMT_NV12, SWS_BILINEAR, NULL, NULL, NULL);
+        if (!scale_ctx)
+            return nullptr;
+        sws_scale(scale_ctx, frame->data, frame->linesize, 0, frame->height, scaled->data, scaled->linesize);
+        av_frame_copy_props(scaled, frame);
+        return scaled;
+    }
+
+    // NV12 frame -> what the software encoder takes, returns the frame to send
+    AVFrame *prepare_sw_frame(AVFrame *frame)
+    {
+        if (sw_convert_fmt == AV_PIX_FMT_NONE)
+        {
+            // 只挂一个引用，改 pts 不影响调用方的帧
+            if (av_frame_ref(enc_frame, frame) < 0)
+                return nullptr;
+            return enc_frame;
+        }
+
+        // 编码器可能还持有之前几帧的引用
+        AVFrame *conv = acquire_frame();
+        if (!conv)
+            return nullptr;
+        sws_ctx = sws_getCachedContext(sws_ctx, frame->width, frame->height, (AVPixelFormat)frame->format,
+                                       conv->width, conv->height, (AVPixelFormat)conv->format,
+                                       SWS_BILINEAR, NULL, NULL, NULL);
+        if (!sws_ctx)
+            return nullptr;
+        sws_scale(sws_ctx, frame->data, frame->linesize, 0, frame->height, conv->data, conv->linesize);
+        stats.bytes_copied += nv12_bytes(frame);
+        return conv;
+    }
+
 public:
+    // frames in the pool unless SetFramePool is called
+    static const int DEFAULT_FRAME_POOL = 4;
+
     AXFFmpegEncoder() = default;
 
+    // frames the encoder may hold while it runs ahead, must be called before Init
+    void SetFramePool(int size)
+    {
+        frame_pool_size = size > 0 ? size : 1;
+    }
+
+    // with SetHwFrames these frames are taken from the shared frames_ctx for as long as the encoder lives
+    int GetFramePoolSize() const { return frame_pool_size; }
+
+    // encode AXMM surfaces of frames_ctx (e.g. AXFFmpegDecoder::GetHwFramesCtx) without
+    // an upload, must be called before Init; host frames are still uploaded as before
+    void SetHwFrames(AVBufferRef *frames_ctx)
+    {
+        if (ext_frames_ctx)
+            av_buffer_unref(&ext_frames_ctx);
+        if (frames_ctx)
+            ext_frames_ctx = av_buffer_ref(frames_ctx);
+    }
+
+    // ax_hwframe_emulated: with the software backend, take host frames the encoder needs no
+    // conversion for the way SetHwFrames takes AXMM surfaces, so that path runs without a card
+    void SetEmulatedHwFrames(bool enable)
+    {
+        emulated_surfaces = enable;
+    }
+
     ~AXFFmpegEncoder()
     {
+        Deinit();
+
         if (ofmt_ctx)
         {
             av_write_trailer(ofmt_ctx);
@@ -106,10 +514,25 @@ public:
             avformat_free_context(ofmt_ctx);
         }
 
-        if (hw_frame)
-            av_frame_free(&hw_frame);
+        for (AVFrame *f : frame_pool)
+            av_frame_free(&f);
+        frame_pool.clear();
+        if (pkt)
+            av_packet_free(&pkt);
         if (sw_frame)
             av_frame_free(&sw_frame);
+        if (enc_frame)
+            av_frame_free(&enc_frame);
+        if (map_frame)
+            av_frame_free(&map_frame);
+        if (ext_frames_ctx)
+            av_buffer_unref(&ext_frames_ctx);
+        if (sws_ctx)
+            sws_freeContext(sws_ctx);
+        if (scale_ctx)
+            sws_freeContext(scale_ctx);
+        if (scaled)
+            av_frame_free(&scaled);
         if (avctx)
             avcodec_free_context(&avctx);
         if (hw_device_ctx)
@@ -118,10 +541,18 @@ public:
             av_dict_free(&dict);
     }
 
+    // backend ax_codec_backend_sw encodes on the host with libx264 / libx265, falling back
+    // to the builtin mpeg4 encoder when those are not compiled in; device_index is ignored.
+    // An empty url opens no output, packets then only reach SetPacketTap. Host frames of
+    // another size are scaled to width x height on the encode thread
     int Init(const std::string &url, AXFFmpegCodecID codec_id,
-             int width, int height, int fps, int device_index)
+             int width, int height, int fps, int device_index,
+             AXCodecBackend _backend = ax_codec_backend_axcl)
     {
         is_rtsp = (url.rfind("rtsp://", 0) == 0); // 判断开头是否是rtsp://
+        backend = _backend;
+        if (backend == ax_codec_backend_sw)
+            return init_sw(url, codec_id, width, height, fps);
 
         if (device_index < 0 || device_index >= 256)
         {
@@ -196,7 +627,13 @@ public:
             return err;
         }
 
-        if (set_hwframe_ctx(avctx, hw_device_ctx, width, height) < 0)
+        if (ext_frames_ctx)
+        {
+            avctx->hw_frames_ctx = av_buffer_ref(ext_frames_ctx);
+            if (!avctx->hw_frames_ctx)
+                return AVERROR(ENOMEM);
+        }
+        else if (set_hwframe_ctx(avctx, hw_device_ctx, width, height) < 0)
         {
             fprintf(stderr, "Failed to set hwframe context.\n");
             return -1;
@@ -208,60 +645,28 @@ public:
             return -1;
         }
 
-        // ---------------- 输出初始化 ----------------
-        if (is_rtsp)
-        {
-            avformat_alloc_output_context2(&ofmt_ctx, NULL, "rtsp", url.c_str());
-        }
-        else
-        {
-            avformat_alloc_output_context2(&ofmt_ctx, NULL, NULL, url.c_str());
-        }
-        if (!ofmt_ctx)
-        {
-            fprintf(stderr, "Could not allocate output context\n");
-            return -1;
-        }
-
-        out_stream = avformat_new_stream(ofmt_ctx, NULL);
-        if (!out_stream)
-        {
-            fprintf(stderr, "Failed to create output stream\n");
-            return -1;
-        }
-
-        avcodec_parameters_from_context(out_stream->codecpar, avctx);
-        out_stream->time_base = avctx->time_base;
+        if (!url.empty() && ((err = open_output(url)) < 0 || (err = write_header(url)) < 0))
+            return err;
 
-        if (is_rtsp)
-        {
-            av_dict_set(&dict, "rtsp_transport", "tcp", 0);
-            av_dict_set(&dict, "muxdelay", "0.1", 0);
-        }
+        enc_frame = av_frame_alloc();
+        map_frame = av_frame_alloc();
+        if (!enc_frame || !map_frame)
+            return AVERROR(ENOMEM);
 
-        // 打开输出
-        if (!(ofmt_ctx->oformat->flags & AVFMT_NOFILE))
-        {
-            if ((err = avio_open(&ofmt_ctx->pb, url.c_str(), AVIO_FLAG_WRITE)) < 0)
-            {
-                fprintf(stderr, "Failed to open output file: %d\n", err);
-                return -1;
-            }
-        }
+        pkt = av_packet_alloc();
+        if (!pkt)
+            return AVERROR(ENOMEM);
+        stats.allocs++;
 
-        if ((err = avformat_write_header(ofmt_ctx, &dict)) < 0)
+        // 分配硬件帧池
+        enc_width = width;
+        enc_height = height;
+        for (int i = 0; i < frame_pool_size; i++)
         {
-            fprintf(stderr, "Error occurred when writing header: %d\n", err);
-            return -1;
+            if (!alloc_pool_frame())
+                return AVERROR(ENOMEM);
         }
 
-        // 分配硬件帧
-        hw_frame = av_frame_alloc();
-        if (!hw_frame)
-            return AVERROR(ENOMEM);
-        if ((err = av_hwframe_get_buffer(avctx->hw_frames_ctx, hw_frame, 0)) < 0)
-            return err;
-
         // 分配软件帧
         sw_frame = av_frame_alloc();
         if (!sw_frame)
@@ -272,41 +677,86 @@ public:
         if ((err = av_frame_get_buffer(sw_frame, 0)) < 0)
             return err;
 
-        printf("Encoder initialized for %s output.\n", is_rtsp ? "RTSP" : "File");
+        printf("Encoder initialized for %s output.\n", url.empty() ? "shared" : is_rtsp ? "RTSP" : "File");
         return 0;
     }
 
     int Encode(AVFrame *frame)
     {
-        auto fixed = match_linesize_and_copy(frame, hw_frame);
-        int err = av_hwframe_transfer_data(hw_frame, fixed, 0);
-        if (err < 0)
+        int64_t t0 = ax_now_us();
+        AVFrame *enc_input = nullptr;
+        int err;
+        bool surface = is_surface(frame);
+        if (!surface && (frame->width != enc_width || frame->height != enc_height))
         {
-            fprintf(stderr, "Error transferring frame data: %d\n", err);
-            return -1;
+            if (!scaled && !(scaled = av_frame_alloc()))
+                return -1;
+            frame = scale_host(frame);
+            if (!frame)
+            {
+                fprintf(stderr, "Error scaling frame to %dx%d\n", enc_width, enc_height);
+                return -1;
+            }
+        }
+        if (surface)
+        {
+            // 已经在卡上，不用上传
+            if (av_frame_ref(enc_frame, frame) < 0)
+                return -1;
+            enc_input = enc_frame;
+            stats.surface_frames++;
+        }
+        else if (backend == ax_codec_backend_sw)
+        {
+            // 软编没有上传，upload_us 记的是格式转换
+            enc_input = prepare_sw_frame(frame);
+            if (!enc_input)
+            {
+                fprintf(stderr, "Error preparing frame for %s\n", enc_name);
+                return -1;
+            }
+        }
+        else
+        {
+            AVFrame *hw_frame = acquire_frame();
+            if (!hw_frame || upload(frame, hw_frame) < 0)
+                return -1;
+            enc_input = hw_frame;
+        }
+        int64_t t1 = ax_now_us();
+        stats.upload_us += t1 - t0;
+        stats.frames++;
+        int64_t trace_pts = frame->pts;
+        if (AXTrace::Enabled())
+            AXTrace::Record("upload", t0, t1 - t0, trace_pts);
+        if (m_upload)
+        {
+            m_upload->Observe(t1 - t0);
+            m_frames->Inc();
         }
 
-        hw_frame->pts = frame_count++;
+        enc_input->pts = frame_count++;
 
-        if ((err = avcodec_send_frame(avctx, hw_frame)) < 0)
+        err = avcodec_send_frame(avctx, enc_input);
+        if (enc_input == enc_frame)
+            av_frame_unref(enc_frame);
+        if (err < 0)
         {
             fprintf(stderr, "Error sending frame: %d\n", err);
             return -1;
         }
 
+        int64_t mux_us = 0;
         while (true)
         {
-            AVPacket *pkt = av_packet_alloc();
             err = avcodec_receive_packet(avctx, pkt);
             if (err == AVERROR(EAGAIN) || err == AVERROR_EOF)
             {
-                av_packet_free(&pkt);
                 break;
             }
             else if (err < 0)
             {
                 fprintf(stderr, "Error receiving packet: %d\n", err);
-                av_packet_free(&pkt);
                 return -1;
             }
 
@@ -316,19 +766,147 @@ public:
                 pkt->dts = encode_pts;
                 encode_pts++;
             }
+            // mp4 的 edit list 按最后一个包的 duration 收尾，为 0 时播放端会丢掉最后一帧
+            if (pkt->duration <= 0)
+                pkt->duration = 1;
+
+            av_packet_rescale_ts(pkt, avctx->time_base, GetTimeBase());
+            pkt->stream_index = out_stream ? out_stream->index : 0;
+            if (packet_tap)
+                packet_tap(pkt);
+            stats.packets++;
+            if (!ofmt_ctx)
+            {
+                // 没有自己的输出，包只交给 packet_tap
+                av_packet_unref(pkt);
+                continue;
+            }
 
-            av_packet_rescale_ts(pkt, avctx->time_base, out_stream->time_base);
-            pkt->stream_index = out_stream->index;
-
-            if ((err = av_interleaved_write_frame(ofmt_ctx, pkt)) < 0)
+            int64_t t_mux = ax_now_us();
+            err = av_interleaved_write_frame(ofmt_ctx, pkt);
+            int64_t t_mux_end = ax_now_us();
+            mux_us += t_mux_end - t_mux;
+            if (AXTrace::Enabled())
+                AXTrace::Record("mux", t_mux, t_mux_end - t_mux, trace_pts);
+            if (m_mux)
+            {
+                m_mux->Observe(t_mux_end - t_mux);
+                m_packets->Inc();
+            }
+            // av_interleaved_write_frame 已经接管了包里的数据，pkt 为空可直接复用
+            av_packet_unref(pkt);
+            if (err < 0)
             {
                 fprintf(stderr, "Error writing frame: %d\n", err);
-                av_packet_free(&pkt);
                 return -1;
             }
-            av_packet_free(&pkt);
         }
 
+        int64_t t2 = ax_now_us();
+        stats.mux_us += mux_us;
+        stats.encode_us += t2 - t1 - mux_us;
+        // mux spans nest inside the encode span
+        if (AXTrace::Enabled())
+            AXTrace::Record("encode", t1, t2 - t1, trace_pts);
+        if (m_encode)
+            m_encode->Observe(t2 - t1 - mux_us);
         return 0;
     }
+
+    // every encoded packet, in GetTimeBase units, before it is muxed; called on the
+    // encode thread, must be set before Start
+    void SetPacketTap(AXPacketCallback tap)
+    {
+        packet_tap = tap;
+    }
+
+    // parameters of the encoded stream after Init, for muxing its packets elsewhere
+    int GetCodecParameters(AVCodecParameters *par) const
+    {
+        return avcodec_parameters_from_context(par, avctx);
+    }
+    AVRational GetTimeBase() const { return out_stream ? out_stream->time_base : avctx->time_base; }
+    AVRational GetFrameRate() const { return avctx->framerate; }
+
+    // publish this encoder in AXMetrics under labels (e.g. stream="3"), call before Start
+    void SetMetricsLabels(const std::string &labels)
+    {
+        AXMetrics &m = AXMetrics::Get();
+        m_frames = m.Counter("axcl_encode_frames_total", "Frames submitted to the encoder", labels);
+        m_packets = m.Counter("axcl_mux_packets_total", "Encoded packets written to the output", labels);
+        m_dropped = m.Counter("axcl_encode_dropped_frames_total", "Frames dropped by the encoder queue policy", labels);
+        m_queue_depth = m.Gauge("axcl_encode_queue_depth", "Frames waiting for the encoder thread", labels);
+        m_upload = m.Histogram("axcl_encode_upload_seconds", "Host to device upload or format conversion per frame", labels);
+        m_encode = m.Histogram("axcl_encode_seconds", "avcodec_send_frame and avcodec_receive_packet per frame", labels);
+        m_mux = m.Histogram("axcl_mux_seconds", "av_interleaved_write_frame per packet", labels);
+    }
+
+    // Run Encode on a dedicated thread fed by a bounded frame queue, so a slow
+    // muxer no longer stalls the caller. Frames are then submitted with Push.
+    void Start(int queue_size = 8, AXOverflowPolicy policy = ax_overflow_block)
+    {
+        q_frames.Config(queue_size, policy);
+        q_frames.SetMetrics(m_queue_depth, m_dropped);
+        th_encode = std::thread(&AXFFmpegEncoder::func_th_encode, this);
+    }
+
+    // queue a reference to frame; returns 0 if queued, 1 if dropped by policy
+    int Push(AVFrame *frame)
+    {
+        if (!th_encode.joinable())
+            return Encode(frame);
+        return q_frames.Push(frame);
+    }
+
+    // stop the worker after the queued frames are encoded
+    void Deinit()
+    {
+        q_frames.Abort();
+        if (th_encode.joinable())
+            th_encode.join();
+    }
+
+    // snapshot of the counters, may be called from any thread
+    AXEncoderStats GetStats()
+    {
+        AXEncoderStats s;
+        s.frames = stats.frames;
+        s.packets = stats.packets;
+        s.upload_us = stats.upload_us;
+        s.encode_us = stats.encode_us;
+        s.mux_us = stats.mux_us;
+        s.bytes_copied = stats.bytes_copied;
+        s.mapped_uploads = stats.mapped_uploads;
+        s.surface_frames = stats.surface_frames;
+        s.allocs = stats.allocs;
+        s.pool_frames = stats.pool_frames;
+        s.queue = q_frames.GetStats();
+        return s;
+    }
+
+private:
+    void func_th_encode()
+    {
+        AXTrace::SetThreadName("encode");
+        AVFrame *frame = av_frame_alloc();
+        if (!frame)
+        {
+            fprintf(stderr, "Can't allocate frame\n");
+            return;
+        }
+
+        while (true)
+        {
+            int ret = q_frames.Pop(frame);
+            if (ret == AVERROR_EOF)
+                break;
+            if (ret < 0)
+                continue;
+
+            Encode(frame);
+            av_frame_unref(frame);
+        }
+
+        av_frame_free(&frame);
+    }
 };
\ No newline at end of file
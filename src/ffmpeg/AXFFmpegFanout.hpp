@@ -0,0 +1,477 @@
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C"
+{
+#include "libavcodec/avcodec.h"
+}
+
+#include "utils/def.h"
+#include "utils/logger.h"
+#include "utils/trace.hpp"
+#include "utils/metrics.hpp"
+#include "AXFFmpegQueue.hpp"
+#include "AXFFmpegEncoder.hpp"
+#include "AXFFmpegMuxer.hpp"
+
+// one extra output of a decoded stream
+struct AXSinkConfig
+{
+    std::string url;
+    bool overlay = true; // frames with the detection boxes drawn, false for the clean picture
+    int width = 0;       // encoded size, 0 keeps the source size (smaller for a preview)
+    int height = 0;
+    int queue_size = 64; // packets this sink may fall behind before it skips to the next keyframe
+};
+
+struct AXSinkStats
+{
+    uint64_t packets = 0; // packets handed to the sink's writer
+    uint64_t dropped = 0; // packets skipped because the writer fell queue_size behind
+    AXMuxerStats mux;
+};
+
+// called on the subscriber's own thread; the frame may be an AXMM surface with hw frames on
+using AXFrameSubscriber = std::function<void(AVFrame *frame)>;
+
+// Fans one decoded stream out to several sinks.
+//
+// Sinks that want the same picture (overlay or clean) at the same size share
+// one encoder; its packets are handed to every such sink by reference, so the
+// bitstream exists once however many outputs carry it. A sink with the same
+// picture as the main output of AXFFmpegPipe shares the main encoder the same
+// way. Every encoder and every sink writer runs on its own thread behind its own
+// queue: an encoder that falls behind drops its oldest frames, a writer that
+// falls queue_size packets behind skips to the next keyframe, so a stalled
+// RTSP server or slow disk never holds up decoding or the other sinks.
+//
+// Raw subscribers get frame references on their own thread the same way.
+class AXFFmpegFanout
+{
+private:
+    struct Encoding;
+
+    struct Sink
+    {
+        AXSinkConfig cfg;
+        Encoding *enc = nullptr;
+        AXFFmpegMuxer muxer;
+        bool resync = false; // 积压超限后等下一个关键帧再送
+        // 编码线程写，LogStats / GetSinkStats 在别的线程读
+        std::atomic<uint64_t> packets{0};
+        std::atomic<uint64_t> dropped{0};
+        AXCounter *m_dropped = nullptr;
+    };
+
+    struct Encoding
+    {
+        bool overlay = true;
+        int width = 0, height = 0;
+        std::unique_ptr<AXFFmpegEncoder> encoder; // nullptr: packets come from the main encoder
+        std::vector<Sink *> sinks;
+    };
+
+    struct Subscriber
+    {
+        AXFrameSubscriber cb;
+        bool overlay = false;
+        int queue_size = 4;
+        AXFFmpegQueue<AVFrame> q_frames;
+        std::thread th;
+    };
+
+    std::vector<std::unique_ptr<Sink>> sinks;
+    std::vector<std::unique_ptr<Encoding>> encodings;
+    std::vector<std::unique_ptr<Subscriber>> subscribers;
+    Encoding *main_encoding = nullptr;
+    bool has_clean = false;
+    bool has_overlay = false;
+    std::string labels;
+
+    // encoder / packet tap thread of enc
+    void deliver(Encoding *enc, const AVPacket *pkt)
+    {
+        for (Sink *sink : enc->sinks)
+        {
+            bool key = pkt->flags & AV_PKT_FLAG_KEY;
+            if (sink->resync && !key)
+            {
+                sink->dropped++;
+                if (sink->m_dropped)
+                    sink->m_dropped->Inc();
+                continue;
+            }
+            // 单生产者，深度只会变小，Push 不会阻塞
+            if (sink->muxer.QueueDepth() >= (size_t)sink->cfg.queue_size)
+            {
+                sink->resync = true;
+                sink->dropped++;
+                if (sink->m_dropped)
+                    sink->m_dropped->Inc();
+                continue;
+            }
+            sink->resync = false;
+            sink->muxer.Push(pkt);
+            sink->packets++;
+        }
+    }
+
+    void func_th_subscriber(Subscriber *sub)
+    {
+        AXTrace::SetThreadName("subscriber");
+        AVFrame *frame = av_frame_alloc();
+        while (frame && sub->q_frames.Pop(frame) != AVERROR_EOF)
+        {
+            sub->cb(frame);
+            av_frame_unref(frame);
+        }
+        av_frame_free(&frame);
+    }
+
+    Encoding *find_encoding(bool overlay, int width, int height)
+    {
+        for (auto &e : encodings)
+        {
+            if (e->overlay == overlay && e->width == width && e->height == height)
+                return e.get();
+        }
+        encodings.emplace_back(new Encoding());
+        Encoding *e = encodings.back().get();
+        e->overlay = overlay;
+        e->width = width;
+        e->height = height;
+        return e;
+    }
+
+public:
+    AXFFmpegFanout() = default;
+    ~AXFFmpegFanout()
+    {
+        Deinit();
+    }
+
+    // must be called before Init
+    void AddSink(const AXSinkConfig &cfg)
+    {
+        sinks.emplace_back(new Sink());
+        sinks.back()->cfg = cfg;
+    }
+
+    // frames before (overlay false) or after the boxes are drawn, must be called before Init.
+    // A subscriber that falls queue_size frames behind loses the oldest ones
+    void AddSubscriber(AXFrameSubscriber cb, bool overlay = false, int queue_size = 4)
+    {
+        subscribers.emplace_back(new Subscriber());
+        Subscriber *sub = subscribers.back().get();
+        sub->cb = cb;
+        sub->overlay = overlay;
+        sub->queue_size = queue_size > 0 ? queue_size : 1;
+    }
+
+    bool Empty() const { return sinks.empty() && subscribers.empty(); }
+
+    // decoder AXMM surfaces the fan-out can hold at once when frames stay on the card (every
+    // sink is then source size): per own encoder its queue, its frame pool and the frame being
+    // encoded, per subscriber its queue and the frame in its callback. main: the pipe has its
+    // own encoder, overlay sinks share it. Valid before Init
+    int HwSurfaces(int enc_queue_size, bool main) const
+    {
+        bool clean_enc = false, overlay_enc = false;
+        for (auto &sink : sinks)
+        {
+            if (!sink->cfg.overlay)
+                clean_enc = true;
+            else if (!main)
+                overlay_enc = true;
+        }
+        int n = ((int)clean_enc + (int)overlay_enc) * (enc_queue_size + AXFFmpegEncoder::DEFAULT_FRAME_POOL + 1);
+        for (auto &sub : subscribers)
+            n += sub->queue_size + 1;
+        return n;
+    }
+
+    // publish in AXMetrics under labels plus sink="<i>", must be called before Init
+    void SetMetricsLabels(const std::string &_labels)
+    {
+        labels = _labels;
+    }
+
+    // main: the pipe's own encoder (boxes drawn, source size) after its Init, nullptr if there is
+    // none; sinks with that picture share it. hw_frames: decoder AXMM pool for source size
+    // encoders, nullptr for host frames. scale false ignores sink sizes (frames on the card)
+    int Init(int width, int height, int fps, int device_index, AXCodecBackend backend,
+             AXFFmpegEncoder *main, AVBufferRef *hw_frames, bool scale)
+    {
+        for (size_t i = 0; i < sinks.size(); i++)
+        {
+            Sink *sink = sinks[i].get();
+            AXSinkConfig &cfg = sink->cfg;
+            if (!scale && (cfg.width > 0 || cfg.height > 0))
+            {
+                SAMPLE_LOG_W("sink %s: frames stay on the card, can not scale, using %dx%d", cfg.url.c_str(), width, height);
+                cfg.width = cfg.height = 0;
+            }
+            int w = cfg.width > 0 ? cfg.width : width;
+            int h = cfg.height > 0 ? cfg.height : height;
+            // 编码器要求宽高为偶数
+            w &= ~1;
+            h &= ~1;
+
+            if (main && cfg.overlay && w == width && h == height)
+            {
+                if (!main_encoding)
+                {
+                    encodings.emplace_back(new Encoding());
+                    main_encoding = encodings.back().get();
+                    main_encoding->width = width;
+                    main_encoding->height = height;
+                }
+                sink->enc = main_encoding;
+            }
+            else
+                sink->enc = find_encoding(cfg.overlay, w, h);
+            sink->enc->sinks.push_back(sink);
+        }
+
+        for (size_t i = 0; i < encodings.size(); i++)
+        {
+            Encoding *e = encodings[i].get();
+            if (e == main_encoding)
+                continue;
+            e->encoder.reset(new AXFFmpegEncoder());
+            if (hw_frames && e->width == width && e->height == height)
+                e->encoder->SetHwFrames(hw_frames);
+            if (!labels.empty())
+                e->encoder->SetMetricsLabels(labels + ",encoding=\"" + std::to_string(i) + "\"");
+            int ret = e->encoder->Init("", AXFFmpegCodecID::auto_ax, e->width, e->height, fps, device_index, backend);
+            if (ret < 0)
+            {
+                SAMPLE_LOG_E("fan-out encoder %dx%d failed: %d", e->width, e->height, ret);
+                return ret;
+            }
+            e->encoder->SetPacketTap([this, e](const AVPacket *pkt)
+                                     { this->deliver(e, pkt); });
+            if (e->overlay)
+                has_overlay = true;
+            else
+                has_clean = true;
+        }
+
+        for (size_t i = 0; i < sinks.size(); i++)
+        {
+            Sink *sink = sinks[i].get();
+            AXFFmpegEncoder *enc = sink->enc->encoder ? sink->enc->encoder.get() : main;
+            AVCodecParameters *par = avcodec_parameters_alloc();
+            if (!par)
+                return AVERROR(ENOMEM);
+            int ret = enc->GetCodecParameters(par);
+            if (ret >= 0)
+            {
+                if (!labels.empty())
+                {
+                    std::string sink_labels = labels + ",sink=\"" + std::to_string(i) + "\"";
+                    sink->muxer.SetMetricsLabels(sink_labels);
+                    sink->m_dropped = AXMetrics::Get().Counter("axcl_sink_dropped_packets_total",
+                                                               "Packets a fan-out sink skipped to catch up", sink_labels);
+                }
+                ret = sink->muxer.Init(sink->cfg.url, par, enc->GetTimeBase(), enc->GetFrameRate());
+            }
+            avcodec_parameters_free(&par);
+            if (ret < 0)
+            {
+                SAMPLE_LOG_E("sink %s failed: %d", sink->cfg.url.c_str(), ret);
+                return ret;
+            }
+            SAMPLE_LOG_I("sink %s: %s %dx%d%s", sink->cfg.url.c_str(), sink->cfg.overlay ? "overlay" : "clean",
+                         sink->enc->width, sink->enc->height, sink->enc->sinks.size() > 1 ? ", shared encoding" : "");
+        }
+
+        for (auto &sub : subscribers)
+        {
+            if (sub->overlay)
+                has_overlay = true;
+            else
+                has_clean = true;
+        }
+        return 0;
+    }
+
+    // enc_queue_size: frames each fan-out encoder may fall behind before it drops the oldest
+    void Start(int enc_queue_size = 8)
+    {
+        for (auto &sink : sinks)
+            sink->muxer.Start(sink->cfg.queue_size + 1);
+        for (auto &e : encodings)
+        {
+            if (e->encoder)
+                e->encoder->Start(enc_queue_size, ax_overflow_drop_oldest);
+        }
+        for (auto &sub : subscribers)
+        {
+            sub->q_frames.Reset();
+            sub->q_frames.Config(sub->queue_size, ax_overflow_drop_oldest);
+            sub->th = std::thread(&AXFFmpegFanout::func_th_subscriber, this, sub.get());
+        }
+    }
+
+    // some sink or subscriber wants the frame before / after OSD
+    bool HasClean() const { return has_clean; }
+    bool HasOverlay() const { return has_overlay; }
+    // some sink shares the main encoder, feed its packets to OnMainPacket
+    bool SharesMain() const { return main_encoding != nullptr; }
+
+    // decode thread, before the boxes are drawn; only references are queued, so the
+    // caller must not draw into frame afterwards unless it is writable again
+    void PushClean(AVFrame *frame)
+    {
+        for (auto &e : encodings)
+        {
+            if (e->encoder && !e->overlay)
+                e->encoder->Push(frame);
+        }
+        for (auto &sub : subscribers)
+        {
+            if (!sub->overlay)
+                sub->q_frames.Push(frame);
+        }
+    }
+
+    // frame with the boxes drawn
+    void PushOverlay(AVFrame *frame)
+    {
+        for (auto &e : encodings)
+        {
+            if (e->encoder && e->overlay)
+                e->encoder->Push(frame);
+        }
+        for (auto &sub : subscribers)
+        {
+            if (sub->overlay)
+                sub->q_frames.Push(frame);
+        }
+    }
+
+    // packet of the main encoder, from its packet tap
+    void OnMainPacket(const AVPacket *pkt)
+    {
+        if (main_encoding)
+            deliver(main_encoding, pkt);
+    }
+
+    // after the decoder and the main encoder have stopped
+    void Deinit()
+    {
+        // 先停编码器，它们的包还要进 muxer
+        for (auto &e : encodings)
+        {
+            if (e->encoder)
+                e->encoder->Deinit();
+        }
+        for (auto &sink : sinks)
+            sink->muxer.Deinit();
+        for (auto &sub : subscribers)
+        {
+            sub->q_frames.Abort();
+            if (sub->th.joinable())
+                sub->th.join();
+        }
+    }
+
+    void LogStats()
+    {
+        for (size_t i = 0; i < sinks.size(); i++)
+        {
+            AXSinkStats st = GetSinkStats(i);
+            SAMPLE_LOG_I("sink %s: packets %llu (%.2f MB), skipped %llu, queue depth %d/%d",
+                         sinks[i]->cfg.url.c_str(), (unsigned long long)st.mux.packets, st.mux.bytes / 1048576.0,
+                         (unsigned long long)st.dropped, st.mux.queue.depth, st.mux.queue.max_depth);
+        }
+        for (auto &e : encodings)
+        {
+            if (!e->encoder)
+                continue;
+            AXEncoderStats st = e->encoder->GetStats();
+            if (st.queue.dropped > 0)
+                SAMPLE_LOG_I("fan-out encoder %dx%d %s: frames %llu, dropped %llu",
+                             e->width, e->height, e->overlay ? "overlay" : "clean",
+                             (unsigned long long)st.frames, (unsigned long long)st.queue.dropped);
+        }
+    }
+
+    size_t SinkCount() const { return sinks.size(); }
+
+    // may be called from any thread
+    AXSinkStats GetSinkStats(size_t i)
+    {
+        Sink *sink = sinks[i].get();
+        AXSinkStats st;
+        st.packets = sink->packets;
+        st.dropped = sink->dropped;
+        st.mux = sink->muxer.GetStats();
+        return st;
+    }
+
+    // "[clean,][WxH=]url;..." e.g. "rec.mp4;clean=clean.mp4;clean,640x360=rtsp://host/preview"
+    static int ParseSinks(const std::string &list, std::vector<AXSinkConfig> &out)
+    {
+        size_t pos = 0;
+        while (pos < list.size())
+        {
+            size_t end = list.find(';', pos);
+            if (end == std::string::npos)
+                end = list.size();
+            std::string item = list.substr(pos, end - pos);
+            pos = end + 1;
+            if (item.empty())
+                continue;
+
+            AXSinkConfig cfg;
+            cfg.url = item;
+            // 选项在第一个 '=' 之前，认不出来就把整项当 url
+            size_t eq = item.find('=');
+            if (eq != std::string::npos && eq < item.find("://"))
+            {
+                std::string opts = item.substr(0, eq);
+                bool ok = true;
+                AXSinkConfig parsed;
+                size_t p = 0;
+                while (ok && p <= opts.size())
+                {
+                    size_t comma = opts.find(',', p);
+                    if (comma == std::string::npos)
+                        comma = opts.size();
+                    std::string opt = opts.substr(p, comma - p);
+                    int w = 0, h = 0;
+                    if (opt == "clean")
+                        parsed.overlay = false;
+                    else if (opt == "overlay")
+                        parsed.overlay = true;
+                    else if (sscanf(opt.c_str(), "%dx%d", &w, &h) == 2 && w > 0 && h > 0)
+                    {
+                        parsed.width = w;
+                        parsed.height = h;
+                    }
+                    else
+                        ok = false;
+                    p = comma + 1;
+                }
+                if (ok)
+                {
+                    cfg = parsed;
+                    cfg.url = item.substr(eq + 1);
+                }
+            }
+            if (cfg.url.empty())
+                return -1;
+            out.push_back(cfg);
+        }
+        return 0;
+    }
+};
@@ -0,0 +1,275 @@
+#pragma once
+#include <stdio.h>
+#include <atomic>
+#include <string>
+#include <thread>
+
+extern "C"
+{
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+}
+
+#include "utils/def.h"
+#include "utils/logger.h"
+#include "utils/timer.hpp"
+#include "utils/trace.hpp"
+#include "utils/metrics.hpp"
+#include "AXFFmpegQueue.hpp"
+
+struct AXMuxerStats
+{
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    uint64_t waited_key = 0; // packets dropped before the first keyframe
+    uint64_t ts_fixed = 0;   // packets whose dts went backwards (reconnect, file loop) and were shifted
+    int64_t mux_us = 0;      // av_interleaved_write_frame
+    AXQueueStats queue;
+};
+
+// the counters behind AXMuxerStats; written on the writer thread, GetStats reads them from any thread
+struct AXMuxerCounters
+{
+    std::atomic<uint64_t> packets{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> waited_key{0};
+    std::atomic<uint64_t> ts_fixed{0};
+    std::atomic<int64_t> mux_us{0};
+};
+
+// Writes already encoded video packets to a file or an RTSP server on its own
+// thread, without touching the bitstream. Used for passthrough outputs: the
+// codec parameters and time base come from the demuxer, packets from
+// AXFFmpegDecoder::SetPacketTap.
+class AXFFmpegMuxer
+{
+private:
+    AVFormatContext *ofmt_ctx = nullptr;
+    AVStream *out_stream = nullptr;
+    AVRational in_tb = {1, 90000};
+    bool is_rtsp = false;
+    bool header_written = false;
+
+    std::thread th_mux;
+    AXFFmpegQueue<AVPacket> q_packets;
+    AVPacket *pkt = nullptr; // 写线程复用
+
+    // 输出时间戳必须单调，输入重连或文件循环后时间戳回退时整体平移
+    bool got_key = false;
+    int64_t last_dts = AV_NOPTS_VALUE;
+    int64_t ts_offset = 0;
+
+    AXMuxerCounters stats;
+    AXCounter *m_packets = nullptr;
+    AXCounter *m_dropped = nullptr;
+    AXGauge *m_queue_depth = nullptr;
+    AXHistogram *m_mux = nullptr;
+
+    // in input time base, keeps dts strictly increasing across discontinuities
+    void fix_timestamps(AVPacket *p)
+    {
+        if (p->dts == AV_NOPTS_VALUE)
+            p->dts = p->pts;
+        if (p->dts == AV_NOPTS_VALUE)
+        {
+            p->dts = last_dts == AV_NOPTS_VALUE ? 0 : last_dts - ts_offset + (p->duration > 0 ? p->duration : 1);
+            p->pts = p->dts;
+        }
+        if (p->pts == AV_NOPTS_VALUE)
+            p->pts = p->dts;
+
+        if (last_dts != AV_NOPTS_VALUE && p->dts + ts_offset <= last_dts)
+        {
+            ts_offset = last_dts + (p->duration > 0 ? p->duration : 1) - p->dts;
+            stats.ts_fixed++;
+        }
+        p->dts += ts_offset;
+        p->pts += ts_offset;
+        last_dts = p->dts;
+    }
+
+    void write(AVPacket *p)
+    {
+        // 没有关键帧之前的包解不出来
+        if (!got_key)
+        {
+            if (!(p->flags & AV_PKT_FLAG_KEY))
+            {
+                stats.waited_key++;
+                return;
+            }
+            got_key = true;
+        }
+
+        fix_timestamps(p);
+        int64_t trace_pts = p->pts;
+        av_packet_rescale_ts(p, in_tb, out_stream->time_base);
+        p->stream_index = out_stream->index;
+        p->pos = -1;
+
+        stats.bytes += p->size;
+        int64_t t0 = ax_now_us();
+        int err = av_interleaved_write_frame(ofmt_ctx, p);
+        int64_t dur = ax_now_us() - t0;
+        stats.mux_us += dur;
+        stats.packets++;
+        if (AXTrace::Enabled())
+            AXTrace::Record("mux", t0, dur, trace_pts);
+        if (m_mux)
+        {
+            m_mux->Observe(dur);
+            m_packets->Inc();
+        }
+        if (err < 0)
+            SAMPLE_LOG_E("av_interleaved_write_frame failed: %d", err);
+    }
+
+    void func_th_mux()
+    {
+        AXTrace::SetThreadName("mux");
+        while (q_packets.Pop(pkt) != AVERROR_EOF)
+        {
+            write(pkt);
+            av_packet_unref(pkt);
+        }
+    }
+
+public:
+    AXFFmpegMuxer() = default;
+    ~AXFFmpegMuxer()
+    {
+        Deinit();
+    }
+
+    // par/time_base describe the packets that will be pushed, usually the input video stream
+    int Init(const std::string &url, const AVCodecParameters *par, AVRational time_base, AVRational frame_rate)
+    {
+        is_rtsp = url.rfind("rtsp://", 0) == 0;
+        in_tb = time_base;
+
+        avformat_alloc_output_context2(&ofmt_ctx, NULL, is_rtsp ? "rtsp" : NULL, url.c_str());
+        if (!ofmt_ctx)
+        {
+            SAMPLE_LOG_E("could not allocate output context for %s", url.c_str());
+            return -1;
+        }
+        out_stream = avformat_new_stream(ofmt_ctx, NULL);
+        if (!out_stream)
+        {
+            SAMPLE_LOG_E("failed to create output stream");
+            return -1;
+        }
+        int err = avcodec_parameters_copy(out_stream->codecpar, par);
+        if (err < 0)
+            return err;
+        out_stream->codecpar->codec_tag = 0; // 让输出格式自己选
+        out_stream->time_base = time_base;
+        if (frame_rate.num > 0 && frame_rate.den > 0)
+            out_stream->avg_frame_rate = frame_rate;
+
+        AVDictionary *opts = nullptr;
+        if (is_rtsp)
+        {
+            av_dict_set(&opts, "rtsp_transport", "tcp", 0);
+            av_dict_set(&opts, "muxdelay", "0.1", 0);
+        }
+
+        if (!(ofmt_ctx->oformat->flags & AVFMT_NOFILE))
+        {
+            if ((err = avio_open(&ofmt_ctx->pb, url.c_str(), AVIO_FLAG_WRITE)) < 0)
+            {
+                SAMPLE_LOG_E("failed to open output %s: %d", url.c_str(), err);
+                av_dict_free(&opts);
+                return -1;
+            }
+        }
+
+        err = avformat_write_header(ofmt_ctx, &opts);
+        av_dict_free(&opts);
+        if (err < 0)
+        {
+            SAMPLE_LOG_E("error writing header for %s: %d", url.c_str(), err);
+            return -1;
+        }
+        header_written = true;
+
+        pkt = av_packet_alloc();
+        if (!pkt)
+            return AVERROR(ENOMEM);
+        SAMPLE_LOG_I("stream copy to %s, %s %dx%d", url.c_str(), avcodec_get_name(par->codec_id), par->width, par->height);
+        return 0;
+    }
+
+    // publish in AXMetrics under labels, call before Start
+    void SetMetricsLabels(const std::string &labels)
+    {
+        AXMetrics &m = AXMetrics::Get();
+        m_packets = m.Counter("axcl_mux_packets_total", "Encoded packets written to the output", labels);
+        m_dropped = m.Counter("axcl_mux_dropped_packets_total", "Packets dropped by the passthrough queue policy", labels);
+        m_queue_depth = m.Gauge("axcl_mux_queue_depth", "Packets waiting for the passthrough writer", labels);
+        m_mux = m.Histogram("axcl_mux_seconds", "av_interleaved_write_frame per packet", labels);
+    }
+
+    // writer thread behind a bounded queue; with ax_overflow_drop_non_ref a stalled
+    // output sheds disposable packets before it blocks the caller
+    void Start(int queue_size = 64, AXOverflowPolicy policy = ax_overflow_block)
+    {
+        q_packets.Reset();
+        q_packets.Config(queue_size, policy);
+        q_packets.SetMetrics(m_queue_depth, m_dropped);
+        th_mux = std::thread(&AXFFmpegMuxer::func_th_mux, this);
+    }
+
+    // queue a reference to p; 0 queued, 1 dropped by policy, AVERROR_EOF after Deinit.
+    // Without Start the packet is written on the calling thread
+    int Push(const AVPacket *p)
+    {
+        if (th_mux.joinable())
+            return q_packets.Push(p);
+        if (!ofmt_ctx || !pkt)
+            return AVERROR_EOF;
+        int ret = av_packet_ref(pkt, p);
+        if (ret < 0)
+            return ret;
+        write(pkt);
+        av_packet_unref(pkt);
+        return 0;
+    }
+
+    // write what is queued, then the trailer
+    void Deinit()
+    {
+        q_packets.Abort();
+        if (th_mux.joinable())
+            th_mux.join();
+
+        if (ofmt_ctx)
+        {
+            if (header_written)
+                av_write_trailer(ofmt_ctx);
+            if (!(ofmt_ctx->oformat->flags & AVFMT_NOFILE))
+                avio_closep(&ofmt_ctx->pb);
+            avformat_free_context(ofmt_ctx);
+            ofmt_ctx = nullptr;
+            out_stream = nullptr;
+        }
+        header_written = false;
+        av_packet_free(&pkt);
+    }
+
+    // snapshot of the counters, may be called from any thread
+    AXMuxerStats GetStats()
+    {
+        AXMuxerStats s;
+        s.packets = stats.packets;
+        s.bytes = stats.bytes;
+        s.waited_key = stats.waited_key;
+        s.ts_fixed = stats.ts_fixed;
+        s.mux_us = stats.mux_us;
+        s.queue = q_packets.GetStats();
+        return s;
+    }
+
+    // packets waiting for the writer thread, cheap enough to check per packet
+    size_t QueueDepth() { return q_packets.Size(); }
+};
@@ -1,172 +1,884 @@
 #pragma once
-#include <condition_variable>
 #include <opencv2/opencv.hpp>
 #include <atomic>
+#include <chrono>
+#include <math.h>
 
 #include "AXFFmpegDecoder.hpp"
 #include "AXFFmpegEncoder.hpp"
+#include "AXFFmpegMuxer.hpp"
+#include "AXSeiInjector.hpp"
+#include "AXEventRecorder.hpp"
+#include "AXFFmpegFanout.hpp"
+#include "AXHwFrame.hpp"
+#include "utils/triple_buffer.hpp"
+#include "utils/nv12_letterbox.hpp"
+#include "utils/spsc_queue.hpp"
+#include "utils/nv12_osd.hpp"
+#include "utils/trace.hpp"
+#include "utils/metrics.hpp"
+#include "infer/AXTracker.hpp"
 #include "../libdet/include/libdet.h"
 
+#include <deque>
+
+// 每帧的编号和时间戳，GetFrame 给出，PushDetResult 用它把结果对回到帧上
+struct AXFrameInfo
+{
+    uint64_t frame_id = 0;
+    int64_t pts = AV_NOPTS_VALUE;
+};
+
 class AXFFmpegPipe
 {
 private:
     AXFFmpegEncoder encoder;
     AXFFmpegDecoder decoder;
+    AXHistogram *m_osd = nullptr; // nullptr until SetMetricsLabels
 
-    std::mutex mtx;
-    std::condition_variable cv_request;
-    std::condition_variable cv_done;
+    // 转发模式：输入的包原样写出，检测结果作为 SEI 插进去，不解码出图也不编码
+    AXOutputMode output_mode = ax_output_encode;
+    AXFFmpegMuxer muxer;
+    AXSeiInjector sei;
+    bool sei_enabled = false;
+    std::vector<std::string> sei_payloads; // results waiting for the next packet with a slice
+    AVPacket *sei_pkt = nullptr;
+    uint64_t sei_injected = 0;
+    uint64_t sei_failed = 0;
+    AXCounter *m_sei = nullptr;
+
+    // 事件录像：检测命中时把预录和之后的包写成 mp4，包来自输入或编码器
+    bool record = false;
+    bool record_from_encoder = false;
+    std::string record_prefix;
+    AXRecorderConfig record_cfg;
+    AXEventRecorder recorder;
+
+    // 额外输出：同一路解码送多个 sink（叠框 / 干净画面 / 小预览 / 原始帧订阅）
+    AXFFmpegFanout fanout;
+
+    struct FrameSlot
+    {
+        cv::Mat nv12;
+        cv::Mat tensor; // letterboxed model input, only with SetModelInput
+        AXLetterboxMap map;
+        AXFrameInfo info;
+    };
 
-    cv::Mat nv12_frame;
+    // 解码线程每帧发布最新 NV12，推理线程无锁读取
+    TripleBuffer<FrameSlot> latest_frame;
     cv::Mat rgb_frame;
 
-    std::atomic<bool> request_copy = false;
-    std::atomic<bool> copy_done = false;
+    // 直接在解码线程把 NV12 缩放成模型输入，省掉全分辨率拷贝和 cvtColor
+    int model_w = 0, model_h = 0;
+    bool model_rgb = false;
+    AXNV12Letterbox letterbox;
+    bool has_front_map = false;
+    AXLetterboxMap front_map; // mapping of the frame last returned by GetFrame
+    AXFrameInfo front_info;   // frame last returned by GetFrame
+
+    struct TaggedResult
+    {
+        uint64_t frame_id = 0;
+        int64_t pts = AV_NOPTS_VALUE;
+        uint64_t applied_from = UINT64_MAX; // first frame the result was drawn on
+        ax_det_result_t result;
+    };
+
+    // 推理线程 -> 解码线程，无锁
+    SpscQueue<TaggedResult> q_det_results{64};
+    std::atomic<uint64_t> dropped_results{0};
+    std::deque<TaggedResult> pending_results; // decode thread only, ordered by frame_id
+    int hold_max_count = 3; // 结果最多沿用的帧数
+
+    // 延迟送编码的帧数，>= 推理延迟时框与帧严格对齐
+    int det_delay = 0;
+    struct DelayedFrame
+    {
+        AVFrame *frame;
+        uint64_t frame_id;
+    };
+    std::deque<DelayedFrame> delay_line;
+    std::vector<AVFrame *> delay_shells;
+
+    // 跟踪器在没跑检测的帧上外推框，检测可以隔帧跑
+    bool use_tracker = false;
+    AXTracker tracker;
+    ax_det_result_t track_result;
+    std::vector<int> track_ids;
+    int infer_interval = 1; // 每隔几帧发布一帧给推理
+
+    AXNV12Osd osd;
+
+    // 零拷贝：解码出来的帧留在卡上直接送编码，只有推理和 OSD 需要时才映射
+    AXHwFrameMode hw_mode = ax_hwframe_off;
+    int hw_pool_size = 32;
+    AXHwFrameAccess hw_access;
+    AVFrame *hw_view = nullptr;   // 映射出来的主机视图，解码线程使用
+    uint64_t osd_copies = 0;      // 共享的 surface 上不能直接画，只能拷出来画的帧数
 
-    std::queue<ax_det_result_t> q_det_results;
-    ax_det_result_t last_result;  // 上一次检测结果
-    bool has_last_result = false; // 是否有有效历史结果
-    int hold_count = 0;           // 保留计数器
-    int hold_max_count = 3; // 最大保留计数
+    int enc_queue_size = 8;
+    AXOverflowPolicy enc_policy = ax_overflow_block;
 
-    int64_t frame_count = 0; // 帧计数器
+    uint64_t last_enc_allocs = 0;
+    bool has_output = true; // output 为空或 "none" 时只分析，不创建编码器
+
+    // ax_hwframe_axmm 时同一时刻可能被占住的 AXMM 帧数，解码器的帧池按它来分配；
+    // ax_hwframe_emulated 没有帧池，只按同样的算法算出大小
+    int hw_surfaces_needed() const
+    {
+        const int codec_frames = 8; // 解码器参考帧和输出帧，编码器正在编的帧
+        int n = codec_frames + det_delay;
+        bool encode = has_output && output_mode == ax_output_encode;
+        if (encode)
+            n += enc_queue_size + encoder.GetFramePoolSize(); // 编码器的上传帧池也从这个池子里分
+        // 额外输出的编码器和原始帧订阅者也各自占着帧
+        n += fanout.HwSurfaces(enc_queue_size, encode);
+        return n;
+    }
+    uint64_t frame_count = 0; // 帧计数器
     void frame_cb(AVFrame *frame, void *user_data)
     {
+        // 统计每 100 帧打印一次，走异步日志，不阻塞解码线程
         if (frame_count % 100 == 0)
         {
-            printf("frame_cb, pts: %ld, width: %d, height: %d, format: %d line_size: %d %d %d\n", frame->pts, frame->width, frame->height, frame->format, frame->linesize[0], frame->linesize[1], frame->linesize[2]);
+            SAMPLE_LOG_D("frame_cb, pts: %ld, width: %d, height: %d, format: %d line_size: %d %d %d", frame->pts, frame->width, frame->height, frame->format, frame->linesize[0], frame->linesize[1], frame->linesize[2]);
+            print_stats();
         }
-        frame_count++;
+        uint64_t frame_id = frame_count++;
+
+        // 先发布原始帧，推理看到的是未叠加 OSD 的画面
+        if (frame_id % infer_interval == 0)
+            publish_frame(frame, frame_id);
+
+        // 干净画面先送出，之后画框时帧多了引用，会先拷贝再画
+        if (fanout.HasClean())
+            fanout.PushClean(frame);
+
         AXFFmpegEncoder *encoder = (AXFFmpegEncoder *)user_data;
+        drain_results();
+        if (!encoder && !fanout.HasOverlay())
+            return;
+
+        if (det_delay <= 0)
+        {
+            render_and_encode(encoder, frame, frame_id);
+            return;
+        }
+
+        AVFrame *held = nullptr;
+        if (!delay_shells.empty())
+        {
+            held = delay_shells.back();
+            delay_shells.pop_back();
+        }
+        else
+        {
+            held = av_frame_alloc();
+        }
+        if (!held || av_frame_ref(held, frame) < 0)
+        {
+            av_frame_free(&held);
+            render_and_encode(encoder, frame, frame_id);
+            return;
+        }
+        delay_line.push_back({held, frame_id});
+
+        // 结果已到或者延迟用满就送出
+        uint64_t newest = pending_results.empty() ? 0 : pending_results.back().frame_id;
+        while (!delay_line.empty() &&
+               ((int)delay_line.size() > det_delay || (!pending_results.empty() && newest >= delay_line.front().frame_id)))
+        {
+            emit_delayed(encoder);
+        }
+    }
+
+    // 解码线程：每个新结果只出队一次，转发的 SEI 和画框的输出各拿一份
+    void drain_results()
+    {
+        bool to_sei = has_output && output_mode == ax_output_passthrough && sei_enabled;
+        bool to_osd = (has_output && output_mode == ax_output_encode) || fanout.HasOverlay();
+        TaggedResult tr;
+        while (q_det_results.Pop(tr))
+        {
+            if (to_sei)
+                sei_payloads.push_back(format_sei(tr));
+            if (to_osd)
+                pending_results.push_back(tr);
+        }
+    }
+
+    void emit_delayed(AXFFmpegEncoder *encoder)
+    {
+        DelayedFrame df = delay_line.front();
+        delay_line.pop_front();
+        render_and_encode(encoder, df.frame, df.frame_id);
+        av_frame_unref(df.frame);
+        delay_shells.push_back(df.frame);
+    }
+
+    // 取 frame_id 之前最新的结果，不会把后面帧的结果画到前面的帧上
+    // fresh 表示这个结果是第一次被用到
+    const ax_det_result_t *match_result(uint64_t frame_id, bool *fresh = nullptr)
+    {
+        while (pending_results.size() >= 2 && pending_results[1].frame_id <= frame_id)
+            pending_results.pop_front();
+
+        if (pending_results.empty() || pending_results.front().frame_id > frame_id)
+            return nullptr;
+
+        TaggedResult &tr = pending_results.front();
+        if (fresh)
+            *fresh = tr.applied_from == UINT64_MAX;
+        if (tr.applied_from == UINT64_MAX)
+            tr.applied_from = frame_id;
+        if (frame_id - tr.applied_from > (uint64_t)hold_max_count)
+            return nullptr;
+        return &tr.result;
+    }
+
+    // encoders take whole frame rates, 29.97 encodes as 30
+    int encode_fps() const
+    {
+        return (int)lrintf(decoder.GetFps());
+    }
+
+    // 额外输出在主输出之后建，和主输出画面相同的 sink 直接共用主编码器的包
+    int init_fanout(int device_index, AXCodecBackend backend)
+    {
+        if (fanout.Empty())
+            return 0;
+        AXFFmpegEncoder *main = has_output && output_mode == ax_output_encode ? &encoder : nullptr;
+        return fanout.Init(decoder.GetWidth(), decoder.GetHeight(), encode_fps(), device_index, backend, main,
+                           hw_mode == ax_hwframe_axmm ? decoder.GetHwFramesCtx() : nullptr, hw_mode == ax_hwframe_off);
+    }
+
+    // encoder 为 nullptr 时只送 fan-out 的叠框输出
+    void emit_overlay(AXFFmpegEncoder *encoder, AVFrame *frame)
+    {
         if (encoder)
+            encoder->Push(frame);
+        fanout.PushOverlay(frame);
+    }
+
+    void render_and_encode(AXFFmpegEncoder *encoder, AVFrame *frame, uint64_t frame_id)
+    {
+        const ax_det_result_t *result = nullptr;
+        const int *ids = nullptr;
+        if (use_tracker)
         {
-            ax_det_result_t result;
-            bool use_new_result = false;
+            bool fresh = false;
+            const ax_det_result_t *det = match_result(frame_id, &fresh);
+            tracker.Predict();
+            if (det && fresh)
+                tracker.Update(*det);
+            tracker.GetResult(track_result, track_ids.data());
+            result = &track_result;
+            ids = track_ids.data();
+        }
+        else
+        {
+            result = match_result(frame_id);
+        }
 
-            if (!q_det_results.empty())
-            {
-                result = q_det_results.front();
-                q_det_results.pop();
-                last_result = result;
-                has_last_result = true;
-                hold_count = 0;
-                use_new_result = true;
-            }
-            else if (has_last_result && hold_count < hold_max_count)
-            {
-                result = last_result;
-                hold_count++;
-            }
-            else
+        if (!result || result->num_objs == 0)
+        {
+            // 没有要画的东西，设备帧不需要映射
+            emit_overlay(encoder, frame);
+            return;
+        }
+
+        if (!hw_access.IsDevice(frame))
+        {
+            // 解码器还引用着的缓冲不能直接画
+            if (!av_frame_is_writable(frame) && av_frame_make_writable(frame) < 0)
             {
-                has_last_result = false; 
+                emit_overlay(encoder, frame);
+                return;
             }
+            draw_osd(frame, result, ids);
+            emit_overlay(encoder, frame);
+            return;
+        }
 
-            if (has_last_result)
+        if (av_frame_is_writable(frame))
+        {
+            // surface 只有这一个引用，映射后原地画，再把 surface 本身送编码
+            if (hw_access.Map(frame, hw_view, true) == 0)
             {
-                cv::Mat gray_frame(frame->height, frame->width, CV_8UC1, frame->data[0], frame->linesize[0]);
-
-                for (int i = 0; i < result.num_objs; i++)
-                {
-                    ax_det_obj_t &obj = result.objects[i];
-                    cv::Rect rect(obj.box.x, obj.box.y, obj.box.w, obj.box.h);
-                    cv::rectangle(gray_frame, rect, cv::Scalar(255), 2);
-
-                    char label_info[128];
-                    sprintf(label_info, "%d %4.2f", obj.label, obj.score);
-                    cv::putText(gray_frame, label_info, cv::Point(obj.box.x, obj.box.y - 10),
-                                cv::FONT_HERSHEY_SIMPLEX, 1.0, cv::Scalar(255), 2);
-
-                    for (int j = 0; j < obj.num_kpt; j++)
-                    {
-                        cv::circle(gray_frame, cv::Point(obj.kpts[j].x, obj.kpts[j].y),
-                                   5, cv::Scalar(255), -1);
-                    }
-                }
+                draw_osd(hw_view, result, ids);
+                hw_access.Unmap(frame, hw_view, true);
             }
+            emit_overlay(encoder, frame);
+            return;
+        }
 
-            encoder->Encode(frame);
+        // surface 可能还是解码参考帧，拷到主机上画，编码器再上传
+        if (hw_access.Map(frame, hw_view, false) < 0)
+        {
+            emit_overlay(encoder, frame);
+            return;
         }
+        AVFrame *copy = av_frame_alloc();
+        if (copy)
+        {
+            copy->format = AV_PIX_FMT_NV12;
+            copy->width = hw_view->width;
+            copy->height = hw_view->height;
+        }
+        if (copy && av_frame_get_buffer(copy, 0) == 0 && av_frame_copy(copy, hw_view) == 0)
+        {
+            av_frame_copy_props(copy, frame);
+            hw_access.Unmap(frame, hw_view, false);
+            draw_osd(copy, result, ids);
+            osd_copies++;
+            emit_overlay(encoder, copy);
+        }
+        else
+        {
+            hw_access.Unmap(frame, hw_view, false);
+            emit_overlay(encoder, frame);
+        }
+        av_frame_free(&copy);
+    }
 
-        // 惰性拷贝逻辑
-        std::unique_lock<std::mutex> lock(mtx);
-        if (request_copy)
+    void draw_osd(AVFrame *frame, const ax_det_result_t *result, const int *ids)
+    {
+        AX_TRACE_SCOPE("osd", frame->pts);
+        int64_t t0 = m_osd ? ax_now_us() : 0;
+        AXNV12Surface surf;
+        surf.y = frame->data[0];
+        surf.y_stride = frame->linesize[0];
+        // NV21 / YUV420P 的色度排布不同, 只画亮度
+        surf.uv = frame->format == AV_PIX_FMT_NV12 ? frame->data[1] : nullptr;
+        surf.uv_stride = frame->linesize[1];
+        surf.width = frame->width;
+        surf.height = frame->height;
+        osd.Draw(surf, *result, ids);
+        if (m_osd)
+            m_osd->Observe(ax_now_us() - t0);
+    }
+
+    void flush_delayed()
+    {
+        AXFFmpegEncoder *main = has_output && output_mode == ax_output_encode ? &encoder : nullptr;
+        while (!delay_line.empty())
+            emit_delayed(main);
+        for (auto p : delay_shells)
+            av_frame_free(&p);
+        delay_shells.clear();
+    }
+
+    // detections of one frame as the SEI text:
+    // {"pts":<pts of the analysed frame>,"frame":<id>,"objs":[[label,score,x,y,w,h],...]}
+    static std::string format_sei(const TaggedResult &tr)
+    {
+        std::string text;
+        char buf[96];
+        snprintf(buf, sizeof(buf), "{\"pts\":%lld,\"frame\":%llu,\"objs\":[",
+                 (long long)(tr.pts == AV_NOPTS_VALUE ? -1 : tr.pts), (unsigned long long)tr.frame_id);
+        text += buf;
+        for (int i = 0; i < tr.result.num_objs; i++)
         {
-            if (nv12_frame.empty())
-                nv12_frame = cv::Mat(frame->height * 3 / 2, frame->width, CV_8UC1).clone();
+            const ax_det_obj_t &obj = tr.result.objects[i];
+            snprintf(buf, sizeof(buf), "%s[%d,%.3f,%d,%d,%d,%d]", i ? "," : "", obj.label, obj.score,
+                     (int)obj.box.x, (int)obj.box.y, (int)obj.box.w, (int)obj.box.h);
+            text += buf;
+        }
+        text += "]}";
+        return text;
+    }
 
-            uint8_t *dst = nv12_frame.data;
+    // 解码线程：新到的检测结果插到下一个带 slice 的包里，没有新结果的包原样转发
+    void packet_cb(const AVPacket *pkt)
+    {
+        if (record && !record_from_encoder)
+            recorder.Push(pkt);
+        if (!has_output || output_mode != ax_output_passthrough)
+            return;
 
-            // copy Y plane
-            for (int i = 0; i < frame->height; ++i)
-            {
-                memcpy(dst + i * frame->width, frame->data[0] + i * frame->linesize[0], frame->width);
-            }
+        drain_results();
+        if (sei_payloads.empty())
+        {
+            muxer.Push(pkt);
+            return;
+        }
 
-            // copy UV plane
-            uint8_t *dst_uv = dst + frame->height * frame->width;
-            for (int i = 0; i < frame->height / 2; ++i)
-            {
-                memcpy(dst_uv + i * frame->width, frame->data[1] + i * frame->linesize[1], frame->width);
-            }
+        int ret = sei.Inject(pkt, sei_payloads, sei_pkt);
+        if (ret == 1)
+        {
+            muxer.Push(pkt);
+            return;
+        }
+        if (ret == 0)
+        {
+            muxer.Push(sei_pkt);
+            av_packet_unref(sei_pkt);
+            sei_injected += sei_payloads.size();
+            if (m_sei)
+                m_sei->Inc(sei_payloads.size());
+        }
+        else
+        {
+            sei_failed += sei_payloads.size();
+            muxer.Push(pkt);
+        }
+        sei_payloads.clear();
+    }
+
+    void print_stats()
+    {
+        if (decoder.GetSkippedPackets() > 0 || decoder.GetSampledOutFrames() > 0)
+            SAMPLE_LOG_I("decode: %llu packets skipped before the decoder, %llu decoded frames sampled out",
+                   decoder.GetSkippedPackets(), decoder.GetSampledOutFrames());
+
+        // EAGAIN 多说明子卡解码已经满负荷
+        AXDecodeStats dec = decoder.GetDecodeStats();
+        if (dec.stalled_packets > 0 || dec.send_errors > 0)
+            SAMPLE_LOG_I("decoder: %llu packets stalled (%llu EAGAIN), stall %.2fms avg %.2fms max, %llu rejected packets",
+                   (unsigned long long)dec.stalled_packets, (unsigned long long)dec.send_eagain,
+                   dec.stalled_packets ? dec.stall_us / 1000.0 / dec.stalled_packets : 0.0, dec.max_stall_us / 1000.0,
+                   (unsigned long long)dec.send_errors);
 
-            copy_done = true;
-            request_copy = false;
-            cv_done.notify_one();
+        AXDemuxStats ds = decoder.GetDemuxStats();
+        if (ds.reconnects > 0 || ds.failures > 0 || !ds.connected)
+            SAMPLE_LOG_I("input: %s, reconnects %llu, failed attempts %llu, downtime %.1fs",
+                   ds.connected ? "connected" : "disconnected",
+                   (unsigned long long)ds.reconnects, (unsigned long long)ds.failures, ds.downtime_us / 1e6);
+
+        AXQueueStats pq = decoder.GetPacketQueueStats();
+        if (pq.popped > 0)
+            SAMPLE_LOG_I("packet queue: depth %d/%d, demux blocked %.2fms, decode starved %.2fms per packet",
+                   pq.depth, pq.max_depth,
+                   pq.push_wait_us / 1000.0 / pq.pushed,
+                   pq.pop_wait_us / 1000.0 / pq.popped);
+
+        fanout.LogStats();
+
+        if (record)
+        {
+            AXRecorderStats rs = recorder.GetStats();
+            SAMPLE_LOG_I("record: %s, triggers %llu, clips %llu, packets %llu, pre-roll %.1fs (%.2f MB), dropped %llu, overflows %llu",
+                         rs.recording ? "recording" : "idle",
+                         (unsigned long long)rs.triggers, (unsigned long long)rs.clips, (unsigned long long)rs.packets,
+                         rs.ring_s, rs.ring_bytes / 1048576.0,
+                         (unsigned long long)rs.dropped, (unsigned long long)rs.overflows);
         }
+
+        if (output_mode == ax_output_passthrough && has_output)
+        {
+            AXMuxerStats ms = muxer.GetStats();
+            SAMPLE_LOG_I("passthrough: packets %llu (%.2f MB), sei %llu (%llu failed), waited for key %llu, ts shifted %llu, queue depth %d/%d, dropped %llu",
+                         (unsigned long long)ms.packets, ms.bytes / 1048576.0,
+                         (unsigned long long)sei_injected, (unsigned long long)sei_failed,
+                         (unsigned long long)ms.waited_key, (unsigned long long)ms.ts_fixed,
+                         ms.queue.depth, ms.queue.max_depth, (unsigned long long)ms.queue.dropped);
+            return;
+        }
+
+        AXEncoderStats st = encoder.GetStats();
+        if (st.frames == 0)
+            return;
+        SAMPLE_LOG_I("encoder: frames %llu, upload %.2fms, encode %.2fms, mux %.2fms, queue depth %d/%d, wait %.2fms, dropped %llu",
+               (unsigned long long)st.frames,
+               st.upload_us / 1000.0 / st.frames,
+               st.encode_us / 1000.0 / st.frames,
+               st.mux_us / 1000.0 / st.frames,
+               st.queue.depth, st.queue.max_depth,
+               st.queue.pop_wait_us / 1000.0 / st.frames,
+               (unsigned long long)st.queue.dropped);
+        SAMPLE_LOG_I("encoder upload: %.2f MB copied per frame, %llu of %llu frames mapped, %llu surfaces",
+               st.bytes_copied / 1048576.0 / st.frames,
+               (unsigned long long)st.mapped_uploads, (unsigned long long)st.frames,
+               (unsigned long long)st.surface_frames);
+        // 稳态下编码器不应再分配，增长说明帧池太小
+        SAMPLE_LOG_I("encoder allocs: %llu (+%llu since last report), frame pool %d",
+               (unsigned long long)st.allocs, (unsigned long long)(st.allocs - last_enc_allocs), st.pool_frames);
+        last_enc_allocs = st.allocs;
+
+        if (hw_mode == ax_hwframe_off)
+            return;
+        AXHwFrameStats hs = hw_access.GetStats();
+        SAMPLE_LOG_I("hw frames: maps %llu, unmaps %llu, downloads %llu (%.1f MB), uploads %llu (%.1f MB), osd copies %llu",
+               (unsigned long long)hs.maps, (unsigned long long)hs.unmaps,
+               (unsigned long long)hs.downloads, hs.bytes_downloaded / 1048576.0,
+               (unsigned long long)hs.uploads, hs.bytes_uploaded / 1048576.0,
+               (unsigned long long)osd_copies);
+    }
+
+    void publish_frame(AVFrame *frame, uint64_t frame_id)
+    {
+        if (!hw_access.IsDevice(frame))
+        {
+            publish_host_frame(frame, frame_id);
+            return;
+        }
+
+        // 推理只读，映射只在拷出 NV12 / letterbox 期间保持
+        if (hw_access.Map(frame, hw_view, false) < 0)
+            return;
+        hw_view->pts = frame->pts;
+        publish_host_frame(hw_view, frame_id);
+        hw_access.Unmap(frame, hw_view, false);
+    }
+
+    void publish_host_frame(AVFrame *frame, uint64_t frame_id)
+    {
+        FrameSlot &slot = latest_frame.Back();
+        slot.info.frame_id = frame_id;
+        slot.info.pts = frame->pts;
+        AX_TRACE_SCOPE(model_w > 0 && model_h > 0 ? "letterbox" : "copy_nv12", frame->pts);
+
+        if (model_w > 0 && model_h > 0)
+        {
+            if (!letterbox.Match(frame->width, frame->height, model_w, model_h, model_rgb) &&
+                letterbox.Init(frame->width, frame->height, model_w, model_h, model_rgb) != 0)
+                return;
+            slot.tensor.create(model_h, model_w, CV_8UC3);
+            slot.map = letterbox.GetMap();
+            letterbox.Run(frame->data[0], frame->linesize[0], frame->data[1], frame->linesize[1],
+                          slot.tensor.data, (int)slot.tensor.step);
+            latest_frame.Publish();
+            return;
+        }
+
+        slot.nv12.create(frame->height * 3 / 2, frame->width, CV_8UC1);
+
+        uint8_t *dst = slot.nv12.data;
+
+        // copy Y plane
+        for (int i = 0; i < frame->height; ++i)
+        {
+            memcpy(dst + i * frame->width, frame->data[0] + i * frame->linesize[0], frame->width);
+        }
+
+        // copy UV plane
+        uint8_t *dst_uv = dst + frame->height * frame->width;
+        for (int i = 0; i < frame->height / 2; ++i)
+        {
+            memcpy(dst_uv + i * frame->width, frame->data[1] + i * frame->linesize[1], frame->width);
+        }
+
+        latest_frame.Publish();
     }
 
 public:
-    AXFFmpegPipe(/* args */) = default;
-    ~AXFFmpegPipe() = default;
+    AXFFmpegPipe(/* args */)
+    {
+        osd.Init();
+    }
+    ~AXFFmpegPipe()
+    {
+        if (hw_view)
+            av_frame_free(&hw_view);
+    }
 
-    int Init(const std::string input, std::string output, int device_index)
+    // backend 为 ax_codec_backend_sw 时编解码都在主机 CPU 上，不需要 axcl 卡
+    // output 为空或 "none" 时不创建编码器
+    int Init(const std::string input, std::string output, int device_index,
+             AXCodecBackend backend = ax_codec_backend_axcl)
     {
-        int ret = decoder.Init(input, AXFFmpegCodecID::auto_ax, device_index);
+        if (hw_mode == ax_hwframe_axmm && backend != ax_codec_backend_axcl)
+        {
+            SAMPLE_LOG_W("AXMM hw frames need the axcl codec backend, using host frames");
+            hw_mode = ax_hwframe_off;
+        }
+        hw_access.Init(hw_mode);
+        if (hw_mode != ax_hwframe_off && !hw_view)
+        {
+            hw_view = av_frame_alloc();
+            if (!hw_view)
+                return AVERROR(ENOMEM);
+        }
+
+        has_output = !(output.empty() || output == "none");
+        if (hw_mode != ax_hwframe_off && hw_surfaces_needed() > hw_pool_size)
+        {
+            SAMPLE_LOG_I("hw frame pool %d -> %d: encode queue %d + encoder pool %d + det_delay %d + fan-out %d + codec frames",
+                         hw_pool_size, hw_surfaces_needed(), enc_queue_size, encoder.GetFramePoolSize(), det_delay,
+                         fanout.HwSurfaces(enc_queue_size, has_output && output_mode == ax_output_encode));
+            hw_pool_size = hw_surfaces_needed();
+        }
+        decoder.SetHwFrames(hw_mode, hw_pool_size);
+        int ret = decoder.Init(input, AXFFmpegCodecID::auto_ax, device_index, backend);
         if (ret < 0)
             return ret;
+        if (record && record_from_encoder && (!has_output || output_mode != ax_output_encode))
+        {
+            SAMPLE_LOG_W("%s is not encoded, recording the input packets", input.c_str());
+            record_from_encoder = false;
+        }
+        if (record && !record_from_encoder)
+        {
+            ret = recorder.Init(record_prefix, decoder.GetCodecParameters(), decoder.GetTimeBase(),
+                                decoder.GetFrameRate(), record_cfg);
+            if (ret < 0)
+                return ret;
+        }
+
+        if (!has_output)
+        {
+            SAMPLE_LOG_I("no output for %s, encoder not created", input.c_str());
+            return init_fanout(device_index, backend);
+        }
 
-        ret = encoder.Init(output, AXFFmpegCodecID::auto_ax, decoder.GetWidth(), decoder.GetHeight(), decoder.GetFps(), device_index);
+        if (output_mode == ax_output_passthrough)
+        {
+            const AVCodecParameters *par = decoder.GetCodecParameters();
+            ret = muxer.Init(output, par, decoder.GetTimeBase(), decoder.GetFrameRate());
+            if (ret < 0)
+                return ret;
+            sei_enabled = sei.Init(par) == 0;
+            if (!sei_enabled)
+                SAMPLE_LOG_W("%s is neither H.264 nor HEVC, passthrough without detection SEI", avcodec_get_name(par->codec_id));
+            sei_pkt = av_packet_alloc();
+            if (!sei_pkt)
+                return AVERROR(ENOMEM);
+            return init_fanout(device_index, backend);
+        }
+
+        // 编码器和解码器共用一个 AXMM 帧池；模拟模式下主机帧也直接送编码
+        if (hw_mode == ax_hwframe_axmm)
+            encoder.SetHwFrames(decoder.GetHwFramesCtx());
+        encoder.SetEmulatedHwFrames(hw_mode == ax_hwframe_emulated);
+
+        ret = encoder.Init(output, AXFFmpegCodecID::auto_ax, decoder.GetWidth(), decoder.GetHeight(), encode_fps(), device_index, backend);
         if (ret < 0)
             return ret;
 
-        return 0;
+        if (record && record_from_encoder)
+        {
+            AVCodecParameters *par = avcodec_parameters_alloc();
+            if (!par)
+                return AVERROR(ENOMEM);
+            ret = encoder.GetCodecParameters(par);
+            if (ret >= 0)
+                ret = recorder.Init(record_prefix, par, encoder.GetTimeBase(), encoder.GetFrameRate(), record_cfg);
+            avcodec_parameters_free(&par);
+            if (ret < 0)
+                return ret;
+        }
+
+        return init_fanout(device_index, backend);
+    }
+
+    // 解码帧放在哪里，需在 Init 之前设置。ax_hwframe_axmm 时帧留在卡上，pool_size 是下限，
+    // Init 按编码队列、编码器帧池、det_delay、额外输出和编解码器自身占用的帧把池子加大
+    void SetHwFrames(AXHwFrameMode mode, int pool_size = 32)
+    {
+        hw_mode = mode;
+        hw_pool_size = pool_size;
+    }
+
+    // Init 算出的帧池大小，SetHwFrames 给的是下限
+    int GetHwPoolSize() const { return hw_pool_size; }
+
+    // 映射次数和画框时拷出来的帧数；解码线程在写，Deinit 之后再读
+    AXHwFrameStats GetHwFrameStats() const { return hw_access.GetStats(); }
+    uint64_t GetOsdCopies() const { return osd_copies; }
+
+    AXEncoderStats GetEncoderStats() { return encoder.GetStats(); }
+
+    // 编码队列长度和溢出策略，需在 Init 之前设置（AXMM 帧池按它分配）
+    void SetEncodeQueue(int queue_size, AXOverflowPolicy policy)
+    {
+        enc_queue_size = queue_size;
+        enc_policy = policy;
     }
 
-    void Start()
+    // 失败时返回 -1：Init 之后改大了编码队列或 det_delay，AXMM 帧池已经不够
+    int Start()
     {
+        if (hw_mode != ax_hwframe_off && hw_surfaces_needed() > hw_pool_size)
+        {
+            SAMPLE_LOG_E("hw frame pool %d is smaller than the %d frames this pipe can hold, "
+                         "call SetEncodeQueue / SetDetDelay before Init",
+                         hw_pool_size, hw_surfaces_needed());
+            return -1;
+        }
+        bool encode = has_output && output_mode == ax_output_encode;
+        if (record)
+            recorder.Start();
+        if (encode && ((record && record_from_encoder) || fanout.SharesMain()))
+        {
+            encoder.SetPacketTap([this](const AVPacket *pkt)
+                                 {
+                                     if (this->record && this->record_from_encoder)
+                                         this->recorder.Push(pkt);
+                                     this->fanout.OnMainPacket(pkt); });
+        }
+        if (!fanout.Empty())
+            fanout.Start(enc_queue_size);
+        if (encode)
+            encoder.Start(enc_queue_size, enc_policy);
+        bool passthrough = has_output && output_mode == ax_output_passthrough;
+        if (passthrough)
+        {
+            if (det_delay > 0 || use_tracker)
+                SAMPLE_LOG_W("passthrough output: det_delay and tracking do not apply, detections are sent as they arrive");
+            muxer.Start(enc_queue_size > 64 ? enc_queue_size : 64, enc_policy);
+        }
+        if (passthrough || (record && !record_from_encoder))
+            decoder.SetPacketTap([this](const AVPacket *pkt)
+                                 { this->packet_cb(pkt); });
         decoder.Start([this](AVFrame *frame, void *user_data)
-                      { this->frame_cb(frame, user_data); }, &encoder);
+                      { this->frame_cb(frame, user_data); }, encode ? &encoder : nullptr);
+        return 0;
+    }
+
+    // 检测结果对齐：送编码前最多缓存 delay 帧等待对应结果；hold 为一个结果最多沿用的帧数
+    // 需在 Init 之前设置（延迟的帧也占 AXMM 帧池）
+    void SetDetDelay(int delay, int hold = 3)
+    {
+        det_delay = delay;
+        hold_max_count = hold;
+    }
+
+    // 开启跟踪，interval 为推理间隔帧数，中间帧由跟踪器外推，需在 Start 之前设置
+    void SetTracker(bool enable, int interval = 1, AXTracker::Config cfg = AXTracker::Config())
+    {
+        use_tracker = enable;
+        infer_interval = interval > 0 ? interval : 1;
+        // 一个推理间隔加上推理延迟内都沿用预测框
+        cfg.max_coast = std::max(cfg.max_coast, infer_interval + hold_max_count);
+        tracker.Init(cfg);
+        track_ids.resize(sizeof(track_result.objects) / sizeof(track_result.objects[0]));
     }
 
     void Deinit()
     {
         decoder.Deinit();
+        flush_delayed();
+        encoder.Deinit();
+        muxer.Deinit();
+        fanout.Deinit();
+        // 解码和编码线程都已停止，不会再有新包
+        recorder.Deinit();
+        av_packet_free(&sei_pkt);
     }
 
-    cv::Mat GetFrame(int timeout_ms = 100, bool convert_to_rgb = false)
+    // ax_output_passthrough 转发输入码流，检测结果作为 SEI 插入，不再编码；
+    // det_delay 和跟踪不起作用。需在 Init 之前设置
+    void SetOutputMode(AXOutputMode mode)
     {
-        // 1. 发起请求
-        {
-            std::unique_lock<std::mutex> lock(mtx);
-            request_copy = true;
-            copy_done = false;
-        }
+        output_mode = mode;
+    }
+
+    AXOutputMode GetOutputMode() const { return output_mode; }
+
+    // 检测命中 cfg.rule 时录像到 <prefix>_<时间>.mp4，不重新编码；from_encoder 时录编码后的
+    // 输出（带 OSD），否则录输入码流。需在 Init 之前设置
+    void SetRecorder(const std::string &prefix, const AXRecorderConfig &cfg, bool from_encoder = false)
+    {
+        record = !prefix.empty();
+        record_prefix = prefix;
+        record_cfg = cfg;
+        record_from_encoder = from_encoder;
+    }
 
-        cv_request.notify_one(); // 通知回调可以拷贝了
+    AXRecorderStats GetRecorderStats() { return recorder.GetStats(); }
+
+    // 再多一路输出，画面和尺寸见 AXSinkConfig；和主输出或别的 sink 画面、尺寸相同时共用
+    // 一个编码器。帧留在卡上（SetHwFrames）时不能缩放。需在 Init 之前设置
+    void AddSink(const AXSinkConfig &cfg)
+    {
+        fanout.AddSink(cfg);
+    }
+
+    // 在自己的线程上拿到每个解码帧的引用，overlay 为 true 时是画框之后的帧；
+    // 跟不上时丢最旧的帧。需在 Init 之前设置
+    void AddSubscriber(AXFrameSubscriber cb, bool overlay = false, int queue_size = 4)
+    {
+        fanout.AddSubscriber(cb, overlay, queue_size);
+    }
+
+    size_t GetSinkCount() const { return fanout.SinkCount(); }
+    AXSinkStats GetSinkStats(size_t i) { return fanout.GetSinkStats(i); }
+
+    // 只解推理要用的帧，需在 Init 之前设置；只分析的流配合 output "none" 使用
+    void SetDecodeMode(AXDecodeMode mode, double sample_fps = 0)
+    {
+        decoder.SetDecodeMode(mode, sample_fps);
+    }
+
+    // 按 url 缓存的编解码参数快速打开输入，跳过探测；需在 Init 之前设置，cache 由调用方持有
+    void SetStreamInfoCache(AXStreamInfoCache *cache)
+    {
+        decoder.SetStreamInfoCache(cache);
+    }
+
+    AXStartupStats GetStartupStats() const { return decoder.GetStartupStats(); }
+
+    // 网络输入断流后自动重连，需在 Init 之前设置
+    void SetReconnect(bool enable, int io_timeout_ms = 5000, int max_backoff_ms = 5000)
+    {
+        decoder.SetReconnect(enable, io_timeout_ms, max_backoff_ms);
+    }
 
-        // 2. 等待回调拷贝完成
+    // 解码、编码和 OSD 的指标挂到 AXMetrics 的 labels 下（如 stream="3"），需在 Init 之前设置
+    void SetMetricsLabels(const std::string &labels)
+    {
+        decoder.SetMetricsLabels(labels);
+        encoder.SetMetricsLabels(labels);
+        muxer.SetMetricsLabels(labels);
+        fanout.SetMetricsLabels(labels);
+        m_sei = AXMetrics::Get().Counter("axcl_sei_messages_total", "Detection results written as SEI into passthrough outputs", labels);
+        m_osd = AXMetrics::Get().Histogram("axcl_osd_seconds", "Drawing detections into one frame", labels);
+    }
+
+    // 输入已结束（文件读完，或不重连的网络流断开）且所有帧都已解出；重连期间为 false
+    // 缓存的流参数核对失败时流也会停下，IsFailed 为 true
+    bool IsFinished() const { return decoder.IsFinished(); }
+    bool IsFailed() const { return decoder.IsFailed(); }
+
+    AXDemuxStats GetDemuxStats() { return decoder.GetDemuxStats(); }
+
+    AXDecodeStats GetDecodeStats() { return decoder.GetDecodeStats(); }
+
+    // GetFrame 返回 w x h 的 letterbox 模型输入，PushDetResult 自动映射回原图坐标
+    // 必须在 Start 之前调用，w/h 为 0 关闭
+    void SetModelInput(int w, int h, bool rgb = false)
+    {
+        model_w = w;
+        model_h = h;
+        model_rgb = rgb;
+    }
+
+    // 取最新一帧，timeout_ms 内没有新帧则返回空 Mat；timeout_ms 为 0 时不等待
+    // 设置了 SetModelInput 时颜色顺序以其为准
+    cv::Mat GetFrame(int timeout_ms = 100, bool convert_to_rgb = false)
+    {
+        AXFrameInfo info;
+        return GetFrame(info, timeout_ms, convert_to_rgb);
+    }
+
+    cv::Mat GetFrame(AXFrameInfo &info, int timeout_ms = 100, bool convert_to_rgb = false)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while (!latest_frame.Fetch())
         {
-            std::unique_lock<std::mutex> lock(mtx);
-            bool done = cv_done.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this]
-                                         { return copy_done.load(); });
-            if (!done)
+            if (std::chrono::steady_clock::now() >= deadline)
             {
-                printf("GetFrame timeout\n");
+                // 重连期间没有帧是预期的，不刷屏
+                if (timeout_ms > 0 && decoder.GetDemuxStats().connected)
+                    SAMPLE_LOG_W("GetFrame timeout");
                 return cv::Mat();
             }
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+        }
+
+        const FrameSlot &slot = latest_frame.Front();
+        info = slot.info;
+        front_info = slot.info;
+        if (model_w > 0 && model_h > 0)
+        {
+            front_map = slot.map;
+            has_front_map = true;
+            return slot.tensor;
         }
 
+        const cv::Mat &nv12_frame = slot.nv12;
+        AX_TRACE_SCOPE("nv12_to_bgr", info.pts);
         if (convert_to_rgb)
         {
             cv::cvtColor(nv12_frame, rgb_frame, cv::COLOR_YUV2RGB_NV12);
@@ -179,8 +891,59 @@ public:
         }
     }
 
-    void PushDetResult(ax_det_result_t result)
+    unsigned long long GetFrameCount() const { return decoder.GetFrameCount(); }
+
+    int GetWidth() const { return decoder.GetWidth(); }
+    int GetHeight() const { return decoder.GetHeight(); }
+    float GetFps() const { return decoder.GetFps(); }
+    bool HasOutput() const { return has_output; }
+
+    // 这一路在卡上占用的帧缓冲，按池子大小估算，Init 之后有效
+    int64_t EstimateSurfaceBytes() const
+    {
+        const int codec_surfaces = 8; // 解码器参考帧和输出帧，不开 AXMM 时编码器的帧池也算在这里
+        int64_t frame = (int64_t)decoder.GetWidth() * decoder.GetHeight() * 3 / 2;
+        int surfaces = hw_mode == ax_hwframe_axmm ? hw_pool_size : codec_surfaces;
+        if (has_output && output_mode == ax_output_encode && hw_mode != ax_hwframe_axmm)
+            surfaces += codec_surfaces;
+        return frame * surfaces;
+    }
+
+    // 结果对应最近一次 GetFrame 返回的帧，需与 GetFrame 在同一线程调用
+    // 没有目标的结果也要送进来，否则旧框会一直沿用到 hold 用完
+    void PushDetResult(const ax_det_result_t &result)
     {
-        q_det_results.push(result);
+        PushDetResult(front_info.frame_id, result);
+    }
+
+    // 单生产者：同一个 pipe 的结果只能来自一个线程
+    void PushDetResult(uint64_t frame_id, ax_det_result_t result)
+    {
+        if (has_front_map)
+        {
+            for (int i = 0; i < result.num_objs; i++)
+            {
+                ax_det_obj_t &obj = result.objects[i];
+                float x1 = obj.box.x, y1 = obj.box.y;
+                float x2 = obj.box.x + obj.box.w, y2 = obj.box.y + obj.box.h;
+                front_map.MapPoint(x1, y1);
+                front_map.MapPoint(x2, y2);
+                obj.box.x = x1;
+                obj.box.y = y1;
+                obj.box.w = x2 - x1;
+                obj.box.h = y2 - y1;
+                for (int j = 0; j < obj.num_kpt; j++)
+                    front_map.MapPoint(obj.kpts[j].x, obj.kpts[j].y);
+            }
+        }
+
+        TaggedResult tr;
+        tr.frame_id = frame_id;
+        tr.pts = frame_id == front_info.frame_id ? front_info.pts : AV_NOPTS_VALUE;
+        tr.result = result;
+        if (record)
+            recorder.OnDetections(tr.result);
+        if (!q_det_results.Push(tr))
+            dropped_results++;
     }
 };
@@ -0,0 +1,288 @@
+#pragma once
+
+extern "C"
+{
+#include "libavcodec/avcodec.h"
+#include "libavutil/frame.h"
+}
+
+#include "utils/def.h"
+#include "utils/timer.hpp"
+#include "utils/metrics.hpp"
+
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <chrono>
+#include <functional>
+
+// taps on compressed packets (decoder input, encoder output), called on the producing thread
+using AXPacketCallback = std::function<void(const AVPacket *pkt)>;
+
+// ref/unref helpers so the same queue works for AVFrame and AVPacket
+template <typename T>
+struct AXAVTraits;
+
+template <>
+struct AXAVTraits<AVFrame>
+{
+    // decoded pictures are independent, any of them can be dropped safely
+    static constexpr bool can_drop_any = true;
+
+    static AVFrame *alloc() { return av_frame_alloc(); }
+    static void free(AVFrame **p) { av_frame_free(p); }
+    static int ref(AVFrame *dst, const AVFrame *src) { return av_frame_ref(dst, src); }
+    static void unref(AVFrame *p) { av_frame_unref(p); }
+    static void move_ref(AVFrame *dst, AVFrame *src) { av_frame_move_ref(dst, src); }
+    static bool is_non_ref(const AVFrame *p) { return p->pict_type == AV_PICTURE_TYPE_B; }
+};
+
+template <>
+struct AXAVTraits<AVPacket>
+{
+    // dropping a reference packet breaks decoding until the next keyframe
+    static constexpr bool can_drop_any = false;
+
+    static AVPacket *alloc() { return av_packet_alloc(); }
+    static void free(AVPacket **p) { av_packet_free(p); }
+    static int ref(AVPacket *dst, const AVPacket *src) { return av_packet_ref(dst, src); }
+    static void unref(AVPacket *p) { av_packet_unref(p); }
+    static void move_ref(AVPacket *dst, AVPacket *src) { av_packet_move_ref(dst, src); }
+    static bool is_non_ref(const AVPacket *p) { return p->flags & AV_PKT_FLAG_DISPOSABLE; }
+};
+
+struct AXQueueStats
+{
+    uint64_t pushed = 0;
+    uint64_t popped = 0;
+    uint64_t dropped = 0;
+    int depth = 0;
+    int max_depth = 0;
+    int64_t push_wait_us = 0; // total time producers spent blocked
+    int64_t pop_wait_us = 0;  // total time consumers spent waiting for data
+};
+
+// Bounded queue of ref-counted AVFrame/AVPacket.
+// Push takes a new reference and never touches the caller's object, Pop moves
+// the reference out. Item shells are recycled, so steady state does not allocate.
+// drop_non_ref discards the oldest non-reference item first; when there is none
+// it falls back to drop_oldest for frames and to block for packets.
+template <typename T>
+class AXFFmpegQueue
+{
+private:
+    using Traits = AXAVTraits<T>;
+
+    std::mutex mtx;
+    std::condition_variable cv_not_empty;
+    std::condition_variable cv_not_full;
+
+    std::deque<T *> items;
+    std::vector<T *> shells;
+
+    size_t capacity = 8;
+    AXOverflowPolicy policy = ax_overflow_block;
+    bool aborted = false;
+
+    AXQueueStats stats;
+    AXGauge *m_depth = nullptr;
+    AXCounter *m_dropped = nullptr;
+
+    void set_depth()
+    {
+        stats.depth = (int)items.size();
+        if (m_depth)
+            m_depth->Set(stats.depth);
+    }
+
+    void count_drop()
+    {
+        stats.dropped++;
+        if (m_dropped)
+            m_dropped->Inc();
+    }
+
+    T *get_shell()
+    {
+        if (shells.empty())
+            return Traits::alloc();
+        T *p = shells.back();
+        shells.pop_back();
+        return p;
+    }
+
+    void put_shell(T *p)
+    {
+        Traits::unref(p);
+        shells.push_back(p);
+    }
+
+    // make room for one item according to policy, lock must be held
+    // returns false if the incoming item should be dropped instead
+    bool make_room(std::unique_lock<std::mutex> &lock, const T *incoming)
+    {
+        AXOverflowPolicy mode = policy;
+        if (mode == ax_overflow_drop_non_ref)
+        {
+            for (auto it = items.begin(); it != items.end(); ++it)
+            {
+                if (Traits::is_non_ref(*it))
+                {
+                    put_shell(*it);
+                    items.erase(it);
+                    count_drop();
+                    return true;
+                }
+            }
+            if (Traits::is_non_ref(incoming))
+                return false;
+            mode = Traits::can_drop_any ? ax_overflow_drop_oldest : ax_overflow_block;
+        }
+
+        if (mode == ax_overflow_drop_oldest)
+        {
+            put_shell(items.front());
+            items.pop_front();
+            count_drop();
+            return true;
+        }
+
+        int64_t t0 = ax_now_us();
+        cv_not_full.wait(lock, [this]
+                         { return aborted || items.size() < capacity; });
+        stats.push_wait_us += ax_now_us() - t0;
+        return true;
+    }
+
+public:
+    AXFFmpegQueue() = default;
+    AXFFmpegQueue(const AXFFmpegQueue &) = delete;
+    AXFFmpegQueue &operator=(const AXFFmpegQueue &) = delete;
+
+    ~AXFFmpegQueue()
+    {
+        for (auto p : items)
+            Traits::free(&p);
+        for (auto p : shells)
+            Traits::free(&p);
+    }
+
+    // must be called before the queue is used
+    void Config(size_t _capacity, AXOverflowPolicy _policy)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        capacity = _capacity > 0 ? _capacity : 1;
+        policy = _policy;
+        while (shells.size() < capacity + 1)
+            shells.push_back(Traits::alloc());
+    }
+
+    // mirror depth and drops into metrics, either may be nullptr
+    void SetMetrics(AXGauge *depth, AXCounter *dropped)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        m_depth = depth;
+        m_dropped = dropped;
+    }
+
+    // 0: queued, 1: dropped by policy, AVERROR_EOF: queue aborted
+    int Push(const T *src)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (aborted)
+            return AVERROR_EOF;
+
+        if (items.size() >= capacity)
+        {
+            if (!make_room(lock, src))
+            {
+                count_drop();
+                return 1;
+            }
+            if (aborted)
+                return AVERROR_EOF;
+        }
+
+        T *p = get_shell();
+        if (!p)
+            return AVERROR(ENOMEM);
+        int ret = Traits::ref(p, src);
+        if (ret < 0)
+        {
+            shells.push_back(p);
+            return ret;
+        }
+
+        items.push_back(p);
+        stats.pushed++;
+        set_depth();
+        if (stats.depth > stats.max_depth)
+            stats.max_depth = stats.depth;
+        cv_not_empty.notify_one();
+        return 0;
+    }
+
+    // dst must be blank, receives the reference
+    // 0: ok, AVERROR(EAGAIN): timed out, AVERROR_EOF: aborted and drained
+    int Pop(T *dst, int timeout_ms = -1)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (items.empty())
+        {
+            int64_t t0 = ax_now_us();
+            auto ready = [this]
+            { return aborted || !items.empty(); };
+            if (timeout_ms < 0)
+                cv_not_empty.wait(lock, ready);
+            else
+                cv_not_empty.wait_for(lock, std::chrono::milliseconds(timeout_ms), ready);
+            stats.pop_wait_us += ax_now_us() - t0;
+        }
+
+        if (items.empty())
+            return aborted ? AVERROR_EOF : AVERROR(EAGAIN);
+
+        T *p = items.front();
+        items.pop_front();
+        Traits::move_ref(dst, p);
+        shells.push_back(p);
+        stats.popped++;
+        set_depth();
+        cv_not_full.notify_one();
+        return 0;
+    }
+
+    // wake everybody up; further pushes fail, pops drain what is left
+    void Abort()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        aborted = true;
+        cv_not_empty.notify_all();
+        cv_not_full.notify_all();
+    }
+
+    // drop everything and accept pushes again
+    void Reset()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (auto p : items)
+            put_shell(p);
+        items.clear();
+        aborted = false;
+        set_depth();
+        cv_not_full.notify_all();
+    }
+
+    size_t Size()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return items.size();
+    }
+
+    AXQueueStats GetStats()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return stats;
+    }
+};
@@ -0,0 +1,123 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+
+extern "C"
+{
+#include "libavutil/frame.h"
+#include "libavutil/hwcontext.h"
+#include "libavutil/imgutils.h"
+}
+
+#include "utils/def.h"
+
+struct AXHwFrameStats
+{
+    uint64_t maps = 0;             // host views served without a copy
+    uint64_t unmaps = 0;           // views released, equals maps + downloads between frames
+    uint64_t downloads = 0;        // map failed, frame copied device -> host
+    uint64_t uploads = 0;          // written view copied host -> device
+    uint64_t bytes_downloaded = 0;
+    uint64_t bytes_uploaded = 0;
+};
+
+// Host access to device (AXMM) surfaces for the few consumers that need pixels:
+// the NPU input and the OSD. Frames themselves stay on the card, a consumer maps
+// the surface for as long as it reads or writes it and unmaps right after.
+// av_hwframe_map is tried first; when the driver can not map, the frame is
+// downloaded and, for writers, uploaded back on Unmap.
+//
+// One view is open at a time: Map, use, Unmap, all on the same thread.
+//
+// ax_hwframe_emulated treats ordinary host NV12 frames as device surfaces, so
+// the map/unmap sequence and its accounting run without a card; AXFFmpegPipe
+// then also hands them to the encoder as surfaces.
+class AXHwFrameAccess
+{
+private:
+    AXHwFrameMode mode = ax_hwframe_off;
+    AXHwFrameStats stats;
+    bool view_downloaded = false;
+
+    static uint64_t frame_bytes(const AVFrame *f)
+    {
+        int size = av_image_get_buffer_size(AV_PIX_FMT_NV12, f->width, f->height, 1);
+        return size > 0 ? (uint64_t)size : 0;
+    }
+
+public:
+    void Init(AXHwFrameMode _mode)
+    {
+        mode = _mode;
+        stats = AXHwFrameStats();
+    }
+
+    AXHwFrameMode GetMode() const { return mode; }
+
+    // true when frame is a surface that must be mapped before touching its pixels
+    bool IsDevice(const AVFrame *frame) const
+    {
+        if (mode == ax_hwframe_emulated)
+            return true;
+        return mode == ax_hwframe_axmm && frame->format == AV_PIX_FMT_AXMM;
+    }
+
+    // host NV12 view of frame in view (an empty frame), 0 on success
+    int Map(AVFrame *frame, AVFrame *view, bool write)
+    {
+        view_downloaded = false;
+        if (mode == ax_hwframe_emulated)
+        {
+            stats.maps++;
+            return av_frame_ref(view, frame);
+        }
+
+        view->format = AV_PIX_FMT_NV12;
+        int flags = AV_HWFRAME_MAP_READ | (write ? AV_HWFRAME_MAP_WRITE : 0);
+        int ret = av_hwframe_map(view, frame, flags);
+        if (ret == 0)
+        {
+            stats.maps++;
+            return 0;
+        }
+
+        av_frame_unref(view);
+        view->format = AV_PIX_FMT_NV12;
+        ret = av_hwframe_transfer_data(view, frame, 0);
+        if (ret < 0)
+        {
+            fprintf(stderr, "hw frame map and download both failed: %d\n", ret);
+            av_frame_unref(view);
+            return ret;
+        }
+        av_frame_copy_props(view, frame);
+        view_downloaded = true;
+        stats.downloads++;
+        stats.bytes_downloaded += frame_bytes(frame);
+        return 0;
+    }
+
+    // releases view; a written view that was downloaded instead of mapped goes back to the card
+    int Unmap(AVFrame *frame, AVFrame *view, bool write)
+    {
+        int ret = 0;
+        if (write && view_downloaded)
+        {
+            ret = av_hwframe_transfer_data(frame, view, 0);
+            if (ret < 0)
+                fprintf(stderr, "hw frame upload failed: %d\n", ret);
+            else
+            {
+                stats.uploads++;
+                stats.bytes_uploaded += frame_bytes(frame);
+            }
+        }
+        av_frame_unref(view);
+        view_downloaded = false;
+        stats.unmaps++;
+        return ret;
+    }
+
+    // Map / Unmap and this must be called on the same thread, the pipe's decode thread
+    AXHwFrameStats GetStats() const { return stats; }
+};
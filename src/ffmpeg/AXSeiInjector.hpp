@@ -0,0 +1,175 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#include "libavcodec/avcodec.h"
+}
+
+// Inserts user_data_unregistered SEI messages (payloadType 5) into H.264 / HEVC
+// access units without re-encoding them. The SEI NAL goes right before the
+// first slice of the packet and is written in the framing the packet already
+// uses: Annex-B start codes, or the NAL length prefixes of avcC / hvcC taken
+// from the stream extradata.
+class AXSeiInjector
+{
+public:
+    // payload UUID of the detection messages, a viewer looks for it to find them
+    static constexpr uint8_t UUID[16] = {0x61, 0x78, 0x63, 0x6c, 0x2d, 0x64, 0x65, 0x74,
+                                         0x9c, 0x3e, 0x4b, 0x51, 0x8f, 0x02, 0xd7, 0x1a};
+
+private:
+    AVCodecID codec_id = AV_CODEC_ID_NONE;
+    int nal_length_size = 0; // 0: Annex-B
+    std::vector<uint8_t> sei;
+
+    bool is_vcl(const uint8_t *nal) const
+    {
+        if (codec_id == AV_CODEC_ID_H264)
+        {
+            int type = nal[0] & 0x1f;
+            return type >= 1 && type <= 5;
+        }
+        int type = (nal[0] >> 1) & 0x3f;
+        return type <= 31;
+    }
+
+    // offset of the start code / length prefix of the first slice NAL, -1 if none
+    int find_first_vcl(const uint8_t *data, int size) const
+    {
+        if (nal_length_size > 0)
+        {
+            int pos = 0;
+            while (pos + nal_length_size < size)
+            {
+                uint32_t len = 0;
+                for (int i = 0; i < nal_length_size; i++)
+                    len = (len << 8) | data[pos + i];
+                if (len == 0 || pos + nal_length_size + (int64_t)len > size)
+                    return -1;
+                if (is_vcl(data + pos + nal_length_size))
+                    return pos;
+                pos += nal_length_size + len;
+            }
+            return -1;
+        }
+
+        for (int i = 0; i + 3 < size; i++)
+        {
+            if (data[i] != 0 || data[i + 1] != 0)
+                continue;
+            int sc = 0;
+            if (data[i + 2] == 1)
+                sc = 3;
+            else if (data[i + 2] == 0 && data[i + 3] == 1)
+                sc = 4;
+            if (!sc || i + sc >= size)
+                continue;
+            if (is_vcl(data + i + sc))
+                return i;
+            i += sc - 1;
+        }
+        return -1;
+    }
+
+    // SEI NAL carrying one message per payload, with emulation prevention
+    void build_sei(const std::vector<std::string> &payloads)
+    {
+        std::vector<uint8_t> rbsp;
+        for (auto &text : payloads)
+        {
+            size_t size = sizeof(UUID) + text.size();
+            rbsp.push_back(5); // user_data_unregistered
+            for (; size >= 255; size -= 255)
+                rbsp.push_back(0xff);
+            rbsp.push_back((uint8_t)size);
+            rbsp.insert(rbsp.end(), UUID, UUID + sizeof(UUID));
+            rbsp.insert(rbsp.end(), text.begin(), text.end());
+        }
+        rbsp.push_back(0x80); // rbsp_trailing_bits
+
+        std::vector<uint8_t> nal;
+        if (codec_id == AV_CODEC_ID_H264)
+            nal.push_back(6); // nal_unit_type SEI
+        else
+        {
+            nal.push_back(39 << 1); // PREFIX_SEI_NUT
+            nal.push_back(1);       // nuh_layer_id 0, nuh_temporal_id_plus1 1
+        }
+        int zeros = 0;
+        for (uint8_t b : rbsp)
+        {
+            if (zeros >= 2 && b <= 3)
+            {
+                nal.push_back(3);
+                zeros = 0;
+            }
+            nal.push_back(b);
+            zeros = b == 0 ? zeros + 1 : 0;
+        }
+
+        sei.clear();
+        if (nal_length_size > 0)
+        {
+            for (int i = nal_length_size - 1; i >= 0; i--)
+                sei.push_back((uint8_t)(nal.size() >> (8 * i)));
+        }
+        else
+        {
+            static const uint8_t start_code[4] = {0, 0, 0, 1};
+            sei.insert(sei.end(), start_code, start_code + 4);
+        }
+        sei.insert(sei.end(), nal.begin(), nal.end());
+    }
+
+public:
+    // -1 for codecs other than H.264 / HEVC
+    int Init(const AVCodecParameters *par)
+    {
+        codec_id = par->codec_id;
+        if (codec_id != AV_CODEC_ID_H264 && codec_id != AV_CODEC_ID_HEVC)
+            return -1;
+
+        // avcC / hvcC 开头是 version 1，Annex-B 开头是起始码
+        nal_length_size = 0;
+        const uint8_t *ex = par->extradata;
+        if (ex && par->extradata_size > 0 && ex[0] == 1)
+        {
+            if (codec_id == AV_CODEC_ID_H264 && par->extradata_size >= 7)
+                nal_length_size = (ex[4] & 3) + 1;
+            else if (codec_id == AV_CODEC_ID_HEVC && par->extradata_size >= 23)
+                nal_length_size = (ex[21] & 3) + 1;
+        }
+        return 0;
+    }
+
+    // out = in with an SEI NAL carrying payloads before its first slice.
+    // 0: done, 1: in has no slice (out untouched, keep the payloads for the next packet), <0: error
+    int Inject(const AVPacket *in, const std::vector<std::string> &payloads, AVPacket *out)
+    {
+        int pos = find_first_vcl(in->data, in->size);
+        if (pos < 0)
+            return 1;
+        build_sei(payloads);
+        // a length prefix of 1 or 2 bytes can not describe a large SEI
+        if (nal_length_size > 0 && nal_length_size < 4 && sei.size() - nal_length_size >= (1u << (8 * nal_length_size)))
+            return AVERROR(EINVAL);
+
+        int ret = av_new_packet(out, in->size + (int)sei.size());
+        if (ret < 0)
+            return ret;
+        ret = av_packet_copy_props(out, in);
+        if (ret < 0)
+        {
+            av_packet_unref(out);
+            return ret;
+        }
+        memcpy(out->data, in->data, pos);
+        memcpy(out->data + pos, sei.data(), sei.size());
+        memcpy(out->data + pos + sei.size(), in->data + pos, in->size - pos);
+        return 0;
+    }
+};
@@ -0,0 +1,163 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "utils/logger.h"
+
+// codec parameters of one input as last seen by a full probe
+struct AXStreamInfo
+{
+    int codec_id = 0; // AVCodecID
+    int width = 0;
+    int height = 0;
+    int fps_num = 0;
+    int fps_den = 1;
+    std::vector<uint8_t> extradata; // SPS/PPS(/VPS), avcC or hvcC as the demuxer exported it
+
+    bool operator==(const AXStreamInfo &o) const
+    {
+        return codec_id == o.codec_id && width == o.width && height == o.height &&
+               fps_num == o.fps_num && fps_den == o.fps_den && extradata == o.extradata;
+    }
+};
+
+// Codec parameters keyed by input url, persisted as a text file so a restart can
+// open every stream without avformat_find_stream_info.
+//
+// One line per url, tab separated:
+//   url codec_id width height fps_num fps_den extradata(hex)
+//
+// The file is rewritten on every change; entries only change when a stream is
+// probed for the first time or turns out to differ from what was cached, so
+// this happens rarely. Shared by all decoders of a process, every call locks.
+class AXStreamInfoCache
+{
+private:
+    std::string path;
+    std::map<std::string, AXStreamInfo> entries;
+    std::mutex mtx;
+
+    static bool parse_hex(const char *s, std::vector<uint8_t> &out)
+    {
+        out.clear();
+        size_t n = strlen(s);
+        if (n % 2)
+            return false;
+        for (size_t i = 0; i < n; i += 2)
+        {
+            unsigned v;
+            if (sscanf(s + i, "%2x", &v) != 1)
+                return false;
+            out.push_back((uint8_t)v);
+        }
+        return true;
+    }
+
+    void save()
+    {
+        std::string tmp = path + ".tmp";
+        FILE *fp = fopen(tmp.c_str(), "w");
+        if (!fp)
+        {
+            SAMPLE_LOG_W("can not write stream cache %s", tmp.c_str());
+            return;
+        }
+        for (auto &kv : entries)
+        {
+            const AXStreamInfo &info = kv.second;
+            fprintf(fp, "%s\t%d\t%d\t%d\t%d\t%d\t", kv.first.c_str(), info.codec_id,
+                    info.width, info.height, info.fps_num, info.fps_den);
+            for (uint8_t b : info.extradata)
+                fprintf(fp, "%02x", b);
+            fprintf(fp, "\n");
+        }
+        fclose(fp);
+        // 先写临时文件再改名，进程中途退出也不会留下半个文件
+        if (rename(tmp.c_str(), path.c_str()) != 0)
+            SAMPLE_LOG_W("can not replace stream cache %s", path.c_str());
+    }
+
+public:
+    // a missing file is an empty cache, malformed lines are skipped
+    int Load(const std::string &_path)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        path = _path;
+        entries.clear();
+
+        FILE *fp = fopen(path.c_str(), "r");
+        if (!fp)
+            return 0;
+
+        std::string line;
+        char buf[4096];
+        while (fgets(buf, sizeof(buf), fp))
+        {
+            line += buf;
+            if (line.empty() || line.back() != '\n')
+                continue; // long extradata, keep reading
+            line.pop_back();
+
+            std::vector<std::string> fields;
+            size_t pos = 0, tab;
+            while ((tab = line.find('\t', pos)) != std::string::npos)
+            {
+                fields.push_back(line.substr(pos, tab - pos));
+                pos = tab + 1;
+            }
+            fields.push_back(line.substr(pos));
+            line.clear();
+
+            AXStreamInfo info;
+            if (fields.size() != 7 || fields[0].empty() ||
+                sscanf(fields[1].c_str(), "%d", &info.codec_id) != 1 ||
+                sscanf(fields[2].c_str(), "%d", &info.width) != 1 ||
+                sscanf(fields[3].c_str(), "%d", &info.height) != 1 ||
+                sscanf(fields[4].c_str(), "%d", &info.fps_num) != 1 ||
+                sscanf(fields[5].c_str(), "%d", &info.fps_den) != 1 ||
+                !parse_hex(fields[6].c_str(), info.extradata))
+            {
+                SAMPLE_LOG_W("skip malformed stream cache line for %s", fields[0].c_str());
+                continue;
+            }
+            entries[fields[0]] = info;
+        }
+        fclose(fp);
+        SAMPLE_LOG_I("stream cache %s: %d entries", path.c_str(), (int)entries.size());
+        return (int)entries.size();
+    }
+
+    bool Get(const std::string &url, AXStreamInfo &info)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = entries.find(url);
+        if (it == entries.end())
+            return false;
+        info = it->second;
+        return true;
+    }
+
+    void Put(const std::string &url, const AXStreamInfo &info)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = entries.find(url);
+        if (it != entries.end() && it->second == info)
+            return;
+        entries[url] = info;
+        if (!path.empty())
+            save();
+    }
+
+    // the stream no longer matches its entry, the next open probes it fully again
+    void Invalidate(const std::string &url)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (entries.erase(url) && !path.empty())
+            save();
+    }
+};
@@ -0,0 +1,734 @@
+#pragma once
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <memory>
+
+#include "AXFFmpegPipe.hpp"
+#include "AXStreamScheduler.hpp"
+#include "infer/AXDetBatcher.hpp"
+#include "infer/AXDetector.hpp"
+#include "utils/timer.hpp"
+#include "../libdet/include/libdet.h"
+
+struct AXStreamConfig
+{
+    std::string input;
+    std::string output;
+};
+
+// One process, many streams: device init and detector handles are created once
+// and shared, each stream owns its own decoder/encoder pipe and infer thread.
+// AXStreamScheduler picks the card of every stream from the measured load and,
+// when a card stays overloaded, moves streams off it.
+class AXStreamManager
+{
+private:
+    using dev_type_t = decltype(ax_det_init_t::dev_type);
+
+    struct Stream;
+
+    struct NpuDevice
+    {
+        dev_type_t type;
+        int devid = -1;
+        std::unique_ptr<AXDetector> detector;
+        std::mutex mtx_det; // Detect is called from several infer threads, unused for a reentrant detector
+        std::atomic<uint64_t> infer_count{0};
+        AXDetBatcher batcher;
+        std::vector<Stream *> batch_streams; // batcher slot -> stream
+    };
+
+    struct Stream
+    {
+        int index = 0;
+        int card = 0; // axcl card used for decode/encode
+        AXStreamConfig cfg;
+        std::unique_ptr<AXFFmpegPipe> pipe;
+        NpuDevice *npu = nullptr;
+        std::thread th_infer;
+        std::atomic<uint64_t> infer_count{0};
+        bool startup_reported = false;
+        uint64_t last_stalled = 0;
+        int64_t last_stall_us = 0;
+
+        // migration swaps pipe/card/npu under mtx_pipe, the infer thread holds it per frame
+        std::mutex mtx_pipe;
+        std::atomic<bool> migrating{false};
+        std::atomic<bool> dead{false}; // lost in a failed migration
+        double frame_cost = 1;         // pixels per frame relative to 1080p
+        uint64_t last_frames = 0;
+        std::atomic<int64_t> busy_us{0}; // time in Detect
+        int64_t last_busy_us = 0;
+
+        std::string labels; // stream="<index>", shared by every pipe the stream runs in
+        AXCounter *m_infer = nullptr;
+        AXHistogram *m_det = nullptr;
+        AXGauge *m_card = nullptr;
+    };
+
+    ax_devices_t ax_devices;
+    bool host_inited = false;
+    AXCodecBackend codec_backend = ax_codec_backend_axcl;
+    AXHwFrameMode hw_mode = ax_hwframe_off;
+    AXDecodeMode decode_mode = ax_decode_all;
+    AXOutputMode output_mode = ax_output_encode;
+    std::string record_prefix; // empty: no event recording
+    AXRecorderConfig record_cfg;
+    bool record_from_encoder = false;
+    std::vector<AXSinkConfig> sinks; // extra outputs of every stream, %d in the url is the stream index
+    double sample_fps = 0;
+    bool reconnect = true;
+    int io_timeout_ms = 5000;
+    std::unique_ptr<AXStreamInfoCache> info_cache;
+    AXStreamScheduler scheduler;
+    AXStreamScheduler::Config sched_cfg;
+    std::mutex mtx_sched; // scheduler is shared by Report and the migration thread once started
+    bool migrate = true;
+    // one migration at a time, reopening on its own thread so Report is not held up
+    std::thread th_migrate;
+    std::atomic<bool> migration_busy{false};
+    std::vector<std::unique_ptr<NpuDevice>> npus;
+    std::vector<std::unique_ptr<Stream>> streams;
+    volatile bool loop_exit = false;
+
+    // cross stream batching, 1 means one infer thread per stream
+    int max_batch = 1;
+    int max_wait_ms = 10;
+
+    int model_w = 0, model_h = 0;
+    int det_delay = 0;
+    int det_interval = 1;
+
+    // for throughput report
+    int64_t last_report_us = 0;
+    std::vector<uint64_t> last_infer;
+
+    void func_th_infer(Stream *st)
+    {
+        AXTrace::SetThreadName("infer");
+        while (!loop_exit && !st->dead)
+        {
+            if (st->migrating)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+            std::lock_guard<std::mutex> lock_pipe(st->mtx_pipe);
+            AXFrameInfo info;
+            cv::Mat src = st->pipe->GetFrame(info);
+            if (src.empty())
+            {
+                // a reconnecting input delivers nothing for a while, only a finished one ends the stream
+                if (st->pipe->IsFinished())
+                {
+                    if (st->pipe->IsFailed())
+                        SAMPLE_LOG_E("stream %d: stopped on an error, stop inference", st->index);
+                    else
+                        SAMPLE_LOG_I("stream %d: input finished, stop inference", st->index);
+                    break;
+                }
+                continue;
+            }
+
+            ax_det_img_t img;
+            img.data = src.data;
+            img.width = src.cols;
+            img.height = src.rows;
+            img.channels = src.channels();
+            img.stride = src.step;
+            ax_det_result_t result;
+
+            int ret;
+            {
+                std::unique_lock<std::mutex> lock(st->npu->mtx_det, std::defer_lock);
+                if (!st->npu->detector->Reentrant())
+                    lock.lock();
+                int64_t t0 = ax_now_us();
+                ret = st->npu->detector->Detect(img, result);
+                int64_t dur = ax_now_us() - t0;
+                st->busy_us += dur;
+                st->m_det->Observe(dur);
+                if (AXTrace::Enabled())
+                    AXTrace::Record("ax_det", t0, dur, info.pts);
+            }
+            if (ret != 0)
+            {
+                SAMPLE_LOG_E("stream %d: %s detect failed %d", st->index, st->npu->detector->Name(), ret);
+                continue;
+            }
+            st->infer_count++;
+            st->m_infer->Inc();
+            st->npu->infer_count++;
+
+            st->pipe->PushDetResult(result);
+        }
+    }
+
+    // decode/encode groups for placement and Report: one per axcl card, or the host for software codecs
+    int codec_groups() const
+    {
+        return codec_backend == ax_codec_backend_sw ? 1 : ax_devices.devices.count;
+    }
+
+    NpuDevice *npu_for_card(int card) const
+    {
+        return npus.size() == 1 ? npus[0].get() : npus[card % npus.size()].get();
+    }
+
+    // NPU load counts against the card only when every card runs its own detector
+    bool npu_on_card() const
+    {
+        return codec_backend == ax_codec_backend_axcl && npus.size() == (size_t)codec_groups() &&
+               npus[0]->type == axcl_device;
+    }
+
+    // new pipe for st on card, nullptr if it does not open
+    std::unique_ptr<AXFFmpegPipe> open_pipe(Stream *st, int card)
+    {
+        auto pipe = std::make_unique<AXFFmpegPipe>();
+        pipe->SetHwFrames(hw_mode);
+        pipe->SetDecodeMode(decode_mode, sample_fps);
+        pipe->SetOutputMode(output_mode);
+        if (!record_prefix.empty())
+            pipe->SetRecorder(record_prefix + "_s" + std::to_string(st->index), record_cfg, record_from_encoder);
+        for (AXSinkConfig cfg : sinks)
+        {
+            size_t pos = cfg.url.find("%d");
+            if (pos != std::string::npos)
+                cfg.url.replace(pos, 2, std::to_string(st->index));
+            pipe->AddSink(cfg);
+        }
+        pipe->SetReconnect(reconnect, io_timeout_ms);
+        pipe->SetStreamInfoCache(info_cache.get());
+        pipe->SetMetricsLabels(st->labels);
+        pipe->SetDetDelay(det_delay);
+        if (pipe->Init(st->cfg.input, st->cfg.output, card, codec_backend) < 0)
+        {
+            SAMPLE_LOG_E("stream %d: init %s -> %s failed", st->index, st->cfg.input.c_str(), st->cfg.output.c_str());
+            return nullptr;
+        }
+        st->frame_cost = (double)pipe->GetWidth() * pipe->GetHeight() / (1920 * 1080);
+        return pipe;
+    }
+
+    int start_pipe(Stream *st)
+    {
+        st->pipe->SetModelInput(model_w, model_h);
+        if (det_interval > 1)
+            st->pipe->SetTracker(true, det_interval);
+        if (st->pipe->Start() != 0)
+        {
+            SAMPLE_LOG_E("stream %d: start failed", st->index);
+            return -1;
+        }
+        return 0;
+    }
+
+    static bool is_live(const std::string &url)
+    {
+        return url.find("://") != std::string::npos && url.rfind("file:", 0) != 0;
+    }
+
+    // only live inputs with live or no outputs survive a restart on another card:
+    // a file input would start over and a file output, main or sink, would be
+    // truncated. Batched streams are pinned to their batcher slot
+    bool movable(const Stream *st) const
+    {
+        if (!migrate || max_batch > 1 || codec_backend != ax_codec_backend_axcl || st->dead || st->migrating)
+            return false;
+        if (!is_live(st->cfg.input) || (st->cfg.output != "none" && !is_live(st->cfg.output)))
+            return false;
+        for (auto &sink : sinks)
+        {
+            if (!is_live(sink.url))
+                return false;
+        }
+        return true;
+    }
+
+    // the old pipe is closed first so a live output is never published twice,
+    // then the stream reopens on the new card (fast with a stream info cache).
+    // Runs on th_migrate; Report leaves st alone until migrating is cleared
+    void migrate_stream(Stream *st, int card)
+    {
+        std::lock_guard<std::mutex> lock(st->mtx_pipe);
+        int from = st->card;
+        SAMPLE_LOG_I("stream %d: card %d overloaded, moving to card %d", st->index, from, card);
+        st->pipe->Deinit();
+
+        std::unique_ptr<AXFFmpegPipe> pipe = open_pipe(st, card);
+        if (!pipe)
+        {
+            SAMPLE_LOG_W("stream %d: can not open on card %d, back to card %d", st->index, card, from);
+            card = from;
+            pipe = open_pipe(st, card);
+        }
+        if (!pipe)
+        {
+            SAMPLE_LOG_E("stream %d: lost during migration", st->index);
+            st->dead = true;
+            std::lock_guard<std::mutex> lock_sched(mtx_sched);
+            scheduler.RemoveStream(st->index);
+            return;
+        }
+
+        st->pipe = std::move(pipe);
+        st->card = card;
+        st->m_card->Set(card);
+        st->npu = npu_for_card(card);
+        {
+            std::lock_guard<std::mutex> lock_sched(mtx_sched);
+            scheduler.MoveStream(st->index, card);
+        }
+        if (start_pipe(st) != 0)
+        {
+            st->dead = true;
+            std::lock_guard<std::mutex> lock_sched(mtx_sched);
+            scheduler.RemoveStream(st->index);
+            return;
+        }
+        // counters of the new pipe start from zero
+        st->last_frames = 0;
+        st->last_stalled = 0;
+        st->last_stall_us = 0;
+    }
+
+    void func_th_migrate(Stream *st, int card)
+    {
+        AXTrace::SetThreadName("migrate");
+        migrate_stream(st, card);
+        st->migrating = false;
+        migration_busy = false;
+    }
+
+public:
+    AXStreamManager()
+    {
+        memset(&ax_devices, 0, sizeof(ax_devices_t));
+    }
+    ~AXStreamManager()
+    {
+        Deinit();
+    }
+
+    // Config file: one stream per line, "<input> [output]", '#' starts a comment
+    static int LoadConfig(const std::string &path, std::vector<AXStreamConfig> &cfgs)
+    {
+        std::ifstream ifs(path);
+        if (!ifs.is_open())
+        {
+            SAMPLE_LOG_E("open config %s failed", path.c_str());
+            return -1;
+        }
+
+        std::string line;
+        while (std::getline(ifs, line))
+        {
+            size_t pos = line.find('#');
+            if (pos != std::string::npos)
+                line = line.substr(0, pos);
+
+            std::istringstream iss(line);
+            AXStreamConfig cfg;
+            if (!(iss >> cfg.input))
+                continue;
+            iss >> cfg.output;
+            cfgs.push_back(cfg);
+        }
+        return 0;
+    }
+
+    // init devices once and load one detector per NPU; init_info.dev_type/devid are filled in here.
+    // backend is one of AXDetector::Create, a backend without NPU gets a single shared detector
+    int Init(ax_det_init_t init_info, const std::string &backend = "libdet", int mock_latency_ms = 20)
+    {
+        std::unique_ptr<AXDetector> detector = AXDetector::Create(backend, mock_latency_ms);
+        if (!detector)
+            return -1;
+
+        memset(&ax_devices, 0, sizeof(ax_devices_t));
+        if (ax_dev_enum_devices(&ax_devices) != 0)
+        {
+            SAMPLE_LOG_E("enum devices failed");
+            return -1;
+        }
+
+        if (detector->NeedNpu() && !ax_devices.host.available && ax_devices.devices.count == 0)
+        {
+            SAMPLE_LOG_E("no device available");
+            return -1;
+        }
+
+        if (detector->NeedNpu() && ax_devices.host.available)
+        {
+            ax_dev_sys_init(host_device, -1);
+            host_inited = true;
+        }
+        // cards are still needed for decode/encode
+        for (int i = 0; i < ax_devices.devices.count; i++)
+            ax_dev_sys_init(axcl_device, i);
+
+        // same preference as the single stream sample: host NPU if present, else one per card
+        if (!detector->NeedNpu())
+        {
+            auto npu = std::make_unique<NpuDevice>();
+            npu->type = host_device;
+            npu->detector = std::move(detector);
+            npus.push_back(std::move(npu));
+        }
+        else if (ax_devices.host.available)
+        {
+            auto npu = std::make_unique<NpuDevice>();
+            npu->type = host_device;
+            npus.push_back(std::move(npu));
+        }
+        else
+        {
+            for (int i = 0; i < ax_devices.devices.count; i++)
+            {
+                auto npu = std::make_unique<NpuDevice>();
+                npu->type = axcl_device;
+                npu->devid = i;
+                npus.push_back(std::move(npu));
+            }
+        }
+
+        for (auto &npu : npus)
+        {
+            if (!npu->detector)
+                npu->detector = AXDetector::Create(backend, mock_latency_ms);
+            init_info.dev_type = npu->type;
+            init_info.devid = npu->devid;
+            if (npu->detector->Init(init_info) != 0)
+            {
+                SAMPLE_LOG_E("%s init failed on device %d", npu->detector->Name(), npu->devid);
+                return -1;
+            }
+        }
+
+        SAMPLE_LOG_I("stream manager: %d card(s), %d %s detector(s)", ax_devices.devices.count, (int)npus.size(), backend.c_str());
+        return 0;
+    }
+
+    // codec backend of the streams added afterwards, must be called before AddStream
+    void SetCodecBackend(AXCodecBackend backend)
+    {
+        codec_backend = backend;
+    }
+
+    // see AXFFmpegPipe::SetHwFrames, must be called before AddStream
+    void SetHwFrames(AXHwFrameMode mode)
+    {
+        hw_mode = mode;
+    }
+
+    // see AXFFmpegPipe::SetDecodeMode, must be called before AddStream
+    void SetDecodeMode(AXDecodeMode mode, double _sample_fps)
+    {
+        decode_mode = mode;
+        sample_fps = _sample_fps;
+    }
+
+    // see AXFFmpegPipe::SetOutputMode, must be called before AddStream
+    void SetOutputMode(AXOutputMode mode)
+    {
+        output_mode = mode;
+    }
+
+    // see AXFFmpegPipe::SetRecorder; clips of stream i go to <prefix>_s<i>_<time>.mp4,
+    // the budget in cfg is per stream. Must be called before AddStream
+    void SetRecorder(const std::string &prefix, const AXRecorderConfig &cfg, bool from_encoder = false)
+    {
+        record_prefix = prefix;
+        record_cfg = cfg;
+        record_from_encoder = from_encoder;
+    }
+
+    // see AXFFmpegPipe::AddSink; every stream gets each sink, with %d in the url replaced
+    // by the stream index so the outputs do not collide. A url without %d allows only one
+    // stream, AddStream refuses the second. Must be called before AddStream
+    void AddSink(const AXSinkConfig &cfg)
+    {
+        sinks.push_back(cfg);
+    }
+
+    // see AXFFmpegPipe::SetReconnect, must be called before AddStream
+    void SetReconnect(bool enable, int _io_timeout_ms = 5000)
+    {
+        reconnect = enable;
+        io_timeout_ms = _io_timeout_ms;
+    }
+
+    // cache file of per-url codec parameters for fast start, see AXFFmpegPipe::SetStreamInfoCache;
+    // must be called before AddStream, an empty path turns it off
+    void SetStreamInfoCache(const std::string &path)
+    {
+        if (path.empty())
+        {
+            info_cache.reset();
+            return;
+        }
+        info_cache = std::make_unique<AXStreamInfoCache>();
+        info_cache->Load(path);
+    }
+
+    // placement and migration thresholds, must be called before AddStream; migrate false only places
+    void SetScheduler(const AXStreamScheduler::Config &cfg, bool _migrate = true)
+    {
+        sched_cfg = cfg;
+        migrate = _migrate;
+    }
+
+    // each stream goes to the card with the lowest load; output "none" runs the stream without encoder
+    int AddStream(const AXStreamConfig &cfg)
+    {
+        if (codec_groups() == 0)
+        {
+            SAMPLE_LOG_E("no axcl card for decode/encode");
+            return -1;
+        }
+
+        // 没有 %d 的 sink 每一路都会打开，写同一个文件、推同一个地址
+        for (auto &sink : sinks)
+        {
+            if (!streams.empty() && sink.url.find("%d") == std::string::npos)
+            {
+                SAMPLE_LOG_E("sink %s would be shared by all streams, put %%d in the url for the stream index",
+                             sink.url.c_str());
+                return -1;
+            }
+        }
+
+        if (streams.empty())
+            scheduler.Init(codec_groups(), sched_cfg);
+
+        auto st = std::make_unique<Stream>();
+        st->index = (int)streams.size();
+        st->cfg = cfg;
+        if (st->cfg.output.empty())
+            st->cfg.output = "stream" + std::to_string(st->index) + ".mp4";
+        st->labels = "stream=\"" + std::to_string(st->index) + "\"";
+        AXMetrics &m = AXMetrics::Get();
+        st->m_infer = m.Counter("axcl_infer_frames_total", "Frames run through the detector", st->labels);
+        st->m_det = m.Histogram("axcl_det_seconds", "Detect latency per frame", st->labels);
+        st->m_card = m.Gauge("axcl_stream_card", "Card decoding and encoding the stream", st->labels);
+
+        // cost is unknown until the stream is open, place it as one 1080p30 stream
+        st->card = scheduler.Place(30, 0);
+        st->npu = npu_for_card(st->card);
+        st->pipe = open_pipe(st.get(), st->card);
+        if (!st->pipe)
+            return -1;
+        st->m_card->Set(st->card);
+        float fps = st->pipe->GetFps();
+        scheduler.AddStream(st->index, st->card, st->frame_cost * (fps > 0 ? fps : 30), st->pipe->EstimateSurfaceBytes());
+
+        if (codec_backend == ax_codec_backend_sw)
+            SAMPLE_LOG_I("stream %d: %s -> %s on host codec", st->index, st->cfg.input.c_str(), st->cfg.output.c_str());
+        else
+            SAMPLE_LOG_I("stream %d: %s -> %s on card %d", st->index, st->cfg.input.c_str(), st->cfg.output.c_str(), st->card);
+        streams.push_back(std::move(st));
+        return 0;
+    }
+
+    // see AXFFmpegPipe::SetModelInput, must be called before Start
+    void SetModelInput(int w, int h)
+    {
+        model_w = w;
+        model_h = h;
+    }
+
+    // see AXFFmpegPipe::SetDetDelay, must be called before Start
+    void SetDetDelay(int delay)
+    {
+        det_delay = delay;
+    }
+
+    // detect every interval frames and track in between, must be called before Start
+    void SetDetInterval(int interval)
+    {
+        det_interval = interval;
+    }
+
+    // batch frames of all streams sharing an NPU, must be called before Start
+    void SetBatch(int _max_batch, int _max_wait_ms)
+    {
+        max_batch = _max_batch;
+        max_wait_ms = _max_wait_ms;
+    }
+
+    void Start()
+    {
+        loop_exit = false;
+        for (auto &st : streams)
+        {
+            if (start_pipe(st.get()) != 0)
+            {
+                st->dead = true;
+                scheduler.RemoveStream(st->index);
+                continue;
+            }
+            if (max_batch > 1)
+            {
+                st->npu->batch_streams.push_back(st.get());
+                st->npu->batcher.AddStream(st->pipe.get(), st->m_det);
+            }
+            else
+            {
+                st->th_infer = std::thread(&AXStreamManager::func_th_infer, this, st.get());
+            }
+        }
+
+        if (max_batch > 1)
+        {
+            for (auto &npu : npus)
+            {
+                NpuDevice *dev = npu.get();
+                dev->batcher.Init(dev->detector.get(), dev->detector->Reentrant() ? nullptr : &dev->mtx_det,
+                                  max_batch, max_wait_ms);
+                dev->batcher.Start([dev](int slot, const ax_det_result_t &result)
+                                   {
+                                       Stream *st = dev->batch_streams[slot];
+                                       st->infer_count++;
+                                       st->m_infer->Inc();
+                                       dev->infer_count++;
+                                       st->pipe->PushDetResult(result); });
+            }
+        }
+        last_report_us = ax_now_us();
+        last_infer.assign(npus.size(), 0);
+    }
+
+    // aggregate decode and inference fps per card since the last call
+    void Report()
+    {
+        int64_t now = ax_now_us();
+        double sec = (now - last_report_us) / 1e6;
+        if (sec <= 0)
+            return;
+        last_report_us = now;
+
+        std::vector<double> decode(codec_groups(), 0);
+        uint64_t total_decode = 0;
+        std::lock_guard<std::mutex> lock_sched(mtx_sched);
+        for (auto &st : streams)
+        {
+            // the pipe of a moving stream is being replaced; once moved, its counters restarted
+            if (st->migrating)
+                continue;
+            uint64_t frames = st->pipe->GetFrameCount();
+            uint64_t delta = frames >= st->last_frames ? frames - st->last_frames : frames;
+            st->last_frames = frames;
+            total_decode += delta;
+            decode[st->card] += delta / sec;
+
+            int64_t busy = st->busy_us;
+            double npu = npu_on_card() ? (busy - st->last_busy_us) / 1e6 / sec : 0;
+            st->last_busy_us = busy;
+
+            AXStartupStats ss = st->pipe->GetStartupStats();
+            if (!st->startup_reported && ss.first_frame_us >= 0)
+            {
+                char how[32] = "cached parameters";
+                if (!ss.cached)
+                    snprintf(how, sizeof(how), "probe %.0fms", ss.probe_us / 1000.0);
+                printf("stream %d: first frame in %.0fms (open %.0fms, %s)\n", st->index, ss.first_frame_us / 1000.0,
+                       ss.open_us / 1000.0, how);
+                st->startup_reported = true;
+            }
+
+            AXDecodeStats dec = st->pipe->GetDecodeStats();
+            double stall = (dec.stall_us - st->last_stall_us) / 1e6 / sec;
+            if (dec.stalled_packets > st->last_stalled)
+                printf("stream %d: decoder saturated, %llu packets stalled %.2fms avg since last report\n", st->index,
+                       (unsigned long long)(dec.stalled_packets - st->last_stalled),
+                       (dec.stall_us - st->last_stall_us) / 1000.0 / (dec.stalled_packets - st->last_stalled));
+            st->last_stalled = dec.stalled_packets;
+            st->last_stall_us = dec.stall_us;
+
+            AXDemuxStats ds = st->pipe->GetDemuxStats();
+            if (ds.reconnects > 0 || !ds.connected)
+                printf("stream %d: %s, reconnects %llu, downtime %.1fs\n", st->index,
+                       ds.connected ? "connected" : "reconnecting",
+                       (unsigned long long)ds.reconnects, ds.downtime_us / 1e6);
+
+            if (!st->dead)
+                scheduler.UpdateStream(st->index, delta / sec * st->frame_cost, npu, stall);
+        }
+
+        int move_id = -1, move_to = -1;
+        if (!migration_busy)
+        {
+            if (th_migrate.joinable())
+                th_migrate.join();
+            if (scheduler.Evaluate(move_id, move_to, [this](int id)
+                                   { return movable(streams[id].get()); }))
+            {
+                // set here, so the next Report already skips the stream
+                streams[move_id]->migrating = true;
+                migration_busy = true;
+                th_migrate = std::thread(&AXStreamManager::func_th_migrate, this, streams[move_id].get(), move_to);
+            }
+        }
+
+        for (int i = 0; i < codec_groups(); i++)
+        {
+            const AXStreamScheduler::CardLoad &l = scheduler.GetLoad(i);
+            if (codec_backend == ax_codec_backend_sw)
+                printf("host codec: %d streams, decode %.1f fps\n", l.streams, decode[i]);
+            else
+                printf("card %d: %d streams, decode %.1f fps, load %.0f%% (decode %.0f%%, npu %.0f%%, mem %.0f%%)%s\n",
+                       i, l.streams, decode[i], l.load * 100, l.decode * 100, l.npu * 100, l.mem * 100,
+                       l.overloaded > 0 ? " overloaded" : "");
+        }
+
+        uint64_t total_infer = 0;
+        for (size_t i = 0; i < npus.size(); i++)
+        {
+            uint64_t n = npus[i]->infer_count;
+            printf("npu %s %d (%s): infer %.1f fps\n", npus[i]->type == host_device ? "host" : "card", npus[i]->devid,
+                   npus[i]->detector->Name(), (n - last_infer[i]) / sec);
+            total_infer += n - last_infer[i];
+            last_infer[i] = n;
+
+            AXBatchStats bs = npus[i]->batcher.GetStats();
+            if (bs.batches > 0)
+                printf("    batch: avg size %.2f, collect %.2fms, infer %.2fms per batch\n",
+                       (double)bs.frames / bs.batches, bs.collect_us / 1000.0 / bs.batches, bs.infer_us / 1000.0 / bs.batches);
+        }
+        printf("total: %d streams, decode %.1f fps, infer %.1f fps\n", (int)streams.size(), total_decode / sec, total_infer / sec);
+    }
+
+    int GetStreamCount() const { return (int)streams.size(); }
+
+    void Deinit()
+    {
+        loop_exit = true;
+        if (th_migrate.joinable())
+            th_migrate.join();
+        for (auto &npu : npus)
+            npu->batcher.Stop();
+        for (auto &st : streams)
+        {
+            if (st->th_infer.joinable())
+                st->th_infer.join();
+            st->pipe->Deinit();
+        }
+        streams.clear();
+
+        for (auto &npu : npus)
+        {
+            if (npu->detector)
+                npu->detector->Deinit();
+        }
+        npus.clear();
+
+        if (host_inited)
+            ax_dev_sys_deinit(host_device, -1);
+        host_inited = false;
+        for (int i = 0; i < ax_devices.devices.count; i++)
+            ax_dev_sys_deinit(axcl_device, i);
+        memset(&ax_devices, 0, sizeof(ax_devices_t));
+    }
+};
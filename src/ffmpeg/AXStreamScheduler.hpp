@@ -0,0 +1,230 @@
+#pragma once
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <vector>
+#include <stdint.h>
+
+// Placement policy for AXStreamManager: which card decodes/encodes a stream and,
+// when NPUs sit on the cards, runs its detector.
+//
+// Load of a card is the largest of
+//   decode: 1080p-equivalent decode fps of its streams / decode_capacity
+//   npu:    busy fraction of the card NPU attributed to its streams
+//   mem:    estimated surface memory of its streams / mem_budget (0 = not checked)
+// A card whose decoders spend more than stall_limit of the time blocked on
+// EAGAIN is saturated whatever the numbers say.
+//
+// New streams go to the card with the lowest projected load. A card above
+// high_watermark for overload_reports evaluations in a row gives away one stream
+// per evaluation to the least loaded card, provided that card stays below
+// low_watermark afterwards. The policy only decides; the manager moves the stream.
+class AXStreamScheduler
+{
+public:
+    struct Config
+    {
+        double decode_capacity = 480; // 1080p frames per second one card decodes
+        int64_t mem_budget = 0;       // bytes of surfaces per card, 0 ignores memory
+        double high_watermark = 0.9;
+        double low_watermark = 0.7;
+        double stall_limit = 0.25;
+        int overload_reports = 3;
+    };
+
+    struct CardLoad
+    {
+        int streams = 0;
+        double decode = 0; // fractions of the capacity, see above
+        double npu = 0;
+        double mem = 0;
+        double stall = 0; // worst stream
+        double load = 0;
+        int overloaded = 0; // consecutive evaluations above the high watermark
+    };
+
+private:
+    struct StreamLoad
+    {
+        int card = 0;
+        double fps = 0; // 1080p-equivalent decode fps
+        double npu = 0; // busy fraction of the card NPU
+        int64_t mem = 0;
+        double stall = 0;
+    };
+
+    Config cfg;
+    std::vector<CardLoad> cards;
+    std::map<int, StreamLoad> streams;
+
+    double mem_ratio(int64_t bytes) const
+    {
+        return cfg.mem_budget > 0 ? (double)bytes / cfg.mem_budget : 0.0;
+    }
+
+    // load of card if extra were added to it
+    double projected(int card, const StreamLoad &extra) const
+    {
+        double decode = 0, npu = 0;
+        int64_t mem = 0;
+        for (auto &kv : streams)
+        {
+            if (kv.second.card != card)
+                continue;
+            decode += kv.second.fps;
+            npu += kv.second.npu;
+            mem += kv.second.mem;
+        }
+        decode += extra.fps;
+        npu += extra.npu;
+        mem += extra.mem;
+        return std::max(std::max(decode / cfg.decode_capacity, npu), mem_ratio(mem));
+    }
+
+    void recompute()
+    {
+        for (auto &c : cards)
+        {
+            int overloaded = c.overloaded;
+            c = CardLoad();
+            c.overloaded = overloaded;
+        }
+        std::vector<int64_t> mem(cards.size(), 0);
+        for (auto &kv : streams)
+        {
+            CardLoad &c = cards[kv.second.card];
+            c.streams++;
+            c.decode += kv.second.fps / cfg.decode_capacity;
+            c.npu += kv.second.npu;
+            c.stall = std::max(c.stall, kv.second.stall);
+            mem[kv.second.card] += kv.second.mem;
+        }
+        for (size_t i = 0; i < cards.size(); i++)
+        {
+            cards[i].mem = mem_ratio(mem[i]);
+            cards[i].load = std::max(std::max(cards[i].decode, cards[i].npu), cards[i].mem);
+        }
+    }
+
+public:
+    void Init(int num_cards, const Config &_cfg)
+    {
+        cfg = _cfg;
+        if (cfg.decode_capacity <= 0)
+            cfg.decode_capacity = Config().decode_capacity;
+        cards.assign(num_cards, CardLoad());
+        streams.clear();
+    }
+
+    const Config &GetConfig() const { return cfg; }
+
+    // card for a new stream with the estimated cost, -1 without cards
+    int Place(double fps, int64_t mem) const
+    {
+        StreamLoad extra;
+        extra.fps = fps;
+        extra.mem = mem;
+        int best = -1;
+        double best_load = 0;
+        for (int i = 0; i < (int)cards.size(); i++)
+        {
+            double load = projected(i, extra);
+            // ties go to the card with fewer streams, then the lower index
+            if (best < 0 || load < best_load - 1e-9 ||
+                (load < best_load + 1e-9 && cards[i].streams < cards[best].streams))
+            {
+                best = i;
+                best_load = load;
+            }
+        }
+        return best;
+    }
+
+    void AddStream(int id, int card, double fps, int64_t mem)
+    {
+        StreamLoad &s = streams[id];
+        s.card = card;
+        s.fps = fps;
+        s.mem = mem;
+        recompute();
+    }
+
+    void RemoveStream(int id)
+    {
+        streams.erase(id);
+        recompute();
+    }
+
+    // measured since the last report; npu is 0 when the stream's NPU is not on its card
+    void UpdateStream(int id, double fps, double npu, double stall)
+    {
+        auto it = streams.find(id);
+        if (it == streams.end())
+            return;
+        it->second.fps = fps;
+        it->second.npu = npu;
+        it->second.stall = stall;
+    }
+
+    void MoveStream(int id, int card)
+    {
+        auto it = streams.find(id);
+        if (it == streams.end())
+            return;
+        it->second.card = card;
+        it->second.stall = 0;
+        recompute();
+    }
+
+    // refresh the card loads and propose at most one migration; movable tells which streams may move
+    bool Evaluate(int &stream_id, int &to_card, const std::function<bool(int)> &movable)
+    {
+        recompute();
+        for (auto &c : cards)
+        {
+            bool over = c.load > cfg.high_watermark || c.stall > cfg.stall_limit;
+            c.overloaded = over ? c.overloaded + 1 : 0;
+        }
+
+        for (int from = 0; from < (int)cards.size(); from++)
+        {
+            if (cards[from].overloaded < cfg.overload_reports)
+                continue;
+
+            // relieve the most while keeping the target under the low watermark
+            int best = -1, target = -1;
+            double best_fps = -1;
+            for (auto &kv : streams)
+            {
+                if (kv.second.card != from || !movable(kv.first))
+                    continue;
+                for (int to = 0; to < (int)cards.size(); to++)
+                {
+                    if (to == from || cards[to].overloaded > 0)
+                        continue;
+                    if (projected(to, kv.second) > cfg.low_watermark)
+                        continue;
+                    double cost = kv.second.fps / cfg.decode_capacity + kv.second.npu;
+                    if (cost > best_fps || (cost == best_fps && target >= 0 && cards[to].load < cards[target].load))
+                    {
+                        best = kv.first;
+                        target = to;
+                        best_fps = cost;
+                    }
+                }
+            }
+            // cool down either way, an overloaded card with nowhere to go is retried later
+            cards[from].overloaded = 0;
+            if (best >= 0)
+            {
+                stream_id = best;
+                to_card = target;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const CardLoad &GetLoad(int card) const { return cards[card]; }
+    int GetCardCount() const { return (int)cards.size(); }
+};
@@ -0,0 +1,192 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ffmpeg/AXFFmpegPipe.hpp"
+#include "infer/AXDetector.hpp"
+#include "utils/logger.h"
+#include "utils/timer.hpp"
+#include "utils/trace.hpp"
+#include "utils/metrics.hpp"
+#include "../libdet/include/libdet.h"
+
+struct AXBatchStats
+{
+    uint64_t batches = 0;
+    uint64_t frames = 0;
+    int64_t collect_us = 0; // time from first frame in a batch until dispatch
+    int64_t infer_us = 0;   // time spent inside the detector
+};
+
+// Collects the newest frame of several pipes into one batch, bounded by
+// max_batch frames or max_wait_ms after the first frame arrived, runs the
+// batch on one NPU and scatters the results back by stream slot.
+// AXDetector only exposes single image Detect, so a batch is executed back to
+// back under a single hold of the NPU lock; the collection and scatter side does
+// not depend on that and stays the same for a batch capable backend.
+class AXDetBatcher
+{
+public:
+    using ResultCallback = std::function<void(int slot, const ax_det_result_t &result)>;
+
+private:
+    AXDetector *detector = nullptr;
+    std::mutex *mtx_det = nullptr;
+    int max_batch = 4;
+    int max_wait_ms = 10;
+
+    std::vector<AXFFmpegPipe *> pipes;
+    std::vector<AXHistogram *> det_latency; // per slot, may be nullptr
+    ResultCallback result_cb = nullptr;
+
+    std::thread th_batch;
+    volatile bool loop_exit = false;
+
+    std::mutex mtx_stats;
+    AXBatchStats stats;
+
+    void func_th_batch()
+    {
+        AXTrace::SetThreadName("batch");
+        std::vector<int> slots;
+        std::vector<cv::Mat> frames;
+        std::vector<int64_t> pts;
+        std::vector<char> taken(pipes.size(), 0);
+        std::vector<ax_det_result_t> results(max_batch);
+        size_t next = 0;
+
+        while (!loop_exit)
+        {
+            slots.clear();
+            frames.clear();
+            pts.clear();
+            std::fill(taken.begin(), taken.end(), 0);
+            int64_t t_first = 0;
+
+            // round robin from a rotating start so no stream is always last
+            while (!loop_exit && (int)slots.size() < max_batch)
+            {
+                bool got = false;
+                for (size_t n = 0; n < pipes.size() && (int)slots.size() < max_batch; n++)
+                {
+                    size_t i = (next + n) % pipes.size();
+                    if (taken[i])
+                        continue;
+                    // GetFrame reuses one Mat per pipe, so take at most one frame per pipe per batch
+                    AXFrameInfo info;
+                    cv::Mat img = pipes[i]->GetFrame(info, 0);
+                    if (img.empty())
+                        continue;
+                    pts.push_back(info.pts);
+                    if (slots.empty())
+                        t_first = ax_now_us();
+                    taken[i] = 1;
+                    slots.push_back((int)i);
+                    frames.push_back(img);
+                    got = true;
+                }
+                next = (next + 1) % pipes.size();
+
+                if (slots.size() == pipes.size())
+                    break;
+                if (!slots.empty() && ax_now_us() - t_first >= max_wait_ms * 1000)
+                    break;
+                if (!got)
+                    std::this_thread::sleep_for(std::chrono::microseconds(500));
+            }
+
+            if (slots.empty())
+                continue;
+
+            int64_t t_infer = ax_now_us();
+            std::vector<int> rets(slots.size(), 0);
+            {
+                std::unique_lock<std::mutex> lock;
+                if (mtx_det)
+                    lock = std::unique_lock<std::mutex>(*mtx_det);
+                for (size_t k = 0; k < slots.size(); k++)
+                {
+                    ax_det_img_t img;
+                    img.data = frames[k].data;
+                    img.width = frames[k].cols;
+                    img.height = frames[k].rows;
+                    img.channels = frames[k].channels();
+                    img.stride = frames[k].step;
+                    AX_TRACE_SCOPE("ax_det", pts[k]);
+                    int64_t t0 = det_latency[slots[k]] ? ax_now_us() : 0;
+                    rets[k] = detector->Detect(img, results[k]);
+                    if (t0)
+                        det_latency[slots[k]]->Observe(ax_now_us() - t0);
+                }
+            }
+            int64_t t_done = ax_now_us();
+
+            for (size_t k = 0; k < slots.size(); k++)
+            {
+                if (rets[k] != 0)
+                {
+                    SAMPLE_LOG_E("%s detect failed %d on slot %d", detector->Name(), rets[k], slots[k]);
+                    continue;
+                }
+                if (result_cb)
+                    result_cb(slots[k], results[k]);
+            }
+
+            std::lock_guard<std::mutex> lock(mtx_stats);
+            stats.batches++;
+            stats.frames += slots.size();
+            stats.collect_us += t_infer - t_first;
+            stats.infer_us += t_done - t_infer;
+        }
+    }
+
+public:
+    AXDetBatcher() = default;
+    ~AXDetBatcher()
+    {
+        Stop();
+    }
+
+    // mtx_det is optional, pass it when the detector is shared with other callers
+    void Init(AXDetector *_detector, std::mutex *_mtx_det, int _max_batch, int _max_wait_ms)
+    {
+        detector = _detector;
+        mtx_det = _mtx_det;
+        max_batch = _max_batch > 0 ? _max_batch : 1;
+        max_wait_ms = _max_wait_ms >= 0 ? _max_wait_ms : 0;
+    }
+
+    // returns the slot the results of this pipe are reported with;
+    // det_latency, if given, receives the Detect time of every frame of this pipe
+    int AddStream(AXFFmpegPipe *pipe, AXHistogram *_det_latency = nullptr)
+    {
+        pipes.push_back(pipe);
+        det_latency.push_back(_det_latency);
+        return (int)pipes.size() - 1;
+    }
+
+    void Start(ResultCallback _result_cb)
+    {
+        if (pipes.empty() || !detector)
+            return;
+        result_cb = _result_cb;
+        loop_exit = false;
+        th_batch = std::thread(&AXDetBatcher::func_th_batch, this);
+    }
+
+    void Stop()
+    {
+        loop_exit = true;
+        if (th_batch.joinable())
+            th_batch.join();
+    }
+
+    AXBatchStats GetStats()
+    {
+        std::lock_guard<std::mutex> lock(mtx_stats);
+        return stats;
+    }
+};
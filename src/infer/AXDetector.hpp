@@ -0,0 +1,169 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <string.h>
+#include <stdint.h>
+
+#include "utils/logger.h"
+#include "../libdet/include/libdet.h"
+
+// Detector backend seen by the pipeline. Input is the frame from
+// AXFFmpegPipe::GetFrame, output is in the coordinates of that frame, so
+// every backend can feed PushDetResult unchanged.
+class AXDetector
+{
+public:
+    virtual ~AXDetector() = default;
+
+    // dev_type/devid in init_info select the NPU, backends without one ignore them
+    virtual int Init(const ax_det_init_t &init_info) = 0;
+    virtual int Detect(const ax_det_img_t &img, ax_det_result_t &result) = 0;
+    virtual void Deinit() = 0;
+    // false for backends that do not run on an AXERA NPU
+    virtual bool NeedNpu() const { return true; }
+    // true when Detect may run on several threads at once, callers then skip the NPU lock
+    virtual bool Reentrant() const { return false; }
+    virtual const char *Name() const = 0;
+
+    // "libdet" or "mock", nullptr for an unknown name; mock_latency_ms only applies to mock
+    static std::unique_ptr<AXDetector> Create(const std::string &backend, int mock_latency_ms = 20);
+};
+
+// libdet on a host NPU or an axcl card
+class AXLibDetDetector : public AXDetector
+{
+private:
+    ax_det_handle_t handle{};
+    bool inited = false;
+
+public:
+    ~AXLibDetDetector() override
+    {
+        Deinit();
+    }
+
+    int Init(const ax_det_init_t &init_info) override
+    {
+        ax_det_init_t info = init_info;
+        int ret = ax_det_init(&info, &handle);
+        if (ret != ax_det_errcode_success)
+        {
+            SAMPLE_LOG_E("ax_det_init failed %d", ret);
+            return -1;
+        }
+        inited = true;
+        return 0;
+    }
+
+    int Detect(const ax_det_img_t &img, ax_det_result_t &result) override
+    {
+        ax_det_img_t in = img;
+        memset(&result, 0, sizeof(result));
+        return ax_det(handle, &in, &result) == ax_det_errcode_success ? 0 : -1;
+    }
+
+    void Deinit() override
+    {
+        if (inited)
+            ax_det_deinit(handle);
+        inited = false;
+    }
+
+    const char *Name() const override { return "libdet"; }
+};
+
+// CPU stand-in with no device at all: sleeps for a fixed latency and returns a
+// deterministic set of boxes sliding across the image, so decode, OSD and
+// encode can be load tested on any Linux host. The same call sequence always
+// yields the same results. Calls from several infer threads overlap instead of
+// queueing on one lock, so one shared mock does not cap the process at
+// 1000 / latency_ms frames per second.
+class AXMockDetector : public AXDetector
+{
+public:
+    struct Config
+    {
+        int latency_ms = 20;
+        int num_objs = 4;
+        int num_classes = 80;
+    };
+
+private:
+    Config cfg;
+    int num_kpt = 0;
+    std::atomic<uint64_t> calls{0};
+
+public:
+    AXMockDetector() = default;
+    explicit AXMockDetector(const Config &_cfg) : cfg(_cfg) {}
+
+    int Init(const ax_det_init_t &init_info) override
+    {
+        if (init_info.num_classes > 0)
+            cfg.num_classes = init_info.num_classes;
+        num_kpt = init_info.num_kpt;
+        calls = 0;
+        return 0;
+    }
+
+    int Detect(const ax_det_img_t &img, ax_det_result_t &result) override
+    {
+        memset(&result, 0, sizeof(result));
+        uint64_t call = calls++;
+        if (cfg.latency_ms > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(cfg.latency_ms));
+
+        const int cap = (int)(sizeof(result.objects) / sizeof(result.objects[0]));
+        const int kpt_cap = (int)(sizeof(result.objects[0].kpts) / sizeof(result.objects[0].kpts[0]));
+        int n = std::min(cfg.num_objs, cap);
+        float bw = img.width / 8.f, bh = img.height / 6.f;
+        for (int i = 0; i < n; i++)
+        {
+            ax_det_obj_t &obj = result.objects[i];
+            // each box walks its own lane, 2 px per call, wrapping at the right edge
+            float span = img.width - bw;
+            float x = span > 0 ? (float)((call * 2 + (uint64_t)i * 97) % (uint64_t)span) : 0.f;
+            float y = (img.height - bh) * (i + 0.5f) / n;
+            obj.box.x = x;
+            obj.box.y = std::max(0.f, y);
+            obj.box.w = bw;
+            obj.box.h = bh;
+            obj.label = i % cfg.num_classes;
+            obj.score = 0.9f - 0.1f * (i % 5);
+            obj.num_kpt = std::min(num_kpt, kpt_cap);
+            for (int j = 0; j < obj.num_kpt; j++)
+            {
+                obj.kpts[j].x = obj.box.x + obj.box.w * (j + 1) / (obj.num_kpt + 1);
+                obj.kpts[j].y = obj.box.y + obj.box.h / 2;
+            }
+        }
+        result.num_objs = n;
+        return 0;
+    }
+
+    void Deinit() override {}
+
+    bool NeedNpu() const override { return false; }
+
+    bool Reentrant() const override { return true; }
+
+    const char *Name() const override { return "mock"; }
+};
+
+inline std::unique_ptr<AXDetector> AXDetector::Create(const std::string &backend, int mock_latency_ms)
+{
+    if (backend == "libdet")
+        return std::unique_ptr<AXDetector>(new AXLibDetDetector());
+    if (backend == "mock")
+    {
+        AXMockDetector::Config cfg;
+        cfg.latency_ms = mock_latency_ms;
+        return std::unique_ptr<AXDetector>(new AXMockDetector(cfg));
+    }
+    SAMPLE_LOG_E("unknown detector backend %s", backend.c_str());
+    return nullptr;
+}
@@ -0,0 +1,282 @@
+#pragma once
+#include <algorithm>
+#include <vector>
+#include <string.h>
+#include <stdint.h>
+
+#include "../libdet/include/libdet.h"
+
+// ByteTrack style multi-object tracker.
+//
+// Boxes are tracked as (cx, cy, w, h) with an independent constant velocity
+// Kalman filter per component, so every filter is a 2x2 problem. Track state is
+// kept as structure of arrays, one array per quantity, so Predict() is a few
+// tight loops over contiguous floats.
+//
+// Call Predict() once per frame. On frames the detector ran, follow it with
+// Update(); on skipped frames the predicted boxes are used as they are.
+// Association is greedy IoU, high score detections first, then low score
+// detections against the tracks that are still unmatched.
+class AXTracker
+{
+public:
+    struct Config
+    {
+        float high_thresh = 0.5f; // detections above start and keep tracks
+        float low_thresh = 0.1f;  // detections above only keep existing tracks alive
+        float match_iou = 0.3f;
+        int max_age = 30;        // frames a track survives without a detection
+        int max_coast = 5;       // frames a track is still reported without a detection
+        int min_hits = 1;        // detections before a track is reported
+        float q_pos = 1.0f;      // process noise
+        float q_vel = 0.05f;
+        float r_meas = 4.0f;     // measurement noise
+    };
+
+private:
+    static constexpr int DIMS = 4; // cx, cy, w, h
+
+    Config cfg;
+    int next_id = 1;
+
+    // structure of arrays, index = track slot
+    std::vector<float> pos[DIMS];
+    std::vector<float> vel[DIMS];
+    std::vector<float> p00[DIMS], p01[DIMS], p11[DIMS];
+    std::vector<int> ids;
+    std::vector<int> labels;
+    std::vector<float> scores;
+    std::vector<int> hits;
+    std::vector<int> misses;         // frames since last detection
+    std::vector<ax_det_obj_t> last_obj; // cold data: keypoints and original box
+
+    // scratch, kept to avoid allocations per frame
+    struct Pair
+    {
+        float iou;
+        int track;
+        int det;
+    };
+    std::vector<Pair> pairs;
+    std::vector<char> track_used, det_used;
+
+    int size() const { return (int)ids.size(); }
+
+    static float iou(float ax, float ay, float aw, float ah, float bx, float by, float bw, float bh)
+    {
+        float x1 = std::max(ax - aw / 2, bx - bw / 2);
+        float y1 = std::max(ay - ah / 2, by - bh / 2);
+        float x2 = std::min(ax + aw / 2, bx + bw / 2);
+        float y2 = std::min(ay + ah / 2, by + bh / 2);
+        float inter = std::max(0.f, x2 - x1) * std::max(0.f, y2 - y1);
+        float uni = aw * ah + bw * bh - inter;
+        return uni > 0 ? inter / uni : 0.f;
+    }
+
+    void remove(int i)
+    {
+        int last = size() - 1;
+        for (int d = 0; d < DIMS; d++)
+        {
+            pos[d][i] = pos[d][last];
+            vel[d][i] = vel[d][last];
+            p00[d][i] = p00[d][last];
+            p01[d][i] = p01[d][last];
+            p11[d][i] = p11[d][last];
+            pos[d].pop_back();
+            vel[d].pop_back();
+            p00[d].pop_back();
+            p01[d].pop_back();
+            p11[d].pop_back();
+        }
+        ids[i] = ids[last];
+        labels[i] = labels[last];
+        scores[i] = scores[last];
+        hits[i] = hits[last];
+        misses[i] = misses[last];
+        last_obj[i] = last_obj[last];
+        ids.pop_back();
+        labels.pop_back();
+        scores.pop_back();
+        hits.pop_back();
+        misses.pop_back();
+        last_obj.pop_back();
+    }
+
+    void add(const ax_det_obj_t &obj)
+    {
+        float m[DIMS] = {obj.box.x + obj.box.w / 2, obj.box.y + obj.box.h / 2, obj.box.w, obj.box.h};
+        for (int d = 0; d < DIMS; d++)
+        {
+            pos[d].push_back(m[d]);
+            vel[d].push_back(0.f);
+            p00[d].push_back(cfg.r_meas);
+            p01[d].push_back(0.f);
+            p11[d].push_back(cfg.r_meas * 10);
+        }
+        ids.push_back(next_id++);
+        labels.push_back(obj.label);
+        scores.push_back(obj.score);
+        hits.push_back(1);
+        misses.push_back(0);
+        last_obj.push_back(obj);
+    }
+
+    void correct(int i, const ax_det_obj_t &obj)
+    {
+        float m[DIMS] = {obj.box.x + obj.box.w / 2, obj.box.y + obj.box.h / 2, obj.box.w, obj.box.h};
+        for (int d = 0; d < DIMS; d++)
+        {
+            float s = p00[d][i] + cfg.r_meas;
+            float k0 = p00[d][i] / s;
+            float k1 = p01[d][i] / s;
+            float y = m[d] - pos[d][i];
+            pos[d][i] += k0 * y;
+            vel[d][i] += k1 * y;
+            float n00 = (1 - k0) * p00[d][i];
+            float n01 = (1 - k0) * p01[d][i];
+            float n11 = p11[d][i] - k1 * p01[d][i];
+            p00[d][i] = n00;
+            p01[d][i] = n01;
+            p11[d][i] = n11;
+        }
+        labels[i] = obj.label;
+        scores[i] = obj.score;
+        hits[i]++;
+        misses[i] = 0;
+        last_obj[i] = obj;
+    }
+
+    // greedy IoU association of detections [with score in (lo, hi]] to unused tracks
+    void associate(const ax_det_result_t &det, float lo, float hi, bool only_confirmed)
+    {
+        pairs.clear();
+        for (int t = 0; t < size(); t++)
+        {
+            if (track_used[t] || (only_confirmed && hits[t] < cfg.min_hits))
+                continue;
+            for (int k = 0; k < det.num_objs; k++)
+            {
+                const ax_det_obj_t &o = det.objects[k];
+                if (det_used[k] || o.score <= lo || o.score > hi || o.label != labels[t])
+                    continue;
+                float v = iou(pos[0][t], pos[1][t], pos[2][t], pos[3][t],
+                              o.box.x + o.box.w / 2, o.box.y + o.box.h / 2, o.box.w, o.box.h);
+                if (v >= cfg.match_iou)
+                    pairs.push_back({v, t, k});
+            }
+        }
+
+        std::sort(pairs.begin(), pairs.end(), [](const Pair &a, const Pair &b)
+                  { return a.iou > b.iou; });
+        for (auto &p : pairs)
+        {
+            if (track_used[p.track] || det_used[p.det])
+                continue;
+            track_used[p.track] = 1;
+            det_used[p.det] = 1;
+            correct(p.track, det.objects[p.det]);
+        }
+    }
+
+public:
+    AXTracker() = default;
+
+    void Init(const Config &_cfg)
+    {
+        cfg = _cfg;
+        Reset();
+    }
+
+    void Reset()
+    {
+        for (int d = 0; d < DIMS; d++)
+        {
+            pos[d].clear();
+            vel[d].clear();
+            p00[d].clear();
+            p01[d].clear();
+            p11[d].clear();
+        }
+        ids.clear();
+        labels.clear();
+        scores.clear();
+        hits.clear();
+        misses.clear();
+        last_obj.clear();
+    }
+
+    // advance all tracks by one frame and drop the ones too old
+    void Predict()
+    {
+        int n = size();
+        for (int d = 0; d < DIMS; d++)
+        {
+            float *x = pos[d].data(), *v = vel[d].data();
+            float *a = p00[d].data(), *b = p01[d].data(), *c = p11[d].data();
+            for (int i = 0; i < n; i++)
+            {
+                x[i] += v[i];
+                a[i] += 2 * b[i] + c[i] + cfg.q_pos;
+                b[i] += c[i];
+                c[i] += cfg.q_vel;
+            }
+        }
+        for (int i = 0; i < n; i++)
+            misses[i]++;
+
+        for (int i = size() - 1; i >= 0; i--)
+        {
+            if (misses[i] > cfg.max_age || pos[2][i] <= 1 || pos[3][i] <= 1)
+                remove(i);
+        }
+    }
+
+    // detections of the current frame, after Predict()
+    void Update(const ax_det_result_t &det)
+    {
+        track_used.assign(size(), 0);
+        det_used.assign(det.num_objs, 0);
+
+        associate(det, cfg.high_thresh, 1.f, false);
+        associate(det, cfg.low_thresh, cfg.high_thresh, true);
+
+        for (int k = 0; k < det.num_objs; k++)
+        {
+            if (!det_used[k] && det.objects[k].score > cfg.high_thresh)
+                add(det.objects[k]);
+        }
+    }
+
+    // confirmed tracks of the current frame as a detection result, keypoints follow
+    // the box motion; track_ids (optional) must hold as many entries as out.objects
+    void GetResult(ax_det_result_t &out, int *track_ids = nullptr) const
+    {
+        const int cap = (int)(sizeof(out.objects) / sizeof(out.objects[0]));
+        out.num_objs = 0;
+        for (int i = 0; i < size() && out.num_objs < cap; i++)
+        {
+            if (hits[i] < cfg.min_hits || misses[i] > cfg.max_coast)
+                continue;
+
+            ax_det_obj_t &o = out.objects[out.num_objs];
+            o = last_obj[i];
+            float dx = pos[0][i] - (o.box.x + o.box.w / 2);
+            float dy = pos[1][i] - (o.box.y + o.box.h / 2);
+            o.box.w = pos[2][i];
+            o.box.h = pos[3][i];
+            o.box.x = pos[0][i] - o.box.w / 2;
+            o.box.y = pos[1][i] - o.box.h / 2;
+            o.label = labels[i];
+            o.score = scores[i];
+            for (int j = 0; j < o.num_kpt; j++)
+            {
+                o.kpts[j].x += dx;
+                o.kpts[j].y += dy;
+            }
+            if (track_ids)
+                track_ids[out.num_objs] = ids[i];
+            out.num_objs++;
+        }
+    }
+};
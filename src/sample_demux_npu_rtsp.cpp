@@ -1,4 +1,5 @@
 #include "ffmpeg/AXFFmpegPipe.hpp"
+#include "infer/AXDetector.hpp"
 
 #include "utils/cmdline.hpp"
 #include <unistd.h>
@@ -14,11 +15,95 @@ void sigint_handler(int signum)
     b_continue = false;
 }
 
+// kill -USR1 <pid> switches tracing on and off while running
+void sigusr1_handler(int signum)
+{
+    AXTrace::Toggle();
+}
+
+// kill -USR2 <pid> cycles the log level error -> warn -> info -> debug -> error
+void sigusr2_handler(int signum)
+{
+    AXLogger::Get().SetLevel((AXLogLevel)((AXLogger::Get().GetLevel() + 1) % 4));
+}
+
 int main(int argc, char *argv[])
 {
     signal(SIGPIPE, SIG_IGN);
     signal(SIGINT, sigint_handler);
 
+    ax_det_init_t init_info;
+    memset(&init_info, 0, sizeof(init_info));
+
+    cmdline::parser a;
+    a.add<std::string>("url", 'u', "url", true, "");
+    a.add<std::string>("output", 'o', "rtsp or xxx.mp4, none for analytics only", false, "1.mp4");
+    a.add<std::string>("model", 'm', "model, not needed by the mock backend", false, "");
+    a.add<std::string>("backend", 0, "detector backend, mock needs no NPU", false, "libdet",
+                       cmdline::oneof<std::string>("libdet", "mock"));
+    a.add<int>("mock_latency", 0, "latency in ms of each mock detection", false, 20);
+    a.add<std::string>("codec", 0, "codec backend, sw runs stock libavcodec on the host", false, "axcl",
+                       cmdline::oneof<std::string>("axcl", "sw"));
+    a.add<std::string>("hw_frames", 0, "keep decoded frames on the card: off, axmm, or emulated to test the path without a card", false, "off",
+                       cmdline::oneof<std::string>("off", "axmm", "emulated"));
+    a.add<std::string>("output_mode", 0, "encode draws boxes and re-encodes, passthrough remuxes the input packets with detections as SEI", false, "encode",
+                       cmdline::oneof<std::string>("encode", "passthrough"));
+    a.add<std::string>("sinks", 0, "extra outputs \"[clean,][WxH=]url;...\", same picture and size share one encoder", false, "");
+    a.add<std::string>("record", 0, "record clips around matching detections to <prefix>_<time>.mp4 without re-encoding, empty disables", false, "");
+    a.add<std::string>("record_source", 0, "packets to record: input stream, or encoder output with boxes drawn", false, "input",
+                       cmdline::oneof<std::string>("input", "encoder"));
+    a.add<double>("pre_roll", 0, "seconds kept before a trigger, rounded out to a keyframe", false, 5);
+    a.add<double>("post_roll", 0, "seconds recorded after the last matching detection", false, 5);
+    a.add<int>("record_mb", 0, "memory budget in MB per stream for the pre-roll ring and again for the writer backlog", false, 32);
+    a.add<std::string>("record_labels", 0, "comma separated class ids that trigger recording, empty for any", false, "");
+    a.add<double>("record_score", 0, "minimum score of a triggering detection", false, 0.5);
+    a.add<std::string>("decode", 0, "frames to decode: all, nonref skips non-reference frames, key decodes keyframes only", false, "all",
+                       cmdline::oneof<std::string>("all", "nonref", "key"));
+    a.add<double>("sample_fps", 0, "deliver at most this many decoded frames per second, 0 delivers all", false, 0);
+    a.add<int>("reconnect", 0, "reconnect network inputs that drop, 0 stops the stream instead", false, 1);
+    a.add<int>("io_timeout", 0, "timeout in ms of a single network open/read before it counts as dropped", false, 5000);
+    a.add<std::string>("stream_cache", 0, "file caching codec parameters per url, streams found there open without probing", false, "");
+    a.add<std::string>("trace", 0, "record per-stage spans from the start and write them as Chrome trace JSON to this file at exit; without it kill -USR1 <pid> starts / stops recording into trace_<pid>.json", false, "");
+    a.add<std::string>("log_level", 0, "log level, kill -USR2 <pid> cycles it at runtime", false, "info",
+                       cmdline::oneof<std::string>("error", "warn", "info", "debug"));
+    a.add<int>("metrics_port", 0, "serve Prometheus metrics on http://127.0.0.1:<port>/metrics, 0 disables", false, 0);
+    a.add<int>("card", 0, "axcl card for decode/encode, and for the detector when there is no host NPU", false, 0);
+    a.add<int>("model_w", 0, "model input width, letterbox on the decode thread, 0 disables", false, 0);
+    a.add<int>("model_h", 0, "model input height", false, 0);
+    a.add<int>("det_delay", 0, "frames held before encoding so boxes match their frame, 0 draws the latest result", false, 0);
+    a.add<int>("det_interval", 0, "run the detector every N frames and track in between, 1 disables tracking", false, 1);
+    a.add<int>("enc_queue", 0, "encoder frame queue size", false, 8);
+    a.add<std::string>("enc_policy", 0, "encoder queue overflow policy", false, "block",
+                       cmdline::oneof<std::string>("block", "drop_oldest", "drop_non_ref"));
+    a.parse_check(argc, argv);
+
+    std::string url = a.get<std::string>("url");
+    std::string output = a.get<std::string>("output");
+    std::string trace_path = a.get<std::string>("trace");
+    if (!trace_path.empty())
+        AXTrace::Enable(true);
+    else
+        trace_path = "trace_" + std::to_string(getpid()) + ".json";
+    signal(SIGUSR1, sigusr1_handler);
+
+    AXLogger::Get().SetLevel(a.get<std::string>("log_level").c_str());
+    signal(SIGUSR2, sigusr2_handler);
+    AXLogger::Get().Start();
+
+    AXMetricsServer metrics_server;
+    if (a.get<int>("metrics_port") > 0 && metrics_server.Start(a.get<int>("metrics_port")) == 0)
+        printf("metrics: http://127.0.0.1:%d/metrics\n", a.get<int>("metrics_port"));
+
+    std::unique_ptr<AXDetector> detector = AXDetector::Create(a.get<std::string>("backend"), a.get<int>("mock_latency"));
+    if (!detector)
+        return -1;
+    bool need_npu = detector->NeedNpu();
+    if (need_npu && a.get<std::string>("model").empty())
+    {
+        printf("-m is required for the libdet backend\n%s", a.usage().c_str());
+        return -1;
+    }
+
     ax_devices_t ax_devices;
     memset(&ax_devices, 0, sizeof(ax_devices_t));
     if (ax_dev_enum_devices(&ax_devices) != 0)
@@ -27,34 +112,28 @@ int main(int argc, char *argv[])
         return -1;
     }
 
-    if (ax_devices.host.available)
+    if (need_npu && ax_devices.host.available)
     {
         ax_dev_sys_init(host_device, -1);
     }
 
+    int card = a.get<int>("card");
+    if (ax_devices.devices.count > 0 && (card < 0 || card >= ax_devices.devices.count))
+    {
+        printf("card %d out of range, %d card(s) found\n", card, ax_devices.devices.count);
+        return -1;
+    }
     if (ax_devices.devices.count > 0)
     {
-        ax_dev_sys_init(axcl_device, 0);
+        ax_dev_sys_init(axcl_device, card);
     }
 
-    if (!ax_devices.host.available && ax_devices.devices.count == 0)
+    if (need_npu && !ax_devices.host.available && ax_devices.devices.count == 0)
     {
         printf("no device available\n");
         return -1;
     }
 
-    ax_det_init_t init_info;
-    memset(&init_info, 0, sizeof(init_info));
-
-    cmdline::parser a;
-    a.add<std::string>("url", 'u', "url", true, "");
-    a.add<std::string>("output", 'o', "rtsp or xxx.mp4", false, "1.mp4");
-    a.add<std::string>("model", 'm', "model", true, "");
-    a.parse_check(argc, argv);
-
-    std::string url = a.get<std::string>("url");
-    std::string output = a.get<std::string>("output");
-
     if (ax_devices.host.available)
     {
         init_info.dev_type = host_device;
@@ -62,7 +141,7 @@ int main(int argc, char *argv[])
     else if (ax_devices.devices.count > 0)
     {
         init_info.dev_type = axcl_device;
-        init_info.devid = 0;
+        init_info.devid = card;
     }
     init_info.num_classes = 80;
     init_info.num_kpt = 0;
@@ -70,34 +149,102 @@ int main(int argc, char *argv[])
 
     sprintf(init_info.model_path, "%s", a.get<std::string>("model").c_str());
     init_info.threshold = 0.25;
-    ax_det_handle_t handle;
-    int ret = ax_det_init(&init_info, &handle);
-    if (ret != ax_det_errcode_success)
+    int ret = detector->Init(init_info);
+    if (ret != 0)
     {
-        printf("ax_det_init failed\n");
+        printf("%s init failed\n", detector->Name());
         return -1;
     }
 
+    AXOverflowPolicy enc_policy = ax_overflow_block;
+    if (a.get<std::string>("enc_policy") == "drop_oldest")
+        enc_policy = ax_overflow_drop_oldest;
+    else if (a.get<std::string>("enc_policy") == "drop_non_ref")
+        enc_policy = ax_overflow_drop_non_ref;
+
+    AXCodecBackend codec_backend = a.get<std::string>("codec") == "sw" ? ax_codec_backend_sw : ax_codec_backend_axcl;
+
+    AXHwFrameMode hw_mode = ax_hwframe_off;
+    if (a.get<std::string>("hw_frames") == "axmm")
+        hw_mode = ax_hwframe_axmm;
+    else if (a.get<std::string>("hw_frames") == "emulated")
+        hw_mode = ax_hwframe_emulated;
+
     AXFFmpegPipe pipe;
-    pipe.Init(url, output, 0);
-    pipe.Start();
-    int cnt_fail = 0;
+    pipe.SetHwFrames(hw_mode);
+    AXDecodeMode decode_mode = ax_decode_all;
+    if (a.get<std::string>("decode") == "nonref")
+        decode_mode = ax_decode_nonref;
+    else if (a.get<std::string>("decode") == "key")
+        decode_mode = ax_decode_key;
+    pipe.SetDecodeMode(decode_mode, a.get<double>("sample_fps"));
+    pipe.SetOutputMode(a.get<std::string>("output_mode") == "passthrough" ? ax_output_passthrough : ax_output_encode);
+    std::vector<AXSinkConfig> sinks;
+    if (AXFFmpegFanout::ParseSinks(a.get<std::string>("sinks"), sinks) != 0)
+    {
+        fprintf(stderr, "bad --sinks: %s\n", a.get<std::string>("sinks").c_str());
+        return -1;
+    }
+    for (auto &sink : sinks)
+        pipe.AddSink(sink);
+    if (!a.get<std::string>("record").empty())
+    {
+        AXRecorderConfig record_cfg;
+        record_cfg.pre_roll_s = a.get<double>("pre_roll");
+        record_cfg.post_roll_s = a.get<double>("post_roll");
+        record_cfg.max_bytes = (int64_t)a.get<int>("record_mb") << 20;
+        record_cfg.rule.SetLabels(a.get<std::string>("record_labels"));
+        record_cfg.rule.min_score = a.get<double>("record_score");
+        pipe.SetRecorder(a.get<std::string>("record"), record_cfg, a.get<std::string>("record_source") == "encoder");
+    }
+    pipe.SetReconnect(a.get<int>("reconnect") != 0, a.get<int>("io_timeout"));
+    pipe.SetMetricsLabels("stream=\"0\"");
+    AXCounter *m_infer = AXMetrics::Get().Counter("axcl_infer_frames_total", "Frames run through the detector", "stream=\"0\"");
+    AXHistogram *m_det = AXMetrics::Get().Histogram("axcl_det_seconds", "Detect latency per frame", "stream=\"0\"");
+    AXStreamInfoCache info_cache;
+    if (!a.get<std::string>("stream_cache").empty())
+    {
+        info_cache.Load(a.get<std::string>("stream_cache"));
+        pipe.SetStreamInfoCache(&info_cache);
+    }
+    pipe.SetEncodeQueue(a.get<int>("enc_queue"), enc_policy);
+    pipe.SetDetDelay(a.get<int>("det_delay"));
+    if (pipe.Init(url, output, card, codec_backend) != 0)
+    {
+        printf("pipe init failed\n");
+        return -1;
+    }
+    pipe.SetModelInput(a.get<int>("model_w"), a.get<int>("model_h"));
+    if (a.get<int>("det_interval") > 1)
+        pipe.SetTracker(true, a.get<int>("det_interval"));
+    if (pipe.Start() != 0)
+    {
+        printf("pipe start failed\n");
+        return -1;
+    }
+    bool startup_reported = false;
     while (b_continue)
     {
-        cv::Mat src = pipe.GetFrame();
+        AXFrameInfo info;
+        cv::Mat src = pipe.GetFrame(info);
         if (src.empty())
         {
-            printf("GetFrame failed\n");
-            cnt_fail++;
-            if (cnt_fail > 10)
+            // 重连期间继续等，输入真正结束才退出
+            if (pipe.IsFinished())
             {
-                printf("GetFrame failed 10 times, exit\n");
+                printf("input finished, exit\n");
                 b_continue = false;
                 break;
             }
             continue;
         }
-        cnt_fail = 0;
+        if (!startup_reported)
+        {
+            AXStartupStats ss = pipe.GetStartupStats();
+            printf("first frame in %.0fms (open %.0fms, probe %.0fms%s)\n", ss.first_frame_us / 1000.0,
+                   ss.open_us / 1000.0, ss.probe_us / 1000.0, ss.cached ? ", cached parameters" : "");
+            startup_reported = true;
+        }
 
         ax_det_img_t img;
         img.data = src.data;
@@ -106,16 +253,20 @@ int main(int argc, char *argv[])
         img.channels = src.channels();
         img.stride = src.step;
         ax_det_result_t result;
-        memset(&result, 0, sizeof(result));
-        ret = ax_det(handle, &img, &result);
-        if (ret != ax_det_errcode_success)
         {
-            printf("ax_det failed\n");
+            AX_TRACE_SCOPE("ax_det", info.pts);
+            int64_t t0 = ax_now_us();
+            ret = detector->Detect(img, result);
+            m_det->Observe(ax_now_us() - t0);
+        }
+        if (ret != 0)
+        {
+            printf("%s detect failed\n", detector->Name());
             return -1;
         }
-        printf("num_objs: %d\n", result.num_objs);
-        if (result.num_objs > 0)
-            pipe.PushDetResult(result);
+        m_infer->Inc();
+        SAMPLE_LOG_D("num_objs: %d", result.num_objs);
+        pipe.PushDetResult(result);
         // for (int i = 0; i < result.num_objs; i++)
         // {
         //     ax_det_obj_t &obj = result.objects[i];
@@ -138,16 +289,19 @@ int main(int argc, char *argv[])
         usleep(1000);
     }
     pipe.Deinit();
+    AXLogger::Get().Stop();
+    if (AXTrace::Recorded())
+        printf("trace: %d spans written to %s\n", AXTrace::Dump(trace_path), trace_path.c_str());
 
-    ax_det_deinit(handle);
+    detector->Deinit();
 
-    if (ax_devices.host.available)
+    if (need_npu && ax_devices.host.available)
     {
         ax_dev_sys_deinit(host_device, -1);
     }
-    else if (ax_devices.devices.count > 0)
+    if (ax_devices.devices.count > 0)
     {
-        ax_dev_sys_deinit(axcl_device, 0);
+        ax_dev_sys_deinit(axcl_device, card);
     }
     return 0;
 }
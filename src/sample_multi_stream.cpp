@@ -0,0 +1,210 @@
+#include "ffmpeg/AXStreamManager.hpp"
+
+#include "utils/cmdline.hpp"
+#include <unistd.h>
+
+#include <signal.h>
+
+volatile bool b_continue = true;
+
+void sigint_handler(int signum)
+{
+    b_continue = false;
+}
+
+// kill -USR1 <pid> switches tracing on and off while running
+void sigusr1_handler(int signum)
+{
+    AXTrace::Toggle();
+}
+
+// kill -USR2 <pid> cycles the log level error -> warn -> info -> debug -> error
+void sigusr2_handler(int signum)
+{
+    AXLogger::Get().SetLevel((AXLogLevel)((AXLogger::Get().GetLevel() + 1) % 4));
+}
+
+int main(int argc, char *argv[])
+{
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, sigint_handler);
+
+    cmdline::parser a;
+    a.add<std::string>("url", 'u', "input url, can be repeated, pairs with the following -o", false, "");
+    a.add<std::string>("output", 'o', "rtsp or xxx.mp4, none for analytics only, can be repeated", false, "");
+    a.add<std::string>("config", 'c', "stream list file, one \"<input> [output]\" per line", false, "");
+    a.add<std::string>("model", 'm', "model, not needed by the mock backend", false, "");
+    a.add<std::string>("backend", 0, "detector backend, mock needs no NPU", false, "libdet",
+                       cmdline::oneof<std::string>("libdet", "mock"));
+    a.add<int>("mock_latency", 0, "latency in ms of each mock detection", false, 20);
+    a.add<std::string>("codec", 0, "codec backend, sw runs stock libavcodec on the host", false, "axcl",
+                       cmdline::oneof<std::string>("axcl", "sw"));
+    a.add<std::string>("hw_frames", 0, "keep decoded frames on the card: off, axmm, or emulated to test the path without a card", false, "off",
+                       cmdline::oneof<std::string>("off", "axmm", "emulated"));
+    a.add<std::string>("output_mode", 0, "encode draws boxes and re-encodes, passthrough remuxes the input packets with detections as SEI", false, "encode",
+                       cmdline::oneof<std::string>("encode", "passthrough"));
+    a.add<std::string>("sinks", 0, "extra outputs \"[clean,][WxH=]url;...\", same picture and size share one encoder, %d in a url is replaced by the stream index", false, "");
+    a.add<std::string>("record", 0, "record clips around matching detections to <prefix>_<time>.mp4 without re-encoding, empty disables", false, "");
+    a.add<std::string>("record_source", 0, "packets to record: input stream, or encoder output with boxes drawn", false, "input",
+                       cmdline::oneof<std::string>("input", "encoder"));
+    a.add<double>("pre_roll", 0, "seconds kept before a trigger, rounded out to a keyframe", false, 5);
+    a.add<double>("post_roll", 0, "seconds recorded after the last matching detection", false, 5);
+    a.add<int>("record_mb", 0, "memory budget in MB per stream for the pre-roll ring and again for the writer backlog", false, 32);
+    a.add<std::string>("record_labels", 0, "comma separated class ids that trigger recording, empty for any", false, "");
+    a.add<double>("record_score", 0, "minimum score of a triggering detection", false, 0.5);
+    a.add<std::string>("decode", 0, "frames to decode: all, nonref skips non-reference frames, key decodes keyframes only", false, "all",
+                       cmdline::oneof<std::string>("all", "nonref", "key"));
+    a.add<double>("sample_fps", 0, "deliver at most this many decoded frames per second, 0 delivers all", false, 0);
+    a.add<int>("reconnect", 0, "reconnect network inputs that drop, 0 stops the stream instead", false, 1);
+    a.add<int>("io_timeout", 0, "timeout in ms of a single network open/read before it counts as dropped", false, 5000);
+    a.add<std::string>("stream_cache", 0, "file caching codec parameters per url, streams found there open without probing", false, "");
+    a.add<std::string>("trace", 0, "record per-stage spans from the start and write them as Chrome trace JSON to this file at exit; without it kill -USR1 <pid> starts / stops recording into trace_<pid>.json", false, "");
+    a.add<std::string>("log_level", 0, "log level, kill -USR2 <pid> cycles it at runtime", false, "info",
+                       cmdline::oneof<std::string>("error", "warn", "info", "debug"));
+    a.add<int>("metrics_port", 0, "serve Prometheus metrics on http://127.0.0.1:<port>/metrics, 0 disables", false, 0);
+    a.add<double>("card_capacity", 0, "1080p frames per second one card decodes, the scheduler's 100% decode load", false, 480);
+    a.add<int>("card_mem_mb", 0, "surface memory budget per card in MB, 0 does not place by memory", false, 0);
+    a.add<int>("migrate", 0, "move live streams off a card that stays overloaded, 0 only places them", false, 1);
+    a.add<int>("batch", 'b', "max frames per NPU batch across streams, 1 disables batching", false, 1);
+    a.add<int>("batch_wait", 0, "max time in ms a batch waits to fill up", false, 10);
+    a.add<int>("model_w", 0, "model input width, letterbox on the decode thread, 0 disables", false, 0);
+    a.add<int>("model_h", 0, "model input height", false, 0);
+    a.add<int>("det_delay", 0, "frames held before encoding so boxes match their frame", false, 0);
+    a.add<int>("det_interval", 0, "run the detector every N frames and track in between", false, 1);
+    a.add<int>("interval", 0, "throughput report interval in seconds", false, 5);
+    a.parse_check(argc, argv);
+
+    std::string trace_path = a.get<std::string>("trace");
+    if (!trace_path.empty())
+        AXTrace::Enable(true);
+    else
+        trace_path = "trace_" + std::to_string(getpid()) + ".json";
+    signal(SIGUSR1, sigusr1_handler);
+
+    AXLogger::Get().SetLevel(a.get<std::string>("log_level").c_str());
+    signal(SIGUSR2, sigusr2_handler);
+    AXLogger::Get().Start();
+
+    AXMetricsServer metrics_server;
+    if (a.get<int>("metrics_port") > 0 && metrics_server.Start(a.get<int>("metrics_port")) == 0)
+        printf("metrics: http://127.0.0.1:%d/metrics\n", a.get<int>("metrics_port"));
+
+    // cmdline keeps only the last value, collect repeated -u/-o pairs here
+    std::vector<AXStreamConfig> cfgs;
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        std::string key = argv[i];
+        if (key == "-u" || key == "--url")
+        {
+            AXStreamConfig cfg;
+            cfg.input = argv[++i];
+            cfgs.push_back(cfg);
+        }
+        else if ((key == "-o" || key == "--output") && !cfgs.empty())
+        {
+            cfgs.back().output = argv[++i];
+        }
+    }
+
+    if (!a.get<std::string>("config").empty() && AXStreamManager::LoadConfig(a.get<std::string>("config"), cfgs) != 0)
+        return -1;
+
+    std::string backend = a.get<std::string>("backend");
+    if (backend == "libdet" && a.get<std::string>("model").empty())
+    {
+        printf("-m is required for the libdet backend\n%s", a.usage().c_str());
+        return -1;
+    }
+
+    if (cfgs.empty())
+    {
+        printf("no stream, use -u/-o or -c\n%s", a.usage().c_str());
+        return -1;
+    }
+
+    ax_det_init_t init_info;
+    memset(&init_info, 0, sizeof(init_info));
+    init_info.num_classes = 80;
+    init_info.num_kpt = 0;
+    init_info.model_type = ax_det_model_type_e::ax_det_model_type_yolov8;
+    sprintf(init_info.model_path, "%s", a.get<std::string>("model").c_str());
+    init_info.threshold = 0.25;
+
+    AXStreamManager manager;
+    if (manager.Init(init_info, backend, a.get<int>("mock_latency")) != 0)
+        return -1;
+
+    AXHwFrameMode hw_mode = ax_hwframe_off;
+    if (a.get<std::string>("hw_frames") == "axmm")
+        hw_mode = ax_hwframe_axmm;
+    else if (a.get<std::string>("hw_frames") == "emulated")
+        hw_mode = ax_hwframe_emulated;
+    manager.SetHwFrames(hw_mode);
+    AXDecodeMode decode_mode = ax_decode_all;
+    if (a.get<std::string>("decode") == "nonref")
+        decode_mode = ax_decode_nonref;
+    else if (a.get<std::string>("decode") == "key")
+        decode_mode = ax_decode_key;
+    manager.SetDecodeMode(decode_mode, a.get<double>("sample_fps"));
+    manager.SetOutputMode(a.get<std::string>("output_mode") == "passthrough" ? ax_output_passthrough : ax_output_encode);
+    std::vector<AXSinkConfig> sinks;
+    if (AXFFmpegFanout::ParseSinks(a.get<std::string>("sinks"), sinks) != 0)
+    {
+        fprintf(stderr, "bad --sinks: %s\n", a.get<std::string>("sinks").c_str());
+        return -1;
+    }
+    for (auto &sink : sinks)
+    {
+        if (cfgs.size() > 1 && sink.url.find("%d") == std::string::npos)
+        {
+            fprintf(stderr, "--sinks url %s has no %%d, every stream would write to it\n", sink.url.c_str());
+            return -1;
+        }
+        manager.AddSink(sink);
+    }
+    if (!a.get<std::string>("record").empty())
+    {
+        AXRecorderConfig record_cfg;
+        record_cfg.pre_roll_s = a.get<double>("pre_roll");
+        record_cfg.post_roll_s = a.get<double>("post_roll");
+        record_cfg.max_bytes = (int64_t)a.get<int>("record_mb") << 20;
+        record_cfg.rule.SetLabels(a.get<std::string>("record_labels"));
+        record_cfg.rule.min_score = a.get<double>("record_score");
+        manager.SetRecorder(a.get<std::string>("record"), record_cfg, a.get<std::string>("record_source") == "encoder");
+    }
+    manager.SetReconnect(a.get<int>("reconnect") != 0, a.get<int>("io_timeout"));
+    manager.SetStreamInfoCache(a.get<std::string>("stream_cache"));
+    AXStreamScheduler::Config sched_cfg;
+    sched_cfg.decode_capacity = a.get<double>("card_capacity");
+    sched_cfg.mem_budget = (int64_t)a.get<int>("card_mem_mb") << 20;
+    manager.SetScheduler(sched_cfg, a.get<int>("migrate") != 0);
+    manager.SetCodecBackend(a.get<std::string>("codec") == "sw" ? ax_codec_backend_sw : ax_codec_backend_axcl);
+    for (auto &cfg : cfgs)
+        manager.AddStream(cfg);
+
+    if (manager.GetStreamCount() == 0)
+    {
+        printf("no stream started\n");
+        return -1;
+    }
+
+    manager.SetModelInput(a.get<int>("model_w"), a.get<int>("model_h"));
+    manager.SetDetDelay(a.get<int>("det_delay"));
+    manager.SetDetInterval(a.get<int>("det_interval"));
+    manager.SetBatch(a.get<int>("batch"), a.get<int>("batch_wait"));
+    manager.Start();
+
+    int interval = a.get<int>("interval");
+    while (b_continue)
+    {
+        for (int i = 0; i < interval * 10 && b_continue; i++)
+            usleep(100 * 1000);
+        manager.Report();
+    }
+
+    manager.Deinit();
+    AXLogger::Get().Stop();
+    if (AXTrace::Recorded())
+        printf("trace: %d spans written to %s\n", AXTrace::Dump(trace_path), trace_path.c_str());
+    return 0;
+}
@@ -0,0 +1,37 @@
+#pragma once
+// shared by the tests in src/test: the CHECK macro, the exit codes ctest reads
+// and the size of the synthetic pictures
+#include <stdio.h>
+
+static int failures = 0;
+
+// counts and reports a failed condition, the test goes on
+#define CHECK(cond, ...)                                \
+    do                                                  \
+    {                                                   \
+        if (!(cond))                                    \
+        {                                               \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__);                        \
+            printf("\n");                               \
+            failures++;                                 \
+        }                                               \
+    } while (0)
+
+// exit code of a test that can not run here, SKIP_RETURN_CODE in CMakeLists.txt
+static const int SKIPPED = 77;
+
+// synthetic frames of the codec tests
+static const int W = 320, H = 240, FPS = 25;
+
+// exit code of main: 0 and PASS when every CHECK held
+static inline int test_result()
+{
+    if (failures)
+    {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
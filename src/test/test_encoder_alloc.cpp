@@ -0,0 +1,250 @@
+// Heap allocations of AXFFmpegEncoder::Encode in steady state.
+//
+// malloc / calloc / realloc / posix_memalign are interposed in this binary, so
+// every allocation in the process is counted, libavcodec and the encoder
+// library included. libavcodec itself allocates per frame (packet buffers,
+// buffer refs), so the encoder is measured against a bare libavcodec loop with
+// the same encoder and settings doing only what has to be done per frame. The
+// wrapper must not allocate more than that loop: its pool frames, conversion
+// frames and output packet are all reused. Runs the software backend for h264
+// (NV12 sent as is) and hevc (converted into the YUV420P pool); exits with 77
+// (skipped) when the FFmpeg build has neither libx264 nor libx265.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+
+extern "C"
+{
+#include "libavcodec/avcodec.h"
+#include "libavutil/opt.h"
+#include "libswscale/swscale.h"
+
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t n, size_t size);
+    void *__libc_realloc(void *ptr, size_t size);
+    void *__libc_memalign(size_t align, size_t size);
+}
+
+#include "ffmpeg/AXFFmpegEncoder.hpp"
+#include "test_common.h"
+
+static std::atomic<uint64_t> heap_allocs{0};
+
+extern "C"
+{
+    void *malloc(size_t size)
+    {
+        heap_allocs++;
+        return __libc_malloc(size);
+    }
+    void *calloc(size_t n, size_t size)
+    {
+        heap_allocs++;
+        return __libc_calloc(n, size);
+    }
+    void *realloc(void *ptr, size_t size)
+    {
+        heap_allocs++;
+        return __libc_realloc(ptr, size);
+    }
+    int posix_memalign(void **ptr, size_t align, size_t size)
+    {
+        heap_allocs++;
+        *ptr = __libc_memalign(align, size);
+        return *ptr ? 0 : ENOMEM;
+    }
+    void *aligned_alloc(size_t align, size_t size)
+    {
+        heap_allocs++;
+        return __libc_memalign(align, size);
+    }
+    void *memalign(size_t align, size_t size)
+    {
+        heap_allocs++;
+        return __libc_memalign(align, size);
+    }
+}
+
+static const int WARMUP = 100, MEASURED = 200;
+
+static void fill(AVFrame *f, int i)
+{
+    for (int y = 0; y < H; y++)
+        memset(f->data[0] + y * f->linesize[0], (i * 3 + y) & 0xff, W);
+    for (int y = 0; y < H / 2; y++)
+        memset(f->data[1] + y * f->linesize[1], 128, W);
+}
+
+static AVFrame *alloc_frame(AVPixelFormat fmt)
+{
+    AVFrame *f = av_frame_alloc();
+    f->format = fmt;
+    f->width = W;
+    f->height = H;
+    if (av_frame_get_buffer(f, 0) < 0)
+        av_frame_free(&f);
+    return f;
+}
+
+// allocations for MEASURED frames through AXFFmpegEncoder::Encode, after WARMUP frames
+static int64_t measure_encoder(AXFFmpegCodecID codec_id, AVCodecID *out_id, uint64_t *pool_growth)
+{
+    AXFFmpegEncoder encoder;
+    // 不写文件，只走编码和 packet_tap，和 fan-out 的共享编码一样
+    encoder.SetPacketTap([](const AVPacket *) {});
+    if (encoder.Init("", codec_id, W, H, FPS, 0, ax_codec_backend_sw) != 0)
+        return -1;
+    AVCodecParameters *par = avcodec_parameters_alloc();
+    encoder.GetCodecParameters(par);
+    *out_id = par->codec_id;
+    avcodec_parameters_free(&par);
+
+    AVFrame *frame = alloc_frame(AV_PIX_FMT_NV12);
+    if (!frame)
+        return -1;
+    for (int i = 0; i < WARMUP; i++)
+    {
+        fill(frame, i);
+        frame->pts = i;
+        encoder.Encode(frame);
+    }
+    uint64_t pool_allocs = encoder.GetStats().allocs;
+    uint64_t n0 = heap_allocs;
+    for (int i = WARMUP; i < WARMUP + MEASURED; i++)
+    {
+        fill(frame, i);
+        frame->pts = i;
+        if (encoder.Encode(frame) != 0)
+            return -1;
+    }
+    int64_t n = (int64_t)(heap_allocs - n0);
+    *pool_growth = encoder.GetStats().allocs - pool_allocs;
+    av_frame_free(&frame);
+    return n;
+}
+
+// the same encoder opened directly with the settings of AXFFmpegEncoder::init_sw; per frame
+// only the unavoidable work: reference the input (or convert it), send, receive into one packet
+static int64_t measure_bare(AVCodecID id)
+{
+    const char *name = id == AV_CODEC_ID_HEVC ? "libx265" : "libx264";
+    const AVCodec *codec = avcodec_find_encoder_by_name(name);
+    if (!codec)
+        return -1;
+    AVCodecContext *ctx = avcodec_alloc_context3(codec);
+    AVPixelFormat pix_fmt = AV_PIX_FMT_YUV420P;
+    const void *cfg = nullptr;
+    avcodec_get_supported_config(ctx, codec, AV_CODEC_CONFIG_PIX_FORMAT, 0, &cfg, nullptr);
+    for (const AVPixelFormat *p = (const AVPixelFormat *)cfg; p && *p != AV_PIX_FMT_NONE; p++)
+    {
+        if (*p == AV_PIX_FMT_NV12)
+            pix_fmt = AV_PIX_FMT_NV12;
+    }
+    ctx->width = W;
+    ctx->height = H;
+    ctx->time_base = {1, FPS};
+    ctx->framerate = {FPS, 1};
+    ctx->sample_aspect_ratio = {1, 1};
+    ctx->pix_fmt = pix_fmt;
+    ctx->bit_rate = W * H;
+    ctx->gop_size = FPS;
+    ctx->max_b_frames = 0;
+    ctx->thread_count = 0;
+    ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    av_opt_set(ctx->priv_data, "preset", "veryfast", 0);
+    av_opt_set(ctx->priv_data, "tune", "zerolatency", 0);
+    if (avcodec_open2(ctx, codec, nullptr) < 0)
+    {
+        avcodec_free_context(&ctx);
+        return -1;
+    }
+
+    AVFrame *frame = alloc_frame(AV_PIX_FMT_NV12);
+    AVFrame *conv = alloc_frame(AV_PIX_FMT_YUV420P);
+    AVFrame *ref = av_frame_alloc();
+    AVPacket *pkt = av_packet_alloc();
+    SwsContext *sws = nullptr;
+    uint64_t n0 = 0;
+    for (int i = 0; i < WARMUP + MEASURED; i++)
+    {
+        if (i == WARMUP)
+            n0 = heap_allocs;
+        fill(frame, i);
+        AVFrame *in = ref;
+        if (pix_fmt == AV_PIX_FMT_NV12)
+            av_frame_ref(ref, frame);
+        else
+        {
+            sws = sws_getCachedContext(sws, W, H, AV_PIX_FMT_NV12, W, H, AV_PIX_FMT_YUV420P,
+                                       SWS_BILINEAR, NULL, NULL, NULL);
+            sws_scale(sws, frame->data, frame->linesize, 0, H, conv->data, conv->linesize);
+            in = conv;
+        }
+        in->pts = i;
+        avcodec_send_frame(ctx, in);
+        av_frame_unref(ref);
+        while (avcodec_receive_packet(ctx, pkt) == 0)
+            av_packet_unref(pkt);
+    }
+    int64_t n = (int64_t)(heap_allocs - n0);
+
+    sws_freeContext(sws);
+    av_packet_free(&pkt);
+    av_frame_free(&ref);
+    av_frame_free(&conv);
+    av_frame_free(&frame);
+    avcodec_free_context(&ctx);
+    return n;
+}
+
+static int run(const char *name, AXFFmpegCodecID codec_id)
+{
+    AVCodecID id = AV_CODEC_ID_NONE;
+    uint64_t pool_growth = 0;
+    int64_t enc = measure_encoder(codec_id, &id, &pool_growth);
+    if (enc < 0)
+    {
+        printf("FAIL: %s encoder did not run\n", name);
+        return -1;
+    }
+    if (id != AV_CODEC_ID_H264 && id != AV_CODEC_ID_HEVC)
+    {
+        printf("SKIP %s: encoder fell back to %s\n", name, avcodec_get_name(id));
+        return SKIPPED;
+    }
+    int64_t bare = measure_bare(id);
+    if (bare < 0)
+    {
+        printf("FAIL: %s could not open the reference encoder\n", name);
+        return -1;
+    }
+
+    printf("%s: %d frames, AXFFmpegEncoder %lld allocations (%.2f per frame), bare libavcodec %lld (%.2f), pool growth %llu\n",
+           name, MEASURED, (long long)enc, (double)enc / MEASURED, (long long)bare, (double)bare / MEASURED,
+           (unsigned long long)pool_growth);
+    if (pool_growth != 0)
+    {
+        printf("FAIL: %s encoder pool grew in steady state\n", name);
+        return -1;
+    }
+    if (enc > bare)
+    {
+        printf("FAIL: %s encoder allocates %lld more than libavcodec needs\n", name, (long long)(enc - bare));
+        return -1;
+    }
+    return 0;
+}
+
+int main()
+{
+    av_log_set_level(AV_LOG_ERROR);
+    int h264 = run("h264", h264_ax);
+    int hevc = run("hevc", hevc_ax);
+    if (h264 < 0 || hevc < 0)
+        return 1;
+    if (h264 == SKIPPED && hevc == SKIPPED)
+        return SKIPPED;
+    printf("PASS\n");
+    return 0;
+}
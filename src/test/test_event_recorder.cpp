@@ -0,0 +1,172 @@
+// AXEventRecorder with packets from the software encoder, needs no axcl card.
+//
+// The encoder numbers its packets from 0, so the tap moves them three hours in
+// (frame 270000 at 25 fps), as packets of a long running input would be, with
+// a keyframe every 25 frames. With no pre-roll the ring keeps only the GOP in
+// progress, so a trigger after frame 59 cuts the clip from the keyframe at
+// frame 50 to the last frame. The clip must hold exactly those 50 packets, start on a
+// keyframe at dts / pts 0 and last 2 s, not three hours of empty edit list.
+// Also checks AXRecordRule matching.
+#include <glob.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#include "libavformat/avformat.h"
+}
+
+#include "ffmpeg/AXFFmpegEncoder.hpp"
+#include "ffmpeg/AXEventRecorder.hpp"
+#include "test_common.h"
+
+static const int FRAMES = 100, TRIGGER = 60;
+static const int64_t BASE = 3 * 3600 * FPS;
+static const char *PREFIX = "test_event_recorder";
+
+static ax_det_result_t one_object(int label, float score)
+{
+    ax_det_result_t r;
+    memset(&r, 0, sizeof(r));
+    r.num_objs = 1;
+    r.objects[0].label = label;
+    r.objects[0].score = score;
+    return r;
+}
+
+static void test_rule()
+{
+    AXRecordRule rule;
+    rule.SetLabels("0,2");
+    rule.min_score = 0.5f;
+    CHECK(rule.Match(one_object(2, 0.6f)), "label 2 above min_score");
+    CHECK(!rule.Match(one_object(1, 0.9f)), "label 1 is not in the list");
+    CHECK(!rule.Match(one_object(0, 0.4f)), "score below min_score");
+    rule.SetLabels("");
+    CHECK(rule.Match(one_object(7, 0.9f)), "empty list takes any label");
+    rule.min_objs = 2;
+    CHECK(!rule.Match(one_object(7, 0.9f)), "min_objs 2 with one object");
+}
+
+static std::vector<std::string> clips()
+{
+    std::vector<std::string> out;
+    glob_t g;
+    if (glob((std::string(PREFIX) + "_*.mp4").c_str(), 0, nullptr, &g) == 0)
+    {
+        for (size_t i = 0; i < g.gl_pathc; i++)
+            out.push_back(g.gl_pathv[i]);
+        globfree(&g);
+    }
+    return out;
+}
+
+static void test_clip()
+{
+    for (auto &path : clips())
+        remove(path.c_str());
+
+    AXFFmpegEncoder encoder;
+    AXEventRecorder recorder;
+    AVPacket *shifted = av_packet_alloc();
+    int64_t offset = 0;
+    // 不写主输出，编码器的包平移后只送录像
+    encoder.SetPacketTap([&](const AVPacket *pkt)
+                         {
+                             av_packet_ref(shifted, pkt);
+                             shifted->pts += offset;
+                             shifted->dts += offset;
+                             recorder.Push(shifted);
+                             av_packet_unref(shifted); });
+    if (encoder.Init("", h264_ax, W, H, FPS, 0, ax_codec_backend_sw) != 0)
+    {
+        CHECK(false, "encoder init");
+        return;
+    }
+    offset = av_rescale_q(BASE, {1, FPS}, encoder.GetTimeBase());
+    AVCodecParameters *par = avcodec_parameters_alloc();
+    encoder.GetCodecParameters(par);
+    AXRecorderConfig cfg;
+    cfg.pre_roll_s = 0;
+    cfg.post_roll_s = 60;
+    cfg.rule.min_score = 0.5f;
+    int ret = recorder.Init(PREFIX, par, encoder.GetTimeBase(), encoder.GetFrameRate(), cfg);
+    avcodec_parameters_free(&par);
+    CHECK(ret == 0, "recorder init %d", ret);
+    recorder.Start();
+
+    AVFrame *frame = av_frame_alloc();
+    frame->format = AV_PIX_FMT_NV12;
+    frame->width = W;
+    frame->height = H;
+    av_frame_get_buffer(frame, 0);
+    for (int i = 0; i < FRAMES; i++)
+    {
+        if (i == TRIGGER)
+            recorder.OnDetections(one_object(0, 0.9f));
+        memset(frame->data[0], 16 + i * 2, frame->linesize[0] * H);
+        memset(frame->data[1], 128, frame->linesize[1] * H / 2);
+        frame->pts = i;
+        encoder.Encode(frame);
+    }
+    av_frame_free(&frame);
+    av_packet_free(&shifted);
+    AXRecorderStats rs = recorder.GetStats();
+    recorder.Deinit();
+    printf("recorder: %llu triggers, %llu clips, %llu packets\n", (unsigned long long)rs.triggers,
+           (unsigned long long)rs.clips, (unsigned long long)rs.packets);
+    CHECK(rs.triggers == 1 && rs.clips == 1, "one trigger, one clip");
+
+    std::vector<std::string> files = clips();
+    CHECK(files.size() == 1, "%d clip files", (int)files.size());
+    if (files.size() != 1)
+        return;
+
+    AVFormatContext *fmt = nullptr;
+    if (avformat_open_input(&fmt, files[0].c_str(), nullptr, nullptr) < 0 || avformat_find_stream_info(fmt, nullptr) < 0)
+    {
+        CHECK(false, "can not open %s", files[0].c_str());
+        return;
+    }
+    AVStream *st = fmt->streams[0];
+    AVPacket *pkt = av_packet_alloc();
+    int packets = 0;
+    bool first_key = false;
+    int64_t first_dts = AV_NOPTS_VALUE, first_pts = AV_NOPTS_VALUE, last_pts = 0;
+    while (av_read_frame(fmt, pkt) >= 0)
+    {
+        if (packets++ == 0)
+        {
+            first_key = pkt->flags & AV_PKT_FLAG_KEY;
+            first_dts = pkt->dts;
+            first_pts = pkt->pts;
+        }
+        last_pts = std::max(last_pts, av_rescale_q(pkt->pts, st->time_base, {1, FPS}));
+        av_packet_unref(pkt);
+    }
+    double duration = fmt->duration / (double)AV_TIME_BASE;
+    printf("clip %s: %d packets, first dts %lld pts %lld, last frame %lld, duration %.2fs\n", files[0].c_str(), packets,
+           (long long)first_dts, (long long)first_pts, (long long)last_pts, duration);
+    // 从触发前的关键帧（第 50 帧）到最后一帧
+    int expect = FRAMES - TRIGGER / FPS * FPS;
+    CHECK(packets == expect, "expected %d packets", expect);
+    CHECK(first_key, "clip does not start on a keyframe");
+    CHECK(first_dts == 0 && first_pts == 0, "clip does not start at 0");
+    CHECK(last_pts == expect - 1, "last frame at %lld", (long long)last_pts);
+    CHECK(duration > 0 && duration < expect / (double)FPS + 0.5, "duration %.2fs", duration);
+    av_packet_free(&pkt);
+    avformat_close_input(&fmt);
+
+    if (!failures)
+        remove(files[0].c_str());
+}
+
+int main()
+{
+    av_log_set_level(AV_LOG_ERROR);
+    test_rule();
+    test_clip();
+    return test_result();
+}
@@ -0,0 +1,179 @@
+// AXFFmpegFanout with the software encoder, needs no axcl card.
+//
+// ParseSinks on good and bad lists, HwSurfaces for the AXMM pool, then one
+// stream fanned out to two overlay sinks (one shared encoding), a clean
+// preview sink at a smaller size and a raw frame subscriber. Checks that every
+// sink gets every packet, that the two overlay sinks carry the very same
+// packets, that the preview has its own size and that the subscriber sees
+// every frame.
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#include "libavformat/avformat.h"
+}
+
+#include "ffmpeg/AXFFmpegFanout.hpp"
+#include "test_common.h"
+
+static const int FRAMES = 30;
+
+static void test_parse()
+{
+    std::vector<AXSinkConfig> s;
+    CHECK(AXFFmpegFanout::ParseSinks("rec.mp4;clean=clean.mp4;clean,640x360=rtsp://host/preview?a=b;;overlay=o%d.mp4", s) == 0, "parse");
+    CHECK(s.size() == 4, "%d sinks", (int)s.size());
+    if (s.size() == 4)
+    {
+        CHECK(s[0].url == "rec.mp4" && s[0].overlay && s[0].width == 0, "sink 0");
+        CHECK(s[1].url == "clean.mp4" && !s[1].overlay, "sink 1");
+        CHECK(s[2].url == "rtsp://host/preview?a=b" && !s[2].overlay && s[2].width == 640 && s[2].height == 360, "sink 2");
+        CHECK(s[3].url == "o%d.mp4" && s[3].overlay, "sink 3");
+    }
+
+    // 认不出的选项把整项当 url，'=' 在 "://" 之后属于 url
+    s.clear();
+    CHECK(AXFFmpegFanout::ParseSinks("bogus=x.mp4;rtsp://h/p?k=v", s) == 0 && s.size() == 2, "parse unknown options");
+    if (s.size() == 2)
+    {
+        CHECK(s[0].url == "bogus=x.mp4" && s[0].overlay, "unknown option kept in the url");
+        CHECK(s[1].url == "rtsp://h/p?k=v", "'=' inside the url");
+    }
+
+    s.clear();
+    CHECK(AXFFmpegFanout::ParseSinks("clean=", s) != 0, "empty url accepted");
+}
+
+static void test_hw_surfaces()
+{
+    AXFFmpegFanout f;
+    CHECK(f.HwSurfaces(8, true) == 0, "empty fan-out holds surfaces");
+
+    AXSinkConfig overlay, clean;
+    overlay.url = "a.mp4";
+    clean.url = "b.mp4";
+    clean.overlay = false;
+    f.AddSink(overlay);
+    f.AddSink(overlay);
+    const int per_encoder = 8 + AXFFmpegEncoder::DEFAULT_FRAME_POOL + 1;
+    // overlay sinks share the main encoder, without it they need one of their own
+    CHECK(f.HwSurfaces(8, true) == 0, "overlay sinks with a main encoder: %d", f.HwSurfaces(8, true));
+    CHECK(f.HwSurfaces(8, false) == per_encoder, "overlay sinks without a main encoder: %d", f.HwSurfaces(8, false));
+    f.AddSink(clean);
+    f.AddSink(clean);
+    CHECK(f.HwSurfaces(8, true) == per_encoder, "clean sinks: %d", f.HwSurfaces(8, true));
+    f.AddSubscriber([](AVFrame *) {}, false, 4);
+    CHECK(f.HwSurfaces(8, false) == 2 * per_encoder + 5, "with a subscriber: %d", f.HwSurfaces(8, false));
+}
+
+// packet payloads of the video stream of a file, and its size
+static std::vector<std::string> read_packets(const std::string &path, int *w, int *h)
+{
+    std::vector<std::string> out;
+    AVFormatContext *fmt = nullptr;
+    if (avformat_open_input(&fmt, path.c_str(), nullptr, nullptr) < 0)
+        return out;
+    avformat_find_stream_info(fmt, nullptr);
+    *w = fmt->streams[0]->codecpar->width;
+    *h = fmt->streams[0]->codecpar->height;
+    AVPacket *pkt = av_packet_alloc();
+    while (av_read_frame(fmt, pkt) >= 0)
+    {
+        out.push_back(std::string((const char *)pkt->data, pkt->size));
+        av_packet_unref(pkt);
+    }
+    av_packet_free(&pkt);
+    avformat_close_input(&fmt);
+    return out;
+}
+
+static void test_run()
+{
+    const char *files[] = {"test_fanout_a.mp4", "test_fanout_b.mp4", "test_fanout_clean.mp4"};
+    std::atomic<int> subscribed{0};
+    {
+        AXFFmpegFanout f;
+        AXSinkConfig cfg;
+        cfg.url = files[0];
+        f.AddSink(cfg);
+        cfg.url = files[1];
+        f.AddSink(cfg);
+        cfg.url = files[2];
+        cfg.overlay = false;
+        cfg.width = 160;
+        cfg.height = 120;
+        f.AddSink(cfg);
+        f.AddSubscriber([&](AVFrame *frame)
+                        {
+                            if (frame->width == W && frame->height == H)
+                                subscribed++; },
+                        false, FRAMES);
+
+        int ret = f.Init(W, H, FPS, 0, ax_codec_backend_sw, nullptr, nullptr, true);
+        CHECK(ret == 0, "Init returned %d", ret);
+        if (ret != 0)
+            return;
+        CHECK(f.HasClean() && f.HasOverlay() && !f.SharesMain(), "picture flags");
+        // 编码队列够大，测试里不丢帧
+        f.Start(FRAMES);
+
+        AVFrame *frame = av_frame_alloc();
+        for (int i = 0; i < FRAMES; i++)
+        {
+            // 每帧新的缓冲，队列里还引用着上一帧
+            frame->format = AV_PIX_FMT_NV12;
+            frame->width = W;
+            frame->height = H;
+            if (av_frame_get_buffer(frame, 0) < 0)
+                break;
+            memset(frame->data[0], 16 + i * 6, frame->linesize[0] * H);
+            memset(frame->data[1], 128, frame->linesize[1] * H / 2);
+            frame->pts = i;
+            f.PushClean(frame);
+            f.PushOverlay(frame);
+            av_frame_unref(frame);
+        }
+        av_frame_free(&frame);
+        f.Deinit();
+
+        for (size_t i = 0; i < f.SinkCount(); i++)
+        {
+            AXSinkStats st = f.GetSinkStats(i);
+            printf("sink %s: %llu packets, %llu skipped, %llu written\n", files[i], (unsigned long long)st.packets,
+                   (unsigned long long)st.dropped, (unsigned long long)st.mux.packets);
+            CHECK(st.packets == FRAMES && st.dropped == 0 && st.mux.packets == FRAMES, "sink %d stats", (int)i);
+        }
+    }
+    printf("subscriber: %d frames\n", subscribed.load());
+    CHECK(subscribed == FRAMES, "subscriber saw %d frames", subscribed.load());
+
+    int w[3] = {0}, h[3] = {0};
+    std::vector<std::string> pkts[3];
+    for (int i = 0; i < 3; i++)
+        pkts[i] = read_packets(files[i], &w[i], &h[i]);
+    CHECK(pkts[0].size() == FRAMES && pkts[2].size() == FRAMES, "files hold %d / %d packets",
+          (int)pkts[0].size(), (int)pkts[2].size());
+    // 同一个编码器的包按引用分给两个 sink
+    CHECK(pkts[0] == pkts[1], "the overlay sinks carry different packets");
+    CHECK(pkts[0] != pkts[2], "the clean sink carries the overlay packets");
+    CHECK(w[0] == W && h[0] == H && w[2] == 160 && h[2] == 120, "sizes %dx%d, %dx%d", w[0], h[0], w[2], h[2]);
+
+    if (!failures)
+    {
+        for (const char *f : files)
+            remove(f);
+    }
+}
+
+int main()
+{
+    av_log_set_level(AV_LOG_ERROR);
+    test_parse();
+    test_hw_surfaces();
+    test_run();
+    return test_result();
+}
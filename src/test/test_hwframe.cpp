@@ -0,0 +1,148 @@
+// AXFFmpegPipe with --codec sw --hw_frames emulated, needs no axcl card.
+//
+// Host frames stand in for AXMM surfaces: inference and the OSD map them, the
+// encoder takes them as they are. A synthetic h264 file runs through the pipe
+// with one detection for every frame inference sees, and a slow clean
+// subscriber that keeps references to the frames. Checks that the pool is
+// sized for the encode queue, the encoder pool, det_delay and the subscriber;
+// that every view mapped is unmapped and nothing is downloaded; that boxes on
+// frames the subscriber still holds are drawn on copies; and that every frame
+// reaches the encoder through the surface branch without a copy. Without
+// libx264 the encoder converts and the test exits with 77 (skipped).
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "ffmpeg/AXFFmpegPipe.hpp"
+#include "test_common.h"
+
+static const int FRAMES = 50;
+static const int ENC_QUEUE = 8, DET_DELAY = 2, SUB_QUEUE = 4;
+static const char *INPUT = "test_hwframe_in.mp4";
+static const char *OUTPUT = "test_hwframe_out.mp4";
+
+// moving gradient, P frames reference the ones before them
+static int write_input()
+{
+    AXFFmpegEncoder encoder;
+    if (encoder.Init(INPUT, h264_ax, W, H, FPS, 0, ax_codec_backend_sw) != 0)
+        return -1;
+    AVCodecParameters *par = avcodec_parameters_alloc();
+    encoder.GetCodecParameters(par);
+    AVCodecID id = par->codec_id;
+    avcodec_parameters_free(&par);
+    if (id != AV_CODEC_ID_H264)
+    {
+        printf("SKIP: encoder fell back to %s\n", avcodec_get_name(id));
+        return SKIPPED;
+    }
+
+    AVFrame *frame = av_frame_alloc();
+    frame->format = AV_PIX_FMT_NV12;
+    frame->width = W;
+    frame->height = H;
+    if (av_frame_get_buffer(frame, 0) < 0)
+        return -1;
+    encoder.Start(4, ax_overflow_block);
+    for (int i = 0; i < FRAMES; i++)
+    {
+        if (av_frame_make_writable(frame) < 0)
+            return -1;
+        for (int y = 0; y < H; y++)
+            for (int x = 0; x < W; x++)
+                frame->data[0][y * frame->linesize[0] + x] = (uint8_t)(x + y + 3 * i);
+        for (int y = 0; y < H / 2; y++)
+            memset(frame->data[1] + y * frame->linesize[1], 128, W);
+        frame->pts = i;
+        encoder.Push(frame);
+    }
+    encoder.Deinit();
+    av_frame_free(&frame);
+    return 0;
+}
+
+int main()
+{
+    int ret = write_input();
+    if (ret != 0)
+    {
+        remove(INPUT);
+        if (ret == SKIPPED)
+            return SKIPPED;
+        printf("FAIL: writing %s\n", INPUT);
+        return 1;
+    }
+
+    AXFFmpegPipe pipe;
+    pipe.SetHwFrames(ax_hwframe_emulated, 4);
+    pipe.SetEncodeQueue(ENC_QUEUE, ax_overflow_block);
+    pipe.SetDetDelay(DET_DELAY);
+    // 订阅者拿着帧慢慢处理，画框时帧还有别的引用
+    std::atomic<int> subscribed{0};
+    pipe.AddSubscriber([&](AVFrame *)
+                       {
+                           std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                           subscribed++; },
+                       false, SUB_QUEUE);
+    if (pipe.Init(INPUT, OUTPUT, 0, ax_codec_backend_sw) != 0 || pipe.Start() != 0)
+    {
+        printf("FAIL: pipe init\n");
+        return 1;
+    }
+    // 8 codec frames + encode queue + encoder pool + det_delay + the subscriber's queue and
+    // callback; the 4 given is only the lower bound
+    int pool = 8 + ENC_QUEUE + AXFFmpegEncoder::DEFAULT_FRAME_POOL + DET_DELAY + SUB_QUEUE + 1;
+    CHECK(pipe.GetHwPoolSize() == pool, "pool %d, expected %d", pipe.GetHwPoolSize(), pool);
+
+    ax_det_result_t result;
+    memset(&result, 0, sizeof(result));
+    result.num_objs = 1;
+    result.objects[0].box = {40, 30, 120, 90};
+    result.objects[0].score = 0.9f;
+    int inferred = 0;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+    while (std::chrono::steady_clock::now() < deadline)
+    {
+        AXFrameInfo info;
+        cv::Mat src = pipe.GetFrame(info, 50);
+        if (src.empty())
+        {
+            if (pipe.IsFinished())
+                break;
+            continue;
+        }
+        pipe.PushDetResult(result);
+        inferred++;
+    }
+    bool finished = pipe.IsFinished();
+    pipe.Deinit();
+
+    AXHwFrameStats hs = pipe.GetHwFrameStats();
+    AXEncoderStats es = pipe.GetEncoderStats();
+    printf("inferred %d, subscribed %d frames; maps %llu, unmaps %llu, osd copies %llu; encoded %llu, %llu as surfaces\n",
+           inferred, subscribed.load(), (unsigned long long)hs.maps, (unsigned long long)hs.unmaps, (unsigned long long)pipe.GetOsdCopies(),
+           (unsigned long long)es.frames, (unsigned long long)es.surface_frames);
+
+    CHECK(finished, "pipe did not reach the end of the input");
+    CHECK(pipe.GetFrameCount() == FRAMES, "decoded %llu frames", pipe.GetFrameCount());
+    CHECK(inferred > 0, "inference saw no frame");
+    CHECK(subscribed > 0, "subscriber saw no frame");
+    // 每帧发布给推理时映射一次，画框的帧再映射一次
+    CHECK(hs.maps > FRAMES, "maps %llu: publishing alone maps every frame, the OSD more", (unsigned long long)hs.maps);
+    CHECK(hs.unmaps == hs.maps, "maps %llu, unmaps %llu", (unsigned long long)hs.maps, (unsigned long long)hs.unmaps);
+    CHECK(hs.downloads == 0 && hs.uploads == 0, "emulated frames downloaded %llu, uploaded %llu",
+          (unsigned long long)hs.downloads, (unsigned long long)hs.uploads);
+    // 订阅者还拿着的帧不能原地画
+    CHECK(pipe.GetOsdCopies() > 0, "no box was drawn on a copy");
+    CHECK(es.frames == FRAMES, "encoded %llu frames", (unsigned long long)es.frames);
+    CHECK(es.surface_frames == es.frames, "%llu of %llu frames sent as surfaces",
+          (unsigned long long)es.surface_frames, (unsigned long long)es.frames);
+    CHECK(es.bytes_copied == 0, "encoder copied %llu bytes", (unsigned long long)es.bytes_copied);
+
+    remove(INPUT);
+    remove(OUTPUT);
+    return test_result();
+}
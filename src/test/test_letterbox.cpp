@@ -0,0 +1,93 @@
+// AXNV12Letterbox: Run (NEON / AVX2 where available) must match RunRef byte for
+// byte. Sizes cover odd widths and heights, widths that are not a multiple of
+// 16 (the SIMD tails), downscaling, upscaling (where the last columns take the
+// second tap only, wx == 128), no scaling, padding on either axis, BGR and RGB.
+// The bytes past dst_w * 3 in every output row must stay untouched.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "utils/nv12_letterbox.hpp"
+#include "test_common.h"
+
+struct Case
+{
+    int src_w, src_h, dst_w, dst_h;
+};
+
+static const uint8_t CANARY = 0xa5;
+
+static void run_case(const Case &c, bool rgb)
+{
+    // linesize wider than the picture, like a decoder's aligned frames
+    int stride = (c.src_w + 1 + 63) / 64 * 64 + 32;
+    std::vector<uint8_t> y((size_t)stride * c.src_h), uv((size_t)stride * ((c.src_h + 1) / 2));
+    for (auto &b : y)
+        b = rand() & 0xff;
+    for (auto &b : uv)
+        b = rand() & 0xff;
+
+    AXNV12Letterbox lb;
+    if (lb.Init(c.src_w, c.src_h, c.dst_w, c.dst_h, rgb) != 0)
+    {
+        CHECK(false, "%dx%d -> %dx%d: Init failed", c.src_w, c.src_h, c.dst_w, c.dst_h);
+        return;
+    }
+    int dst_stride = c.dst_w * 3 + 16;
+    std::vector<uint8_t> ref((size_t)dst_stride * c.dst_h, CANARY), simd((size_t)dst_stride * c.dst_h, CANARY);
+    lb.RunRef(y.data(), stride, uv.data(), stride, ref.data(), dst_stride);
+    lb.Run(y.data(), stride, uv.data(), stride, simd.data(), dst_stride);
+
+    for (int row = 0; row < c.dst_h; row++)
+    {
+        const uint8_t *a = ref.data() + (size_t)row * dst_stride, *b = simd.data() + (size_t)row * dst_stride;
+        int x = 0;
+        while (x < c.dst_w * 3 && a[x] == b[x])
+            x++;
+        if (x < c.dst_w * 3)
+        {
+            CHECK(false, "%dx%d -> %dx%d %s: row %d byte %d, ref %d simd %d", c.src_w, c.src_h, c.dst_w, c.dst_h,
+                  rgb ? "rgb" : "bgr", row, x, a[x], b[x]);
+            return;
+        }
+        for (x = c.dst_w * 3; x < dst_stride; x++)
+        {
+            if (a[x] != CANARY || b[x] != CANARY)
+            {
+                CHECK(false, "%dx%d -> %dx%d: row %d written past the picture", c.src_w, c.src_h, c.dst_w, c.dst_h, row);
+                return;
+            }
+        }
+    }
+}
+
+int main()
+{
+    srand(1);
+    static const Case cases[] = {
+        {1920, 1080, 640, 640}, // the usual model input
+        {1920, 1080, 640, 384},
+        {1280, 720, 320, 320},
+        {1279, 719, 640, 640}, // odd sizes
+        {333, 277, 97, 101},
+        {101, 37, 17, 33},
+        {640, 360, 640, 360},  // no scaling
+        {320, 240, 640, 640},  // upscaling: the right edge columns take wx == 128
+        {176, 144, 1023, 577},
+        {35, 19, 100, 100},
+        {2, 2, 7, 5},          // smallest source
+        {720, 1280, 640, 640}, // portrait, padding left and right
+        {64, 48, 15, 15},
+        {1000, 1000, 31, 47},
+    };
+    for (const Case &c : cases)
+    {
+        run_case(c, false);
+        run_case(c, true);
+    }
+    // every destination width from 1 to 70 runs through the SIMD tails
+    for (int w = 1; w <= 70; w++)
+        run_case({97, 55, w, 40}, false);
+    return test_result();
+}
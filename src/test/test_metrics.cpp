@@ -0,0 +1,175 @@
+// AXMetrics and AXMetricsServer, plain C++, needs neither FFmpeg nor an axcl card.
+//
+// Counters and gauges updated from several threads at once, histogram bucket
+// edges and quantiles, the Prometheus text Render produces, and one scrape of
+// /metrics (and of an unknown path) through AXMetricsServer on a local port.
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "utils/metrics.hpp"
+#include "test_common.h"
+
+static const int THREADS = 8, ROUNDS = 100000;
+
+static bool has_line(const std::string &text, const std::string &line)
+{
+    return text.find(line + "\n") != std::string::npos;
+}
+
+static void test_concurrent()
+{
+    AXMetrics &m = AXMetrics::Get();
+    AXCounter *c = m.Counter("test_frames_total", "frames", "stream=\"0\"");
+    AXGauge *g = m.Gauge("test_level", "level");
+    AXHistogram *h = m.Histogram("test_latency_seconds", "latency");
+    CHECK(m.Counter("test_frames_total", "frames", "stream=\"0\"") == c, "same name and labels, different counter");
+    CHECK(m.Counter("test_frames_total", "frames", "stream=\"1\"") != c, "other labels, same counter");
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; t++)
+    {
+        threads.emplace_back([=]
+                             {
+                                 for (int i = 0; i < ROUNDS; i++)
+                                 {
+                                     c->Inc();
+                                     g->Add(0.5);
+                                     h->Observe(100);
+                                 } });
+    }
+    for (auto &t : threads)
+        t.join();
+    CHECK(c->Get() == (uint64_t)THREADS * ROUNDS, "counter %llu", (unsigned long long)c->Get());
+    CHECK(g->Get() == THREADS * ROUNDS * 0.5, "gauge %f", g->Get());
+    CHECK(h->Count() == (uint64_t)THREADS * ROUNDS, "histogram count %llu", (unsigned long long)h->Count());
+    CHECK(h->SumUs() == (int64_t)THREADS * ROUNDS * 100, "histogram sum %lld", (long long)h->SumUs());
+    g->Set(-3);
+    CHECK(g->Get() == -3, "gauge set %f", g->Get());
+}
+
+static void test_histogram()
+{
+    // 每个值落进的桶：上沿大于它，且不超过它的 1.25 倍
+    for (int64_t v = 1; v < ((int64_t)1 << 30); v = v * 3 / 2 + 1)
+    {
+        AXHistogram h;
+        h.Observe(v);
+        int64_t upper = h.Percentile(1);
+        CHECK(upper > v && (v < 4 || upper <= v + v / 4 + 1), "value %lld in bucket below %lld", (long long)v, (long long)upper);
+    }
+
+    for (int i = 1; i < AXHistogram::BUCKETS; i++)
+        CHECK(AXHistogram::UpperBound(i) > AXHistogram::UpperBound(i - 1), "bucket %d edge does not grow", i);
+    CHECK(AXHistogram::UpperBound(AXHistogram::BUCKETS - 1) > ((int64_t)1 << 30), "largest edge");
+
+    AXHistogram h;
+    CHECK(h.Percentile(0.5) == 0, "empty histogram");
+    for (int i = 0; i < 90; i++)
+        h.Observe(1000);
+    for (int i = 0; i < 10; i++)
+        h.Observe(100000);
+    CHECK(h.Percentile(0.5) > 1000 && h.Percentile(0.5) <= 1250, "p50 %lld", (long long)h.Percentile(0.5));
+    CHECK(h.Percentile(0.99) > 100000 && h.Percentile(0.99) <= 125000, "p99 %lld", (long long)h.Percentile(0.99));
+    CHECK(h.CountBelow(1024) == 90 && h.CountBelow(1 << 17) == 100 && h.CountBelow(64) == 0,
+          "count below %llu %llu", (unsigned long long)h.CountBelow(1024), (unsigned long long)h.CountBelow(1 << 17));
+    h.Observe(-5);
+    CHECK(h.CountBelow(1) == 1, "negative values go to the first bucket");
+}
+
+static void test_render()
+{
+    AXMetrics &m = AXMetrics::Get();
+    m.Counter("test_render_total", "rendered things", "stream=\"2\",card=\"1\"")->Inc(7);
+    m.Gauge("test_render_level", "a level")->Set(2.5);
+    AXHistogram *h = m.Histogram("test_render_seconds", "a latency", "stream=\"2\"");
+    h->Observe(50);
+    h->Observe(1000);
+    h->Observe(2000000);
+
+    std::string text = m.Render();
+    CHECK(has_line(text, "# HELP test_render_total rendered things"), "counter help");
+    CHECK(has_line(text, "# TYPE test_render_total counter"), "counter type");
+    CHECK(has_line(text, "test_render_total{stream=\"2\",card=\"1\"} 7"), "counter value");
+    CHECK(has_line(text, "# TYPE test_render_level gauge"), "gauge type");
+    CHECK(has_line(text, "test_render_level 2.5"), "gauge without labels");
+    CHECK(has_line(text, "# TYPE test_render_seconds histogram"), "histogram type");
+    CHECK(has_line(text, "test_render_seconds_bucket{stream=\"2\",le=\"6.4e-05\"} 1"), "first bucket");
+    CHECK(has_line(text, "test_render_seconds_bucket{stream=\"2\",le=\"0.001024\"} 2"), "1 ms bucket");
+    CHECK(has_line(text, "test_render_seconds_bucket{stream=\"2\",le=\"2.09715\"} 3"), "2 s bucket");
+    CHECK(has_line(text, "test_render_seconds_bucket{stream=\"2\",le=\"+Inf\"} 3"), "+Inf bucket");
+    CHECK(has_line(text, "test_render_seconds_sum{stream=\"2\"} 2.001050"), "sum");
+    CHECK(has_line(text, "test_render_seconds_count{stream=\"2\"} 3"), "count");
+    if (failures)
+        printf("%s", text.c_str());
+}
+
+// one request, the whole answer
+static std::string http_get(int port, const char *path)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    std::string out;
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+    {
+        std::string req = std::string("GET ") + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        send(fd, req.data(), req.size(), MSG_NOSIGNAL);
+        char buf[4096];
+        ssize_t n;
+        while ((n = recv(fd, buf, sizeof(buf), 0)) > 0)
+            out.append(buf, n);
+    }
+    if (fd >= 0)
+        close(fd);
+    return out;
+}
+
+static void test_server()
+{
+    // 端口可能被占，往后找一个
+    AXMetricsServer server;
+    int port = 0;
+    for (int p = 19464; p < 19564 && !port; p++)
+    {
+        if (server.Start(p) == 0)
+            port = p;
+    }
+    CHECK(port != 0, "no free port");
+    if (!port)
+        return;
+
+    AXMetrics::Get().Counter("test_scraped_total", "scrapes")->Inc();
+    std::string resp = http_get(port, "/metrics");
+    CHECK(resp.compare(0, 15, "HTTP/1.1 200 OK") == 0, "status: %.40s", resp.c_str());
+    CHECK(resp.find("Content-Type: text/plain; version=0.0.4\r\n") != std::string::npos, "content type");
+    size_t body = resp.find("\r\n\r\n");
+    CHECK(body != std::string::npos, "no header end");
+    if (body != std::string::npos)
+    {
+        std::string text = resp.substr(body + 4);
+        char length[64];
+        snprintf(length, sizeof(length), "Content-Length: %zu\r\n", text.size());
+        CHECK(resp.find(length) != std::string::npos, "content length does not match %zu body bytes", text.size());
+        CHECK(has_line(text, "test_scraped_total 1"), "scraped counter");
+    }
+
+    resp = http_get(port, "/other");
+    CHECK(resp.compare(0, 22, "HTTP/1.1 404 Not Found") == 0, "unknown path: %.40s", resp.c_str());
+    server.Stop();
+    CHECK(http_get(port, "/metrics").empty(), "answers after Stop");
+}
+
+int main()
+{
+    test_concurrent();
+    test_histogram();
+    test_render();
+    test_server();
+    return test_result();
+}
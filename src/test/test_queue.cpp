@@ -0,0 +1,196 @@
+// AXFFmpegQueue overflow policies, needs no axcl card.
+//
+// Fills a queue of 3 past capacity under block, drop_oldest and drop_non_ref,
+// with frames (B frames are non-reference) and with packets (disposable ones
+// are), and checks which items survive in which order, what Push returns
+// (0 queued, 1 dropped, AVERROR_EOF aborted), the drop counters and the
+// metrics mirrors. A blocked Push must return only after a Pop made room.
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ffmpeg/AXFFmpegQueue.hpp"
+#include "test_common.h"
+
+static const int CAPACITY = 3;
+
+// frame with a real buffer, so the queue's reference is a real one; pts is the id
+static AVFrame *make_frame(int id, AVPictureType type)
+{
+    AVFrame *f = av_frame_alloc();
+    f->format = AV_PIX_FMT_GRAY8;
+    f->width = 16;
+    f->height = 16;
+    av_frame_get_buffer(f, 0);
+    f->pts = id;
+    f->pict_type = type;
+    return f;
+}
+
+static AVPacket *make_packet(int id, int flags)
+{
+    AVPacket *p = av_packet_alloc();
+    av_new_packet(p, 16);
+    p->pts = id;
+    p->flags = flags;
+    return p;
+}
+
+template <typename T>
+static std::string drain(AXFFmpegQueue<T> &q)
+{
+    std::string ids;
+    T *dst = AXAVTraits<T>::alloc();
+    while (q.Pop(dst, 0) == 0)
+    {
+        ids += std::to_string(dst->pts) + " ";
+        AXAVTraits<T>::unref(dst);
+    }
+    AXAVTraits<T>::free(&dst);
+    return ids;
+}
+
+// pushes every item, returns the Push results as a string
+template <typename T>
+static std::string push_all(AXFFmpegQueue<T> &q, const std::vector<T *> &items)
+{
+    std::string ret;
+    for (T *p : items)
+        ret += std::to_string(q.Push(p)) + " ";
+    return ret;
+}
+
+template <typename T>
+static void free_all(std::vector<T *> &items)
+{
+    for (T *p : items)
+        AXAVTraits<T>::free(&p);
+    items.clear();
+}
+
+// Push on a full blocking queue returns only after a Pop
+template <typename T>
+static void check_blocks(AXFFmpegQueue<T> &q, T *item, const char *what)
+{
+    std::atomic<int> result{-100};
+    std::thread producer([&]
+                         { result = q.Push(item); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    CHECK(result == -100, "%s: push on a full queue returned %d without blocking", what, result.load());
+    T *dst = AXAVTraits<T>::alloc();
+    CHECK(q.Pop(dst) == 0, "%s: pop", what);
+    producer.join();
+    CHECK(result == 0, "%s: blocked push returned %d", what, result.load());
+    CHECK(q.GetStats().push_wait_us >= 50000, "%s: push wait %lld us", what, (long long)q.GetStats().push_wait_us);
+    AXAVTraits<T>::free(&dst);
+}
+
+static void test_block()
+{
+    AXFFmpegQueue<AVFrame> q;
+    q.Config(CAPACITY, ax_overflow_block);
+    std::vector<AVFrame *> f;
+    for (int i = 0; i < 5; i++)
+        f.push_back(make_frame(i, AV_PICTURE_TYPE_P));
+
+    CHECK(push_all(q, {f[0], f[1], f[2]}) == "0 0 0 ", "pushes into a free queue");
+    check_blocks(q, f[3], "block");
+    CHECK(q.Size() == CAPACITY, "size %d", (int)q.Size());
+    AXQueueStats st = q.GetStats();
+    CHECK(st.pushed == 4 && st.popped == 1 && st.dropped == 0 && st.max_depth == CAPACITY,
+          "stats pushed %llu popped %llu dropped %llu max %d", (unsigned long long)st.pushed,
+          (unsigned long long)st.popped, (unsigned long long)st.dropped, st.max_depth);
+
+    // 阻塞中的 Push 在 Abort 后返回 EOF，之后的 Pop 先取完剩下的
+    std::atomic<int> result{-100};
+    std::thread producer([&]
+                         { result = q.Push(f[4]); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    q.Abort();
+    producer.join();
+    CHECK(result == AVERROR_EOF, "push blocked at Abort returned %d", result.load());
+    CHECK(q.Push(f[4]) == AVERROR_EOF, "push after Abort");
+    CHECK(drain(q) == "1 2 3 ", "left after Abort");
+    AVFrame *dst = av_frame_alloc();
+    CHECK(q.Pop(dst, 10) == AVERROR_EOF, "pop of an aborted, empty queue");
+
+    q.Reset();
+    CHECK(q.Pop(dst, 10) == AVERROR(EAGAIN), "pop times out on an empty queue");
+    CHECK(q.Push(f[4]) == 0 && drain(q) == "4 ", "push after Reset");
+    av_frame_free(&dst);
+    free_all(f);
+}
+
+static void test_drop_oldest()
+{
+    AXFFmpegQueue<AVFrame> q;
+    q.Config(CAPACITY, ax_overflow_drop_oldest);
+    AXGauge depth;
+    AXCounter dropped;
+    q.SetMetrics(&depth, &dropped);
+    std::vector<AVFrame *> f;
+    for (int i = 0; i < 5; i++)
+        f.push_back(make_frame(i, AV_PICTURE_TYPE_P));
+
+    CHECK(push_all(q, f) == "0 0 0 0 0 ", "drop_oldest never refuses");
+    CHECK(q.GetStats().dropped == 2 && dropped.Get() == 2 && depth.Get() == CAPACITY, "dropped %llu, metrics %llu / %g",
+          (unsigned long long)q.GetStats().dropped, (unsigned long long)dropped.Get(), depth.Get());
+    CHECK(drain(q) == "2 3 4 ", "newest survive");
+    CHECK(depth.Get() == 0, "depth after drain %g", depth.Get());
+    free_all(f);
+
+    // 包也可以用 drop_oldest
+    AXFFmpegQueue<AVPacket> qp;
+    qp.Config(CAPACITY, ax_overflow_drop_oldest);
+    std::vector<AVPacket *> p;
+    for (int i = 0; i < 4; i++)
+        p.push_back(make_packet(i, i == 0 ? AV_PKT_FLAG_KEY : 0));
+    CHECK(push_all(qp, p) == "0 0 0 0 " && drain(qp) == "1 2 3 " && qp.GetStats().dropped == 1, "packets, drop_oldest");
+    free_all(p);
+}
+
+static void test_drop_non_ref_frames()
+{
+    AXFFmpegQueue<AVFrame> q;
+    q.Config(CAPACITY, ax_overflow_drop_non_ref);
+    std::vector<AVFrame *> f = {make_frame(0, AV_PICTURE_TYPE_I), make_frame(1, AV_PICTURE_TYPE_B),
+                                make_frame(2, AV_PICTURE_TYPE_P), make_frame(3, AV_PICTURE_TYPE_P),
+                                make_frame(4, AV_PICTURE_TYPE_B), make_frame(5, AV_PICTURE_TYPE_P)};
+    // 3 挤掉队列里的 B 帧 1；4 是 B 帧而队列里没有 B 帧，丢 4 本身；5 退回 drop_oldest，丢 0
+    CHECK(push_all(q, f) == "0 0 0 0 1 0 ", "push results");
+    CHECK(q.GetStats().dropped == 3, "dropped %llu", (unsigned long long)q.GetStats().dropped);
+    CHECK(drain(q) == "2 3 5 ", "survivors");
+    free_all(f);
+}
+
+static void test_drop_non_ref_packets()
+{
+    AXFFmpegQueue<AVPacket> q;
+    q.Config(CAPACITY, ax_overflow_drop_non_ref);
+    AXCounter dropped;
+    q.SetMetrics(nullptr, &dropped);
+    std::vector<AVPacket *> p = {make_packet(0, AV_PKT_FLAG_KEY), make_packet(1, AV_PKT_FLAG_DISPOSABLE),
+                                 make_packet(2, 0), make_packet(3, 0), make_packet(4, AV_PKT_FLAG_DISPOSABLE),
+                                 make_packet(5, 0)};
+    CHECK(push_all(q, {p[0], p[1], p[2], p[3], p[4]}) == "0 0 0 0 1 ", "push results");
+    CHECK(q.GetStats().dropped == 2 && dropped.Get() == 2, "dropped %llu, metric %llu",
+          (unsigned long long)q.GetStats().dropped, (unsigned long long)dropped.Get());
+    // 没有可丢的包时不丢参考包，退回阻塞；取走 0 后 5 进队
+    check_blocks(q, p[5], "drop_non_ref packets");
+    CHECK(drain(q) == "2 3 5 ", "survivors");
+    CHECK(q.GetStats().dropped == 2, "blocking dropped a packet");
+    free_all(p);
+}
+
+int main()
+{
+    test_block();
+    test_drop_oldest();
+    test_drop_non_ref_frames();
+    test_drop_non_ref_packets();
+    return test_result();
+}
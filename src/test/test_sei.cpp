@@ -0,0 +1,424 @@
+// AXSeiInjector: SEI payload coding, emulation prevention and placement.
+//
+// The first part works on hand built packets and reads the inserted NAL back
+// byte by byte: payload sizes around the 255 boundary of the ff_byte coding,
+// several messages in one NAL, payload bytes that need emulation prevention
+// (and one that must not get it), Annex-B and 1 / 2 / 4 byte length prefixes,
+// H.264 and HEVC NAL headers, packets without a slice.
+//
+// The second part encodes a short clip with the software encoder, injects a
+// message into every packet in both framings (the mp4 packets as demuxed, and
+// the same packets through *_mp4toannexb) and decodes them with FFmpeg's own
+// h264 / hevc decoder, which must return every message unchanged as
+// AV_FRAME_DATA_SEI_UNREGISTERED. It is skipped when the FFmpeg build has no
+// libx264 / libx265; the first part always runs.
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#include "libavcodec/avcodec.h"
+#include "libavcodec/bsf.h"
+#include "libavformat/avformat.h"
+}
+
+#include "ffmpeg/AXSeiInjector.hpp"
+#include "ffmpeg/AXFFmpegEncoder.hpp"
+#include "test_common.h"
+
+typedef std::vector<uint8_t> Bytes;
+
+struct Nal
+{
+    int offset; // of the start code / length prefix in the packet
+    Bytes data; // header and payload, still escaped
+};
+
+// NAL units of an Annex-B (nal_length_size 0) or length prefixed packet
+static std::vector<Nal> split(const uint8_t *p, int size, int nal_length_size)
+{
+    std::vector<Nal> nals;
+    if (nal_length_size > 0)
+    {
+        for (int pos = 0; pos + nal_length_size <= size;)
+        {
+            uint32_t len = 0;
+            for (int i = 0; i < nal_length_size; i++)
+                len = (len << 8) | p[pos + i];
+            if (pos + nal_length_size + (int64_t)len > size)
+                break;
+            nals.push_back({pos, Bytes(p + pos + nal_length_size, p + pos + nal_length_size + len)});
+            pos += nal_length_size + len;
+        }
+        return nals;
+    }
+    std::vector<std::pair<int, int>> starts; // start code offset, NAL offset
+    for (int i = 0; i + 2 < size; i++)
+    {
+        if (p[i] == 0 && p[i + 1] == 0 && p[i + 2] == 1)
+        {
+            int sc = i > 0 && p[i - 1] == 0 ? i - 1 : i;
+            starts.push_back({sc, i + 3});
+            i += 2;
+        }
+    }
+    for (size_t k = 0; k < starts.size(); k++)
+    {
+        int end = k + 1 < starts.size() ? starts[k + 1].first : size;
+        nals.push_back({starts[k].first, Bytes(p + starts[k].second, p + end)});
+    }
+    return nals;
+}
+
+// remove emulation prevention; *escaped_ok is false if a 00 00 0x (x <= 3) is left in
+static Bytes unescape(const Bytes &nal, bool *escaped_ok)
+{
+    Bytes out;
+    int zeros = 0;
+    *escaped_ok = true;
+    for (size_t i = 0; i < nal.size(); i++)
+    {
+        uint8_t b = nal[i];
+        if (zeros >= 2 && b <= 3)
+        {
+            if (b != 3)
+                *escaped_ok = false;
+            zeros = 0;
+            if (b == 3)
+                continue;
+        }
+        out.push_back(b);
+        zeros = b == 0 ? zeros + 1 : 0;
+    }
+    return out;
+}
+
+// messages of an SEI rbsp as (payloadType, payload); false if it is malformed
+static bool parse_sei(const Bytes &rbsp, size_t header, std::vector<std::pair<int, Bytes>> *msgs)
+{
+    size_t pos = header;
+    while (pos < rbsp.size() && rbsp[pos] != 0x80)
+    {
+        int type = 0, size = 0;
+        while (pos < rbsp.size() && rbsp[pos] == 0xff)
+            type += rbsp[pos++];
+        if (pos >= rbsp.size())
+            return false;
+        type += rbsp[pos++];
+        while (pos < rbsp.size() && rbsp[pos] == 0xff)
+            size += rbsp[pos++];
+        if (pos >= rbsp.size())
+            return false;
+        size += rbsp[pos++];
+        if (pos + size > rbsp.size())
+            return false;
+        msgs->push_back({type, Bytes(rbsp.begin() + pos, rbsp.begin() + pos + size)});
+        pos += size;
+    }
+    // rbsp_trailing_bits ends the NAL
+    return pos + 1 == rbsp.size() && rbsp[pos] == 0x80;
+}
+
+static Bytes nal_bytes(int nal_length_size, const std::vector<Bytes> &nals)
+{
+    Bytes pkt;
+    for (auto &n : nals)
+    {
+        if (nal_length_size == 0)
+            pkt.insert(pkt.end(), {0, 0, 0, 1});
+        for (int i = nal_length_size - 1; i >= 0; i--)
+            pkt.push_back((uint8_t)(n.size() >> (8 * i)));
+        pkt.insert(pkt.end(), n.begin(), n.end());
+    }
+    return pkt;
+}
+
+struct Case
+{
+    const char *name;
+    AVCodecID codec_id;
+    int nal_length_size;
+};
+
+// inject payloads into [non-VCL..., slice] and check the NAL that comes out
+static void check_inject(const Case &c, const std::vector<std::string> &payloads, size_t expect_escapes = (size_t)-1)
+{
+    bool h264 = c.codec_id == AV_CODEC_ID_H264;
+    // H.264: AUD, SPS, IDR slice. HEVC: VPS, SPS, IDR_W_RADL slice
+    std::vector<Bytes> in_nals = h264 ? std::vector<Bytes>{{0x09, 0xf0}, {0x67, 0x42, 0x00, 0x1e}, {0x65, 0x88, 0x84, 0x00}}
+                                      : std::vector<Bytes>{{0x40, 0x01, 0x0c}, {0x42, 0x01, 0x01}, {0x26, 0x01, 0xaf, 0x00}};
+    Bytes in = nal_bytes(c.nal_length_size, in_nals);
+
+    AVCodecParameters *par = avcodec_parameters_alloc();
+    par->codec_id = c.codec_id;
+    Bytes extradata;
+    if (c.nal_length_size > 0)
+    {
+        // just enough avcC / hvcC for the NAL length size to be read
+        extradata.assign(h264 ? 7 : 23, 0);
+        extradata[0] = 1;
+        extradata[h264 ? 4 : 21] = 0xfc | (c.nal_length_size - 1);
+        par->extradata = (uint8_t *)av_mallocz(extradata.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+        memcpy(par->extradata, extradata.data(), extradata.size());
+        par->extradata_size = (int)extradata.size();
+    }
+    AXSeiInjector sei;
+    CHECK(sei.Init(par) == 0, "%s: Init", c.name);
+    avcodec_parameters_free(&par);
+
+    AVPacket *pin = av_packet_alloc(), *pout = av_packet_alloc();
+    av_new_packet(pin, (int)in.size());
+    memcpy(pin->data, in.data(), in.size());
+    pin->pts = 42;
+    pin->flags = AV_PKT_FLAG_KEY;
+
+    int ret = sei.Inject(pin, payloads, pout);
+    CHECK(ret == 0, "%s: Inject returned %d", c.name, ret);
+    if (ret == 0)
+    {
+        CHECK(pout->pts == 42 && (pout->flags & AV_PKT_FLAG_KEY), "%s: packet props not copied", c.name);
+        std::vector<Nal> out = split(pout->data, pout->size, c.nal_length_size);
+        CHECK(out.size() == in_nals.size() + 1, "%s: %d NAL units, expected %d", c.name, (int)out.size(), (int)in_nals.size() + 1);
+        if (out.size() == in_nals.size() + 1)
+        {
+            // the SEI goes right before the slice, the other NAL units are untouched
+            for (size_t i = 0; i + 1 < in_nals.size(); i++)
+                CHECK(out[i].data == in_nals[i], "%s: NAL %d changed", c.name, (int)i);
+            CHECK(out.back().data == in_nals.back(), "%s: slice changed", c.name);
+            const Bytes &nal = out[in_nals.size() - 1].data;
+            size_t header = h264 ? 1 : 2;
+            CHECK(h264 ? nal[0] == 6 : (nal[0] == (39 << 1) && nal[1] == 1), "%s: not an SEI NAL header", c.name);
+
+            bool escaped_ok;
+            Bytes rbsp = unescape(nal, &escaped_ok);
+            CHECK(escaped_ok, "%s: 00 00 0x left unescaped", c.name);
+            if (expect_escapes != (size_t)-1)
+                CHECK(nal.size() - rbsp.size() == expect_escapes, "%s: %d emulation prevention bytes, expected %d",
+                      c.name, (int)(nal.size() - rbsp.size()), (int)expect_escapes);
+
+            std::vector<std::pair<int, Bytes>> msgs;
+            CHECK(parse_sei(rbsp, header, &msgs), "%s: malformed SEI rbsp", c.name);
+            CHECK(msgs.size() == payloads.size(), "%s: %d messages, expected %d", c.name, (int)msgs.size(), (int)payloads.size());
+            for (size_t i = 0; i < msgs.size() && i < payloads.size(); i++)
+            {
+                Bytes expect(AXSeiInjector::UUID, AXSeiInjector::UUID + 16);
+                expect.insert(expect.end(), payloads[i].begin(), payloads[i].end());
+                CHECK(msgs[i].first == 5, "%s: payloadType %d", c.name, msgs[i].first);
+                CHECK(msgs[i].second == expect, "%s: payload %d (%d bytes) differs", c.name, (int)i, (int)expect.size());
+            }
+        }
+    }
+    av_packet_unref(pout);
+
+    // no slice: nothing is written, the caller keeps the payloads
+    pin->size = (int)nal_bytes(c.nal_length_size, {in_nals[0]}).size();
+    CHECK(sei.Inject(pin, payloads, pout) == 1 && pout->size == 0, "%s: packet without a slice", c.name);
+
+    av_packet_free(&pin);
+    av_packet_free(&pout);
+}
+
+static void test_bytes()
+{
+    const Case cases[] = {
+        {"h264 annexb", AV_CODEC_ID_H264, 0},
+        {"h264 avcc4", AV_CODEC_ID_H264, 4},
+        {"h264 avcc2", AV_CODEC_ID_H264, 2},
+        {"hevc annexb", AV_CODEC_ID_HEVC, 0},
+        {"hevc hvcc4", AV_CODEC_ID_HEVC, 4},
+        {"hevc hvcc1", AV_CODEC_ID_HEVC, 1},
+    };
+    for (const Case &c : cases)
+    {
+        // payloadSize is the UUID plus the text: 16, and both sides of 255 and 510
+        int sizes[] = {16, 254, 255, 256, 509, 510, 511, 1000};
+        for (int size : sizes)
+        {
+            // a 1 byte length prefix can not describe the larger NALs
+            if (c.nal_length_size == 1 && size > 200)
+                continue;
+            check_inject(c, {std::string(size - 16, 'a')});
+        }
+        check_inject(c, {"{\"pts\":1}", std::string(c.nal_length_size == 1 ? 180 : 300, 'b'), ""});
+
+        // 00 00 00 / 01 / 02 / 03 need an 03 inserted, 00 00 04 does not
+        std::string text("x\0\0\0y\0\0\1y\0\0\2y\0\0\3y\0\0\4", 21);
+        check_inject(c, {text}, 4);
+        // zeros running into the next message header (type 5) and into the trailing bits (0x80)
+        // need no escape, the run of four zeros needs one
+        check_inject(c, {std::string("\0\0", 2), std::string("\0\0\0\0", 4)}, 1);
+    }
+
+    // an SEI longer than a 1 byte length prefix can hold is refused
+    AVCodecParameters *par = avcodec_parameters_alloc();
+    par->codec_id = AV_CODEC_ID_H264;
+    par->extradata = (uint8_t *)av_mallocz(7 + AV_INPUT_BUFFER_PADDING_SIZE);
+    par->extradata[0] = 1;
+    par->extradata[4] = 0xfc;
+    par->extradata_size = 7;
+    AXSeiInjector sei;
+    sei.Init(par);
+    avcodec_parameters_free(&par);
+    Bytes in = nal_bytes(1, {{0x65, 0x88}});
+    AVPacket *pin = av_packet_alloc(), *pout = av_packet_alloc();
+    av_new_packet(pin, (int)in.size());
+    memcpy(pin->data, in.data(), in.size());
+    CHECK(sei.Inject(pin, {std::string(300, 'c')}, pout) == AVERROR(EINVAL), "oversized SEI for a 1 byte prefix not refused");
+    av_packet_free(&pin);
+    av_packet_free(&pout);
+
+    AVCodecParameters *mpeg4 = avcodec_parameters_alloc();
+    mpeg4->codec_id = AV_CODEC_ID_MPEG4;
+    CHECK(AXSeiInjector().Init(mpeg4) < 0, "Init accepted mpeg4");
+    avcodec_parameters_free(&mpeg4);
+}
+
+static const int FRAMES = 30;
+
+// sizes over the 255 boundary, with bytes that need escaping
+static std::string payload_for(int64_t pts)
+{
+    std::string text = "{\"pts\":" + std::to_string(pts) + "}";
+    text += std::string("\0\0\1", 3);
+    text.resize(230 + pts, 'z');
+    return text;
+}
+
+static int encode_clip(const std::string &path, AXFFmpegCodecID codec_id)
+{
+    AXFFmpegEncoder encoder;
+    if (encoder.Init(path, codec_id, W, H, FPS, 0, ax_codec_backend_sw) != 0)
+        return -1;
+    AVCodecParameters *par = avcodec_parameters_alloc();
+    encoder.GetCodecParameters(par);
+    AVCodecID id = par->codec_id;
+    avcodec_parameters_free(&par);
+
+    AVFrame *frame = av_frame_alloc();
+    frame->format = AV_PIX_FMT_NV12;
+    frame->width = W;
+    frame->height = H;
+    av_frame_get_buffer(frame, 0);
+    for (int i = 0; i < FRAMES; i++)
+    {
+        memset(frame->data[0], i * 7, frame->linesize[0] * H);
+        memset(frame->data[1], 128, frame->linesize[1] * H / 2);
+        frame->pts = i;
+        encoder.Encode(frame);
+    }
+    encoder.Deinit();
+    av_frame_free(&frame);
+    return id == AV_CODEC_ID_H264 || id == AV_CODEC_ID_HEVC ? 0 : 1;
+}
+
+// inject into every packet of the clip and check what the decoder hands back
+static void decode_injected(const char *name, const std::string &path, bool annexb)
+{
+    AVFormatContext *fmt = nullptr;
+    if (avformat_open_input(&fmt, path.c_str(), nullptr, nullptr) < 0 || avformat_find_stream_info(fmt, nullptr) < 0)
+    {
+        CHECK(false, "%s: could not open %s", name, path.c_str());
+        return;
+    }
+    AVStream *st = fmt->streams[0];
+
+    AVBSFContext *bsf = nullptr;
+    const AVCodecParameters *par = st->codecpar;
+    if (annexb)
+    {
+        const AVBitStreamFilter *f = av_bsf_get_by_name(st->codecpar->codec_id == AV_CODEC_ID_H264 ? "h264_mp4toannexb" : "hevc_mp4toannexb");
+        av_bsf_alloc(f, &bsf);
+        avcodec_parameters_copy(bsf->par_in, st->codecpar);
+        bsf->time_base_in = st->time_base;
+        av_bsf_init(bsf);
+        par = bsf->par_out;
+    }
+
+    AXSeiInjector sei;
+    sei.Init(par);
+    const AVCodec *codec = avcodec_find_decoder(par->codec_id);
+    AVCodecContext *dec = avcodec_alloc_context3(codec);
+    avcodec_parameters_to_context(dec, par);
+    dec->pkt_timebase = st->time_base;
+    avcodec_open2(dec, codec, nullptr);
+
+    AVPacket *pkt = av_packet_alloc(), *out = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    int injected = 0, frames = 0, matched = 0;
+    auto receive = [&]
+    {
+        while (avcodec_receive_frame(dec, frame) == 0)
+        {
+            frames++;
+            std::string expect = payload_for(av_rescale_q(frame->pts, st->time_base, {1, FPS}));
+            for (int i = 0; i < frame->nb_side_data; i++)
+            {
+                AVFrameSideData *sd = frame->side_data[i];
+                if (sd->type != AV_FRAME_DATA_SEI_UNREGISTERED || sd->size < 16 || memcmp(sd->data, AXSeiInjector::UUID, 16) != 0)
+                    continue;
+                if (std::string((const char *)sd->data + 16, sd->size - 16) == expect)
+                    matched++;
+                else
+                    CHECK(false, "%s: frame %lld carries a different payload", name, (long long)frame->pts);
+            }
+            av_frame_unref(frame);
+        }
+    };
+
+    while (av_read_frame(fmt, pkt) >= 0)
+    {
+        if (bsf)
+        {
+            av_bsf_send_packet(bsf, pkt);
+            if (av_bsf_receive_packet(bsf, pkt) < 0)
+                continue;
+        }
+        int64_t pts = av_rescale_q(pkt->pts, st->time_base, {1, FPS});
+        if (sei.Inject(pkt, {payload_for(pts)}, out) == 0)
+        {
+            injected++;
+            avcodec_send_packet(dec, out);
+            av_packet_unref(out);
+        }
+        av_packet_unref(pkt);
+        receive();
+    }
+    avcodec_send_packet(dec, nullptr);
+    receive();
+
+    printf("%s: %d packets injected, %d frames decoded, %d payloads returned intact\n", name, injected, frames, matched);
+    CHECK(injected == FRAMES && frames == FRAMES && matched == FRAMES, "%s: expected %d of each", name, FRAMES);
+
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+    av_packet_free(&out);
+    avcodec_free_context(&dec);
+    av_bsf_free(&bsf);
+    avformat_close_input(&fmt);
+}
+
+static void test_decode(const char *name, AXFFmpegCodecID codec_id)
+{
+    std::string path = std::string("test_sei_") + name + ".mp4";
+    int ret = encode_clip(path, codec_id);
+    if (ret != 0)
+    {
+        printf("SKIP %s decode: no %s software encoder\n", name, name);
+        remove(path.c_str());
+        return;
+    }
+    decode_injected((std::string(name) + " length prefixed").c_str(), path, false);
+    decode_injected((std::string(name) + " annexb").c_str(), path, true);
+    remove(path.c_str());
+}
+
+int main()
+{
+    av_log_set_level(AV_LOG_ERROR);
+    test_bytes();
+    test_decode("h264", h264_ax);
+    test_decode("hevc", hevc_ax);
+    return test_result();
+}
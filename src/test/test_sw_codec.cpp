@@ -0,0 +1,171 @@
+// Software codec round trip, needs no axcl card.
+//
+// AXFFmpegEncoder with ax_codec_backend_sw writes synthetic NV12 frames to an mp4,
+// AXFFmpegDecoder with ax_codec_backend_sw reads it back. Checks that every frame
+// comes out, in order, as NV12 of the encoded size, and that the luma is close to
+// what went in. Runs for h264 (libx264 takes NV12 as is) and hevc (libx265 goes
+// through the YUV420P conversion). An FFmpeg build with neither falls back to
+// mpeg4, which the decoder does not take; the test then exits with 77 (skipped).
+#include <math.h>
+#include <stdio.h>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "ffmpeg/AXFFmpegEncoder.hpp"
+#include "ffmpeg/AXFFmpegDecoder.hpp"
+#include "test_common.h"
+
+static const int FRAMES = 50;
+
+// smooth pattern moving 2 px per frame, so a low bit rate still keeps it recognisable
+static uint8_t luma(int x, int y, int i)
+{
+    return (uint8_t)(128 + 60 * sin((x + 2 * i) * 0.05) + 40 * cos(y * 0.04));
+}
+
+static void fill(AVFrame *f, int i)
+{
+    for (int y = 0; y < H; y++)
+        for (int x = 0; x < W; x++)
+            f->data[0][y * f->linesize[0] + x] = luma(x, y, i);
+    for (int y = 0; y < H / 2; y++)
+        for (int x = 0; x < W / 2; x++)
+        {
+            f->data[1][y * f->linesize[1] + 2 * x] = (uint8_t)(128 + x / 4);
+            f->data[1][y * f->linesize[1] + 2 * x + 1] = (uint8_t)(128 - y / 4);
+        }
+}
+
+static double psnr_y(const AVFrame *f, int i)
+{
+    double se = 0;
+    for (int y = 0; y < H; y++)
+        for (int x = 0; x < W; x++)
+        {
+            double d = (double)f->data[0][y * f->linesize[0] + x] - luma(x, y, i);
+            se += d * d;
+        }
+    double mse = se / (W * H);
+    return mse > 0 ? 10 * log10(255.0 * 255.0 / mse) : 99;
+}
+
+static int encode(const std::string &path, AXFFmpegCodecID codec_id)
+{
+    AXFFmpegEncoder encoder;
+    if (encoder.Init(path, codec_id, W, H, FPS, 0, ax_codec_backend_sw) != 0)
+    {
+        printf("encoder init failed\n");
+        return -1;
+    }
+
+    AVFrame *frame = av_frame_alloc();
+    frame->format = AV_PIX_FMT_NV12;
+    frame->width = W;
+    frame->height = H;
+    if (av_frame_get_buffer(frame, 0) < 0)
+        return -1;
+    // 走编码线程，和 pipe 的用法一致
+    encoder.Start(4, ax_overflow_block);
+    for (int i = 0; i < FRAMES; i++)
+    {
+        if (av_frame_make_writable(frame) < 0)
+            return -1;
+        fill(frame, i);
+        frame->pts = i;
+        encoder.Push(frame);
+    }
+    encoder.Deinit();
+    av_frame_free(&frame);
+
+    AXEncoderStats s = encoder.GetStats();
+    printf("encoded %llu frames into %llu packets\n", (unsigned long long)s.frames, (unsigned long long)s.packets);
+    if (s.frames != FRAMES || s.packets != FRAMES)
+    {
+        printf("FAIL: expected %d frames and packets\n", FRAMES);
+        return -1;
+    }
+
+    AVCodecParameters *par = avcodec_parameters_alloc();
+    encoder.GetCodecParameters(par);
+    AVCodecID id = par->codec_id;
+    avcodec_parameters_free(&par);
+    if (id != AV_CODEC_ID_H264 && id != AV_CODEC_ID_HEVC)
+    {
+        printf("SKIP: encoder fell back to %s\n", avcodec_get_name(id));
+        return SKIPPED;
+    }
+    return 0;
+}
+
+static int decode(const std::string &path)
+{
+    std::mutex mtx;
+    int frames = 0, bad_format = 0;
+    double min_psnr = 99;
+
+    AXFFmpegDecoder decoder;
+    if (decoder.Init(path, auto_ax, 0, ax_codec_backend_sw) != 0)
+    {
+        printf("decoder init failed\n");
+        return -1;
+    }
+    decoder.Start([&](AVFrame *frame, void *)
+                  {
+                      std::lock_guard<std::mutex> lock(mtx);
+                      if (frame->format != AV_PIX_FMT_NV12 || frame->width != W || frame->height != H)
+                          bad_format++;
+                      else
+                          min_psnr = std::min(min_psnr, psnr_y(frame, frames));
+                      frames++; });
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+    while (!decoder.IsFinished() && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    bool finished = decoder.IsFinished();
+    decoder.Deinit();
+
+    printf("decoded %d frames, min luma psnr %.1f dB\n", frames, min_psnr);
+    if (!finished)
+    {
+        printf("FAIL: decoder did not reach the end of the file\n");
+        return -1;
+    }
+    if (frames != FRAMES || bad_format)
+    {
+        printf("FAIL: expected %d NV12 %dx%d frames, %d had another format or size\n", FRAMES, W, H, bad_format);
+        return -1;
+    }
+    // 丢帧、帧序错位或者解出别的内容都会让 psnr 明显下降
+    if (min_psnr < 30)
+    {
+        printf("FAIL: luma psnr below 30 dB\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int round_trip(const char *name, AXFFmpegCodecID codec_id)
+{
+    std::string path = std::string("test_sw_codec_") + name + ".mp4";
+    printf("--- %s\n", name);
+    int ret = encode(path, codec_id);
+    if (ret == 0)
+        ret = decode(path);
+    if (ret == 0 || ret == SKIPPED)
+        remove(path.c_str());
+    return ret;
+}
+
+int main()
+{
+    int h264 = round_trip("h264", h264_ax);
+    int hevc = round_trip("hevc", hevc_ax);
+    if (h264 < 0 || hevc < 0)
+        return 1;
+    if (h264 == SKIPPED && hevc == SKIPPED)
+        return SKIPPED;
+    printf("PASS\n");
+    return 0;
+}
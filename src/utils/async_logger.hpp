@@ -0,0 +1,248 @@
+/**************************************************************************************************
+ *
+ * Copyright (c) 2019-2024 Axera Semiconductor Co., Ltd. All Rights Reserved.
+ *
+ * This source file is the property of Axera Semiconductor Co., Ltd. and
+ * may not be copied or distributed in any isomorphic form without the prior
+ * written consent of Axera Semiconductor Co., Ltd.
+ *
+ **************************************************************************************************/
+
+#ifndef __SAMPLE_ASYNC_LOGGER_HPP__
+#define __SAMPLE_ASYNC_LOGGER_HPP__
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "spsc_queue.hpp"
+#include "timer.hpp"
+
+// Backend of the SAMPLE_LOG_* macros.
+//
+// Until Start the macros print on the calling thread as before. After Start a
+// line is formatted on the calling thread into that thread's own lock-free ring
+// and written to stdout by one writer thread, so streams no longer contend on
+// stdout. A full ring drops the line instead of blocking; the drops are
+// reported when the writer stops. The level can be changed at any time.
+//
+// Every call site is limited to rate_limit lines per second; the next line that
+// gets through reports how many were suppressed in between.
+enum AXLogLevel
+{
+    ax_log_error = 0,
+    ax_log_warn,
+    ax_log_info,
+    ax_log_debug,
+};
+
+class AXLogger
+{
+public:
+    static constexpr size_t LINE_SIZE = 256;  // longer lines are truncated
+    static constexpr size_t RING_SIZE = 512;  // lines per thread, 128 KB
+
+private:
+    struct Line
+    {
+        char text[LINE_SIZE];
+    };
+
+    using Ring = SpscQueue<Line>;
+
+    std::atomic<int> level{ax_log_info};
+    std::atomic<int> rate_limit{20};
+    std::atomic<bool> async{false};
+    std::atomic<uint64_t> dropped{0};
+
+    std::mutex mtx_rings;
+    std::vector<std::shared_ptr<Ring>> rings; // also kept by the owning thread
+    std::thread th_writer;
+    volatile bool loop_exit = false;
+
+    ~AXLogger()
+    {
+        Stop();
+    }
+
+    Ring *ring()
+    {
+        thread_local std::shared_ptr<Ring> r;
+        if (!r)
+        {
+            r = std::make_shared<Ring>(RING_SIZE);
+            std::lock_guard<std::mutex> lock(mtx_rings);
+            rings.push_back(r);
+        }
+        return r.get();
+    }
+
+    // write out everything queued, returns the number of lines
+    int drain()
+    {
+        int n = 0;
+        Line line;
+        std::lock_guard<std::mutex> lock(mtx_rings);
+        for (size_t i = 0; i < rings.size();)
+        {
+            while (rings[i]->Pop(line))
+            {
+                fputs(line.text, stdout);
+                n++;
+            }
+            // the thread is gone and its ring is empty
+            if (rings[i].use_count() == 1)
+                rings.erase(rings.begin() + i);
+            else
+                i++;
+        }
+        if (n)
+            fflush(stdout);
+        return n;
+    }
+
+    void func_th_writer()
+    {
+        while (!loop_exit)
+        {
+            if (drain() == 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+    }
+
+public:
+    static AXLogger &Get()
+    {
+        static AXLogger instance;
+        return instance;
+    }
+
+    void SetLevel(AXLogLevel _level) { level.store(_level, std::memory_order_relaxed); }
+    AXLogLevel GetLevel() const { return (AXLogLevel)level.load(std::memory_order_relaxed); }
+    bool Enabled(AXLogLevel _level) const { return _level <= level.load(std::memory_order_relaxed); }
+
+    // lines per second and call site, 0 disables the limit
+    void SetRateLimit(int per_sec) { rate_limit.store(per_sec, std::memory_order_relaxed); }
+    int GetRateLimit() const { return rate_limit.load(std::memory_order_relaxed); }
+
+    // "error", "warn", "info" or "debug"; returns false and keeps the level otherwise
+    bool SetLevel(const char *name)
+    {
+        static const char *names[] = {"error", "warn", "info", "debug"};
+        for (int i = 0; i < 4; i++)
+        {
+            if (strcmp(name, names[i]) == 0)
+            {
+                SetLevel((AXLogLevel)i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // move writing to the background thread
+    void Start()
+    {
+        if (th_writer.joinable())
+            return;
+        fflush(stdout);
+        loop_exit = false;
+        th_writer = std::thread(&AXLogger::func_th_writer, this);
+        async = true;
+    }
+
+    // write what is queued and go back to printing on the calling thread
+    void Stop()
+    {
+        if (!th_writer.joinable())
+            return;
+        async = false;
+        loop_exit = true;
+        th_writer.join();
+        drain();
+        uint64_t n = dropped.exchange(0);
+        if (n)
+            printf("logger: %llu lines dropped, log rings were full\n", (unsigned long long)n);
+        fflush(stdout);
+    }
+
+    // text is a complete line including colour codes and newline, at most LINE_SIZE - 1 chars
+    void Write(const char *text)
+    {
+        if (!async.load(std::memory_order_relaxed))
+        {
+            fputs(text, stdout);
+            return;
+        }
+        Line line;
+        snprintf(line.text, sizeof(line.text), "%s", text);
+        if (!ring()->Push(line))
+            dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+// rate limit state of one SAMPLE_LOG_* call site, shared by every thread using it
+class AXLogSite
+{
+private:
+    std::atomic<int64_t> window_start{0};
+    std::atomic<int> count{0};
+    std::atomic<int> suppressed{0};
+
+public:
+    // true if this line may be printed; *skipped gets the lines suppressed since the last one printed
+    bool Allow(int *skipped)
+    {
+        *skipped = 0;
+        int limit = AXLogger::Get().GetRateLimit();
+        if (limit <= 0)
+            return true;
+
+        int64_t now = ax_now_us();
+        int64_t start = window_start.load(std::memory_order_relaxed);
+        if (now - start >= 1000000 && window_start.compare_exchange_strong(start, now, std::memory_order_relaxed))
+            count.store(0, std::memory_order_relaxed);
+
+        if (count.fetch_add(1, std::memory_order_relaxed) >= limit)
+        {
+            suppressed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        *skipped = suppressed.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+};
+
+__attribute__((format(printf, 6, 7))) static inline void ax_log_write(AXLogLevel level, AXLogSite *site, const char *color,
+                                                                       const char *func, int line, const char *fmt, ...)
+{
+    static const char *tags[] = {"FAIL ", "WARN ", "INFO ", "DEBUG"};
+    int skipped;
+    if (!site->Allow(&skipped))
+        return;
+
+    char text[AXLogger::LINE_SIZE];
+    int n = snprintf(text, sizeof(text), "%s[%s][%32s][%4d]: ", color, tags[level], func, line);
+    va_list ap;
+    va_start(ap, fmt);
+    if (n > 0 && n < (int)sizeof(text))
+        n += vsnprintf(text + n, sizeof(text) - n, fmt, ap);
+    va_end(ap);
+    if (n > 0 && n < (int)sizeof(text) && skipped)
+        n += snprintf(text + n, sizeof(text) - n, " (%d similar lines suppressed)", skipped);
+    // 截断时把结尾写在缓冲最后，颜色关掉时 COLOR_DEFAULT 为空
+    static const char tail[] = COLOR_DEFAULT "\n";
+    if (n >= 0 && n < (int)sizeof(text))
+        snprintf(text + n, sizeof(text) - n, "%s", tail);
+    else
+        snprintf(text + sizeof(text) - sizeof(tail), sizeof(tail), "%s", tail);
+    AXLogger::Get().Write(text);
+}
+
+#endif /* __SAMPLE_ASYNC_LOGGER_HPP__ */
@@ -20,4 +20,42 @@ typedef enum
     auto_ax = 2, // let ffmpeg pick by codec id
 } AXFFmpegCodecID;
 
+// which codecs AXFFmpegDecoder / AXFFmpegEncoder run on
+typedef enum
+{
+    ax_codec_backend_axcl = 0, // h264/hevc_axdec, h264/hevc_axenc on the axcl card
+    ax_codec_backend_sw = 1,   // stock libavcodec on the host CPU, no card needed
+} AXCodecBackend;
+
+// where decoded frames live between the decoder and the encoder
+typedef enum
+{
+    ax_hwframe_off = 0,      // decoder downloads to host NV12, encoder uploads again
+    ax_hwframe_axmm = 1,     // AXMM surfaces go from decoder to encoder, host maps on demand
+    ax_hwframe_emulated = 2, // host frames handled like surfaces, for testing without a card
+} AXHwFrameMode;
+
+// which packets AXFFmpegDecoder actually decodes
+typedef enum
+{
+    ax_decode_all = 0,    // every frame
+    ax_decode_nonref = 1, // skip frames nothing else references (disposable / B frames)
+    ax_decode_key = 2,    // keyframes only, other packets never reach the decoder
+} AXDecodeMode;
+
+// what an output of AXFFmpegPipe carries
+typedef enum
+{
+    ax_output_encode = 0,      // decoded frames with OSD boxes, re-encoded
+    ax_output_passthrough = 1, // input packets unchanged, detections as SEI user data
+} AXOutputMode;
+
+// what a bounded queue does when it is full
+typedef enum
+{
+    ax_overflow_block = 0,        // producer waits for room
+    ax_overflow_drop_oldest = 1,  // oldest queued item is discarded
+    ax_overflow_drop_non_ref = 2, // non-reference items are discarded first
+} AXOverflowPolicy;
+
 #endif /* __SAMPLE_DEF_H__ */
\ No newline at end of file
@@ -24,19 +24,39 @@
 #define COLOR_WHITE     "\033[1;30;37m"
 #define COLOR_DEFAULT   "\033[0m"
 #else
-#define COLOR_BLACK
-#define COLOR_RED
-#define COLOR_GREEN
-#define COLOR_YELLOW
-#define COLOR_BLUE
-#define COLOR_PURPLE
-#define COLOR_WHITE
-#define COLOR_DEFAULT
+#define COLOR_BLACK     ""
+#define COLOR_RED       ""
+#define COLOR_GREEN     ""
+#define COLOR_YELLOW    ""
+#define COLOR_BLUE      ""
+#define COLOR_PURPLE    ""
+#define COLOR_WHITE     ""
+#define COLOR_DEFAULT   ""
 #endif
 
+#ifdef __cplusplus
+// leveled, rate limited per call site and asynchronous after AXLogger::Get().Start(), see async_logger.hpp
+#include "async_logger.hpp"
+
+#define SAMPLE_LOG_(level, color, fmt, ...)                                                     \
+    do                                                                                          \
+    {                                                                                           \
+        if (AXLogger::Get().Enabled(level))                                                     \
+        {                                                                                       \
+            static AXLogSite ax_log_site;                                                       \
+            ax_log_write(level, &ax_log_site, color, __func__, __LINE__, fmt, ##__VA_ARGS__);   \
+        }                                                                                       \
+    } while (0)
+
+#define SAMPLE_LOG_E(fmt, ...) SAMPLE_LOG_(ax_log_error, COLOR_RED, fmt, ##__VA_ARGS__)
+#define SAMPLE_LOG_W(fmt, ...) SAMPLE_LOG_(ax_log_warn, COLOR_YELLOW, fmt, ##__VA_ARGS__)
+#define SAMPLE_LOG_I(fmt, ...) SAMPLE_LOG_(ax_log_info, COLOR_GREEN, fmt, ##__VA_ARGS__)
+#define SAMPLE_LOG_D(fmt, ...) SAMPLE_LOG_(ax_log_debug, COLOR_WHITE, fmt, ##__VA_ARGS__)
+#else
 #define SAMPLE_LOG_E(fmt, ...) printf(COLOR_RED    "[FAIL ][%32s][%4d]: " fmt COLOR_DEFAULT "\n", __func__, __LINE__, ##__VA_ARGS__)
 #define SAMPLE_LOG_W(fmt, ...) printf(COLOR_YELLOW "[WARN ][%32s][%4d]: " fmt COLOR_DEFAULT "\n", __func__, __LINE__, ##__VA_ARGS__)
 #define SAMPLE_LOG_I(fmt, ...) printf(COLOR_GREEN  "[INFO ][%32s][%4d]: " fmt COLOR_DEFAULT "\n", __func__, __LINE__, ##__VA_ARGS__)
 #define SAMPLE_LOG_D(fmt, ...) printf(COLOR_WHITE  "[DEBUG][%32s][%4d]: " fmt COLOR_DEFAULT "\n", __func__, __LINE__, ##__VA_ARGS__)
+#endif
 
 #endif /* __SAMPLE_LOGGER_H__ */
\ No newline at end of file
@@ -0,0 +1,388 @@
+/**************************************************************************************************
+ *
+ * Copyright (c) 2019-2024 Axera Semiconductor Co., Ltd. All Rights Reserved.
+ *
+ * This source file is the property of Axera Semiconductor Co., Ltd. and
+ * may not be copied or distributed in any isomorphic form without the prior
+ * written consent of Axera Semiconductor Co., Ltd.
+ *
+ **************************************************************************************************/
+
+#ifndef __SAMPLE_METRICS_HPP__
+#define __SAMPLE_METRICS_HPP__
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+// Process wide metrics in Prometheus text format.
+//
+// Metrics are looked up once by name and label set (e.g. stream="3") and then
+// updated through the returned pointer with relaxed atomics only; the registry
+// lock is taken when a metric is created and while rendering, never on update.
+// Asking again for the same name and labels returns the same metric, so a
+// stream that is reopened keeps counting where it left off. Metrics live until
+// the process exits.
+
+class AXCounter
+{
+private:
+    std::atomic<uint64_t> value{0};
+
+public:
+    void Inc(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t Get() const { return value.load(std::memory_order_relaxed); }
+};
+
+class AXGauge
+{
+private:
+    std::atomic<double> value{0};
+
+public:
+    void Set(double v) { value.store(v, std::memory_order_relaxed); }
+    void Add(double d)
+    {
+        double cur = value.load(std::memory_order_relaxed);
+        while (!value.compare_exchange_weak(cur, cur + d, std::memory_order_relaxed))
+            ;
+    }
+    double Get() const { return value.load(std::memory_order_relaxed); }
+};
+
+// Latency histogram in microseconds with log-linear buckets: every power of two
+// is split into 4 linear steps, so any value lands in a bucket at most 25% wide
+// from 1 us up to ~18 minutes. Prometheus gets the power of two boundaries from
+// 64 us to 16.8 s (exact, they are bucket edges), in seconds.
+class AXHistogram
+{
+public:
+    static constexpr int SUB = 4;
+    static constexpr int MAX_EXP = 30;
+    static constexpr int BUCKETS = SUB + (MAX_EXP - 1) * SUB;
+
+private:
+    std::atomic<uint64_t> buckets[BUCKETS] = {};
+    std::atomic<uint64_t> count{0};
+    std::atomic<int64_t> sum_us{0};
+
+    static int index(int64_t v)
+    {
+        if (v < SUB)
+            return v < 0 ? 0 : (int)v;
+        int e = 63 - __builtin_clzll((unsigned long long)v);
+        int sub = (int)(v >> (e - 2)) - SUB;
+        int idx = SUB + (e - 2) * SUB + sub;
+        return idx < BUCKETS ? idx : BUCKETS - 1;
+    }
+
+public:
+    // exclusive upper edge of bucket idx in microseconds
+    static int64_t UpperBound(int idx)
+    {
+        if (idx < SUB)
+            return idx + 1;
+        int e = (idx - SUB) / SUB + 2;
+        int sub = (idx - SUB) % SUB;
+        return (int64_t)(SUB + 1 + sub) << (e - 2);
+    }
+
+    void Observe(int64_t us)
+    {
+        buckets[index(us)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sum_us.fetch_add(us, std::memory_order_relaxed);
+    }
+
+    uint64_t Count() const { return count.load(std::memory_order_relaxed); }
+    int64_t SumUs() const { return sum_us.load(std::memory_order_relaxed); }
+
+    // observations below upper_us, upper_us must be a bucket edge
+    uint64_t CountBelow(int64_t upper_us) const
+    {
+        uint64_t n = 0;
+        for (int i = 0; i < BUCKETS && UpperBound(i) <= upper_us; i++)
+            n += buckets[i].load(std::memory_order_relaxed);
+        return n;
+    }
+
+    // upper edge of the bucket holding quantile q (0..1), 0 when empty
+    int64_t Percentile(double q) const
+    {
+        uint64_t total = Count();
+        if (total == 0)
+            return 0;
+        uint64_t target = (uint64_t)(q * total + 0.5);
+        uint64_t n = 0;
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            n += buckets[i].load(std::memory_order_relaxed);
+            if (n >= target && n > 0)
+                return UpperBound(i);
+        }
+        return UpperBound(BUCKETS - 1);
+    }
+};
+
+class AXMetrics
+{
+private:
+    enum Type
+    {
+        counter,
+        gauge,
+        histogram
+    };
+
+    struct Family
+    {
+        Type type;
+        std::string help;
+        // labels -> metric, only the pointer matching type is set
+        std::map<std::string, std::unique_ptr<AXCounter>> counters;
+        std::map<std::string, std::unique_ptr<AXGauge>> gauges;
+        std::map<std::string, std::unique_ptr<AXHistogram>> histograms;
+    };
+
+    std::mutex mtx;
+    std::map<std::string, Family> families;
+
+    Family &family(const std::string &name, const std::string &help, Type type)
+    {
+        Family &f = families[name];
+        if (f.help.empty())
+        {
+            f.help = help;
+            f.type = type;
+        }
+        return f;
+    }
+
+    static void series(std::string &out, const std::string &name, const std::string &labels, const char *extra, const char *value)
+    {
+        out += name;
+        if (!labels.empty() || extra)
+        {
+            out += '{';
+            out += labels;
+            if (extra)
+            {
+                if (!labels.empty())
+                    out += ',';
+                out += extra;
+            }
+            out += '}';
+        }
+        out += ' ';
+        out += value;
+        out += '\n';
+    }
+
+public:
+    static AXMetrics &Get()
+    {
+        static AXMetrics instance;
+        return instance;
+    }
+
+    // labels is the inside of the braces, e.g. stream="3",card="0"; empty for none
+    AXCounter *Counter(const std::string &name, const std::string &help, const std::string &labels = "")
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto &slot = family(name, help, counter).counters[labels];
+        if (!slot)
+            slot.reset(new AXCounter());
+        return slot.get();
+    }
+
+    AXGauge *Gauge(const std::string &name, const std::string &help, const std::string &labels = "")
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto &slot = family(name, help, gauge).gauges[labels];
+        if (!slot)
+            slot.reset(new AXGauge());
+        return slot.get();
+    }
+
+    // name should end in _seconds, observations are in microseconds
+    AXHistogram *Histogram(const std::string &name, const std::string &help, const std::string &labels = "")
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto &slot = family(name, help, histogram).histograms[labels];
+        if (!slot)
+            slot.reset(new AXHistogram());
+        return slot.get();
+    }
+
+    // Prometheus text exposition format 0.0.4
+    std::string Render()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::string out;
+        out.reserve(64 * 1024);
+        char value[64];
+        for (auto &kv : families)
+        {
+            const std::string &name = kv.first;
+            const Family &f = kv.second;
+            static const char *type_names[] = {"counter", "gauge", "histogram"};
+            out += "# HELP " + name + " " + f.help + "\n";
+            out += "# TYPE " + name + " " + type_names[f.type] + "\n";
+
+            for (auto &c : f.counters)
+            {
+                snprintf(value, sizeof(value), "%llu", (unsigned long long)c.second->Get());
+                series(out, name, c.first, nullptr, value);
+            }
+            for (auto &g : f.gauges)
+            {
+                snprintf(value, sizeof(value), "%.6g", g.second->Get());
+                series(out, name, g.first, nullptr, value);
+            }
+            for (auto &h : f.histograms)
+            {
+                char le[48];
+                for (int e = 6; e <= 24; e++)
+                {
+                    int64_t edge = (int64_t)1 << e;
+                    snprintf(le, sizeof(le), "le=\"%.6g\"", edge / 1e6);
+                    snprintf(value, sizeof(value), "%llu", (unsigned long long)h.second->CountBelow(edge));
+                    series(out, name + "_bucket", h.first, le, value);
+                }
+                snprintf(value, sizeof(value), "%llu", (unsigned long long)h.second->Count());
+                series(out, name + "_bucket", h.first, "le=\"+Inf\"", value);
+                snprintf(value, sizeof(value), "%.6f", h.second->SumUs() / 1e6);
+                series(out, name + "_sum", h.first, nullptr, value);
+                snprintf(value, sizeof(value), "%llu", (unsigned long long)h.second->Count());
+                series(out, name + "_count", h.first, nullptr, value);
+            }
+        }
+        return out;
+    }
+};
+
+// Serves AXMetrics::Get().Render() on GET /metrics. One thread, one request per
+// connection; meant for a Prometheus scraper on the same host, so it binds to
+// 127.0.0.1 unless told otherwise.
+class AXMetricsServer
+{
+private:
+    int listen_fd = -1;
+    std::thread th_serve;
+    volatile bool loop_exit = false;
+
+    static void send_all(int fd, const char *data, size_t len)
+    {
+        while (len > 0)
+        {
+            ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+            if (n <= 0)
+                return;
+            data += n;
+            len -= n;
+        }
+    }
+
+    void handle(int fd)
+    {
+        // 请求行就够了，头部不用解析
+        struct timeval tv = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        char req[2048];
+        ssize_t n = recv(fd, req, sizeof(req) - 1, 0);
+        if (n <= 0)
+            return;
+        req[n] = 0;
+
+        std::string body, status = "200 OK";
+        if (strncmp(req, "GET /metrics", 12) == 0 && (req[12] == ' ' || req[12] == '?'))
+            body = AXMetrics::Get().Render();
+        else
+        {
+            status = "404 Not Found";
+            body = "try /metrics\n";
+        }
+
+        char head[256];
+        int len = snprintf(head, sizeof(head),
+                           "HTTP/1.1 %s\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                           status.c_str(), body.size());
+        send_all(fd, head, len);
+        send_all(fd, body.data(), body.size());
+    }
+
+    void func_th_serve()
+    {
+        while (!loop_exit)
+        {
+            struct pollfd pfd = {listen_fd, POLLIN, 0};
+            if (poll(&pfd, 1, 200) <= 0)
+                continue;
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd < 0)
+                continue;
+            handle(fd);
+            close(fd);
+        }
+    }
+
+public:
+    ~AXMetricsServer()
+    {
+        Stop();
+    }
+
+    int Start(int port, const std::string &bind_addr = "127.0.0.1")
+    {
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listen_fd < 0)
+        {
+            fprintf(stderr, "metrics: socket failed\n");
+            return -1;
+        }
+        int one = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if (inet_pton(AF_INET, bind_addr.c_str(), &addr.sin_addr) != 1 ||
+            bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 16) < 0)
+        {
+            fprintf(stderr, "metrics: can not listen on %s:%d\n", bind_addr.c_str(), port);
+            close(listen_fd);
+            listen_fd = -1;
+            return -1;
+        }
+
+        loop_exit = false;
+        th_serve = std::thread(&AXMetricsServer::func_th_serve, this);
+        return 0;
+    }
+
+    void Stop()
+    {
+        loop_exit = true;
+        if (th_serve.joinable())
+            th_serve.join();
+        if (listen_fd >= 0)
+            close(listen_fd);
+        listen_fd = -1;
+    }
+};
+
+#endif /* __SAMPLE_METRICS_HPP__ */
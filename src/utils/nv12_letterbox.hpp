@@ -0,0 +1,399 @@
+/**************************************************************************************************
+ *
+ * Copyright (c) 2019-2024 Axera Semiconductor Co., Ltd. All Rights Reserved.
+ *
+ * This source file is the property of Axera Semiconductor Co., Ltd. and
+ * may not be copied or distributed in any isomorphic form without the prior
+ * written consent of Axera Semiconductor Co., Ltd.
+ *
+ **************************************************************************************************/
+
+#ifndef __SAMPLE_NV12_LETTERBOX_HPP__
+#define __SAMPLE_NV12_LETTERBOX_HPP__
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define AX_LETTERBOX_NEON 1
+#elif defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define AX_LETTERBOX_AVX2 1
+#endif
+
+// how a model input pixel maps back onto the source frame
+struct AXLetterboxMap
+{
+    float scale = 1.f;
+    int pad_x = 0;
+    int pad_y = 0;
+    int src_w = 0;
+    int src_h = 0;
+
+    void MapPoint(float &x, float &y) const
+    {
+        x = std::min(std::max((x - pad_x) / scale, 0.f), (float)src_w);
+        y = std::min(std::max((y - pad_y) / scale, 0.f), (float)src_h);
+    }
+
+    float MapLength(float v) const { return v / scale; }
+};
+
+// NV12 (any linesize) -> letterboxed, model resolution, packed BGR/RGB in one pass.
+//
+// Per output row the two source luma rows are blended vertically (SIMD), luma is
+// then sampled horizontally with bilinear weights and chroma with nearest
+// neighbour into small line buffers, and the line is colour converted (SIMD,
+// BT.601 limited range like cv::COLOR_YUV2BGR_NV12) straight into the output.
+// No full resolution intermediate is ever written.
+//
+// Run() picks NEON / AVX2 when available, RunRef() is the scalar reference and
+// produces bit identical output.
+class AXNV12Letterbox
+{
+private:
+    // Q6 BT.601 coefficients
+    static constexpr int CY = 75;
+    static constexpr int CVR = 102;
+    static constexpr int CUG = -25;
+    static constexpr int CVG = -52;
+    static constexpr int CUB = 129;
+
+    typedef void (*blend_fn)(const uint8_t *r0, const uint8_t *r1, int wy, uint8_t *out, int n);
+    typedef void (*convert_fn)(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst, int n, bool rgb);
+
+    int src_w = 0, src_h = 0;
+    int dst_w = 0, dst_h = 0;
+    int new_w = 0, new_h = 0;
+    int pad_x = 0, pad_y = 0;
+    float scale = 1.f;
+    bool rgb = false;
+    uint8_t pad_value = 114;
+
+    // per content column / row lookup tables, Q7 weights of the second tap
+    std::vector<int> col_x0;
+    std::vector<uint8_t> col_wx;
+    std::vector<int> col_uv;
+    std::vector<int> row_y0, row_y1, row_uv;
+    std::vector<uint8_t> row_wy;
+
+    // line buffers
+    std::vector<uint8_t> line_blend;
+    std::vector<uint8_t> line_y, line_u, line_v;
+
+    blend_fn blend = blend_scalar;
+    convert_fn convert = convert_scalar;
+
+    static inline int sat16(int v)
+    {
+        return v < -32768 ? -32768 : (v > 32767 ? 32767 : v);
+    }
+
+    static inline uint8_t clamp_u8(int v)
+    {
+        return v < 0 ? 0 : (v > 255 ? 255 : v);
+    }
+
+    static void blend_scalar(const uint8_t *r0, const uint8_t *r1, int wy, uint8_t *out, int n)
+    {
+        int w0 = 128 - wy;
+        for (int i = 0; i < n; i++)
+            out[i] = (r0[i] * w0 + r1[i] * wy + 64) >> 7;
+    }
+
+    static void convert_scalar(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst, int n, bool rgb)
+    {
+        int ib = rgb ? 2 : 0;
+        int ir = rgb ? 0 : 2;
+        for (int i = 0; i < n; i++)
+        {
+            int yt = (y[i] - 16) * CY + 32;
+            int uu = u[i] - 128;
+            int vv = v[i] - 128;
+            dst[3 * i + ib] = clamp_u8(sat16(yt + uu * CUB) >> 6);
+            dst[3 * i + 1] = clamp_u8(sat16(sat16(yt + uu * CUG) + vv * CVG) >> 6);
+            dst[3 * i + ir] = clamp_u8(sat16(yt + vv * CVR) >> 6);
+        }
+    }
+
+#if defined(AX_LETTERBOX_NEON)
+    static void blend_neon(const uint8_t *r0, const uint8_t *r1, int wy, uint8_t *out, int n)
+    {
+        uint8x8_t w0 = vdup_n_u8(128 - wy);
+        uint8x8_t w1 = vdup_n_u8(wy);
+        int i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            uint8x16_t a = vld1q_u8(r0 + i);
+            uint8x16_t b = vld1q_u8(r1 + i);
+            uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(a), w0), vget_low_u8(b), w1);
+            uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(a), w0), vget_high_u8(b), w1);
+            vst1q_u8(out + i, vcombine_u8(vrshrn_n_u16(lo, 7), vrshrn_n_u16(hi, 7)));
+        }
+        blend_scalar(r0 + i, r1 + i, wy, out + i, n - i);
+    }
+
+    static inline uint8x8_t neon_channel(int16x8_t yt, int16x8_t c)
+    {
+        return vqmovun_s16(vshrq_n_s16(vqaddq_s16(yt, c), 6));
+    }
+
+    static void convert_neon(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst, int n, bool rgb)
+    {
+        int i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            uint8x16_t y8 = vld1q_u8(y + i);
+            uint8x16_t u8 = vld1q_u8(u + i);
+            uint8x16_t v8 = vld1q_u8(v + i);
+            uint8x8_t b[2], g[2], r[2];
+            for (int h = 0; h < 2; h++)
+            {
+                uint8x8_t yh = h ? vget_high_u8(y8) : vget_low_u8(y8);
+                uint8x8_t uh = h ? vget_high_u8(u8) : vget_low_u8(u8);
+                uint8x8_t vh = h ? vget_high_u8(v8) : vget_low_u8(v8);
+                int16x8_t ys = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(yh)), vdupq_n_s16(16));
+                int16x8_t us = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(uh)), vdupq_n_s16(128));
+                int16x8_t vs = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vh)), vdupq_n_s16(128));
+                int16x8_t yt = vaddq_s16(vmulq_n_s16(ys, CY), vdupq_n_s16(32));
+                b[h] = neon_channel(yt, vmulq_n_s16(us, CUB));
+                g[h] = vqmovun_s16(vshrq_n_s16(vqaddq_s16(vqaddq_s16(yt, vmulq_n_s16(us, CUG)), vmulq_n_s16(vs, CVG)), 6));
+                r[h] = neon_channel(yt, vmulq_n_s16(vs, CVR));
+            }
+            uint8x16x3_t px;
+            px.val[0] = rgb ? vcombine_u8(r[0], r[1]) : vcombine_u8(b[0], b[1]);
+            px.val[1] = vcombine_u8(g[0], g[1]);
+            px.val[2] = rgb ? vcombine_u8(b[0], b[1]) : vcombine_u8(r[0], r[1]);
+            vst3q_u8(dst + 3 * i, px);
+        }
+        convert_scalar(y + i, u + i, v + i, dst + 3 * i, n - i, rgb);
+    }
+#endif
+
+#if defined(AX_LETTERBOX_AVX2)
+    __attribute__((target("avx2"))) static void blend_avx2(const uint8_t *r0, const uint8_t *r1, int wy, uint8_t *out, int n)
+    {
+        const __m256i w0 = _mm256_set1_epi16(128 - wy);
+        const __m256i w1 = _mm256_set1_epi16(wy);
+        const __m256i rnd = _mm256_set1_epi16(64);
+        int i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(r0 + i)));
+            __m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(r1 + i)));
+            __m256i s = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(a, w0), _mm256_mullo_epi16(b, w1)), rnd);
+            s = _mm256_srli_epi16(s, 7);
+            _mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1)));
+        }
+        blend_scalar(r0 + i, r1 + i, wy, out + i, n - i);
+    }
+
+    __attribute__((target("avx2"))) static inline __m128i avx2_pack(__m256i v)
+    {
+        v = _mm256_srai_epi16(v, 6);
+        return _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    }
+
+    // shuffle masks interleaving three 16 byte planes into 48 bytes
+    struct InterleaveMasks
+    {
+        uint8_t m[3][3][16]; // [output block][plane][byte]
+        InterleaveMasks()
+        {
+            for (int k = 0; k < 3; k++)
+                for (int c = 0; c < 3; c++)
+                    for (int p = 0; p < 16; p++)
+                    {
+                        int q = 16 * k + p;
+                        m[k][c][p] = (q % 3 == c) ? (uint8_t)(q / 3) : 0x80;
+                    }
+        }
+    };
+
+    __attribute__((target("avx2"))) static void convert_avx2(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst, int n, bool rgb)
+    {
+        static const InterleaveMasks masks;
+        __m128i mk[3][3];
+        for (int k = 0; k < 3; k++)
+            for (int c = 0; c < 3; c++)
+                mk[k][c] = _mm_loadu_si128((const __m128i *)masks.m[k][c]);
+
+        const __m256i c16 = _mm256_set1_epi16(16);
+        const __m256i c128 = _mm256_set1_epi16(128);
+        const __m256i c32 = _mm256_set1_epi16(32);
+        int i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            __m256i ys = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(y + i))), c16);
+            __m256i us = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(u + i))), c128);
+            __m256i vs = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(v + i))), c128);
+            __m256i yt = _mm256_add_epi16(_mm256_mullo_epi16(ys, _mm256_set1_epi16(CY)), c32);
+
+            __m128i b = avx2_pack(_mm256_adds_epi16(yt, _mm256_mullo_epi16(us, _mm256_set1_epi16(CUB))));
+            __m128i g = avx2_pack(_mm256_adds_epi16(_mm256_adds_epi16(yt, _mm256_mullo_epi16(us, _mm256_set1_epi16(CUG))),
+                                                    _mm256_mullo_epi16(vs, _mm256_set1_epi16(CVG))));
+            __m128i r = avx2_pack(_mm256_adds_epi16(yt, _mm256_mullo_epi16(vs, _mm256_set1_epi16(CVR))));
+
+            __m128i p0 = rgb ? r : b;
+            __m128i p2 = rgb ? b : r;
+            for (int k = 0; k < 3; k++)
+            {
+                __m128i o = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(p0, mk[k][0]), _mm_shuffle_epi8(g, mk[k][1])),
+                                         _mm_shuffle_epi8(p2, mk[k][2]));
+                _mm_storeu_si128((__m128i *)(dst + 3 * i + 16 * k), o);
+            }
+        }
+        convert_scalar(y + i, u + i, v + i, dst + 3 * i, n - i, rgb);
+    }
+#endif
+
+    void run(const uint8_t *y, int y_stride, const uint8_t *uv, int uv_stride,
+             uint8_t *dst, int dst_stride, blend_fn fn_blend, convert_fn fn_convert)
+    {
+        for (int dy = 0; dy < dst_h; dy++)
+        {
+            uint8_t *d = dst + (size_t)dy * dst_stride;
+            int cy = dy - pad_y;
+            if (cy < 0 || cy >= new_h)
+            {
+                memset(d, pad_value, dst_w * 3);
+                continue;
+            }
+            if (pad_x > 0)
+                memset(d, pad_value, pad_x * 3);
+            if (dst_w - pad_x - new_w > 0)
+                memset(d + (pad_x + new_w) * 3, pad_value, (dst_w - pad_x - new_w) * 3);
+
+            const uint8_t *r0 = y + (size_t)row_y0[cy] * y_stride;
+            const uint8_t *src = r0;
+            if (row_wy[cy])
+            {
+                fn_blend(r0, y + (size_t)row_y1[cy] * y_stride, row_wy[cy], line_blend.data(), src_w);
+                src = line_blend.data();
+            }
+
+            const uint8_t *uv_row = uv + (size_t)row_uv[cy] * uv_stride;
+            for (int cx = 0; cx < new_w; cx++)
+            {
+                int x0 = col_x0[cx];
+                int wx = col_wx[cx];
+                line_y[cx] = (src[x0] * (128 - wx) + src[x0 + 1] * wx + 64) >> 7;
+                line_u[cx] = uv_row[col_uv[cx]];
+                line_v[cx] = uv_row[col_uv[cx] + 1];
+            }
+
+            fn_convert(line_y.data(), line_u.data(), line_v.data(), d + pad_x * 3, new_w, rgb);
+        }
+    }
+
+public:
+    AXNV12Letterbox() = default;
+
+    // src must be at least 2x2, returns -1 on bad sizes
+    int Init(int _src_w, int _src_h, int _dst_w, int _dst_h, bool _rgb = false, uint8_t _pad_value = 114)
+    {
+        if (_src_w < 2 || _src_h < 2 || _dst_w <= 0 || _dst_h <= 0)
+            return -1;
+
+        src_w = _src_w;
+        src_h = _src_h;
+        dst_w = _dst_w;
+        dst_h = _dst_h;
+        rgb = _rgb;
+        pad_value = _pad_value;
+
+        scale = std::min((float)dst_w / src_w, (float)dst_h / src_h);
+        new_w = std::max(1, std::min(dst_w, (int)lroundf(src_w * scale)));
+        new_h = std::max(1, std::min(dst_h, (int)lroundf(src_h * scale)));
+        pad_x = (dst_w - new_w) / 2;
+        pad_y = (dst_h - new_h) / 2;
+
+        col_x0.resize(new_w);
+        col_wx.resize(new_w);
+        col_uv.resize(new_w);
+        for (int cx = 0; cx < new_w; cx++)
+        {
+            float sx = std::max(0.f, (cx + 0.5f) / scale - 0.5f);
+            int x0 = (int)sx;
+            int wx = (int)lroundf((sx - x0) * 128);
+            if (x0 >= src_w - 1)
+            {
+                x0 = src_w - 2;
+                wx = 128;
+            }
+            col_x0[cx] = x0;
+            col_wx[cx] = wx;
+            int ux = std::min((int)((cx + 0.5f) / scale), src_w - 1);
+            col_uv[cx] = (ux >> 1) * 2;
+        }
+
+        row_y0.resize(new_h);
+        row_y1.resize(new_h);
+        row_wy.resize(new_h);
+        row_uv.resize(new_h);
+        for (int cy = 0; cy < new_h; cy++)
+        {
+            float sy = std::max(0.f, (cy + 0.5f) / scale - 0.5f);
+            int y0 = std::min((int)sy, src_h - 1);
+            int wy = (int)lroundf((sy - y0) * 128);
+            row_y0[cy] = y0;
+            row_y1[cy] = std::min(y0 + 1, src_h - 1);
+            row_wy[cy] = row_y1[cy] == y0 ? 0 : wy;
+            int uy = std::min((int)((cy + 0.5f) / scale), src_h - 1);
+            row_uv[cy] = uy >> 1;
+        }
+
+        line_blend.resize(src_w);
+        line_y.resize(new_w);
+        line_u.resize(new_w);
+        line_v.resize(new_w);
+
+        blend = blend_scalar;
+        convert = convert_scalar;
+#if defined(AX_LETTERBOX_NEON)
+        blend = blend_neon;
+        convert = convert_neon;
+#elif defined(AX_LETTERBOX_AVX2)
+        if (__builtin_cpu_supports("avx2"))
+        {
+            blend = blend_avx2;
+            convert = convert_avx2;
+        }
+#endif
+        return 0;
+    }
+
+    bool Match(int _src_w, int _src_h, int _dst_w, int _dst_h, bool _rgb) const
+    {
+        return src_w == _src_w && src_h == _src_h && dst_w == _dst_w && dst_h == _dst_h && rgb == _rgb;
+    }
+
+    // dst is dst_h rows of dst_w * 3 bytes, dst_stride >= dst_w * 3
+    void Run(const uint8_t *y, int y_stride, const uint8_t *uv, int uv_stride, uint8_t *dst, int dst_stride)
+    {
+        run(y, y_stride, uv, uv_stride, dst, dst_stride, blend, convert);
+    }
+
+    // scalar reference of Run
+    void RunRef(const uint8_t *y, int y_stride, const uint8_t *uv, int uv_stride, uint8_t *dst, int dst_stride)
+    {
+        run(y, y_stride, uv, uv_stride, dst, dst_stride, blend_scalar, convert_scalar);
+    }
+
+    AXLetterboxMap GetMap() const
+    {
+        AXLetterboxMap map;
+        map.scale = scale;
+        map.pad_x = pad_x;
+        map.pad_y = pad_y;
+        map.src_w = src_w;
+        map.src_h = src_h;
+        return map;
+    }
+};
+
+#endif /* __SAMPLE_NV12_LETTERBOX_HPP__ */
@@ -0,0 +1,261 @@
+/**************************************************************************************************
+ *
+ * Copyright (c) 2019-2024 Axera Semiconductor Co., Ltd. All Rights Reserved.
+ *
+ * This source file is the property of Axera Semiconductor Co., Ltd. and
+ * may not be copied or distributed in any isomorphic form without the prior
+ * written consent of Axera Semiconductor Co., Ltd.
+ *
+ **************************************************************************************************/
+
+#ifndef __SAMPLE_NV12_OSD_HPP__
+#define __SAMPLE_NV12_OSD_HPP__
+
+#include <opencv2/opencv.hpp>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+#include "../libdet/include/libdet.h"
+
+// NV12 plane pointers of one frame, uv = nullptr draws luma only
+struct AXNV12Surface
+{
+    uint8_t *y = nullptr;
+    int y_stride = 0;
+    uint8_t *uv = nullptr;
+    int uv_stride = 0;
+    int width = 0;
+    int height = 0;
+};
+
+// Colour OSD drawn straight into NV12.
+//
+// Everything is reduced to horizontal spans: luma spans are memset, chroma spans
+// are memcpy'd from a pre-built UV pattern line, both of which libc runs with
+// SIMD. Text uses a glyph atlas rasterised once in Init (printable ASCII) and
+// stored as per row runs, so a label costs a handful of memsets per glyph row
+// and no font rendering per frame.
+class AXNV12Osd
+{
+public:
+    struct Color
+    {
+        uint8_t y, u, v;
+    };
+
+private:
+    struct Run
+    {
+        uint8_t row;
+        uint8_t x;
+        uint8_t len;
+    };
+
+    struct Glyph
+    {
+        int advance = 0;
+        int run_begin = 0;
+        int run_end = 0;
+    };
+
+    static constexpr int FIRST_CHAR = 32;
+    static constexpr int LAST_CHAR = 126;
+
+    Glyph glyphs[LAST_CHAR - FIRST_CHAR + 1];
+    std::vector<Run> runs;
+    int glyph_h = 0;
+
+    std::vector<Color> palette;
+    std::vector<uint8_t> uv_line; // u,v,u,v... pattern for chroma span fills
+    uint8_t line_u = 0, line_v = 0;
+
+    static Color rgb2yuv(int r, int g, int b)
+    {
+        Color c;
+        c.y = (uint8_t)std::min(235.0, std::max(16.0, 16 + (65.481 * r + 128.553 * g + 24.966 * b) / 255));
+        c.u = (uint8_t)std::min(240.0, std::max(16.0, 128 + (-37.797 * r - 74.203 * g + 112.0 * b) / 255));
+        c.v = (uint8_t)std::min(240.0, std::max(16.0, 128 + (112.0 * r - 93.786 * g - 18.214 * b) / 255));
+        return c;
+    }
+
+    void fill_uv(uint8_t *dst, int pairs, const Color &c)
+    {
+        int bytes = pairs * 2;
+        if ((int)uv_line.size() < bytes || line_u != c.u || line_v != c.v)
+        {
+            if ((int)uv_line.size() < bytes)
+                uv_line.resize(bytes);
+            for (size_t i = 0; i + 1 < uv_line.size(); i += 2)
+            {
+                uv_line[i] = c.u;
+                uv_line[i + 1] = c.v;
+            }
+            line_u = c.u;
+            line_v = c.v;
+        }
+        memcpy(dst, uv_line.data(), bytes);
+    }
+
+public:
+    AXNV12Osd() = default;
+
+    // font_scale / thickness as in cv::putText with FONT_HERSHEY_SIMPLEX
+    int Init(double font_scale = 0.6, int thickness = 1)
+    {
+        int baseline = 0;
+        cv::Size ref = cv::getTextSize("Ag", cv::FONT_HERSHEY_SIMPLEX, font_scale, thickness, &baseline);
+        glyph_h = std::min(255, ref.height + baseline + thickness);
+        runs.clear();
+
+        for (int ch = FIRST_CHAR; ch <= LAST_CHAR; ch++)
+        {
+            std::string s(1, (char)ch);
+            int bl = 0;
+            cv::Size sz = cv::getTextSize(s, cv::FONT_HERSHEY_SIMPLEX, font_scale, thickness, &bl);
+            int w = std::min(255, std::max(1, sz.width + thickness));
+            cv::Mat cell(glyph_h, w, CV_8UC1, cv::Scalar(0));
+            cv::putText(cell, s, cv::Point(0, ref.height), cv::FONT_HERSHEY_SIMPLEX, font_scale, cv::Scalar(255), thickness);
+
+            Glyph &g = glyphs[ch - FIRST_CHAR];
+            g.advance = w;
+            g.run_begin = (int)runs.size();
+            for (int r = 0; r < glyph_h; r++)
+            {
+                const uint8_t *p = cell.ptr<uint8_t>(r);
+                for (int x = 0; x < w;)
+                {
+                    if (p[x] < 128)
+                    {
+                        x++;
+                        continue;
+                    }
+                    int x0 = x;
+                    while (x < w && p[x] >= 128)
+                        x++;
+                    runs.push_back({(uint8_t)r, (uint8_t)x0, (uint8_t)(x - x0)});
+                }
+            }
+            g.run_end = (int)runs.size();
+        }
+
+        static const int colors[][3] = {
+            {255, 56, 56}, {255, 157, 151}, {255, 112, 31}, {255, 178, 29}, {207, 210, 49},
+            {72, 249, 10}, {146, 204, 23}, {61, 219, 134}, {26, 147, 52}, {0, 212, 187},
+            {44, 153, 168}, {0, 194, 255}, {52, 69, 147}, {100, 115, 255}, {0, 24, 236},
+            {132, 56, 255}, {82, 0, 133}, {203, 56, 255}, {255, 149, 200}, {255, 55, 199}};
+        palette.clear();
+        for (auto &c : colors)
+            palette.push_back(rgb2yuv(c[0], c[1], c[2]));
+        uv_line.clear();
+        return 0;
+    }
+
+    const Color &LabelColor(int label) const
+    {
+        return palette[(unsigned)label % palette.size()];
+    }
+
+    void FillRect(AXNV12Surface &s, int x, int y, int w, int h, const Color &c)
+    {
+        int x0 = std::max(0, x), y0 = std::max(0, y);
+        int x1 = std::min(s.width, x + w), y1 = std::min(s.height, y + h);
+        if (x0 >= x1 || y0 >= y1)
+            return;
+
+        for (int r = y0; r < y1; r++)
+            memset(s.y + (size_t)r * s.y_stride + x0, c.y, x1 - x0);
+
+        if (!s.uv)
+            return;
+        int cx0 = x0 >> 1, cx1 = (x1 + 1) >> 1;
+        for (int r = y0 >> 1; r < (y1 + 1) >> 1; r++)
+            fill_uv(s.uv + (size_t)r * s.uv_stride + cx0 * 2, cx1 - cx0, c);
+    }
+
+    void DrawRect(AXNV12Surface &s, int x, int y, int w, int h, const Color &c, int thickness = 2)
+    {
+        FillRect(s, x, y, w, thickness, c);
+        FillRect(s, x, y + h - thickness, w, thickness, c);
+        FillRect(s, x, y + thickness, thickness, h - 2 * thickness, c);
+        FillRect(s, x + w - thickness, y + thickness, thickness, h - 2 * thickness, c);
+    }
+
+    void FillCircle(AXNV12Surface &s, int cx, int cy, int radius, const Color &c)
+    {
+        for (int dy = -radius; dy <= radius; dy++)
+        {
+            int dx = 0;
+            while ((dx + 1) * (dx + 1) + dy * dy <= radius * radius)
+                dx++;
+            FillRect(s, cx - dx, cy + dy, 2 * dx + 1, 1, c);
+        }
+    }
+
+    int TextWidth(const char *text) const
+    {
+        int w = 0;
+        for (const char *p = text; *p; p++)
+        {
+            int ch = (unsigned char)*p;
+            if (ch >= FIRST_CHAR && ch <= LAST_CHAR)
+                w += glyphs[ch - FIRST_CHAR].advance;
+        }
+        return w;
+    }
+
+    int TextHeight() const { return glyph_h; }
+
+    // luma only, chroma keeps whatever is underneath (label background)
+    void DrawText(AXNV12Surface &s, int x, int y, const char *text, uint8_t luma)
+    {
+        for (const char *p = text; *p; p++)
+        {
+            int ch = (unsigned char)*p;
+            if (ch < FIRST_CHAR || ch > LAST_CHAR)
+                continue;
+            const Glyph &g = glyphs[ch - FIRST_CHAR];
+            for (int i = g.run_begin; i < g.run_end; i++)
+            {
+                const Run &r = runs[i];
+                int ry = y + r.row;
+                int rx0 = std::max(0, x + r.x), rx1 = std::min(s.width, x + r.x + r.len);
+                if (ry < 0 || ry >= s.height || rx0 >= rx1)
+                    continue;
+                memset(s.y + (size_t)ry * s.y_stride + rx0, luma, rx1 - rx0);
+            }
+            x += g.advance;
+        }
+    }
+
+    // boxes, keypoints and "[#id] label score" tags in the label colour
+    void Draw(AXNV12Surface &s, const ax_det_result_t &result, const int *track_ids = nullptr, int thickness = 2)
+    {
+        char label_info[64];
+        for (int i = 0; i < result.num_objs; i++)
+        {
+            const ax_det_obj_t &obj = result.objects[i];
+            const Color &c = LabelColor(obj.label);
+            int bx = (int)obj.box.x, by = (int)obj.box.y;
+            int bw = (int)obj.box.w, bh = (int)obj.box.h;
+            DrawRect(s, bx, by, bw, bh, c, thickness);
+
+            if (track_ids)
+                snprintf(label_info, sizeof(label_info), "#%d %d %4.2f", track_ids[i], obj.label, obj.score);
+            else
+                snprintf(label_info, sizeof(label_info), "%d %4.2f", obj.label, obj.score);
+            int tw = TextWidth(label_info) + 4;
+            int th = TextHeight();
+            int ty = by - th >= 0 ? by - th : by;
+            FillRect(s, bx, ty, tw, th, c);
+            DrawText(s, bx + 2, ty, label_info, c.y > 128 ? 16 : 235);
+
+            for (int j = 0; j < obj.num_kpt; j++)
+                FillCircle(s, (int)obj.kpts[j].x, (int)obj.kpts[j].y, 3, c);
+        }
+    }
+};
+
+#endif /* __SAMPLE_NV12_OSD_HPP__ */
@@ -0,0 +1,69 @@
+/**************************************************************************************************
+ *
+ * Copyright (c) 2019-2024 Axera Semiconductor Co., Ltd. All Rights Reserved.
+ *
+ * This source file is the property of Axera Semiconductor Co., Ltd. and
+ * may not be copied or distributed in any isomorphic form without the prior
+ * written consent of Axera Semiconductor Co., Ltd.
+ *
+ **************************************************************************************************/
+
+#ifndef __SAMPLE_SPSC_QUEUE_HPP__
+#define __SAMPLE_SPSC_QUEUE_HPP__
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+
+// Lock-free bounded ring for exactly one producer thread and one consumer thread.
+// Capacity is rounded up to a power of two; Push fails instead of blocking when full.
+template <typename T>
+class SpscQueue
+{
+private:
+    std::unique_ptr<T[]> buf;
+    size_t mask = 0;
+
+    alignas(64) std::atomic<size_t> head{0}; // consumer
+    alignas(64) std::atomic<size_t> tail{0}; // producer
+
+public:
+    explicit SpscQueue(size_t capacity = 64)
+    {
+        size_t n = 1;
+        while (n < capacity)
+            n <<= 1;
+        buf.reset(new T[n]);
+        mask = n - 1;
+    }
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    bool Push(const T &v)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) > mask)
+            return false;
+        buf[t & mask] = v;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Pop(T &v)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+        v = buf[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t Size() const
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+};
+
+#endif /* __SAMPLE_SPSC_QUEUE_HPP__ */
@@ -0,0 +1,25 @@
+/**************************************************************************************************
+ *
+ * Copyright (c) 2019-2024 Axera Semiconductor Co., Ltd. All Rights Reserved.
+ *
+ * This source file is the property of Axera Semiconductor Co., Ltd. and
+ * may not be copied or distributed in any isomorphic form without the prior
+ * written consent of Axera Semiconductor Co., Ltd.
+ *
+ **************************************************************************************************/
+
+#ifndef __SAMPLE_TIMER_HPP__
+#define __SAMPLE_TIMER_HPP__
+
+#include <chrono>
+#include <stdint.h>
+
+// monotonic clock in microseconds
+static inline int64_t ax_now_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+#endif /* __SAMPLE_TIMER_HPP__ */
@@ -0,0 +1,266 @@
+/**************************************************************************************************
+ *
+ * Copyright (c) 2019-2024 Axera Semiconductor Co., Ltd. All Rights Reserved.
+ *
+ * This source file is the property of Axera Semiconductor Co., Ltd. and
+ * may not be copied or distributed in any isomorphic form without the prior
+ * written consent of Axera Semiconductor Co., Ltd.
+ *
+ **************************************************************************************************/
+
+#ifndef __SAMPLE_TRACE_HPP__
+#define __SAMPLE_TRACE_HPP__
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "timer.hpp"
+
+// Per-stage latency spans, exported as Chrome trace-event JSON (chrome://tracing,
+// ui.perfetto.dev).
+//
+// Every thread records into its own fixed ring, so recording takes no lock and
+// never allocates after the first span of a thread; when a ring is full the
+// oldest spans are overwritten. A finished thread leaves its ring to the next
+// thread that starts recording, so reconnect and migration threads do not pile
+// up rings; its spans can be dumped until then. Disabled, a span costs one
+// relaxed atomic load; enabled, two clock reads and one store into the ring
+// (bench_trace measures both).
+// Span names must be string literals (only the pointer is stored).
+//
+//   AXTrace::SetThreadName("decode");
+//   { AX_TRACE_SCOPE("decode", frame->pts); ... }
+//
+// The optional argument is the pts of the frame being worked on, which every
+// stage from decoder to muxer sees, so the spans of one frame can be lined up.
+//   AXTrace::Dump("trace.json");
+class AXTrace
+{
+public:
+    static constexpr size_t RING_SIZE = 1 << 14; // spans kept per thread, 512 KB
+
+private:
+    struct Event
+    {
+        const char *name;
+        int64_t ts_us;
+        int64_t dur_us;
+        int64_t arg; // pts of the frame, negative for none
+    };
+
+    struct Ring
+    {
+        int tid = 0;
+        char name[32] = {0};
+        std::atomic<uint64_t> written{0};
+        std::unique_ptr<Event[]> events{new Event[RING_SIZE]};
+    };
+
+    static std::atomic<bool> &enabled()
+    {
+        static std::atomic<bool> on{false};
+        return on;
+    }
+
+    static std::mutex &registry_mutex()
+    {
+        static std::mutex mtx;
+        return mtx;
+    }
+
+    // every ring ever created, in use or not, so spans of finished threads can still be dumped
+    static std::vector<std::unique_ptr<Ring>> &registry()
+    {
+        static std::vector<std::unique_ptr<Ring>> rings;
+        return rings;
+    }
+
+    // rings whose thread has exited, handed out again before a new one is created
+    static std::vector<Ring *> &free_rings()
+    {
+        static std::vector<Ring *> rings;
+        return rings;
+    }
+
+    // the ring of one thread, returned to free_rings when the thread exits
+    struct RingHolder
+    {
+        Ring *r = nullptr;
+        ~RingHolder()
+        {
+            if (!r)
+                return;
+            std::lock_guard<std::mutex> lock(registry_mutex());
+            free_rings().push_back(r);
+        }
+    };
+
+    static char *thread_name()
+    {
+        thread_local char name[32] = {0};
+        return name;
+    }
+
+    // created on the first span, threads that never record while tracing cost nothing
+    static Ring *ring()
+    {
+        thread_local RingHolder holder;
+        if (!holder.r)
+        {
+            static int last_tid = 0;
+            std::lock_guard<std::mutex> lock(registry_mutex());
+            Ring *r;
+            if (!free_rings().empty())
+            {
+                // 复用已退出线程的缓冲，它留下的 span 就此作废
+                r = free_rings().back();
+                free_rings().pop_back();
+                r->written.store(0, std::memory_order_relaxed);
+            }
+            else
+            {
+                registry().emplace_back(new Ring());
+                r = registry().back().get();
+            }
+            r->tid = ++last_tid;
+            if (thread_name()[0])
+                snprintf(r->name, sizeof(r->name), "%s", thread_name());
+            else
+                snprintf(r->name, sizeof(r->name), "thread %d", r->tid);
+            holder.r = r;
+        }
+        return holder.r;
+    }
+
+    static void write_escaped(FILE *fp, const char *s)
+    {
+        for (; *s; s++)
+        {
+            if (*s == '"' || *s == '\\')
+                fputc('\\', fp);
+            if ((unsigned char)*s >= 0x20)
+                fputc(*s, fp);
+        }
+    }
+
+public:
+    static void Enable(bool on) { enabled().store(on, std::memory_order_relaxed); }
+    static bool Enabled() { return enabled().load(std::memory_order_relaxed); }
+
+    // flips tracing, only touches an atomic so it is safe from a signal handler
+    static void Toggle() { enabled().store(!Enabled(), std::memory_order_relaxed); }
+
+    // whether any thread has recorded a span since the start
+    static bool Recorded()
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        return !registry().empty();
+    }
+
+    // number of rings allocated, at most the number of threads that recorded at the same time
+    static size_t RingCount()
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        return registry().size();
+    }
+
+    // label of the calling thread in the exported trace, call before its first span
+    static void SetThreadName(const char *name)
+    {
+        snprintf(thread_name(), 32, "%s", name);
+    }
+
+    static void Record(const char *name, int64_t ts_us, int64_t dur_us, int64_t arg = -1)
+    {
+        Ring *r = ring();
+        uint64_t w = r->written.load(std::memory_order_relaxed);
+        r->events[w & (RING_SIZE - 1)] = {name, ts_us, dur_us, arg};
+        r->written.store(w + 1, std::memory_order_release);
+    }
+
+    // writes every span still in the rings; can run while threads keep recording,
+    // spans overwritten during the copy are left out. Returns the number of spans
+    static int Dump(const std::string &path)
+    {
+        FILE *fp = fopen(path.c_str(), "w");
+        if (!fp)
+        {
+            fprintf(stderr, "can not open trace file %s\n", path.c_str());
+            return -1;
+        }
+
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        int count = 0;
+        bool first = true;
+        fprintf(fp, "{\"traceEvents\":[\n");
+        std::vector<Event> copy;
+        for (auto &r : registry())
+        {
+            fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"", first ? "" : ",\n", r->tid);
+            write_escaped(fp, r->name);
+            fprintf(fp, "\"}}");
+            first = false;
+
+            uint64_t end = r->written.load(std::memory_order_acquire);
+            uint64_t begin = end > RING_SIZE ? end - RING_SIZE : 0;
+            copy.clear();
+            for (uint64_t i = begin; i < end; i++)
+                copy.push_back(r->events[i & (RING_SIZE - 1)]);
+            // the writer may have lapped the copy, drop what it overwrote
+            uint64_t now = r->written.load(std::memory_order_acquire);
+            size_t skip = now > RING_SIZE && now - RING_SIZE > begin ? (size_t)(now - RING_SIZE - begin) : 0;
+
+            for (size_t i = skip; i < copy.size(); i++)
+            {
+                const Event &e = copy[i];
+                fprintf(fp, ",\n{\"name\":\"");
+                write_escaped(fp, e.name);
+                fprintf(fp, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld", r->tid,
+                        (long long)e.ts_us, (long long)e.dur_us);
+                if (e.arg >= 0)
+                    fprintf(fp, ",\"args\":{\"pts\":%lld}", (long long)e.arg);
+                fprintf(fp, "}");
+                count++;
+            }
+        }
+        fprintf(fp, "\n]}\n");
+        fclose(fp);
+        return count;
+    }
+};
+
+// records the enclosing scope as one span when tracing was on at its start
+class AXTraceScope
+{
+private:
+    const char *name;
+    int64_t arg;
+    int64_t start = 0;
+
+public:
+    explicit AXTraceScope(const char *_name, int64_t _arg = -1) : name(_name), arg(_arg)
+    {
+        if (AXTrace::Enabled())
+            start = ax_now_us();
+    }
+
+    ~AXTraceScope()
+    {
+        if (start)
+            AXTrace::Record(name, start, ax_now_us() - start, arg);
+    }
+
+    AXTraceScope(const AXTraceScope &) = delete;
+    AXTraceScope &operator=(const AXTraceScope &) = delete;
+};
+
+#define AX_TRACE_CONCAT_(a, b) a##b
+#define AX_TRACE_CONCAT(a, b) AX_TRACE_CONCAT_(a, b)
+#define AX_TRACE_SCOPE(...) AXTraceScope AX_TRACE_CONCAT(ax_trace_scope_, __LINE__)(__VA_ARGS__)
+
+#endif /* __SAMPLE_TRACE_HPP__ */
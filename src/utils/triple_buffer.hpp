@@ -0,0 +1,67 @@
+/**************************************************************************************************
+ *
+ * Copyright (c) 2019-2024 Axera Semiconductor Co., Ltd. All Rights Reserved.
+ *
+ * This source file is the property of Axera Semiconductor Co., Ltd. and
+ * may not be copied or distributed in any isomorphic form without the prior
+ * written consent of Axera Semiconductor Co., Ltd.
+ *
+ **************************************************************************************************/
+
+#ifndef __SAMPLE_TRIPLE_BUFFER_HPP__
+#define __SAMPLE_TRIPLE_BUFFER_HPP__
+
+#include <atomic>
+#include <stdint.h>
+
+// Lock-free single-producer / single-consumer "latest value" buffer.
+//
+// The producer always writes into Back() and calls Publish(); it never waits.
+// The consumer calls Fetch() and, if it returns true, reads Front(). Frames the
+// consumer was too slow to pick up are simply overwritten, so the consumer
+// always sees the newest published value.
+//
+// Three slots rotate between the roles back (producer), middle (ready) and
+// front (consumer). Only the middle index is shared; bit 2 marks it fresh.
+template <typename T>
+class TripleBuffer
+{
+private:
+    static constexpr uint8_t IDX_MASK = 0x3;
+    static constexpr uint8_t FRESH = 0x4;
+
+    T slots[3];
+    alignas(64) std::atomic<uint8_t> middle{1};
+    alignas(64) uint8_t back = 0; // owned by producer
+    alignas(64) uint8_t front = 2; // owned by consumer
+
+public:
+    TripleBuffer() = default;
+    TripleBuffer(const TripleBuffer &) = delete;
+    TripleBuffer &operator=(const TripleBuffer &) = delete;
+
+    // producer side
+    T &Back() { return slots[back]; }
+
+    void Publish()
+    {
+        uint8_t prev = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+        back = prev & IDX_MASK;
+    }
+
+    // consumer side, returns false if nothing new was published since last Fetch()
+    bool Fetch()
+    {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH))
+            return false;
+        uint8_t prev = middle.exchange(front, std::memory_order_acq_rel);
+        front = prev & IDX_MASK;
+        return true;
+    }
+
+    T &Front() { return slots[front]; }
+
+    bool HasFresh() const { return middle.load(std::memory_order_relaxed) & FRESH; }
+};
+
+#endif /* __SAMPLE_TRIPLE_BUFFER_HPP__ */